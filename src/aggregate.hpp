@@ -0,0 +1,131 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/string/string.hpp>
+#include <micron/types.hpp>
+
+#include "format.hpp"
+#include "funcs.hpp"
+
+// streaming summary of many runs: one update per run, Welford mean / variance plus min / max of
+// every format::fields column, in doubles (no long long sum to overflow) and constant memory.
+// aggregators of disjoint run sets merge exactly (Chan et al.), so workers can keep their own
+namespace bbench::aggregate
+{
+
+struct moments {
+  u64 n = 0;
+  double mean = 0.0;
+  double m2 = 0.0;     // sum of squared deviations from the mean
+  double mn = 0.0;
+  double mx = 0.0;
+
+  void
+  add(double x)
+  {
+    if ( n == 0 || x < mn ) mn = x;
+    if ( n == 0 || x > mx ) mx = x;
+    ++n;
+    const double d = x - mean;
+    mean += d / static_cast<double>(n);
+    m2 += d * (x - mean);
+  }
+
+  void
+  merge(const moments &o)
+  {
+    if ( o.n == 0 ) return;
+    if ( n == 0 ) {
+      *this = o;
+      return;
+    }
+    const double na = static_cast<double>(n), nb = static_cast<double>(o.n);
+    const double d = o.mean - mean;
+    const double tot = na + nb;
+    mean += d * nb / tot;
+    m2 += o.m2 + d * d * na * nb / tot;
+    if ( o.mn < mn ) mn = o.mn;
+    if ( o.mx > mx ) mx = o.mx;
+    n += o.n;
+  }
+
+  // sample variance, n - 1
+  double
+  variance(void) const
+  {
+    return n > 1 ? m2 / static_cast<double>(n - 1) : 0.0;
+  }
+
+  double
+  stddev(void) const
+  {
+    return format::__impl::__sqrt(variance());
+  }
+};
+
+class aggregator
+{
+  micron::string label;
+  moments m[format::n_fields];
+  moments samples;     // mem_samples isn't a CSV column but is still averaged
+  u64 runs = 0;
+
+public:
+  void
+  add(const benchmark_t &b)
+  {
+    if ( runs++ == 0 ) label = b.name;
+    for ( usize i = 0; i < format::n_fields; ++i ) m[i].add(format::fields[i].get(b));
+    samples.add(static_cast<double>(b.mem_samples));
+  }
+
+  void
+  merge(const aggregator &o)
+  {
+    if ( o.runs == 0 ) return;
+    if ( runs == 0 ) label = o.label;
+    for ( usize i = 0; i < format::n_fields; ++i ) m[i].merge(o.m[i]);
+    samples.merge(o.samples);
+    runs += o.runs;
+  }
+
+  u64
+  count(void) const
+  {
+    return runs;
+  }
+
+  // format::fields[i]
+  const moments &
+  field(usize i) const
+  {
+    return m[i];
+  }
+
+  // the mean of every field as one benchmark_t (integer counters truncated), named after the first run
+  benchmark_t
+  mean(void) const
+  {
+    benchmark_t out{};
+    if ( runs == 0 ) return out;
+    out.name = label;
+    for ( usize i = 0; i < format::n_fields; ++i ) format::fields[i].set(out, m[i].mean);
+    out.mem_samples = static_cast<long long>(samples.mean);
+    return out;
+  }
+
+  // mean / stddev / min / max of field i; the order statistics need the runs themselves
+  format::stats_t
+  stats(usize i) const
+  {
+    format::stats_t s{ m[i].mean, m[i].stddev(), m[i].mn, m[i].mx };
+    s.n = static_cast<u32>(m[i].n);
+    return s;
+  }
+};
+
+};     // namespace bbench::aggregate
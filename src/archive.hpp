@@ -0,0 +1,579 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/chrono.hpp>
+#include <micron/linux/io.hpp>
+#include <micron/linux/sys/fcntl.hpp>
+#include <micron/memory/cmemory.hpp>
+#include <micron/string/string.hpp>
+#include <micron/syscall.hpp>
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+#include "format.hpp"
+#include "funcs.hpp"
+#include "sysfs.hpp"
+
+// columnar result archive (bbench --archive FILE, bbench-dump). years of history in one file that
+// is only ever appended to: a 16-byte file header, then one block per append
+//
+//   file:   "BBARCH\0\0"  u32 version  u32 0
+//   block:  "BBLK"  u64 block bytes  u64 rows  u64 unix time  u32 detail  u32 cpus
+//           u64 host fingerprint  u64 nominal khz  str hostname, cpu model, kernel, governor, tag
+//           varint n names, str each  varint index bytes, one varint name index per row
+//           u32 n columns, each: str name  u8 kind  varint bytes  data
+//
+// str is a varint length and the bytes, fixed-width integers are little-endian. every block carries
+// its own schema (format::fields names at its detail level) and host, so blocks written by other
+// versions or machines sit side by side. a column is stored one of three ways: constant (one double,
+// the unmeasured counters cost nothing per row), integer (zigzag varint of the delta from the
+// previous row) or double (varint of the xor with the previous row's bits); all lossless.
+// the reader maps the file and indexes block headers only, so opening is O(blocks); a column is
+// decoded straight from the mapping when it is read, and only the columns that are read. a block
+// torn by a crash or a full disk doesn't hide the ones after it: the reader skips to the next
+// "BBLK" that parses, and append cuts a torn tail off before it writes
+namespace bbench::archive
+{
+
+constexpr u32 version = 1;
+constexpr usize file_header_bytes = 16;
+
+enum : u8 { col_constant = 0, col_integer = 1, col_double = 2 };
+
+// bytes inside the mapping, not NUL-terminated
+struct str {
+  const char *p;
+  usize n;
+};
+
+struct column {
+  str name;
+  u8 kind;
+  const u8 *data;
+  usize bytes;
+};
+
+struct block {
+  u64 offset;     // in the file
+  u64 bytes;
+  u64 rows;
+  u64 written;     // unix seconds
+  u32 detail;
+  u32 cpus;
+  u64 host;     // sys::host_fingerprint
+  u64 nominal_khz;
+  str hostname, cpu_model, kernel, governor, tag;
+  micron::vector<str> names;     // distinct run names; index holds one per row
+  const u8 *index;
+  usize index_bytes;
+  micron::vector<column> columns;
+};
+
+namespace __impl
+{
+
+inline void
+__put(micron::vector<u8> &b, const void *p, usize n)
+{
+  const u8 *c = static_cast<const u8 *>(p);
+  for ( usize i = 0; i < n; ++i ) b.push_back(c[i]);
+}
+
+inline void
+__put_u32(micron::vector<u8> &b, u32 v)
+{
+  __put(b, &v, sizeof(v));
+}
+
+inline void
+__put_u64(micron::vector<u8> &b, u64 v)
+{
+  __put(b, &v, sizeof(v));
+}
+
+inline void
+__put_varint(micron::vector<u8> &b, u64 v)
+{
+  while ( v >= 0x80 ) {
+    b.push_back(static_cast<u8>(v | 0x80));
+    v >>= 7;
+  }
+  b.push_back(static_cast<u8>(v));
+}
+
+inline void
+__put_str(micron::vector<u8> &b, const char *s)
+{
+  const usize n = s ? micron::strlen(s) : 0;
+  __put_varint(b, n);
+  __put(b, s, n);
+}
+
+inline u64
+__zigzag(long long v)
+{
+  return (static_cast<u64>(v) << 1) ^ static_cast<u64>(v >> 63);
+}
+
+inline long long
+__unzigzag(u64 v)
+{
+  return static_cast<long long>(v >> 1) ^ -static_cast<long long>(v & 1);
+}
+
+inline u64
+__to_bits(double v)
+{
+  u64 b;
+  micron::memcpy(&b, &v, sizeof(b));
+  return b;
+}
+
+inline double
+__from_bits(u64 b)
+{
+  double v;
+  micron::memcpy(&v, &b, sizeof(v));
+  return v;
+}
+
+// exactly a long long (and not -0.0, which would come back as 0.0)
+inline bool
+__integral(double v)
+{
+  return v >= -9.2e18 && v <= 9.2e18 && static_cast<double>(static_cast<long long>(v)) == v && __to_bits(v) != 0x8000000000000000ull;
+}
+
+
+inline bool
+__get(const u8 *&p, const u8 *end, void *dst, usize n)
+{
+  if ( static_cast<usize>(end - p) < n ) return false;
+  micron::memcpy(dst, p, n);
+  p += n;
+  return true;
+}
+
+inline bool
+__get_varint(const u8 *&p, const u8 *end, u64 &v)
+{
+  v = 0;
+  for ( u32 sh = 0; p < end && sh < 64; sh += 7 ) {
+    const u8 c = *p++;
+    v |= static_cast<u64>(c & 0x7f) << sh;
+    if ( !(c & 0x80) ) return true;
+  }
+  return false;
+}
+
+inline bool
+__get_str(const u8 *&p, const u8 *end, str &s)
+{
+  u64 n = 0;
+  if ( !__get_varint(p, end, n) || n > static_cast<u64>(end - p) ) return false;
+  s = str{ reinterpret_cast<const char *>(p), static_cast<usize>(n) };
+  p += n;
+  return true;
+}
+
+inline bool
+__eq(const str &s, const char *z)
+{
+  return micron::strncmp(s.p, z, s.n) == 0 && z[s.n] == '\0';
+}
+
+inline u64
+__unix_now(void)
+{
+  micron::timespec_t t{};
+  micron::clock_gettime(micron::clock_realtime, t);
+  return static_cast<u64>(t.tv_sec);
+}
+
+// smallest of three encodings; see the top of the file
+template <typename V>
+inline void
+__encode_column(micron::vector<u8> &out, const V &runs, const format::field_def &f)
+{
+  const usize n = runs.size();
+  const double first = f.get(runs[0]);
+  bool constant = true, integral = true;
+  for ( usize i = 0; i < n; ++i ) {
+    const double v = f.get(runs[i]);
+    if ( __to_bits(v) != __to_bits(first) ) constant = false;
+    if ( !__integral(v) ) integral = false;
+  }
+  micron::vector<u8> data;
+  u8 kind = col_constant;
+  if ( constant ) {
+    __put_u64(data, __to_bits(first));
+  } else if ( integral ) {
+    kind = col_integer;
+    u64 prev = 0;
+    for ( usize i = 0; i < n; ++i ) {
+      const u64 x = static_cast<u64>(static_cast<long long>(f.get(runs[i])));
+      __put_varint(data, __zigzag(static_cast<long long>(x - prev)));
+      prev = x;
+    }
+  } else {
+    kind = col_double;
+    u64 prev = 0;
+    for ( usize i = 0; i < n; ++i ) {
+      const u64 x = __to_bits(f.get(runs[i]));
+      __put_varint(data, x ^ prev);
+      prev = x;
+    }
+  }
+  __put_str(out, f.name);
+  out.push_back(kind);
+  __put_varint(out, data.size());
+  __put(out, &data[0], data.size());
+}
+
+// false for anything that isn't a whole block inside [base, base + len)
+inline bool
+__parse(const u8 *base, usize len, usize off, block &b)
+{
+  const u8 *p = base + off;
+  const u8 *end = base + len;
+  if ( len - off < 12 || p[0] != 'B' || p[1] != 'B' || p[2] != 'L' || p[3] != 'K' ) return false;
+  p += 4;
+  if ( !__get(p, end, &b.bytes, 8) || b.bytes > len - off || b.bytes < 12 ) return false;
+  end = base + off + b.bytes;
+  b.offset = off;
+  bool ok = __get(p, end, &b.rows, 8) && __get(p, end, &b.written, 8) && __get(p, end, &b.detail, 4)
+            && __get(p, end, &b.cpus, 4) && __get(p, end, &b.host, 8) && __get(p, end, &b.nominal_khz, 8);
+  ok = ok && __get_str(p, end, b.hostname) && __get_str(p, end, b.cpu_model) && __get_str(p, end, b.kernel)
+       && __get_str(p, end, b.governor) && __get_str(p, end, b.tag);
+  u64 n = 0;
+  if ( !ok || !__get_varint(p, end, n) ) return false;
+  for ( u64 i = 0; i < n; ++i ) {
+    str s{};
+    if ( !__get_str(p, end, s) ) return false;
+    b.names.push_back(s);
+  }
+  if ( !__get_varint(p, end, n) || n > static_cast<u64>(end - p) ) return false;
+  b.index = p;
+  b.index_bytes = static_cast<usize>(n);
+  p += n;
+  u32 nc = 0;
+  if ( !__get(p, end, &nc, 4) ) return false;
+  for ( u32 i = 0; i < nc; ++i ) {
+    column c{};
+    if ( !__get_str(p, end, c.name) || p >= end ) return false;
+    c.kind = *p++;
+    if ( !__get_varint(p, end, n) || n > static_cast<u64>(end - p) ) return false;
+    c.data = p;
+    c.bytes = static_cast<usize>(n);
+    p += n;
+    b.columns.push_back(c);
+  }
+  return true;
+}
+
+// the next offset from off where a block starts, len if none; after one that doesn't parse
+inline usize
+__resync(const u8 *base, usize len, usize off)
+{
+  for ( ; off + 4 <= len; ++off )
+    if ( base[off] == 'B' && base[off + 1] == 'B' && base[off + 2] == 'L' && base[off + 3] == 'K' ) {
+      block b{};
+      if ( __parse(base, len, off, b) ) return off;
+    }
+  return len;
+}
+
+inline void
+__header(micron::vector<u8> &out)
+{
+  __put(out, "BBARCH\0\0", 8);
+  __put_u32(out, version);
+  __put_u32(out, 0);
+}
+
+// where an append to the open archive fd of size bytes goes: past its last whole block, or 0 for
+// an empty file or a header torn before it was complete; -1 when it isn't an archive of this version
+inline long
+__append_at(int fd, long size)
+{
+  micron::vector<u8> hdr;
+  __header(hdr);
+  if ( size < static_cast<long>(file_header_bytes) ) {
+    char head[file_header_bytes];
+    if ( size > 0 && micron::syscall(SYS_pread64, fd, head, size, 0) != size ) return -1;
+    for ( long i = 0; i < size; ++i )
+      if ( static_cast<u8>(head[i]) != hdr[static_cast<usize>(i)] ) return -1;
+    return 0;
+  }
+  // PROT_READ, MAP_PRIVATE
+  const long addr = micron::syscall(SYS_mmap, nullptr, size, 0x1, 0x02, fd, 0);
+  if ( addr < 0 && addr > -4096 ) return -1;
+  const u8 *map = reinterpret_cast<const u8 *>(addr);
+  const usize len = static_cast<usize>(size);
+  bool same = true;
+  for ( usize i = 0; i < 12; ++i ) same = same && map[i] == hdr[i];     // magic and version
+  long at = -1;
+  if ( same ) {
+    usize end = file_header_bytes;
+    for ( usize off = file_header_bytes; off < len; ) {
+      block b{};
+      if ( !__parse(map, len, off, b) ) {
+        off = __resync(map, len, off + 1);
+        continue;
+      }
+      off += b.bytes;
+      end = off;
+    }
+    at = static_cast<long>(end);
+  }
+  micron::syscall(SYS_munmap, map, len);
+  return at;
+}
+
+// all of it or false; short writes resume, EINTR retries
+inline bool
+__write_all(int fd, const u8 *p, usize n)
+{
+  while ( n > 0 ) {
+    const long w = micron::posix::write(fd, p, n);
+    if ( w == -4 /* EINTR */ ) continue;
+    if ( w <= 0 ) return false;
+    p += w;
+    n -= static_cast<usize>(w);
+  }
+  return true;
+}
+
+};     // namespace __impl
+
+// one block for runs (any mix of names) onto out: the format::fields columns of the detail level,
+// this host, tag (a revision, a suite name; may be empty)
+template <typename V>
+inline void
+encode(const V &runs, u32 detail, const char *tag, micron::vector<u8> &out)
+{
+  const usize n = runs.size();
+  if ( n == 0 ) return;
+  const sys::host_info h = sys::query_host();
+  const usize start = out.size();
+  __impl::__put(out, "BBLK", 4);
+  const usize size_at = out.size();
+  __impl::__put_u64(out, 0);     // block bytes, patched below
+  __impl::__put_u64(out, n);
+  __impl::__put_u64(out, __impl::__unix_now());
+  __impl::__put_u32(out, detail);
+  __impl::__put_u32(out, h.cpus);
+  __impl::__put_u64(out, sys::host_fingerprint(h) & 0x7fffffffffffffffull);
+  __impl::__put_u64(out, h.nominal_khz);
+  __impl::__put_str(out, h.hostname);
+  __impl::__put_str(out, h.cpu_model);
+  __impl::__put_str(out, h.kernel);
+  __impl::__put_str(out, h.governor);
+  __impl::__put_str(out, tag);
+
+  micron::vector<const char *> names;
+  micron::vector<u8> index;
+  for ( usize i = 0; i < n; ++i ) {
+    const char *name = runs[i].name.c_str();
+    usize k = 0;
+    while ( k < names.size() && micron::strcmp(names[k], name) != 0 ) ++k;
+    if ( k == names.size() ) names.push_back(name);
+    __impl::__put_varint(index, k);
+  }
+  __impl::__put_varint(out, names.size());
+  for ( const char *name : names ) __impl::__put_str(out, name);
+  __impl::__put_varint(out, index.size());
+  __impl::__put(out, &index[0], index.size());
+
+  u32 nc = 0;
+  for ( const format::field_def &f : format::fields )
+    if ( f.detail <= detail ) ++nc;
+  __impl::__put_u32(out, nc);
+  for ( const format::field_def &f : format::fields )
+    if ( f.detail <= detail ) __impl::__encode_column(out, runs, f);
+
+  const u64 bytes = out.size() - start;
+  micron::memcpy(&out[size_at], &bytes, sizeof(bytes));
+}
+
+// appends one block to path, writing the file header first if the file is new. under an exclusive
+// flock, so appenders don't take each other's block in progress for a torn one: a torn tail left
+// by an earlier crash is cut off first, and a write that fails (full disk) is cut back off, so the
+// file always ends on a block boundary. false when path isn't an archive or anything failed
+template <typename V>
+inline bool
+append(const char *path, const V &runs, u32 detail, const char *tag = "")
+{
+  if ( runs.size() == 0 ) return true;
+  // O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC
+  const int fd = micron::open(path, 02 | micron::posix::o_create | 02000 | micron::posix::o_cloexec, 0644);
+  if ( fd < 0 ) return false;
+  bool ok = micron::syscall(SYS_flock, fd, 2 /* LOCK_EX */) == 0;
+  const long size = ok ? micron::syscall(SYS_lseek, fd, 0, 2 /* SEEK_END */) : -1;
+  const long at = size >= 0 ? __impl::__append_at(fd, size) : -1;
+  ok = at >= 0 && (at == size || micron::syscall(SYS_ftruncate, fd, at) == 0);
+  if ( ok ) {
+    micron::vector<u8> buf;
+    if ( at == 0 ) __impl::__header(buf);
+    encode(runs, detail, tag, buf);
+    ok = __impl::__write_all(fd, &buf[0], buf.size());
+    if ( !ok ) micron::syscall(SYS_ftruncate, fd, at);
+  }
+  micron::close(fd);     // drops the lock
+  return ok;
+}
+
+// sequential values of one column, decoded from the mapping
+class cursor
+{
+  const u8 *p = nullptr;
+  const u8 *end = nullptr;
+  u8 kind = col_constant;
+  u64 prev = 0;
+
+public:
+  cursor() = default;
+
+  explicit cursor(const column &c) : p(c.data), end(c.data + c.bytes), kind(c.kind)
+  {
+    if ( kind == col_constant && c.bytes >= 8 ) micron::memcpy(&prev, p, 8);
+  }
+
+  // 0 past the end
+  double
+  next(void)
+  {
+    if ( kind == col_constant ) return __impl::__from_bits(prev);
+    u64 v = 0;
+    if ( !__impl::__get_varint(p, end, v) ) return 0.0;
+    if ( kind == col_integer ) {
+      prev += static_cast<u64>(__impl::__unzigzag(v));
+      return static_cast<double>(static_cast<long long>(prev));
+    }
+    prev ^= v;
+    return __impl::__from_bits(prev);
+  }
+};
+
+// NUL-terminated copy of s, cut to cap - 1
+inline void
+copy(const str &s, char *dst, usize cap)
+{
+  const usize n = s.n < cap - 1 ? s.n : cap - 1;
+  micron::memcpy(dst, s.p, n);
+  dst[n] = '\0';
+}
+
+inline const column *
+find(const block &b, const char *name)
+{
+  for ( const column &c : b.columns )
+    if ( __impl::__eq(c.name, name) ) return &c;
+  return nullptr;
+}
+
+class reader
+{
+  const u8 *map = nullptr;
+  usize len = 0;
+  micron::vector<block> blocks;
+
+public:
+  reader() = default;
+  reader(const reader &) = delete;
+
+  ~reader()
+  {
+    if ( map ) micron::syscall(SYS_munmap, map, len);
+  }
+
+  // false when path can't be mapped or isn't an archive; a block that doesn't parse (torn by a crash
+  // or a full disk mid-append) is skipped to the next one that does
+  bool
+  open(const char *path)
+  {
+    int fd = micron::open(path, micron::posix::o_rdonly | micron::posix::o_cloexec);
+    if ( fd < 0 ) return false;
+    const long size = micron::syscall(SYS_lseek, fd, 0, 2 /* SEEK_END */);
+    if ( size < static_cast<long>(file_header_bytes) ) {
+      micron::close(fd);
+      return false;
+    }
+    // PROT_READ, MAP_PRIVATE
+    const long addr = micron::syscall(SYS_mmap, nullptr, size, 0x1, 0x02, fd, 0);
+    micron::close(fd);
+    if ( addr < 0 && addr > -4096 ) return false;
+    map = reinterpret_cast<const u8 *>(addr);
+    len = static_cast<usize>(size);
+    u32 ver = 0;
+    micron::memcpy(&ver, map + 8, 4);
+    if ( micron::strncmp(reinterpret_cast<const char *>(map), "BBARCH", 6) != 0 || ver != version ) return false;
+    for ( usize off = file_header_bytes; off < len; ) {
+      block b{};
+      if ( !__impl::__parse(map, len, off, b) ) {
+        off = __impl::__resync(map, len, off + 1);
+        continue;
+      }
+      off += b.bytes;
+      blocks.push_back(micron::move(b));
+    }
+    return true;
+  }
+
+  usize
+  size(void) const
+  {
+    return blocks.size();
+  }
+
+  const block &
+  operator[](usize i) const
+  {
+    return blocks[i];
+  }
+
+  u64
+  rows(void) const
+  {
+    u64 n = 0;
+    for ( const block &b : blocks ) n += b.rows;
+    return n;
+  }
+
+  // every row of b as a benchmark_t: columns by format::fields name, those the block lacks 0
+  template <typename F>
+  void
+  for_each(const block &b, F &&f) const
+  {
+    micron::vector<cursor> cur;
+    micron::vector<usize> field;
+    for ( const column &c : b.columns )
+      for ( usize i = 0; i < format::n_fields; ++i )
+        if ( __impl::__eq(c.name, format::fields[i].name) ) {
+          cur.push_back(cursor(c));
+          field.push_back(i);
+        }
+    benchmark_t row{};
+    const u8 *ip = b.index;
+    const u8 *iend = b.index + b.index_bytes;
+    u64 last = ~0ull;
+    for ( u64 r = 0; r < b.rows; ++r ) {
+      u64 k = 0;
+      __impl::__get_varint(ip, iend, k);
+      if ( k != last && k < b.names.size() ) {
+        char name[256];
+        copy(b.names[k], name, sizeof(name));
+        row.name = micron::string{ name };
+        last = k;
+      }
+      for ( usize c = 0; c < cur.size(); ++c ) format::fields[field[c]].set(row, cur[c].next());
+      f(static_cast<const benchmark_t &>(row));
+    }
+  }
+};
+
+};     // namespace bbench::archive
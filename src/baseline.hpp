@@ -0,0 +1,381 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/linux/io.hpp>
+#include <micron/linux/sys/fcntl.hpp>
+#include <micron/memory/cmemory.hpp>
+#include <micron/syscall.hpp>
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+#include "format.hpp"
+#include "funcs.hpp"
+#include "stopping.hpp"
+#include "sysfs.hpp"
+
+// persistent baselines (bbench --save-baseline / --check)
+//
+// a text file, one line per benchmark metric:
+//   b HOST DETAIL REV METRIC N MEAN STDDEV MEDIAN MAD NAME
+// HOST is sys::host_fingerprint (cpu model, kernel, governor), METRIC a format::fields column name,
+// NAME the rest of the line. saving replaces the lines with the same host / detail / rev / name and
+// keeps everything else, so one file can hold many revisions and machines. a check compares the
+// current runs with the newest matching revision (or a named one): a metric moved if its mean
+// changed by more than its threshold and, when both sides have two runs or more, Welch's t-test
+// agrees at 95%. higher is worse for every metric but eff_ghz. only time_us, cycles, instructions
+// and the metrics a threshold names gate (comparison::gated); the other columns are too noisy or
+// too numerous to fail a check on, and are reported only
+namespace bbench::baseline
+{
+
+struct entry {
+  u64 host;
+  u32 detail;
+  char rev[64];
+  char metric[32];
+  u32 n;
+  double mean;
+  double stddev;
+  double median;
+  double mad;
+  char name[256];
+};
+
+enum class verdict : u8 { unchanged, regression, improvement };
+
+struct comparison {
+  const char *metric;
+  const entry *base;
+  format::stats_t cur;
+  double change;        // (current - baseline) / baseline, of the means
+  double threshold;     // relative
+  bool tested;          // Welch's test ran (both sides >= 2 runs)
+  bool significant;
+  bool gated;     // a regression here fails the check; otherwise it is only reported
+  verdict v;
+};
+
+namespace __impl
+{
+
+inline u64
+__host(void)
+{
+  const sys::host_info h = sys::query_host();
+  return sys::host_fingerprint(h) & 0x7fffffffffffffffull;
+}
+
+inline const char *
+__word(const char *p, char *dst, usize cap)
+{
+  while ( *p == ' ' ) ++p;
+  usize n = 0;
+  while ( *p && *p != ' ' && *p != '\n' ) {
+    if ( n < cap - 1 ) dst[n++] = *p;
+    ++p;
+  }
+  dst[n] = '\0';
+  return p;
+}
+
+// the whole file, NUL-terminated; nullptr when it can't be opened
+inline char *
+__slurp(const char *path)
+{
+  int fd = micron::open(path, micron::posix::o_rdonly | micron::posix::o_cloexec);
+  if ( fd < 0 ) return nullptr;
+  usize cap = 65536, len = 0;
+  char *buf = new char[cap];
+  for ( ;; ) {
+    if ( len + 4096 > cap ) {
+      char *g = new char[cap * 2];
+      micron::memcpy(g, buf, len);
+      delete[] buf;
+      buf = g;
+      cap *= 2;
+    }
+    const long r = micron::posix::read(fd, buf + len, cap - len - 1);
+    if ( r <= 0 ) break;
+    len += static_cast<usize>(r);
+  }
+  micron::close(fd);
+  buf[len] = '\0';
+  return buf;
+}
+
+// "5%" or "0.05"
+inline bool
+__fraction(const char *&p, double &out)
+{
+  if ( !sys::parse_double(p, out) ) return false;
+  if ( *p == '%' ) {
+    out /= 100.0;
+    ++p;
+  }
+  return true;
+}
+
+// Welch's t statistic and Welch-Satterthwaite degrees of freedom
+inline void
+__welch(double m1, double s1, u32 n1, double m2, double s2, u32 n2, double &t, double &df)
+{
+  const double v1 = s1 * s1 / static_cast<double>(n1);
+  const double v2 = s2 * s2 / static_cast<double>(n2);
+  const double se2 = v1 + v2;
+  if ( se2 <= 0.0 ) {
+    t = m1 == m2 ? 0.0 : 1e300;     // no spread on either side: any difference is real
+    df = static_cast<double>(n1 + n2 - 2);
+    return;
+  }
+  t = (m2 - m1) / format::__impl::__sqrt(se2);
+  df = se2 * se2 / (v1 * v1 / static_cast<double>(n1 - 1) + v2 * v2 / static_cast<double>(n2 - 1));
+}
+
+// the one column where up is good: a lower effective clock is the regression
+inline bool
+__higher_is_better(const char *metric)
+{
+  return micron::strcmp(metric, "eff_ghz") == 0;
+}
+
+};     // namespace __impl
+
+// per-metric relative thresholds: "5%" for all, "time_us=2%,cycles=1%" per metric, or both
+class thresholds
+{
+  struct item {
+    char metric[32];
+    double rel;
+  };
+
+  micron::vector<item> items;
+  double all = 0.05;
+
+public:
+  bool
+  parse(const char *spec)
+  {
+    const char *p = spec;
+    while ( *p ) {
+      const char *eq = p;
+      while ( *eq && *eq != '=' && *eq != ',' ) ++eq;
+      double v = 0.0;
+      if ( *eq == '=' ) {
+        item it{};
+        const usize n = static_cast<usize>(eq - p) < sizeof(it.metric) - 1 ? static_cast<usize>(eq - p) : sizeof(it.metric) - 1;
+        micron::memcpy(it.metric, p, n);
+        it.metric[n] = '\0';
+        p = eq + 1;
+        if ( !__impl::__fraction(p, v) ) return false;
+        it.rel = v;
+        items.push_back(it);
+      } else {
+        if ( !__impl::__fraction(p, v) ) return false;
+        all = v;
+      }
+      if ( *p == ',' )
+        ++p;
+      else if ( *p )
+        return false;
+    }
+    return true;
+  }
+
+  double
+  of(const char *metric) const
+  {
+    for ( const item &it : items )
+      if ( micron::strcmp(it.metric, metric) == 0 ) return it.rel;
+    return all;
+  }
+
+  // time_us, cycles and instructions always; any other metric once it has its own threshold
+  bool
+  gates(const char *metric) const
+  {
+    for ( const item &it : items )
+      if ( micron::strcmp(it.metric, metric) == 0 ) return true;
+    return micron::strcmp(metric, "time_us") == 0 || micron::strcmp(metric, "cycles") == 0 || micron::strcmp(metric, "instructions") == 0;
+  }
+};
+
+class store
+{
+  micron::vector<entry> entries;
+
+  static bool
+  __same_run(const entry &e, u64 host, u32 detail, const char *rev, const char *name)
+  {
+    return e.host == host && e.detail == detail && micron::strcmp(e.rev, rev) == 0 && micron::strcmp(e.name, name) == 0;
+  }
+
+  // the whole store to path, flushed and synced
+  bool
+  __write(const char *path) const
+  {
+    format::sink f = format::sink::file_sink(path);
+    if ( f.fd < 0 ) return false;
+    f.emit("# bbench baseline: b HOST DETAIL REV METRIC N MEAN STDDEV MEDIAN MAD NAME\n");
+    for ( const entry &e : entries ) {
+      f.emit("b ");
+      f.emit_int(static_cast<long long>(e.host));
+      f.emit(" ");
+      f.emit_int(e.detail);
+      f.emit(" ");
+      f.emit(e.rev);
+      f.emit(" ");
+      f.emit(e.metric);
+      f.emit(" ");
+      f.emit_int(e.n);
+      f.emit(" ");
+      f.emit_double(e.mean);
+      f.emit(" ");
+      f.emit_double(e.stddev);
+      f.emit(" ");
+      f.emit_double(e.median);
+      f.emit(" ");
+      f.emit_double(e.mad);
+      f.emit(" ");
+      f.emit(e.name);
+      f.newline();
+    }
+    f.flush();
+    return !f.failed && micron::syscall(SYS_fsync, f.fd) == 0;
+  }
+
+public:
+  // a missing file is an empty store; false only for lines that don't parse
+  bool
+  load(const char *path)
+  {
+    char *buf = __impl::__slurp(path);
+    if ( !buf ) return true;
+    bool ok = true;
+    for ( const char *p = buf; *p; ) {
+      if ( p[0] == 'b' && p[1] == ' ' ) {
+        entry e{};
+        const char *q = p + 2;
+        u64 v = 0;
+        ok = sys::parse_u64(q, e.host) && ok;
+        ok = sys::parse_u64(q, v) && ok;
+        e.detail = static_cast<u32>(v);
+        q = __impl::__word(q, e.rev, sizeof(e.rev));
+        q = __impl::__word(q, e.metric, sizeof(e.metric));
+        ok = sys::parse_u64(q, v) && ok;
+        e.n = static_cast<u32>(v);
+        ok = sys::parse_double(q, e.mean) && sys::parse_double(q, e.stddev) && sys::parse_double(q, e.median) && sys::parse_double(q, e.mad) && ok;
+        while ( *q == ' ' ) ++q;
+        sys::copy_line(e.name, sizeof(e.name), q);
+        entries.push_back(e);
+      }
+      while ( *p && *p != '\n' ) ++p;
+      if ( *p ) ++p;
+    }
+    delete[] buf;
+    return ok;
+  }
+
+  // written to PATH.tmp, synced and renamed over PATH, so a failed or interrupted save leaves the
+  // previous file whole; false on any open / write / sync / rename error
+  bool
+  save(const char *path) const
+  {
+    char tmp[4096];
+    const usize len = micron::strlen(path);
+    if ( len + sizeof(".tmp") > sizeof(tmp) ) return false;
+    micron::memcpy(tmp, path, len);
+    micron::memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+    bool ok = __write(tmp);
+    if ( ok ) ok = micron::syscall(SYS_rename, tmp, path) == 0;
+    if ( !ok ) micron::syscall(SYS_unlink, tmp);
+    return ok;
+  }
+
+  // replaces this host / detail / rev's lines for runs[0].name with one per measured metric
+  void
+  put(const micron::vector<benchmark_t> &runs, u32 detail, const char *rev)
+  {
+    if ( runs.size() == 0 ) return;
+    const u64 host = __impl::__host();
+    const char *name = runs[0].name.c_str();
+    micron::vector<entry> kept;
+    for ( const entry &e : entries )
+      if ( !__same_run(e, host, detail, rev, name) ) kept.push_back(e);
+    entries = micron::move(kept);
+    for ( const format::field_def &f : format::fields ) {
+      if ( f.detail > detail ) continue;
+      const format::stats_t s = format::compute_stats(runs, f.get);
+      if ( s.mn == 0.0 && s.mx == 0.0 ) continue;
+      entry e{};
+      e.host = host;
+      e.detail = detail;
+      sys::copy_line(e.rev, sizeof(e.rev), rev);
+      for ( char *c = e.rev; *c; ++c )
+        if ( *c == ' ' ) *c = '_';     // one word in the file
+      sys::copy_line(e.metric, sizeof(e.metric), f.name);
+      sys::copy_line(e.name, sizeof(e.name), name);
+      e.n = s.n;
+      e.mean = s.mean;
+      e.stddev = s.stddev;
+      e.median = s.median;
+      e.mad = s.mad;
+      entries.push_back(e);
+    }
+  }
+
+  // the revision to compare name against: rev if given and present, else the newest saved one
+  // for this host and detail; nullptr when there is none
+  const char *
+  pick_rev(const char *name, u32 detail, const char *rev) const
+  {
+    const u64 host = __impl::__host();
+    const char *found = nullptr;
+    for ( const entry &e : entries ) {
+      if ( e.host != host || e.detail != detail || micron::strcmp(e.name, name) != 0 ) continue;
+      if ( rev && micron::strcmp(e.rev, rev) != 0 ) continue;
+      found = e.rev;
+    }
+    return found;
+  }
+
+  // every saved metric of name at rev, against the same metric over runs
+  void
+  compare(const micron::vector<benchmark_t> &runs, u32 detail, const char *rev, const thresholds &th,
+          micron::vector<comparison> &out) const
+  {
+    if ( runs.size() == 0 ) return;
+    const u64 host = __impl::__host();
+    const char *name = runs[0].name.c_str();
+    for ( const entry &e : entries ) {
+      if ( !__same_run(e, host, detail, rev, name) ) continue;
+      const format::field_def *f = nullptr;
+      for ( const format::field_def &fd : format::fields )
+        if ( micron::strcmp(fd.name, e.metric) == 0 ) f = &fd;
+      if ( !f ) continue;
+      comparison c{};
+      c.metric = f->name;
+      c.base = &e;
+      c.cur = format::compute_stats(runs, f->get);
+      c.change = e.mean != 0.0 ? (c.cur.mean - e.mean) / (e.mean < 0 ? -e.mean : e.mean) : 0.0;
+      c.threshold = th.of(f->name);
+      c.gated = th.gates(f->name);
+      c.tested = e.n >= 2 && c.cur.n >= 2;
+      if ( c.tested ) {
+        double t = 0.0, df = 0.0;
+        __impl::__welch(e.mean, e.stddev, e.n, c.cur.mean, c.cur.stddev, c.cur.n, t, df);
+        const double crit = stopping::__impl::__t975(df < 1.0 ? 1 : static_cast<usize>(df));
+        c.significant = (t < 0 ? -t : t) > crit;
+      }
+      const double mag = c.change < 0 ? -c.change : c.change;
+      const bool worse = __impl::__higher_is_better(c.metric) ? c.change < 0 : c.change > 0;
+      if ( mag > c.threshold && (!c.tested || c.significant) ) c.v = worse ? verdict::regression : verdict::improvement;
+      out.push_back(c);
+    }
+  }
+};
+
+};     // namespace bbench::baseline
@@ -0,0 +1,84 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef BBENCH_ROI_H
+#define BBENCH_ROI_H
+
+// region-of-interest markers for programs measured with bbench --roi
+// include this in the benchmarked program (C or C++, no other bbench headers needed):
+//
+//    roi_begin("steady");
+//    for ( ... ) work();
+//    roi_end();
+//
+// bbench hands over two pipe fds through BBENCH_CTL_FD / BBENCH_ACK_FD; every marker writes one
+// line and waits for a one-byte ack, so the counters are snapshotted exactly at the marker.
+// regions nest, repeat (same name accumulates) and are no-ops when not running under bbench
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BBENCH_ROI_NAME_MAX 63
+
+static inline int
+bbench_roi__env_fd(const char *var)
+{
+  const char *s = getenv(var);
+  int v = 0;
+  if ( !s || !*s ) return -1;
+  for ( ; *s >= '0' && *s <= '9'; ++s ) v = v * 10 + (*s - '0');
+  return *s ? -1 : v;
+}
+
+static inline void
+bbench_roi__send(const char *msg, size_t n)
+{
+  static int ctl = -2, ack = -2;
+  char c;
+  if ( ctl == -2 ) {
+    ctl = bbench_roi__env_fd("BBENCH_CTL_FD");
+    ack = bbench_roi__env_fd("BBENCH_ACK_FD");
+  }
+  if ( ctl < 0 || ack < 0 ) return;
+  if ( write(ctl, msg, n) != (ssize_t)n ) {
+    ctl = -1;
+    return;
+  }
+  if ( read(ack, &c, 1) != 1 ) ctl = -1;
+}
+
+static inline void
+roi_begin(const char *name)
+{
+  char msg[BBENCH_ROI_NAME_MAX + 3];
+  size_t n = name ? strlen(name) : 0;
+  if ( n > BBENCH_ROI_NAME_MAX ) n = BBENCH_ROI_NAME_MAX;
+  msg[0] = 'b';
+  if ( n ) memcpy(msg + 1, name, n);
+  msg[n + 1] = '\n';
+  bbench_roi__send(msg, n + 2);
+}
+
+static inline void
+roi_end(void)
+{
+  bbench_roi__send("e\n", 2);
+}
+
+#ifdef __cplusplus
+namespace bbench
+{
+// scoped region: roi r{ "parse" };
+struct roi {
+  explicit roi(const char *name) { roi_begin(name); }
+  ~roi() { roi_end(); }
+  roi(const roi &) = delete;
+  roi &operator=(const roi &) = delete;
+};
+};     // namespace bbench
+#endif
+
+#endif
@@ -13,11 +13,23 @@
 #include <micron/types.hpp>
 #include <micron/vector.hpp>
 
+#include "aggregate.hpp"
+#include "cgroup.hpp"
 #include "clock.hpp"
 #include "events.hpp"
+#include "forkserver.hpp"
 #include "funcs.hpp"
+#include "memsample.hpp"
+#include "offcpu.hpp"
 #include "options.hpp"
 #include "process.hpp"
+#include "procio.hpp"
+#include "proctree.hpp"
+#include "regress.hpp"
+#include "roi.hpp"
+#include "sysfs.hpp"
+#include "stopping.hpp"
+#include "systrace.hpp"
 
 namespace bbench
 {
@@ -52,6 +64,29 @@ template <typename E, typename... Cs> struct group_has<event_group<Cs...>, E> :
 
 template <typename G, typename E> inline constexpr bool group_has_v = group_has<G, E>::value;
 
+// set_ref_ghz: the clock norm_time_us of in-process runs is put at, they take no benchmark_opts
+inline u64 __ref_khz = 0;
+
+// eff_ghz and norm_time_us from the cycles / ref-cycles ratio; ref-cycles tick at the nominal clock
+// whatever the core does, so the ratio is the run's average clock relative to nominal. both are
+// recomputed from scratch, counters replaced since the last call (roi, --cgroup) leave no stale
+// values. with ref_khz but no known nominal clock norm_time_us stays 0: time at this host's nominal
+// would pass for time at ref_khz and defeat the cross-host comparison
+inline void
+__apply_clock(benchmark_t &b, u64 ref_khz)
+{
+  b.eff_ghz = 0.0;
+  b.norm_time_us = 0.0;
+  if ( b.total_cycles <= 0 || b.cycles <= 0 ) return;
+  static const u64 nominal = sys::nominal_khz();
+  const double ratio = static_cast<double>(b.cycles) / static_cast<double>(b.total_cycles);
+  b.eff_ghz = ratio * static_cast<double>(nominal) / 1e6;
+  if ( !ref_khz )
+    b.norm_time_us = b.time * ratio;
+  else if ( nominal )
+    b.norm_time_us = b.time * ratio * static_cast<double>(nominal) / static_cast<double>(ref_khz);
+}
+
 template <time_resolution R, class G>
 inline benchmark_t
 collect(const micron::string &name, time_clock &cl, G &gr)
@@ -96,10 +131,97 @@ collect(const micron::string &name, time_clock &cl, G &gr)
   if constexpr ( group_has_v<G, alignment_faults> ) b.alignment_faults = (long long)gr.template get<alignment_faults>().retrieve();
   if constexpr ( group_has_v<G, emulation_faults> ) b.emulation_faults = (long long)gr.template get<emulation_faults>().retrieve();
 
+  __apply_clock(b, __ref_khz);
   return b;
 }
+
+inline void
+__apply_usage(benchmark_t &b, const child_usage &cu)
+{
+  b.max_rss_kb = cu.max_rss_kb;
+  b.user_time_us = cu.user_time_us;
+  b.sys_time_us = cu.sys_time_us;
+  b.vol_ctx_switches = cu.vol_ctx_switches;
+  b.invol_ctx_switches = cu.invol_ctx_switches;
+  b.ru_minor_faults = cu.minor_faults;
+  b.ru_major_faults = cu.major_faults;
+}
+
+// a launched binary and how it was started; the fork server reaps its own children
+struct __launched {
+  int pid = -1;
+  bool served = false;
+  u64 launch_ns = 0;
+};
+
+// through the fork server when asked for and running, otherwise a direct process_attach
+template <typename F>
+inline __launched
+__launch(const launch_spec &ls, bool fork_server, F &&attach_fn)
+{
+  __launched l;
+  const u64 t0 = __now_ns();
+  auto timed = [&](int pid) {
+    l.launch_ns = __now_ns() - t0;
+    attach_fn(pid);
+  };
+  if ( fork_server && forkserver::instance().running() ) {
+    l.pid = forkserver::instance().launch(ls, timed);
+    l.served = l.pid > 0;
+  }
+  if ( !l.served ) l.pid = process_attach(ls, timed);
+  return l;
+}
+
+// waits for exit only; the rusage of a served child arrives through __finish, outside the timed window
+inline void
+__wait_launched(const __launched &l, u32 timeout_ms, child_usage &cu)
+{
+  if ( l.served )
+    forkserver::instance().wait_exit(l.pid, timeout_ms, cu);
+  else
+    __wait_child(l.pid, timeout_ms, cu);
+}
+
+inline void
+__finish(const __launched &l, child_usage &cu)
+{
+  if ( l.served ) forkserver::instance().collect(cu);
+}
+
+// the unit a benchmark<R> time is in, as the reports print it
+constexpr const char *
+__unit(time_resolution r)
+{
+  switch ( r ) {
+  case time_resolution::seconds :
+  case time_resolution::sec :
+    return "s";
+  case time_resolution::deciseconds :
+  case time_resolution::ds :
+    return "ds";
+  case time_resolution::milliseconds :
+  case time_resolution::ms :
+    return "ms";
+  case time_resolution::microseconds :
+  case time_resolution::us :
+    return "us";
+  default :
+    return "ns";
+  }
+}
 };     // namespace __impl
 
+// bbench --ref-ghz for in-process runs (benchmark<>(), bench_linear, ...): their norm_time_us is
+// put at ghz instead of this host's nominal clock; 0 restores nominal. binaries take
+// benchmark_opts::ref_khz. false when the nominal clock is unknown, norm_time_us then stays 0
+inline bool
+set_ref_ghz(double ghz)
+{
+  __impl::__ref_khz = ghz > 0.0 ? static_cast<u64>(ghz * 1e6) : 0;
+  return __impl::__ref_khz == 0 || sys::nominal_khz() != 0;
+}
+
 template <time_resolution R = time_resolution::us, class G = event_group_d1, typename F, typename... Args>
 inline benchmark_t
 benchmark(F func, Args &&...args)
@@ -148,10 +270,13 @@ benchmark_bin(const char *s, A... args)
   gr.reopen(pid);
   cl.begin();
   gr.begin();
-  micron::waitpid(pid, nullptr, 0);
+  child_usage cu;
+  __impl::__wait_child(pid, 0, cu);
   cl.end();
   gr.end();
-  return __impl::collect<time_resolution::us>(micron::string{ s }, cl, gr);
+  benchmark_t b = __impl::collect<time_resolution::us>(micron::string{ s }, cl, gr);
+  __impl::__apply_usage(b, cu);
+  return b;
 }
 
 template <class G = event_group_d1, micron::is_string T, micron::is_string... A>
@@ -164,64 +289,95 @@ benchmark_bin(const T &s, A... args)
   gr.reopen(pid);
   cl.begin();
   gr.begin();
-  micron::waitpid(pid, nullptr, 0);
+  child_usage cu;
+  __impl::__wait_child(pid, 0, cu);
   cl.end();
   gr.end();
-  return __impl::collect<time_resolution::us>(micron::string{ s.c_str() }, cl, gr);
+  benchmark_t b = __impl::collect<time_resolution::us>(micron::string{ s.c_str() }, cl, gr);
+  __impl::__apply_usage(b, cu);
+  return b;
 }
 
+// one named region from bbench_roi.h; every begin/end pair with the same name adds up
+struct roi_region {
+  micron::string name;
+  benchmark_t b;     // counter deltas inside the region, time in us
+  u32 count;         // how many times the region was entered
+};
+
+// optional per-run outputs of benchmark_bin besides benchmark_t; null members aren't collected
+struct run_outputs {
+  micron::vector<roi_region> *regions = nullptr;     // bbench_roi.h regions (--roi)
+  memsample::timeline *mem = nullptr;                // needs opts.mem_interval_us (--mem-timeline)
+  systrace::table *syscalls = nullptr;               // raw_syscalls tracepoints (--syscalls)
+};
+
 namespace __impl
 {
 
-inline void
-__sleep_ms(u32 ms)
+template <class G>
+inline benchmark_t
+__snapshot(G &gr)
 {
-  if ( ms == 0 ) return;
-  micron::timespec_t req{};
-  req.tv_sec = ms / 1000;
-  req.tv_nsec = static_cast<long>((ms % 1000) * 1'000'000);
-  micron::nanosleep(req);
+  static const micron::string none{};
+  time_clock cl;
+  return collect<time_resolution::us>(none, cl, gr);
 }
 
-inline u64
-__now_ms(void)
-{
-  micron::timespec_t t{};
-  micron::clock_gettime(micron::clock_monotonic, t);
-  return static_cast<u64>(t.tv_sec) * 1000ull + static_cast<u64>(t.tv_nsec) / 1'000'000ull;
-}
+// turns roi begin/end messages into per-region counter deltas; regions nest up to 8 deep
+template <class G> struct __roi_tracker {
+  struct open_t {
+    usize region;
+    benchmark_t at;
+    u64 t_ns;
+  };
 
-inline void
-__wait_with_timeout(int pid, u32 timeout_ms)
-{
-  if ( timeout_ms == 0 ) {
-    micron::waitpid(pid, nullptr, 0);
-    return;
-  }
-  u64 deadline = __now_ms() + timeout_ms;
-  int status = 0;
-  for ( ;; ) {
-    int r = micron::waitpid(pid, &status, micron::wnohang);
-    if ( r == pid ) return;     // exited
-    if ( __now_ms() >= deadline ) {
-      micron::posix::kill(pid, static_cast<int>(micron::signal::terminate));
-      u64 hard = __now_ms() + 50;
-      while ( __now_ms() < hard ) {
-        if ( micron::waitpid(pid, &status, micron::wnohang) == pid ) return;
-        __sleep_ms(2);
+  G &gr;
+  micron::vector<roi_region> *out;
+  open_t stack[8];
+  u32 depth = 0;
+  u32 dropped = 0;     // begins past the nesting limit; their ends are skipped too
+  benchmark_t outer{};     // outermost regions only, so nesting doesn't double count
+  bool any = false;
+
+  void
+  on(char kind, const char *name)
+  {
+    if ( kind == 'b' ) {
+      if ( depth == 8 ) {
+        ++dropped;
+        return;
+      }
+      usize idx = out->size();
+      for ( usize i = 0; i < out->size(); ++i )
+        if ( micron::strcmp((*out)[i].name.c_str(), name) == 0 ) idx = i;
+      if ( idx == out->size() ) out->push_back(roi_region{ micron::string{ name }, benchmark_t{}, 0 });
+      stack[depth++] = open_t{ idx, __snapshot(gr), __now_ns() };
+    } else if ( kind == 'e' && dropped > 0 ) {
+      --dropped;
+    } else if ( kind == 'e' && depth > 0 ) {
+      const u64 t1 = __now_ns();
+      const benchmark_t now = __snapshot(gr);
+      const open_t &o = stack[--depth];
+      const double us = static_cast<double>(t1 - o.t_ns) / 1000.0;
+      roi_region &r = (*out)[o.region];
+      for ( auto f : counter_fields ) r.b.*f += now.*f - o.at.*f;
+      r.b.time += us;
+      ++r.count;
+      if ( depth == 0 ) {
+        for ( auto f : counter_fields ) outer.*f += now.*f - o.at.*f;
+        outer.time += us;
+        any = true;
       }
-      micron::posix::kill(pid, static_cast<int>(micron::signal::kill9));
-      micron::waitpid(pid, &status, 0);
-      return;
     }
-    __sleep_ms(1);
   }
-}
+};
 
 template <class G>
 inline benchmark_t
-__bench_bin_with_opts(const char *s, const benchmark_opts &opts)
+__bench_bin_with_opts(const char *s, const benchmark_opts &opts, const run_outputs &o)
 {
+  micron::vector<roi_region> *regions = o.regions;
   time_clock cl;
   G gr{ quiet{} };
   gr.set_inherit(opts.inherit);
@@ -229,29 +385,171 @@ __bench_bin_with_opts(const char *s, const benchmark_opts &opts)
   gr.set_enable_on_exec(true);
 
   if ( opts.pre ) process<true>(opts.pre);
-  int pid = process_attach(s, [&](int child_pid) { gr.reopen(child_pid); });
+  stdio_redirect io(opts.stdout_path, opts.stderr_path);
+  launch_spec ls = __launch_from(s, opts, io);
+  // the control fds only exist in our fd table, so roi runs never go through the fork server
+  roi::session rs;
+  const bool roi_on = regions && rs.open(opts.envp);
+  if ( roi_on ) ls.envp = rs.envp();
+  // --cgroup: the child joins the transient cgroup while parked; without delegation this is a plain run
+  cgroup::run cg;
+  const bool cg_on = opts.cgroup && cg.create();
+  const bool cg_counters = cg_on && cg.open_counters(opts.excl_kernel);
+  // --mem-sample, --io and --syscalls all work from our own wait loop, so those are direct launches too
+  memsample::sampler ms;
+  const bool mem_on = opts.mem_interval_us > 0;
+  procio::reader pio;
+  procio::io_t io_totals{};
+  bool io_ok = false;
+  systrace::tracer st;
+  bool st_on = false;
+  const bool own_wait = roi_on || mem_on || opts.io || o.syscalls;
+  __launched l = __launch(ls, opts.fork_server && !own_wait, [&](int child_pid) {
+    if ( cg_on ) cg.enter(child_pid);
+    if ( mem_on ) ms.open(child_pid, opts.mem_interval_us, o.mem ? opts.mem_capacity : 0);
+    if ( opts.io ) pio.open(child_pid);
+    if ( o.syscalls ) st_on = st.attach(child_pid);
+    gr.reopen(child_pid);
+    if ( cg_counters ) cg.begin();
+  });
+  if ( roi_on ) rs.launched();
   if ( opts.delay_ms > 0 ) __sleep_ms(opts.delay_ms);
   cl.begin();
-  __wait_with_timeout(pid, opts.timeout_ms);
+  const u64 t0 = __now_ns();
+  child_usage cu;
+  __roi_tracker<G> tr{ gr, regions };
+  if ( mem_on ) ms.start(t0);
+  if ( own_wait ) {
+    const int watch[2] = { roi_on ? rs.ctl : -1, st_on ? st.watch_fd() : -1 };
+    __wait_child_ticked(
+        l.pid, opts.timeout_ms, cu, watch, 2,
+        [&](usize i) {
+          if ( i == 0 )
+            rs.drain([&](char kind, const char *name) { tr.on(kind, name); });
+          else
+            st.drain();
+        },
+        mem_on ? ms.period_ns() : 0,
+        [&](u64 now, bool exited) {
+          if ( mem_on ) ms.tick(now);
+          if ( exited && opts.io ) io_ok = pio.read(io_totals);
+        });
+  } else {
+    __wait_launched(l, opts.timeout_ms, cu);
+  }
+  // whatever the child left behind in the cgroup is part of the run
+  if ( cg_on && !cg.wait_empty(opts.timeout_ms ? t0 + static_cast<u64>(opts.timeout_ms) * 1'000'000ull : 0) ) cu.timed_out = true;
   cl.end();
   gr.end();
+  if ( cg_counters ) cg.end();
+  __finish(l, cu);
   if ( opts.post ) process<true>(opts.post);
-  return __impl::collect<time_resolution::us>(micron::string{ s }, cl, gr);
+  benchmark_t b = __impl::collect<time_resolution::us>(micron::string{ s }, cl, gr);
+  if ( tr.any ) {
+    for ( auto f : counter_fields ) b.*f = tr.outer.*f;
+    b.time = tr.outer.time;
+  }
+  if ( cg_on ) cg.collect(b);
+  if ( mem_on ) {
+    ms.collect(b);
+    if ( o.mem ) ms.collect(*o.mem);
+  }
+  if ( io_ok ) procio::apply(b, io_totals);
+  if ( o.syscalls ) st.finish(*o.syscalls);
+  __apply_usage(b, cu);
+  __apply_clock(b, opts.ref_khz);     // again: roi regions and --cgroup replace the counters
+  b.launch_us = static_cast<double>(l.launch_ns) / 1000.0;
+  return b;
 }
-};     // namespace __impl
 
 inline benchmark_t
-benchmark_bin(const char *s, const benchmark_opts &opts)
+__bench_bin_detail(const char *s, const benchmark_opts &opts, const run_outputs &o)
 {
   switch ( opts.detail ) {
   case 2 :
-    return __impl::__bench_bin_with_opts<event_group_d2>(s, opts);
+    return __bench_bin_with_opts<event_group_d2>(s, opts, o);
   case 3 :
-    return __impl::__bench_bin_with_opts<event_group_d3>(s, opts);
+    return __bench_bin_with_opts<event_group_d3>(s, opts, o);
   default :
-    return __impl::__bench_bin_with_opts<event_group_d1>(s, opts);
+    return __bench_bin_with_opts<event_group_d1>(s, opts, o);
   }
 }
+};     // namespace __impl
+
+inline benchmark_t
+benchmark_bin(const char *s, const benchmark_opts &opts)
+{
+  return __impl::__bench_bin_detail(s, opts, run_outputs{});
+}
+
+// for a child built with bbench_roi.h: counters and time cover only its outermost regions, the
+// per-region split lands in regions. a child that never marks a region gets whole-process counters
+inline benchmark_t
+benchmark_bin(const char *s, const benchmark_opts &opts, micron::vector<roi_region> &regions)
+{
+  run_outputs o;
+  o.regions = &regions;
+  return __impl::__bench_bin_detail(s, opts, o);
+}
+
+// with opts.mem_interval_us set: the memory timeline of the run, at most opts.mem_capacity samples
+inline benchmark_t
+benchmark_bin(const char *s, const benchmark_opts &opts, memsample::timeline &tl)
+{
+  run_outputs o;
+  o.mem = &tl;
+  return __impl::__bench_bin_detail(s, opts, o);
+}
+
+// any combination of the above, plus the per-syscall table
+inline benchmark_t
+benchmark_bin(const char *s, const benchmark_opts &opts, const run_outputs &o)
+{
+  return __impl::__bench_bin_detail(s, opts, o);
+}
+
+// runs s until the time's confidence interval meets rule (stopping.hpp) instead of a fixed count;
+// every run is appended to runs, the report says how many were needed and why it stopped
+inline stopping::report
+benchmark_bin_until(const char *s, const benchmark_opts &opts, const stopping::rule &rule, micron::vector<benchmark_t> &runs)
+{
+  stopping::monitor m(rule);
+  m.start(__impl::__now_ns());
+  for ( ;; ) {
+    runs.push_back(benchmark_bin(s, opts));
+    if ( m.add(runs[runs.size() - 1].time, __impl::__now_ns()) ) break;
+  }
+  return m.result();
+}
+
+// the same for an in-process payload
+template <time_resolution R = time_resolution::us, class G = event_group_d1, typename F, typename... Args>
+inline stopping::report
+benchmark_until(const stopping::rule &rule, micron::vector<benchmark_t> &runs, F func, Args &&...args)
+{
+  stopping::monitor m(rule);
+  m.start(__impl::__now_ns());
+  for ( ;; ) {
+    runs.push_back(benchmark<R, G>(func, args...));
+    if ( m.add(runs[runs.size() - 1].time, __impl::__now_ns()) ) break;
+  }
+  return m.result();
+}
+
+// n runs of s folded into agg as they finish, for sweeps too long to keep every run
+inline void
+benchmark_bin_aggregate(const char *s, const benchmark_opts &opts, usize n, aggregate::aggregator &agg)
+{
+  for ( usize i = 0; i < n; ++i ) agg.add(benchmark_bin(s, opts));
+}
+
+// the same for an in-process payload
+template <time_resolution R = time_resolution::us, class G = event_group_d1, typename F, typename... Args>
+inline void
+benchmark_aggregate(usize n, aggregate::aggregator &agg, F func, Args &&...args)
+{
+  for ( usize i = 0; i < n; ++i ) agg.add(benchmark<R, G>(func, args...));
+}
 
 // dynamic (-e)
 struct dynamic_result_t {
@@ -266,6 +564,8 @@ struct dynamic_result_t {
   };
 
   micron::vector<entry> rows;
+  child_usage usage;
+  double launch_us;
 };
 
 inline dynamic_result_t
@@ -281,12 +581,16 @@ benchmark_bin_dynamic(const char *s, const micron::vector<event_def> &defs, cons
 
   time_clock cl;
   if ( opts.pre ) process<true>(opts.pre);
-  int pid = process_attach(s, [&](int child_pid) { gr.reopen(child_pid); });
+  stdio_redirect io(opts.stdout_path, opts.stderr_path);
+  __impl::__launched l
+      = __impl::__launch(__impl::__launch_from(s, opts, io), opts.fork_server, [&](int child_pid) { gr.reopen(child_pid); });
   if ( opts.delay_ms > 0 ) __impl::__sleep_ms(opts.delay_ms);
   cl.begin();
-  __impl::__wait_with_timeout(pid, opts.timeout_ms);
+  __impl::__wait_launched(l, opts.timeout_ms, out.usage);
   cl.end();
   gr.end();
+  __impl::__finish(l, out.usage);
+  out.launch_us = static_cast<double>(l.launch_ns) / 1000.0;
   if ( opts.post ) process<true>(opts.post);
 
   out.time = cl.template elapsed<time_resolution::us>();
@@ -295,6 +599,103 @@ benchmark_bin_dynamic(const char *s, const micron::vector<event_def> &defs, cons
   return out;
 }
 
+// the benchmark_t columns a dynamic run has without counting an event: the time, the launch
+// overhead and the child's rusage. a -M operand that is only a column must be one of these with -e
+inline bool
+dynamic_column(const char *column)
+{
+  constexpr const char *names[]
+      = { "time_us", "launch_us", "max_rss_kb", "user_time_us", "sys_time_us", "vol_ctx_switches", "invol_ctx_switches", "ru_minor_faults", "ru_major_faults" };
+  for ( const char *n : names )
+    if ( micron::strcmp(n, column) == 0 ) return true;
+  return false;
+}
+
+// those columns of r filled in, every other one 0
+inline benchmark_t
+dynamic_columns(const dynamic_result_t &r)
+{
+  benchmark_t b{};
+  b.name = r.name;
+  b.time = r.time;
+  b.launch_us = r.launch_us;
+  __impl::__apply_usage(b, r.usage);
+  return b;
+}
+
+// --per-process: counters split per process of the tree the binary spawns, and rolled up per
+// executable. records are drained while the tree runs. a descendant still alive when the root
+// exits never sends its own counts (they come only on exit); the totals read here still hold what
+// it counted so far, so that lands in the root's share and the rest of its life isn't measured.
+// always a direct launch, the rings need our own child
+inline proctree::result
+benchmark_bin_tree(const char *s, const benchmark_opts &opts)
+{
+  proctree::result out;
+  out.name = micron::string{ s };
+
+  proctree::tracker tr;
+  time_clock cl;
+  if ( opts.pre ) process<true>(opts.pre);
+  stdio_redirect io(opts.stdout_path, opts.stderr_path);
+  const int pid = process_attach(__impl::__launch_from(s, opts, io), [&](int child_pid) { tr.attach(child_pid, s, opts.excl_kernel); });
+  if ( opts.delay_ms > 0 ) __impl::__sleep_ms(opts.delay_ms);
+  cl.begin();
+  __impl::__wait_child_watch(pid, opts.timeout_ms, out.usage, tr.watch_fd(), [&] { tr.drain(); });
+  cl.end();
+  tr.finish(out);
+  if ( opts.post ) process<true>(opts.post);
+  out.time = cl.template elapsed<time_resolution::us>();
+  return out;
+}
+
+// --off-cpu: where the binary's tree waited instead of running, split into runnable (preempted or
+// woken, waiting for a cpu) and blocked, with the stacks it switched out from. direct launch
+inline offcpu::result
+benchmark_bin_offcpu(const char *s, const benchmark_opts &opts)
+{
+  offcpu::result out;
+  out.name = micron::string{ s };
+
+  offcpu::tracer tr;
+  time_clock cl;
+  if ( opts.pre ) process<true>(opts.pre);
+  stdio_redirect io(opts.stdout_path, opts.stderr_path);
+  const int pid = process_attach(__impl::__launch_from(s, opts, io), [&](int child_pid) { tr.attach(child_pid); });
+  if ( opts.delay_ms > 0 ) __impl::__sleep_ms(opts.delay_ms);
+  tr.enable();
+  cl.begin();
+  const int watch[] = { tr.watch_fd(), tr.wake_watch_fd() };
+  __impl::__wait_child_ticked(pid, opts.timeout_ms, out.usage, watch, 2, [&](usize) { tr.drain(); }, 0, [](u64, bool) {});
+  cl.end();
+  tr.disable();
+  tr.finish(out);
+  if ( opts.post ) process<true>(opts.post);
+  out.time = cl.template elapsed<time_resolution::us>();
+  return out;
+}
+
+// the same for an in-process payload: the calling thread and every thread it starts. nothing
+// drains while func runs, a payload that switches a lot can overrun the rings (see result.lost)
+template <typename F, typename... Args>
+inline offcpu::result
+benchmark_offcpu(const micron::string &_name, F func, Args &&...args)
+{
+  offcpu::result out;
+  out.name = _name;
+  offcpu::tracer tr;
+  time_clock cl;
+  tr.attach(0);
+  tr.enable();
+  cl.begin();
+  func(micron::forward<Args>(args)...);
+  cl.end();
+  tr.disable();
+  tr.finish(out);
+  out.time = cl.template elapsed<time_resolution::us>();
+  return out;
+}
+
 template <class C = hardware_cycles, typename F, typename... Args>
 inline long long
 cpu_bench(F func, Args &&...args)
@@ -400,4 +801,28 @@ bench_repeat(F func, Args... args)
   return results;
 }
 
+// K batches of step, 2 step, ... K step calls, each timed and counted as one measurement; the
+// per-iteration cost is the slope of the fit (regress.hpp), the per-batch overhead its intercept.
+// the time column is in R (ns by default, per-call costs are small), e.time_unit says so
+template <usize K, time_resolution R = time_resolution::ns, class G = event_group_d1, typename F, typename... Args>
+inline regress::estimate
+bench_linear(usize step, F func, Args... args)
+{
+  static_assert(K >= 2, "bench_linear needs two batch sizes or more");
+  regress::estimate e;
+  e.time_unit = __impl::__unit(R);
+  e.iters.reserve(K);
+  e.batches.reserve(K);
+  if ( step == 0 ) step = 1;
+  for ( usize k = 1; k <= K; ++k ) {
+    const usize iters = k * step;
+    e.iters.push_back(static_cast<double>(iters));
+    e.batches.push_back(benchmark<R, G>([&]() {
+      for ( usize i = 0; i < iters; ++i ) func(args...);
+    }));
+  }
+  regress::solve(e);
+  return e;
+}
+
 };     // namespace bbench
@@ -0,0 +1,471 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/linux/io.hpp>
+#include <micron/linux/sys/fcntl.hpp>
+#include <micron/memory/cmemory.hpp>
+#include <micron/proc.hpp>
+#include <micron/syscall.hpp>
+#include <micron/types.hpp>
+
+#include "events.hpp"
+#include "funcs.hpp"
+#include "process.hpp"
+#include "sysfs.hpp"
+
+// cgroup v2 isolated runs (bbench --cgroup)
+//
+// a transient cgroup is created under bbench's own one; the parked child is moved into it before
+// exec, so everything it forks, daemonized or not, stays accounted. counters are opened per cpu
+// with PERF_FLAG_PID_CGROUP, the run ends when the cgroup is empty (or --timeout kills all of it),
+// then cpu.stat / memory.peak / memory.stat / io.stat are folded into the result and the cgroup
+// is removed. memory.* and io.* only exist when those controllers are delegated to us
+namespace bbench::cgroup
+{
+
+inline constexpr const char *mount_root = "/sys/fs/cgroup";
+
+namespace __impl
+{
+
+inline constexpr int __at_fdcwd = -100;
+inline constexpr int __at_removedir = 0x200;
+inline constexpr int __o_directory = 0200000;
+inline constexpr short __pollpri = 0x0002;
+
+inline void
+__append(char *dst, usize cap, usize &n, const char *s)
+{
+  while ( *s && n < cap - 1 ) dst[n++] = *s++;
+  dst[n] = '\0';
+}
+
+inline void
+__append_int(char *dst, usize cap, usize &n, long long v)
+{
+  char digits[24];
+  int k = 0;
+  for ( unsigned long long u = static_cast<unsigned long long>(v); k == 0 || u > 0; u /= 10 )
+    digits[k++] = static_cast<char>('0' + u % 10);
+  while ( k > 0 && n < cap - 1 ) dst[n++] = digits[--k];
+  dst[n] = '\0';
+}
+
+// dir + "/" + leaf
+inline void
+__leaf(char *dst, usize cap, const char *dir, const char *leaf)
+{
+  usize n = 0;
+  __append(dst, cap, n, dir);
+  __append(dst, cap, n, "/");
+  __append(dst, cap, n, leaf);
+}
+
+inline bool
+__write_file(const char *path, const char *s)
+{
+  int fd = micron::open(path, micron::posix::o_wronly | micron::posix::o_cloexec, 0);
+  if ( fd < 0 ) return false;
+  const long n = static_cast<long>(micron::strlen(s));
+  const bool ok = micron::posix::write(fd, s, static_cast<usize>(n)) == n;
+  micron::close(fd);
+  return ok;
+}
+
+// our own cgroup directory, from the "0::/path" line of /proc/self/cgroup
+inline bool
+__self_dir(char *dst, usize cap)
+{
+  char buf[1024];
+  if ( sys::read_file("/proc/self/cgroup", buf, sizeof(buf)) <= 0 ) return false;
+  const char *p = sys::find_key(buf, "0::");
+  if ( !p ) return false;     // v1-only hierarchy
+  char rel[512];
+  sys::copy_line(rel, sizeof(rel), p);
+  usize n = 0;
+  __append(dst, cap, n, mount_root);
+  if ( rel[0] == '/' && rel[1] == '\0' ) return true;
+  __append(dst, cap, n, rel);
+  return true;
+}
+
+inline long long
+__key(const char *buf, const char *key)
+{
+  const char *p = sys::find_key(buf, key);
+  u64 v = 0;
+  return p && sys::parse_u64(p, v) ? static_cast<long long>(v) : 0;
+}
+
+// whole-word match in a space-separated list (cgroup.controllers)
+inline bool
+__has_word(const char *list, const char *w)
+{
+  const usize wn = micron::strlen(w);
+  for ( const char *p = list; *p; ++p )
+    if ( (p == list || p[-1] == ' ') && micron::strncmp(p, w, wn) == 0 && (p[wn] == ' ' || p[wn] == '\n' || p[wn] == '\0') ) return true;
+  return false;
+}
+
+// io.stat: one line per device, "MAJ:MIN rbytes=N wbytes=N ..."; sums key over devices
+inline long long
+__io_sum(const char *buf, const char *key)
+{
+  const usize kn = micron::strlen(key);
+  long long sum = 0;
+  for ( const char *p = buf; *p; ++p ) {
+    if ( (p == buf || p[-1] == ' ') && micron::strncmp(p, key, kn) == 0 ) {
+      const char *q = p + kn;
+      u64 v = 0;
+      if ( sys::parse_u64(q, v) ) sum += static_cast<long long>(v);
+    }
+  }
+  return sum;
+}
+
+// room under RLIMIT_NOFILE for need more fds besides a margin for everything else bbench keeps
+// open; the soft limit is raised toward the hard one when it is short. false if even that isn't enough
+inline bool
+__fd_room(usize need)
+{
+  struct {
+    u64 cur, max;
+  } lim{};
+  if ( micron::syscall(SYS_prlimit64, 0, 7 /* RLIMIT_NOFILE */, nullptr, &lim) < 0 ) return true;     // can't tell: the opens decide
+  const u64 want = static_cast<u64>(need) + 256;
+  if ( lim.cur >= want ) return true;
+  if ( lim.max < want ) return false;
+  lim.cur = want;
+  return micron::syscall(SYS_prlimit64, 0, 7, &lim, nullptr) == 0;
+}
+
+};     // namespace __impl
+
+// counters opened on the cgroup, and where they land in benchmark_t
+struct counter_def {
+  const char *event;
+  long long benchmark_t::*field;
+};
+
+inline constexpr counter_def counters[] = {
+  { "cycles", &benchmark_t::cycles },
+  { "instructions", &benchmark_t::instructions },
+  { "cache-misses", &benchmark_t::cache_misses },
+  { "branches", &benchmark_t::total_branches },
+  { "branch-misses", &benchmark_t::branch_misses },
+  { "ref-cycles", &benchmark_t::total_cycles },
+  { "task-clock", &benchmark_t::cpu_time },
+  { "context-switches", &benchmark_t::context_switches },
+  { "cpu-migrations", &benchmark_t::migrations },
+  { "page-faults", &benchmark_t::page_faults },
+};
+
+inline constexpr usize n_counters = sizeof(counters) / sizeof(counters[0]);
+
+class run
+{
+  char dir[512] = {};
+  int dir_fd = -1;
+  dynamic_event *events = nullptr;     // n_counters per cpu
+  usize n_events = 0;
+  bool made = false;
+  const char *counters_failed = nullptr;     // why open_counters returned false
+
+public:
+  run(void) = default;
+  run(const run &) = delete;
+  run &operator=(const run &) = delete;
+
+  ~run() { destroy(); }
+
+  bool
+  active(void) const
+  {
+    return made;
+  }
+
+  const char *
+  path(void) const
+  {
+    return dir;
+  }
+
+  // <our cgroup>/bbench-<pid>-<seq>; asks for the cpu/memory/io controllers, which only succeeds
+  // when our cgroup is delegated and has no processes of its own (probe() explains the rest)
+  bool
+  create(void)
+  {
+    static u32 seq = 0;
+    char self[512];
+    if ( !__impl::__self_dir(self, sizeof(self)) ) return false;
+    char ctl[600];
+    __impl::__leaf(ctl, sizeof(ctl), self, "cgroup.subtree_control");
+    __impl::__write_file(ctl, "+cpu");
+    __impl::__write_file(ctl, "+memory");
+    __impl::__write_file(ctl, "+io");
+
+    usize n = 0;
+    __impl::__append(dir, sizeof(dir), n, self);
+    __impl::__append(dir, sizeof(dir), n, "/bbench-");
+    __impl::__append_int(dir, sizeof(dir), n, static_cast<long long>(micron::syscall(SYS_getpid)));
+    __impl::__append(dir, sizeof(dir), n, "-");
+    __impl::__append_int(dir, sizeof(dir), n, __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED));
+    if ( micron::syscall(SYS_mkdirat, __impl::__at_fdcwd, dir, 0755) < 0 ) return false;
+    made = true;
+    dir_fd = micron::open(dir, micron::posix::o_rdonly | __impl::__o_directory | micron::posix::o_cloexec, 0);
+    return dir_fd >= 0;
+  }
+
+  // moves a (parked) process in; its future children follow
+  bool
+  enter(int pid)
+  {
+    char procs[600];
+    char num[24];
+    usize n = 0;
+    __impl::__append_int(num, sizeof(num), n, pid);
+    __impl::__leaf(procs, sizeof(procs), dir, "cgroup.procs");
+    return __impl::__write_file(procs, num);
+  }
+
+  // one event per counter per online cpu, n_counters x ncpu fds; false if none could be opened
+  // (perf_event_paranoid, no CAP_PERFMON) or if RLIMIT_NOFILE can't hold them all, since counters
+  // missing on some cpus would undercount: the caller keeps its per-pid counters then, and
+  // counters_error() says why
+  bool
+  open_counters(bool excl_kernel)
+  {
+    char buf[512];
+    counters_failed = "cgroup perf counters unavailable (needs perf_event_paranoid <= 0 or CAP_PERFMON)";
+    if ( dir_fd < 0 || sys::read_file("/sys/devices/system/cpu/online", buf, sizeof(buf)) <= 0 ) return false;
+    const u32 ncpu = sys::count_cpulist(buf);
+    const usize need = static_cast<usize>(ncpu) * n_counters;
+    if ( !__impl::__fd_room(need) ) {
+      counters_failed = "cgroup perf counters need one fd per counter per cpu, more than RLIMIT_NOFILE allows (raise ulimit -n)";
+      return false;
+    }
+    n_events = need;
+    events = new dynamic_event[n_events];
+    usize i = 0, ok = 0;
+    bool out_of_fds = false;
+    sys::for_each_cpu(buf, [&](int cpu) {
+      for ( const auto &c : counters ) {
+        const event_def *def = lookup_event(c.event);
+        events[i].configure(*def, excl_kernel);
+        if ( events[i].open_cgroup(dir_fd, cpu) >= 0 ) ++ok;
+        else if ( events[i].last_errno == 24 /* EMFILE */ || events[i].last_errno == 23 /* ENFILE */ ) out_of_fds = true;
+        ++i;
+      }
+    });
+    if ( out_of_fds ) {
+      counters_failed = "cgroup perf counters ran out of file descriptors (raise ulimit -n)";
+      ok = 0;
+    }
+    if ( ok == 0 ) {
+      delete[] events;
+      events = nullptr;
+      n_events = 0;
+      return false;
+    }
+    counters_failed = nullptr;
+    return true;
+  }
+
+  const char *
+  counters_error(void) const
+  {
+    return counters_failed;
+  }
+
+  void
+  begin(void)
+  {
+    for ( usize i = 0; i < n_events; ++i ) events[i].begin();
+  }
+
+  void
+  end(void)
+  {
+    for ( usize i = 0; i < n_events; ++i ) events[i].end();
+  }
+
+  bool
+  populated(void) const
+  {
+    char ev[600];
+    char buf[256];
+    __impl::__leaf(ev, sizeof(ev), dir, "cgroup.events");
+    if ( sys::read_file(ev, buf, sizeof(buf)) <= 0 ) return false;
+    return __impl::__key(buf, "populated ") != 0;
+  }
+
+  // cgroup.kill (5.14+), else SIGKILL to every pid in cgroup.procs
+  void
+  kill(void)
+  {
+    char path[600];
+    __impl::__leaf(path, sizeof(path), dir, "cgroup.kill");
+    if ( __impl::__write_file(path, "1") ) return;
+    char buf[4096];
+    __impl::__leaf(path, sizeof(path), dir, "cgroup.procs");
+    if ( sys::read_file(path, buf, sizeof(buf)) <= 0 ) return;
+    for ( const char *p = buf; *p; ) {
+      u64 pid = 0;
+      if ( !sys::parse_u64(p, pid) ) break;
+      micron::posix::kill(static_cast<int>(pid), static_cast<int>(micron::signal::kill9));
+      while ( *p == '\n' ) ++p;
+    }
+  }
+
+  // waits for everything left in the cgroup (daemonized children) to exit; past the deadline
+  // (0 = none) the rest is killed. returns false if it had to kill
+  bool
+  wait_empty(u64 deadline_ns)
+  {
+    char ev[600];
+    __impl::__leaf(ev, sizeof(ev), dir, "cgroup.events");
+    int fd = micron::open(ev, micron::posix::o_rdonly | micron::posix::o_cloexec, 0);
+    bool clean = true;
+    // cgroup.events signals POLLPRI on change; the 10 ms cap covers kernels that don't
+    while ( populated() ) {
+      const u64 now = bbench::__impl::__now_ns();
+      if ( deadline_ns && now >= deadline_ns ) {
+        clean = false;
+        kill();
+        deadline_ns = 0;
+        continue;
+      }
+      u64 wait = 10'000'000ull;
+      if ( deadline_ns && deadline_ns - now < wait ) wait = deadline_ns - now;
+      micron::timespec_t ts{};
+      ts.tv_sec = 0;
+      ts.tv_nsec = static_cast<long>(wait);
+      bbench::__impl::__pollfd_t p{ fd, __impl::__pollpri, 0 };
+      if ( fd >= 0 )
+        micron::syscall(SYS_ppoll, &p, 1, &ts, nullptr, 0);
+      else
+        micron::nanosleep(ts);
+    }
+    if ( fd >= 0 ) micron::close(fd);
+    return clean;
+  }
+
+  // cgroup counters replace the per-pid ones they cover; cgroup files fill the cg_* fields
+  void
+  collect(benchmark_t &b)
+  {
+    if ( n_events ) {
+      for ( usize k = 0; k < n_counters; ++k ) {
+        long long sum = 0;
+        bool any = false;
+        for ( usize i = k; i < n_events; i += n_counters ) {
+          if ( !events[i].valid ) continue;
+          sum += events[i].retrieve();
+          any = true;
+        }
+        if ( any ) b.*(counters[k].field) = sum;
+      }
+    }
+    char path[600];
+    char buf[4096];
+    __impl::__leaf(path, sizeof(path), dir, "cpu.stat");
+    if ( sys::read_file(path, buf, sizeof(buf)) > 0 ) {
+      b.cg_usage_us = __impl::__key(buf, "usage_usec ");
+      b.cg_user_us = __impl::__key(buf, "user_usec ");
+      b.cg_system_us = __impl::__key(buf, "system_usec ");
+    }
+    __impl::__leaf(path, sizeof(path), dir, "memory.peak");
+    u64 peak = 0;
+    if ( sys::read_u64(path, peak) ) b.cg_memory_peak = static_cast<long long>(peak);
+    __impl::__leaf(path, sizeof(path), dir, "memory.stat");
+    if ( sys::read_file(path, buf, sizeof(buf)) > 0 ) {
+      b.cg_memory_anon = __impl::__key(buf, "anon ");
+      b.cg_memory_file = __impl::__key(buf, "file ");
+    }
+    __impl::__leaf(path, sizeof(path), dir, "io.stat");
+    if ( sys::read_file(path, buf, sizeof(buf)) > 0 ) {
+      b.cg_io_rbytes = __impl::__io_sum(buf, "rbytes=");
+      b.cg_io_wbytes = __impl::__io_sum(buf, "wbytes=");
+    }
+  }
+
+  // closes the counters, empties and removes the cgroup
+  void
+  destroy(void)
+  {
+    delete[] events;
+    events = nullptr;
+    n_events = 0;
+    if ( dir_fd >= 0 ) micron::close(dir_fd);
+    dir_fd = -1;
+    if ( !made ) return;
+    if ( populated() ) {
+      kill();
+      wait_empty(bbench::__impl::__now_ns() + 100'000'000ull);
+    }
+    // zombies reparented to init can hold the cgroup for a moment
+    for ( int tries = 0; tries < 50; ++tries ) {
+      if ( micron::syscall(SYS_unlinkat, __impl::__at_fdcwd, dir, __impl::__at_removedir) == 0 ) break;
+      bbench::__impl::__sleep_ms(2);
+    }
+    made = false;
+  }
+};
+
+// checks up front what --cgroup will be able to do; writes a one-line explanation of the first
+// problem into why and returns false if cgroup runs are impossible. a usable setup can still
+// lack memory/io accounting or cgroup counters: *limits then says so
+inline bool
+probe(char *why, usize cap, char *limits, usize lcap)
+{
+  why[0] = '\0';
+  limits[0] = '\0';
+  char self[512];
+  usize n = 0;
+  if ( !__impl::__self_dir(self, sizeof(self)) ) {
+    __impl::__append(why, cap, n, "no cgroup v2 hierarchy (is the unified hierarchy mounted at /sys/fs/cgroup?)");
+    return false;
+  }
+  run r;
+  if ( !r.create() ) {
+    __impl::__append(why, cap, n, "cannot create a cgroup under ");
+    __impl::__append(why, cap, n, self);
+    __impl::__append(why, cap, n, " (not delegated to this user; try systemd-run --user --scope -p Delegate=yes)");
+    return false;
+  }
+  char procs[600];
+  __impl::__leaf(procs, sizeof(procs), r.path(), "cgroup.procs");
+  if ( micron::syscall(SYS_faccessat, __impl::__at_fdcwd, procs, 2 /* W_OK */, 0) < 0 ) {
+    __impl::__append(why, cap, n, "cannot move processes into ");
+    __impl::__append(why, cap, n, r.path());
+    return false;
+  }
+
+  usize ln = 0;
+  char ctrl[600];
+  char buf[256];
+  __impl::__leaf(ctrl, sizeof(ctrl), r.path(), "cgroup.controllers");
+  sys::read_file(ctrl, buf, sizeof(buf));
+  const char *missing[2] = { nullptr, nullptr };
+  if ( !__impl::__has_word(buf, "memory") ) missing[0] = "memory";
+  if ( !__impl::__has_word(buf, "io") ) missing[1] = "io";
+  for ( const char *m : missing ) {
+    if ( !m ) continue;
+    __impl::__append(limits, lcap, ln, ln ? ", " : "");
+    __impl::__append(limits, lcap, ln, m);
+    __impl::__append(limits, lcap, ln, m[0] == 'm' ? ".* unavailable" : ".stat unavailable");
+  }
+  if ( ln ) __impl::__append(limits, lcap, ln, " (controller not enabled for the parent cgroup)");
+  if ( !r.open_counters(true) ) {
+    __impl::__append(limits, lcap, ln, ln ? "; " : "");
+    __impl::__append(limits, lcap, ln, r.counters_error());
+    __impl::__append(limits, lcap, ln, ", using per-pid counters");
+  }
+  return true;
+}
+
+};     // namespace bbench::cgroup
@@ -0,0 +1,259 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+#include "funcs.hpp"
+
+// level shifts in an ordered run sequence (a host that throttles halfway through -n 100): binary
+// segmentation on the Gaussian mean-shift cost, split while the gain beats a BIC penalty of
+// 2 sigma^2 ln n, with sigma taken from the MAD of successive differences so the shifts themselves
+// don't inflate it. run on time and on cycles / ref-cycles (the effective clock relative to
+// nominal); the stable segment is the longest stretch neither series breaks
+namespace bbench::changepoint
+{
+
+struct rule {
+  usize min_len = 3;          // shortest segment
+  double min_shift = 0.02;    // ignore level changes under 2% of the overall level
+};
+
+struct segment {
+  usize begin, end;     // runs [begin, end)
+  double level;         // mean of the series over them
+};
+
+// per-run bits
+constexpr u8 time_shift = 0x1;     // time level differs from the stable segment's
+constexpr u8 freq_shift = 0x2;     // clock ratio level differs from the stable segment's
+constexpr u8 migrated = 0x4;       // the run moved between cpus
+
+struct analysis {
+  micron::vector<segment> time;
+  micron::vector<segment> freq;     // empty when ref-cycles weren't counted
+  micron::vector<usize> cuts;       // both series' boundaries, ascending: first run of each new segment
+  usize stable_begin = 0, stable_end = 0;
+  micron::vector<u8> flags;
+  usize flagged = 0;
+
+  bool
+  shifted(void) const
+  {
+    return cuts.size() > 0;
+  }
+};
+
+namespace __impl
+{
+
+inline double
+__median(double *v, usize n)
+{
+  usize lo = 0, hi = n, k = n / 2;
+  while ( hi - lo > 1 ) {
+    const double p = v[lo + (hi - lo) / 2];
+    usize i = lo, j = hi - 1;
+    while ( i <= j ) {
+      while ( v[i] < p ) ++i;
+      while ( v[j] > p ) --j;
+      if ( i <= j ) {
+        const double t = v[i];
+        v[i] = v[j];
+        v[j] = t;
+        ++i;
+        if ( j == 0 ) break;
+        --j;
+      }
+    }
+    if ( k <= j )
+      hi = j + 1;
+    else if ( k >= i )
+      lo = i;
+    else
+      break;
+  }
+  return v[k];
+}
+
+// sigma^2 of the noise, robust to level shifts: MAD of x[i+1] - x[i], scaled to a normal sigma
+inline double
+__noise(const double *x, usize n)
+{
+  if ( n < 3 ) return 0.0;
+  micron::vector<double> d;
+  d.reserve(n - 1);
+  for ( usize i = 0; i + 1 < n; ++i ) d.push_back(x[i + 1] > x[i] ? x[i + 1] - x[i] : x[i] - x[i + 1]);
+  const double s = 1.4826 * __median(&d[0], n - 1);
+  return s * s / 2.0;     // a difference has twice the variance of one run
+}
+
+inline double
+__abs(double x)
+{
+  return x < 0 ? -x : x;
+}
+
+// prefix sums of the centred series; cost(a, b) is the squared deviation from the segment mean
+struct __prefix {
+  micron::vector<double> s1, s2;
+
+  __prefix(const double *x, usize n, double centre)
+  {
+    s1.reserve(n + 1);
+    s2.reserve(n + 1);
+    s1.push_back(0.0);
+    s2.push_back(0.0);
+    for ( usize i = 0; i < n; ++i ) {
+      const double y = x[i] - centre;
+      s1.push_back(s1[i] + y);
+      s2.push_back(s2[i] + y * y);
+    }
+  }
+
+  double
+  mean(usize a, usize b) const
+  {
+    return (s1[b] - s1[a]) / static_cast<double>(b - a);
+  }
+
+  double
+  cost(usize a, usize b) const
+  {
+    const double s = s1[b] - s1[a];
+    return s2[b] - s2[a] - s * s / static_cast<double>(b - a);
+  }
+};
+
+inline void
+__sort(micron::vector<usize> &v)
+{
+  for ( usize i = 1; i < v.size(); ++i )
+    for ( usize j = i; j > 0 && v[j] < v[j - 1]; --j ) {
+      const usize t = v[j];
+      v[j] = v[j - 1];
+      v[j - 1] = t;
+    }
+}
+
+};     // namespace __impl
+
+// segments of x[0, n), in order; one segment covering everything when nothing shifted
+inline void
+segments(const double *x, usize n, const rule &r, micron::vector<segment> &out)
+{
+  if ( n == 0 ) return;
+  double centre = 0.0;
+  for ( usize i = 0; i < n; ++i ) centre += x[i];
+  centre /= static_cast<double>(n);
+  const __impl::__prefix ps(x, n, centre);
+  double ln = 0.0;     // ln n without libm: sum of 1/k is ln n + 0.577 within 1/2n
+  for ( usize k = 1; k <= n; ++k ) ln += 1.0 / static_cast<double>(k);
+  ln -= 0.5772156649;
+  const double penalty = 2.0 * __impl::__noise(x, n) * (ln > 0.0 ? ln : 0.0);
+  const double floor = r.min_shift * __impl::__abs(centre);
+  const usize min_len = r.min_len ? r.min_len : 1;
+
+  micron::vector<usize> cuts;
+  micron::vector<usize> todo;     // pending [a, b) pairs
+  todo.push_back(0);
+  todo.push_back(n);
+  for ( usize t = 0; t + 1 < todo.size(); t += 2 ) {
+    const usize a = todo[t], b = todo[t + 1];
+    if ( b - a < 2 * min_len ) continue;
+    const double whole = ps.cost(a, b);
+    double best = 0.0;
+    usize at = 0;
+    for ( usize k = a + min_len; k + min_len <= b; ++k ) {
+      const double gain = whole - ps.cost(a, k) - ps.cost(k, b);
+      if ( gain > best ) {
+        best = gain;
+        at = k;
+      }
+    }
+    if ( !at || best <= penalty ) continue;
+    if ( __impl::__abs(ps.mean(a, at) - ps.mean(at, b)) <= floor ) continue;
+    cuts.push_back(at);
+    todo.push_back(a);
+    todo.push_back(at);
+    todo.push_back(at);
+    todo.push_back(b);
+  }
+  __impl::__sort(cuts);
+  usize a = 0;
+  for ( usize i = 0; i <= cuts.size(); ++i ) {
+    const usize b = i < cuts.size() ? cuts[i] : n;
+    out.push_back(segment{ a, b, ps.mean(a, b) + centre });
+    a = b;
+  }
+}
+
+// cycles per ref-cycle of one run: 1.0 at nominal clock, lower when throttled; 0 if not counted
+inline double
+freq_ratio(const benchmark_t &b)
+{
+  return b.total_cycles > 0 ? static_cast<double>(b.cycles) / static_cast<double>(b.total_cycles) : 0.0;
+}
+
+template <typename V>
+inline analysis
+analyze(const V &runs, const rule &r = rule{})
+{
+  analysis a;
+  const usize n = runs.size();
+  if ( n == 0 ) return a;
+  micron::vector<double> x;
+  x.reserve(n);
+  for ( usize i = 0; i < n; ++i ) x.push_back(runs[i].time);
+  segments(&x[0], n, r, a.time);
+  bool have_ref = true;
+  for ( usize i = 0; i < n; ++i ) {
+    x[i] = freq_ratio(runs[i]);
+    if ( x[i] == 0.0 ) have_ref = false;
+  }
+  if ( have_ref ) segments(&x[0], n, r, a.freq);
+
+  for ( usize i = 1; i < a.time.size(); ++i ) a.cuts.push_back(a.time[i].begin);
+  for ( usize i = 1; i < a.freq.size(); ++i ) {
+    bool dup = false;
+    for ( usize c = 0; c < a.cuts.size(); ++c )
+      if ( a.cuts[c] == a.freq[i].begin ) dup = true;
+    if ( !dup ) a.cuts.push_back(a.freq[i].begin);
+  }
+  __impl::__sort(a.cuts);
+
+  // longest uncut stretch; on a tie the later one, past any warm-up
+  usize from = 0;
+  for ( usize i = 0; i <= a.cuts.size(); ++i ) {
+    const usize to = i < a.cuts.size() ? a.cuts[i] : n;
+    if ( to - from >= a.stable_end - a.stable_begin ) {
+      a.stable_begin = from;
+      a.stable_end = to;
+    }
+    from = to;
+  }
+
+  auto level_at = [](const micron::vector<segment> &s, usize run) {
+    for ( const segment &g : s )
+      if ( run >= g.begin && run < g.end ) return g.level;
+    return 0.0;
+  };
+  const double t0 = level_at(a.time, a.stable_begin);
+  const double f0 = level_at(a.freq, a.stable_begin);
+  a.flags.reserve(n);
+  for ( usize i = 0; i < n; ++i ) {
+    u8 f = 0;
+    if ( __impl::__abs(level_at(a.time, i) - t0) > r.min_shift * __impl::__abs(t0) ) f |= time_shift;
+    if ( have_ref && __impl::__abs(level_at(a.freq, i) - f0) > r.min_shift * f0 ) f |= freq_shift;
+    if ( runs[i].migrations > 0 ) f |= migrated;
+    a.flags.push_back(f);
+    if ( f ) ++a.flagged;
+  }
+  return a;
+}
+
+};     // namespace bbench::changepoint
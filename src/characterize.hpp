@@ -0,0 +1,359 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/memory/cmemory.hpp>
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+#include "bench.hpp"
+#include "format.hpp"
+#include "sysfs.hpp"
+
+// machine characterization suite (bbench --characterize)
+//
+//  -> pointer-chase load latency over working-set sizes, L1/L2/LLC/DRAM knees
+//  -> STREAM copy/scale/add/triad bandwidth per thread count
+//  -> integer / fp throughput per cycle
+//
+// the result is written as a key=value machine profile that later runs reference by id
+namespace bbench::characterize
+{
+
+using chase_group = event_group<hardware_cycles, hardware_instructions, level1d_miss, llcache_miss>;
+using kernel_group = event_group<hardware_cycles, hardware_instructions>;
+
+struct latency_point {
+  usize bytes;
+  double ns_per_load;
+  double cycles_per_load;
+  double l1d_miss_per_load;
+  double llc_miss_per_load;
+};
+
+struct bandwidth_point {
+  u32 threads;
+  double copy_gbs;
+  double scale_gbs;
+  double add_gbs;
+  double triad_gbs;
+};
+
+struct machine_profile {
+  sys::host_info host;
+  u64 id;
+  micron::vector<latency_point> latency;
+  micron::vector<bandwidth_point> bandwidth;
+  usize cache_bytes[3];     // detected L1 / L2 / LLC capacity, 0 if no knee was found
+  double cache_ns[3];
+  double dram_ns;
+  double int_ops_per_cycle;
+  double fp_ops_per_cycle;
+};
+
+struct config {
+  usize min_bytes = 4u << 10;
+  usize max_bytes = 256u << 20;
+  usize chase_steps = 1u << 21;
+  usize stream_elems = 1u << 23;     // per array, 64 MiB of doubles
+  u32 stream_reps = 5;
+  u32 max_threads = 0;               // 0 = all online cpus
+};
+
+namespace __impl
+{
+
+struct alignas(64) __node {
+  __node *next;
+  char pad[64 - sizeof(__node *)];
+};
+
+inline u64
+__next_rand(u64 &s)
+{
+  s ^= s >> 12;
+  s ^= s << 25;
+  s ^= s >> 27;
+  return s * 0x2545f4914f6cdd1dull;
+}
+
+// Sattolo's algorithm: a single random cycle through every line, so the prefetchers can't follow it
+inline void
+__build_chain(__node *nodes, usize n, u64 seed)
+{
+  usize *perm = new usize[n];
+  for ( usize i = 0; i < n; ++i ) perm[i] = i;
+  for ( usize i = n - 1; i > 0; --i ) {
+    usize j = static_cast<usize>(__next_rand(seed) % i);
+    usize t = perm[i];
+    perm[i] = perm[j];
+    perm[j] = t;
+  }
+  for ( usize i = 0; i < n; ++i ) nodes[perm[i]].next = &nodes[perm[(i + 1) % n]];
+  delete[] perm;
+}
+
+inline __attribute__((noinline)) __node *
+__chase(__node *p, usize steps)
+{
+  for ( usize i = 0; i < steps; ++i ) p = p->next;
+  asm volatile("" : "+r"(p));
+  return p;
+}
+
+};     // namespace __impl
+
+inline latency_point
+measure_latency(usize bytes, usize steps)
+{
+  latency_point pt{ bytes, 0, 0, 0, 0 };
+  const usize n = bytes / sizeof(__impl::__node);
+  if ( n < 2 ) return pt;
+  __impl::__node *nodes = new __impl::__node[n];
+  __impl::__build_chain(nodes, n, 0x9e3779b97f4a7c15ull ^ bytes);
+  __impl::__node *p = __impl::__chase(&nodes[0], n);     // warm: touch every line once
+  benchmark_t b = benchmark<time_resolution::ns, chase_group>([&]() { p = __impl::__chase(p, steps); });
+  delete[] nodes;
+
+  const double s = static_cast<double>(steps);
+  pt.ns_per_load = b.time / s;
+  pt.cycles_per_load = static_cast<double>(b.cycles) / s;
+  pt.l1d_miss_per_load = static_cast<double>(b.l1d_miss) / s;
+  pt.llc_miss_per_load = static_cast<double>(b.llcache_miss) / s;
+  return pt;
+}
+
+// a knee is the last size before latency rises by more than 40% over the plateau it sits on. the
+// plateau is the mean of every size since the last knee, so a slow climb across many sizes (a
+// prefetcher giving up bit by bit) still adds up to a knee instead of being compared step by step
+inline void
+detect_knees(machine_profile &mp)
+{
+  for ( usize k = 0; k < 3; ++k ) {
+    mp.cache_bytes[k] = 0;
+    mp.cache_ns[k] = 0.0;
+  }
+  mp.dram_ns = 0.0;
+  if ( mp.latency.size() == 0 ) return;
+  usize level = 0;
+  double sum = mp.latency[0].ns_per_load;
+  usize count = 1;
+  for ( usize i = 1; i < mp.latency.size() && level < 3; ++i ) {
+    const double cur = mp.latency[i].ns_per_load;
+    const double plateau = sum / static_cast<double>(count);
+    if ( plateau > 0.0 && cur > plateau * 1.4 ) {
+      mp.cache_bytes[level] = mp.latency[i - 1].bytes;
+      mp.cache_ns[level] = plateau;
+      ++level;
+      sum = 0.0;
+      count = 0;
+    }
+    sum += cur;
+    ++count;
+  }
+  mp.dram_ns = mp.latency[mp.latency.size() - 1].ns_per_load;
+}
+
+inline bandwidth_point
+measure_bandwidth(u32 threads, usize n, u32 reps)
+{
+  bandwidth_point bp{ threads, 0, 0, 0, 0 };
+  double *a = new double[n];
+  double *b = new double[n];
+  double *c = new double[n];
+  const int nt = static_cast<int>(threads);
+  const long ln = static_cast<long>(n);
+
+#pragma omp parallel for num_threads(nt) schedule(static)
+  for ( long i = 0; i < ln; ++i ) {
+    a[i] = 1.0;
+    b[i] = 2.0;
+    c[i] = 0.0;
+  }
+
+  double best[4] = { 1e300, 1e300, 1e300, 1e300 };
+  const double q = 3.0;
+  for ( u32 r = 0; r < reps; ++r ) {
+    double t;
+    t = bench<time_resolution::sec>([&]() {
+#pragma omp parallel for num_threads(nt) schedule(static)
+      for ( long i = 0; i < ln; ++i ) c[i] = a[i];
+    });
+    if ( t < best[0] ) best[0] = t;
+    t = bench<time_resolution::sec>([&]() {
+#pragma omp parallel for num_threads(nt) schedule(static)
+      for ( long i = 0; i < ln; ++i ) b[i] = q * c[i];
+    });
+    if ( t < best[1] ) best[1] = t;
+    t = bench<time_resolution::sec>([&]() {
+#pragma omp parallel for num_threads(nt) schedule(static)
+      for ( long i = 0; i < ln; ++i ) c[i] = a[i] + b[i];
+    });
+    if ( t < best[2] ) best[2] = t;
+    t = bench<time_resolution::sec>([&]() {
+#pragma omp parallel for num_threads(nt) schedule(static)
+      for ( long i = 0; i < ln; ++i ) a[i] = b[i] + q * c[i];
+    });
+    if ( t < best[3] ) best[3] = t;
+  }
+  delete[] a;
+  delete[] b;
+  delete[] c;
+
+  const double w = static_cast<double>(sizeof(double)) * static_cast<double>(n) / 1e9;
+  bp.copy_gbs = best[0] > 0 ? 2.0 * w / best[0] : 0.0;
+  bp.scale_gbs = best[1] > 0 ? 2.0 * w / best[1] : 0.0;
+  bp.add_gbs = best[2] > 0 ? 3.0 * w / best[2] : 0.0;
+  bp.triad_gbs = best[3] > 0 ? 3.0 * w / best[3] : 0.0;
+  return bp;
+}
+
+// eight independent dependency chains, enough to cover multiply / fma latency on current cores
+inline double
+measure_int_throughput(usize iters)
+{
+  u64 x[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  benchmark_t b = benchmark<time_resolution::ns, kernel_group>([&]() {
+    for ( usize i = 0; i < iters; ++i ) {
+      for ( usize k = 0; k < 8; ++k ) x[k] = x[k] * 0x9e3779b97f4a7c15ull + k;
+      asm volatile("" : "+r"(x[0]), "+r"(x[1]), "+r"(x[2]), "+r"(x[3]), "+r"(x[4]), "+r"(x[5]), "+r"(x[6]), "+r"(x[7]));
+    }
+  });
+  return b.cycles > 0 ? 16.0 * static_cast<double>(iters) / static_cast<double>(b.cycles) : 0.0;
+}
+
+inline double
+measure_fp_throughput(usize iters)
+{
+  double x[8] = { 1.0, 1.1, 1.2, 1.3, 1.4, 1.5, 1.6, 1.7 };
+  benchmark_t b = benchmark<time_resolution::ns, kernel_group>([&]() {
+    for ( usize i = 0; i < iters; ++i ) {
+      for ( usize k = 0; k < 8; ++k ) x[k] = x[k] * 0.999999 + 1e-7;
+      asm volatile("" : "+x"(x[0]), "+x"(x[1]), "+x"(x[2]), "+x"(x[3]), "+x"(x[4]), "+x"(x[5]), "+x"(x[6]), "+x"(x[7]));
+    }
+  });
+  return b.cycles > 0 ? 16.0 * static_cast<double>(iters) / static_cast<double>(b.cycles) : 0.0;
+}
+
+inline machine_profile
+run(const config &cfg = {})
+{
+  machine_profile mp{};
+  mp.host = sys::query_host();
+  mp.id = sys::fnv1a(mp.host.hostname, sys::host_fingerprint(mp.host)) & 0x7fffffffffffffffull;
+
+  for ( usize sz = cfg.min_bytes; sz <= cfg.max_bytes; sz *= 2 ) mp.latency.push_back(measure_latency(sz, cfg.chase_steps));
+  detect_knees(mp);
+
+  const u32 max_t = cfg.max_threads ? cfg.max_threads : mp.host.cpus;
+  for ( u32 t = 1; t <= max_t; t *= 2 ) mp.bandwidth.push_back(measure_bandwidth(t, cfg.stream_elems, cfg.stream_reps));
+  if ( mp.bandwidth.size() && mp.bandwidth[mp.bandwidth.size() - 1].threads != max_t )
+    mp.bandwidth.push_back(measure_bandwidth(max_t, cfg.stream_elems, cfg.stream_reps));
+
+  mp.int_ops_per_cycle = measure_int_throughput(1u << 24);
+  mp.fp_ops_per_cycle = measure_fp_throughput(1u << 24);
+  return mp;
+}
+
+inline void
+__kv(const format::sink &out, const char *k, const char *v)
+{
+  out.emit(k);
+  out.emit("=");
+  out.emit(v);
+  out.newline();
+}
+
+inline void
+__kv(const format::sink &out, const char *k, double v)
+{
+  out.emit(k);
+  out.emit("=");
+  out.emit_double(v);
+  out.newline();
+}
+
+inline void
+__kv(const format::sink &out, const char *k, long long v)
+{
+  out.emit(k);
+  out.emit("=");
+  out.emit_int(v);
+  out.newline();
+}
+
+// key=value lines; summary keys first so load_profile() only has to scan the head
+inline void
+save_profile(const format::sink &out, const machine_profile &mp)
+{
+  __kv(out, "id", static_cast<long long>(mp.id));
+  __kv(out, "hostname", mp.host.hostname);
+  __kv(out, "cpu_model", mp.host.cpu_model);
+  __kv(out, "kernel", mp.host.kernel);
+  __kv(out, "governor", mp.host.governor);
+  __kv(out, "cpus", static_cast<long long>(mp.host.cpus));
+  __kv(out, "l1_bytes", static_cast<long long>(mp.cache_bytes[0]));
+  __kv(out, "l2_bytes", static_cast<long long>(mp.cache_bytes[1]));
+  __kv(out, "llc_bytes", static_cast<long long>(mp.cache_bytes[2]));
+  __kv(out, "l1_ns", mp.cache_ns[0]);
+  __kv(out, "l2_ns", mp.cache_ns[1]);
+  __kv(out, "llc_ns", mp.cache_ns[2]);
+  __kv(out, "dram_ns", mp.dram_ns);
+  __kv(out, "int_ops_per_cycle", mp.int_ops_per_cycle);
+  __kv(out, "fp_ops_per_cycle", mp.fp_ops_per_cycle);
+  if ( mp.bandwidth.size() ) {
+    __kv(out, "triad_gbs_1t", mp.bandwidth[0].triad_gbs);
+    __kv(out, "triad_gbs_max", mp.bandwidth[mp.bandwidth.size() - 1].triad_gbs);
+  }
+  for ( const auto &pt : mp.latency ) {
+    out.emit("latency.");
+    out.emit_int(static_cast<long long>(pt.bytes));
+    out.emit("=");
+    out.emit_double(pt.ns_per_load);
+    out.emit(",");
+    out.emit_double(pt.cycles_per_load);
+    out.newline();
+  }
+  for ( const auto &bp : mp.bandwidth ) {
+    out.emit("stream.");
+    out.emit_int(static_cast<long long>(bp.threads));
+    out.emit("=");
+    out.emit_double(bp.copy_gbs);
+    out.emit(",");
+    out.emit_double(bp.scale_gbs);
+    out.emit(",");
+    out.emit_double(bp.add_gbs);
+    out.emit(",");
+    out.emit_double(bp.triad_gbs);
+    out.newline();
+  }
+}
+
+// summary of a saved profile, enough for a result to reference and normalize against
+struct profile_ref {
+  u64 id = 0;
+  char hostname[64] = {};
+  double dram_ns = 0.0;
+  double triad_gbs_1t = 0.0;
+  bool valid = false;
+};
+
+inline profile_ref
+load_profile(const char *path)
+{
+  profile_ref r{};
+  char buf[2048];
+  if ( sys::read_file(path, buf, sizeof(buf)) <= 0 ) return r;
+  const char *p = sys::find_key(buf, "id=");
+  if ( !p || !sys::parse_u64(p, r.id) ) return r;
+  if ( (p = sys::find_key(buf, "hostname=")) ) sys::copy_line(r.hostname, sizeof(r.hostname), p);
+  if ( (p = sys::find_key(buf, "dram_ns=")) ) sys::parse_double(p, r.dram_ns);
+  if ( (p = sys::find_key(buf, "triad_gbs_1t=")) ) sys::parse_double(p, r.triad_gbs_1t);
+  r.valid = true;
+  return r;
+}
+
+};     // namespace bbench::characterize
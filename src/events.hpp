@@ -189,6 +189,17 @@ struct dynamic_event {
       micron::close(e_fd);
     return open(pid);
   }
+  int open_cgroup(int cgroup_fd, int cpu) {
+    e_fd = static_cast<int>(perf_event_cgroup(attr, cgroup_fd, cpu));
+    if (e_fd == -1) {
+      last_errno = errno;
+      valid = false;
+      return -1;
+    }
+    last_errno = 0;
+    valid = true;
+    return e_fd;
+  }
 
   inline __attribute__((always_inline)) void begin(void) {
     if (!valid)
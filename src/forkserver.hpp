@@ -0,0 +1,361 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/linux/io.hpp>
+#include <micron/linux/sys/fcntl.hpp>
+#include <micron/memory/cmemory.hpp>
+#include <micron/proc.hpp>
+#include <micron/syscall.hpp>
+#include <micron/types.hpp>
+
+#include "process.hpp"
+
+// pre-spawned launcher for repeated binary runs
+//
+// fork cost grows with the parent's page tables; a helper forked while bbench is still small
+// keeps it constant. the helper receives launch requests over a SOCK_SEQPACKET socketpair (stdio
+// fds travel as SCM_RIGHTS), forks + parks the child exactly like process_attach, and hands the
+// child's sync-pipe write end back, so counters are still attached before exec and
+// enable_on_exec behaves the same. the helper reaps the child with wait4 and returns its rusage.
+//
+// the helper serves one launch at a time; concurrent callers (-j) use process_attach directly
+namespace bbench::forkserver
+{
+
+namespace __impl
+{
+
+struct __iovec {
+  void *base;
+  usize len;
+};
+
+// kernel user_msghdr / cmsghdr layouts
+struct __msghdr {
+  void *name;
+  int namelen;
+  __iovec *iov;
+  usize iovlen;
+  void *control;
+  usize controllen;
+  unsigned flags;
+};
+
+struct __cmsghdr {
+  usize len;
+  int level;
+  int type;
+};
+
+inline constexpr int __af_unix = 1;
+inline constexpr int __sock_seqpacket = 5;
+inline constexpr int __sock_cloexec = 02000000;
+inline constexpr int __sol_socket = 1;
+inline constexpr int __scm_rights = 1;
+inline constexpr int __msg_cmsg_cloexec = 0x40000000;
+inline constexpr usize __max_msg = 64u << 10;
+
+struct __req_hdr {
+  u32 argc;     // argv entries after the path, argv[0] included
+  u32 envc;
+  i32 cpu;
+  u8 has_env;
+  u8 has_fd[3];     // stdin / stdout / stderr present, in SCM_RIGHTS order
+};
+
+struct __launch_reply {
+  i32 pid;
+  i32 err;
+};
+
+struct __exit_reply {
+  i32 status;
+  rusage_t ru;
+};
+
+inline long
+__sendmsg(int sock, const void *data, usize len, const int *fds, usize nfds)
+{
+  __iovec iov{ const_cast<void *>(data), len };
+  alignas(8) char ctl[sizeof(__cmsghdr) + 4 * sizeof(int)] = {};
+  __msghdr m{};
+  m.iov = &iov;
+  m.iovlen = 1;
+  if ( nfds ) {
+    __cmsghdr *c = reinterpret_cast<__cmsghdr *>(ctl);
+    c->len = sizeof(__cmsghdr) + nfds * sizeof(int);
+    c->level = __sol_socket;
+    c->type = __scm_rights;
+    micron::memcpy(ctl + sizeof(__cmsghdr), fds, nfds * sizeof(int));
+    m.control = ctl;
+    m.controllen = sizeof(__cmsghdr) + ((nfds * sizeof(int) + 7) & ~usize(7));
+  }
+  return micron::syscall(SYS_sendmsg, sock, &m, 0);
+}
+
+// returns bytes received; *nfds is in: capacity, out: received
+inline long
+__recvmsg(int sock, void *data, usize len, int *fds, usize *nfds)
+{
+  __iovec iov{ data, len };
+  alignas(8) char ctl[sizeof(__cmsghdr) + 4 * sizeof(int)] = {};
+  __msghdr m{};
+  m.iov = &iov;
+  m.iovlen = 1;
+  m.control = ctl;
+  m.controllen = sizeof(ctl);
+  long r = micron::syscall(SYS_recvmsg, sock, &m, __msg_cmsg_cloexec);
+  usize got = 0;
+  if ( r >= 0 && nfds && m.controllen >= sizeof(__cmsghdr) ) {
+    const __cmsghdr *c = reinterpret_cast<const __cmsghdr *>(ctl);
+    if ( c->level == __sol_socket && c->type == __scm_rights ) {
+      got = (c->len - sizeof(__cmsghdr)) / sizeof(int);
+      if ( got > *nfds ) got = *nfds;
+      micron::memcpy(fds, ctl + sizeof(__cmsghdr), got * sizeof(int));
+    }
+  }
+  if ( nfds ) *nfds = got;
+  return r;
+}
+
+// helper main loop; never returns
+[[noreturn]] inline void
+__serve(int sock)
+{
+  micron::syscall(SYS_prctl, 1 /* PR_SET_PDEATHSIG */, 9 /* SIGKILL */, 0, 0, 0);
+  char *buf = new char[__max_msg];
+  for ( ;; ) {
+    int fds[3] = { -1, -1, -1 };
+    usize nfds = 3;
+    long n = __recvmsg(sock, buf, __max_msg - 1, fds, &nfds);
+    if ( n <= static_cast<long>(sizeof(__req_hdr)) ) micron::posix::exit(0);
+    buf[n] = '\0';
+
+    __req_hdr h;
+    micron::memcpy(&h, buf, sizeof(h));
+    const char *end = buf + n;
+    const char *path = buf + sizeof(h);
+
+    launch_spec ls{};
+    ls.path = path;
+    ls.cpu = h.cpu;
+    usize fi = 0;
+    if ( h.has_fd[0] ) ls.stdin_fd = fi < nfds ? fds[fi++] : -1;
+    if ( h.has_fd[1] ) ls.stdout_fd = fi < nfds ? fds[fi++] : -1;
+    if ( h.has_fd[2] ) ls.stderr_fd = fi < nfds ? fds[fi++] : -1;
+
+    // strings: path, argv[0..argc), env[0..envc); rebuilt as [argv..., NULL, env..., NULL]
+    const char **vec = new const char *[h.argc + h.envc + 2];
+    usize vi = 0;
+    const char *p = path;
+    while ( p < end && *p ) ++p;
+    ++p;
+    for ( u32 i = 0; i < h.argc && p < end; ++i ) {
+      vec[vi++] = p;
+      while ( p < end && *p ) ++p;
+      ++p;
+    }
+    vec[vi++] = nullptr;
+    const usize env_at = vi;
+    for ( u32 i = 0; i < h.envc && p < end; ++i ) {
+      vec[vi++] = p;
+      while ( p < end && *p ) ++p;
+      ++p;
+    }
+    vec[vi] = nullptr;
+    ls.argv = vec;
+    ls.envp = h.has_env ? vec + env_at : nullptr;
+
+    __launch_reply rep{ -1, 0 };
+    int sync_pipe[2];
+    if ( micron::pipe2(sync_pipe, micron::posix::o_cloexec) < 0 ) {
+      rep.err = errno;
+      __sendmsg(sock, &rep, sizeof(rep), nullptr, 0);
+    } else {
+      micron::pid_t pid = micron::fork();
+      if ( pid == 0 ) {
+        micron::close(sock);
+        micron::close(sync_pipe[1]);
+        char c = 0;
+        micron::posix::read(sync_pipe[0], &c, 1);
+        micron::close(sync_pipe[0]);
+        bbench::__impl::__child_stdio(ls);
+        bbench::__impl::__child_affinity(ls.cpu);
+        char **envp = ls.envp ? const_cast<char **>(ls.envp) : environ;
+        micron::posix::execve(ls.path, const_cast<char **>(ls.argv), envp);
+        micron::posix::exit(127);
+      }
+      micron::close(sync_pipe[0]);
+      rep.pid = static_cast<i32>(pid);
+      if ( pid < 0 ) rep.err = errno;
+      __sendmsg(sock, &rep, sizeof(rep), pid > 0 ? &sync_pipe[1] : nullptr, pid > 0 ? 1 : 0);
+      micron::close(sync_pipe[1]);
+      if ( pid > 0 ) {
+        __exit_reply ex{};
+        bbench::__impl::__wait4(pid, &ex.status, 0, &ex.ru);
+        __sendmsg(sock, &ex, sizeof(ex), nullptr, 0);
+      }
+    }
+    for ( usize i = 0; i < nfds; ++i ) micron::close(fds[i]);
+    delete[] vec;
+  }
+}
+
+inline bool
+__append(char *buf, usize &at, const char *s)
+{
+  const usize n = micron::strlen(s) + 1;
+  if ( at + n > __max_msg ) return false;
+  micron::memcpy(buf + at, s, n);
+  at += n;
+  return true;
+}
+
+};     // namespace __impl
+
+struct server {
+  int sock = -1;
+  int pid = -1;
+  char *buf = nullptr;
+
+  bool
+  running(void) const
+  {
+    return sock >= 0;
+  }
+
+  // fork the helper; call early, before the parent grows
+  bool
+  start(void)
+  {
+    if ( sock >= 0 ) return true;
+    int sv[2];
+    if ( micron::syscall(SYS_socketpair, __impl::__af_unix, __impl::__sock_seqpacket | __impl::__sock_cloexec, 0, sv) < 0 ) return false;
+    micron::pid_t p = micron::fork();
+    if ( p < 0 ) {
+      micron::close(sv[0]);
+      micron::close(sv[1]);
+      return false;
+    }
+    if ( p == 0 ) {
+      micron::close(sv[0]);
+      __impl::__serve(sv[1]);
+    }
+    micron::close(sv[1]);
+    sock = sv[0];
+    pid = static_cast<int>(p);
+    buf = new char[__impl::__max_msg];
+    return true;
+  }
+
+  void
+  stop(void)
+  {
+    if ( sock < 0 ) return;
+    micron::close(sock);     // helper sees EOF and exits
+    bbench::__impl::__wait4(pid, nullptr, 0, nullptr);
+    sock = -1;
+    pid = -1;
+    delete[] buf;
+    buf = nullptr;
+  }
+
+  ~server() { stop(); }
+
+  // same contract as process_attach: attach_fn(pid) runs while the child is parked before exec
+  template <typename F>
+  int
+  launch(const launch_spec &ls, F &&attach_fn)
+  {
+    __impl::__req_hdr h{};
+    usize at = sizeof(h);
+    if ( !__impl::__append(buf, at, ls.path) ) return -1;
+    if ( ls.argv ) {
+      for ( const char *const *a = ls.argv; *a; ++a, ++h.argc )
+        if ( !__impl::__append(buf, at, *a) ) return -1;
+    } else {
+      if ( !__impl::__append(buf, at, ls.path) ) return -1;
+      h.argc = 1;
+    }
+    if ( ls.envp ) {
+      h.has_env = 1;
+      for ( const char *const *e = ls.envp; *e; ++e, ++h.envc )
+        if ( !__impl::__append(buf, at, *e) ) return -1;
+    }
+    h.cpu = ls.cpu;
+    int fds[3];
+    usize nfds = 0;
+    if ( ls.stdin_fd >= 0 ) {
+      h.has_fd[0] = 1;
+      fds[nfds++] = ls.stdin_fd;
+    }
+    if ( ls.stdout_fd >= 0 ) {
+      h.has_fd[1] = 1;
+      fds[nfds++] = ls.stdout_fd;
+    }
+    if ( ls.stderr_fd >= 0 ) {
+      h.has_fd[2] = 1;
+      fds[nfds++] = ls.stderr_fd;
+    }
+    micron::memcpy(buf, &h, sizeof(h));
+    if ( __impl::__sendmsg(sock, buf, at, fds, nfds) < 0 ) return -1;
+
+    __impl::__launch_reply rep{ -1, 0 };
+    int sync_fd = -1;
+    usize got = 1;
+    if ( __impl::__recvmsg(sock, &rep, sizeof(rep), &sync_fd, &got) <= 0 || rep.pid <= 0 || got != 1 ) {
+      if ( got == 1 ) micron::close(sync_fd);
+      return -1;
+    }
+    attach_fn(static_cast<int>(rep.pid));
+    char go = 'g';
+    micron::posix::write(sync_fd, &go, 1);
+    micron::close(sync_fd);
+    return static_cast<int>(rep.pid);
+  }
+
+  // waits for exit (pidfd works on non-children), killing on timeout; the rusage follows via collect()
+  void
+  wait_exit(int child, u32 timeout_ms, child_usage &cu)
+  {
+    const u64 deadline = timeout_ms ? bbench::__impl::__now_ns() + static_cast<u64>(timeout_ms) * 1'000'000ull : 0;
+    int pfd = bbench::__impl::__pidfd_open(child);
+    const int fd = pfd >= 0 ? pfd : sock;     // without pidfd, the helper's exit reply is the signal
+    if ( bbench::__impl::__poll_until(fd, deadline) == 0 ) {
+      cu.timed_out = true;
+      if ( pfd >= 0 )
+        bbench::__impl::__terminate(child, pfd);
+      else
+        micron::posix::kill(child, static_cast<int>(micron::signal::kill9));
+    }
+    if ( pfd >= 0 ) micron::close(pfd);
+  }
+
+  void
+  collect(child_usage &cu)
+  {
+    __impl::__exit_reply ex{};
+    if ( __impl::__recvmsg(sock, &ex, sizeof(ex), nullptr, nullptr) <= 0 ) return;
+    bbench::__impl::__fill_usage(cu, ex.ru, ex.status);
+  }
+};
+
+inline server &
+instance(void)
+{
+  static server s;
+  return s;
+}
+
+// bbench --fork-server: start right after argument parsing
+inline bool
+start(void)
+{
+  return instance().start();
+}
+
+};     // namespace bbench::forkserver
@@ -13,42 +13,64 @@
 #include <micron/string/conversions/floating_point.hpp>
 #include <micron/string/conversions/integral.hpp>
 #include <micron/string/string.hpp>
+#include <micron/syscall.hpp>
 #include <micron/types.hpp>
 #include <micron/vector.hpp>
 
+#include "changepoint.hpp"
 #include "events.hpp"
 #include "funcs.hpp"
 
 namespace bbench::format
 {
 
+// how a sink batches its writes: none (a write per fragment), line (flush at every '\n'), full
+// (flush when the buffer fills, on flush() and on destruction)
+enum class buffering : u8 { none, line, full };
+
+// output through a fixed buffer: fragments are copied in and go out in one writev with whatever is
+// pending, so a -ddd emit_human_one is a handful of syscalls instead of a hundred; a fragment too big
+// for the space left is not copied, it rides in the same writev as the second iovec. numbers are
+// formatted straight into the buffer. stdout and stderr are line-buffered, files fully
 struct sink {
+  static constexpr usize capacity = 8192;
+
   int fd = 1;
   bool owned = false;     // close in destructor
+  buffering mode = buffering::line;
+  mutable usize used = 0;
+  mutable bool failed = false;     // a write came up short; what follows it is lost
+  mutable char pending[capacity];
 
   sink() = default;
 
-  explicit sink(int fd_, bool own = false) : fd(fd_), owned(own) {}
+  explicit sink(int fd_, bool own = false, buffering b = buffering::full) : fd(fd_), owned(own), mode(b) {}
 
   sink(const sink &) = delete;
 
-  sink(sink &&o) noexcept : fd(o.fd), owned(o.owned) { o.owned = false; }
+  sink(sink &&o) noexcept : fd(o.fd), owned(o.owned), mode(o.mode)
+  {
+    o.flush();
+    failed = o.failed;
+    o.owned = false;
+  }
 
   ~sink()
   {
+    flush();
     if ( owned && fd != -1 ) micron::close(fd);
   }
 
   static sink
   stdout_sink(void)
   {
-    return sink(1, false);
+    return sink(1, false, buffering::line);
   }
 
   static sink
   stderr_sink(void)
   {
-    return sink(2, false);
+    return sink(2, false, buffering::line);
   }
 
   static sink
@@ -58,11 +80,43 @@ struct sink {
     return sink(f, true);
   }
 
+  // pending output goes out first; none for interactive use, where every fragment should show at once
+  void
+  set_buffering(buffering b)
+  {
+    flush();
+    mode = b;
+  }
+
+  void
+  flush(void) const
+  {
+    if ( used == 0 ) return;
+    __writev(pending, used, nullptr, 0);
+    used = 0;
+  }
+
   void
   emit(const char *s, usize n) const
   {
-    if ( fd < 0 ) return;
-    micron::posix::write(fd, s, n);
+    if ( fd < 0 || n == 0 ) return;
+    if ( mode == buffering::none ) {
+      __writev(s, n, nullptr, 0);
+      return;
+    }
+    if ( n > capacity - used ) {
+      __writev(pending, used, s, n);
+      used = 0;
+      return;
+    }
+    micron::memcpy(pending + used, s, n);
+    used += n;
+    if ( mode == buffering::line )
+      for ( usize i = 0; i < n; ++i )
+        if ( s[i] == '\n' ) {
+          flush();
+          break;
+        }
   }
 
   void
@@ -74,6 +128,10 @@ struct sink {
   void
   emit_int(long long v) const
   {
+    if ( mode != buffering::none && capacity - used >= 32 ) {
+      used += micron::format::__impl::fmt_int_to_buf(pending + used, 32, v, 10, false);
+      return;
+    }
     char buf[32];
     usize n = micron::format::__impl::fmt_int_to_buf(buf, sizeof(buf), v, 10, false);
     emit(buf, n);
@@ -82,6 +140,10 @@ struct sink {
   void
   emit_double(double v) const
   {
+    if ( mode != buffering::none && capacity - used >= 64 ) {
+      used += micron::__impl::__ryu::d2s_buffered(v, pending + used);
+      return;
+    }
     char buf[64];
     usize n = micron::__impl::__ryu::d2s_buffered(v, buf);
     emit(buf, n);
@@ -92,6 +154,43 @@ struct sink {
   {
     emit("\n", 1);
   }
+
+private:
+  struct __iovec {
+    const char *base;
+    usize len;
+  };
+
+  // a then b, in as few writev calls as the kernel allows; short writes resume where they stopped
+  void
+  __writev(const char *a, usize na, const char *b, usize nb) const
+  {
+    if ( fd < 0 ) return;
+    __iovec iov[2] = { { a, na }, { b, nb } };
+    usize k = 0;
+    for ( ;; ) {
+      while ( k < 2 && iov[k].len == 0 ) ++k;
+      if ( k == 2 ) return;
+      const long w = micron::syscall(SYS_writev, fd, &iov[k], 2 - k);
+      if ( w == -4 /* EINTR */ ) continue;
+      if ( w <= 0 ) {
+        failed = true;
+        return;
+      }
+      usize left = static_cast<usize>(w);
+      while ( left > 0 && k < 2 ) {
+        if ( left >= iov[k].len ) {
+          left -= iov[k].len;
+          iov[k].len = 0;
+          ++k;
+        } else {
+          iov[k].base += left;
+          iov[k].len -= left;
+          left = 0;
+        }
+      }
+    }
+  }
 };
 
 inline void
@@ -126,6 +225,22 @@ emit_human_one(const sink &out, const benchmark_t &b, u32 detail, bool color, u3
   out.emit_double(b.time);
   out.emit(" microseconds");
   out.newline();
+  if ( b.norm_time_us > 0.0 ) {
+    if ( b.eff_ghz > 0.0 ) {
+      if ( color ) out.emit("\033[34m", 5);
+      out.emit("Effective Clock:      ");
+      if ( color ) out.emit("\033[0m", 4);
+      out.emit_double(b.eff_ghz);
+      out.emit(" GHz");
+      out.newline();
+    }
+    if ( color ) out.emit("\033[34m", 5);
+    out.emit("Normalized Time:      ");
+    if ( color ) out.emit("\033[0m", 4);
+    out.emit_double(b.norm_time_us);
+    out.emit(" microseconds at the reference clock");
+    out.newline();
+  }
 
   __emit_row(out, "Cycles Spent:         ", b.cycles, color);
   __emit_row(out, "Total Instructions:   ", b.instructions, color);
@@ -141,6 +256,55 @@ emit_human_one(const sink &out, const benchmark_t &b, u32 detail, bool color, u3
   __emit_row(out, "Last Level Cache:     ", b.ll_cache, color);
   __emit_row(out, "Cache Accesses:       ", b.access, color);
   __emit_row(out, "Branch Predictions:   ", b.bpu, color);
+  __emit_row(out, "Max RSS (KiB):        ", b.max_rss_kb, color);
+  __emit_row(out, "User Time (us):       ", b.user_time_us, color);
+  __emit_row(out, "System Time (us):     ", b.sys_time_us, color);
+  __emit_row(out, "Voluntary Switches:   ", b.vol_ctx_switches, color);
+  __emit_row(out, "Involuntary Switches: ", b.invol_ctx_switches, color);
+  __emit_row(out, "Minor Faults (ru):    ", b.ru_minor_faults, color);
+  __emit_row(out, "Major Faults (ru):    ", b.ru_major_faults, color);
+  if ( b.cg_usage_us > 0 ) {
+    __emit_row(out, "cgroup CPU (us):      ", b.cg_usage_us, color);
+    __emit_row(out, "cgroup User (us):     ", b.cg_user_us, color);
+    __emit_row(out, "cgroup System (us):   ", b.cg_system_us, color);
+    __emit_row(out, "cgroup Mem Peak (B):  ", b.cg_memory_peak, color);
+    __emit_row(out, "cgroup Anon (B):      ", b.cg_memory_anon, color);
+    __emit_row(out, "cgroup File (B):      ", b.cg_memory_file, color);
+    __emit_row(out, "cgroup IO Read (B):   ", b.cg_io_rbytes, color);
+    __emit_row(out, "cgroup IO Write (B):  ", b.cg_io_wbytes, color);
+  }
+  if ( b.mem_samples > 0 ) {
+    __emit_row(out, "Mem Peak RSS (KiB):   ", b.mem_peak_rss_kb, color);
+    __emit_row(out, "Mem Avg RSS (KiB):    ", b.mem_avg_rss_kb, color);
+    __emit_row(out, "Mem Peak Anon (KiB):  ", b.mem_peak_anon_kb, color);
+    __emit_row(out, "Mem Peak File (KiB):  ", b.mem_peak_file_kb, color);
+    __emit_row(out, "Mem PSS (KiB):        ", b.mem_pss_kb, color);
+    __emit_row(out, "Mem Swap (KiB):       ", b.mem_swap_kb, color);
+    if ( color ) out.emit("\033[34m", 5);
+    out.emit("Mem Fault Rate:       ");
+    if ( color ) out.emit("\033[0m", 4);
+    out.emit_double(b.mem_fault_rate);
+    out.emit(" faults/s (");
+    out.emit_int(b.mem_samples);
+    out.emit(" samples)");
+    out.newline();
+  }
+  if ( b.io_syscr > 0 || b.io_syscw > 0 ) {
+    __emit_row(out, "I/O Read (B):         ", b.io_rchar, color);
+    __emit_row(out, "I/O Written (B):      ", b.io_wchar, color);
+    __emit_row(out, "I/O Read Calls:       ", b.io_syscr, color);
+    __emit_row(out, "I/O Write Calls:      ", b.io_syscw, color);
+    __emit_row(out, "Storage Read (B):     ", b.io_read_bytes, color);
+    __emit_row(out, "Storage Written (B):  ", b.io_write_bytes, color);
+  }
+  if ( b.launch_us > 0.0 ) {
+    if ( color ) out.emit("\033[34m", 5);
+    out.emit("Launch Overhead:      ");
+    if ( color ) out.emit("\033[0m", 4);
+    out.emit_double(b.launch_us);
+    out.emit(" microseconds");
+    out.newline();
+  }
 
   if ( detail >= 2 ) {
     __emit_row(out, "Page Faults:          ", b.page_faults, color);
@@ -239,15 +403,76 @@ emit_csv_header(const sink &out, u32 detail, char sep)
     out.emit(s);
     out.emit("emulation_faults");
   }
+  // rusage columns go last so the counter columns keep their positions
+  out.emit(s);
+  out.emit("max_rss_kb");
+  out.emit(s);
+  out.emit("user_time_us");
+  out.emit(s);
+  out.emit("sys_time_us");
+  out.emit(s);
+  out.emit("vol_ctx_switches");
+  out.emit(s);
+  out.emit("invol_ctx_switches");
+  out.emit(s);
+  out.emit("ru_minor_faults");
+  out.emit(s);
+  out.emit("ru_major_faults");
+  out.emit(s);
+  out.emit("launch_us");
+  out.emit(s);
+  out.emit("cg_usage_us");
+  out.emit(s);
+  out.emit("cg_user_us");
+  out.emit(s);
+  out.emit("cg_system_us");
+  out.emit(s);
+  out.emit("cg_memory_peak");
+  out.emit(s);
+  out.emit("cg_memory_anon");
+  out.emit(s);
+  out.emit("cg_memory_file");
+  out.emit(s);
+  out.emit("cg_io_rbytes");
+  out.emit(s);
+  out.emit("cg_io_wbytes");
+  out.emit(s);
+  out.emit("mem_peak_rss_kb");
+  out.emit(s);
+  out.emit("mem_avg_rss_kb");
+  out.emit(s);
+  out.emit("mem_peak_anon_kb");
+  out.emit(s);
+  out.emit("mem_peak_file_kb");
+  out.emit(s);
+  out.emit("mem_pss_kb");
+  out.emit(s);
+  out.emit("mem_swap_kb");
+  out.emit(s);
+  out.emit("mem_fault_rate");
+  out.emit(s);
+  out.emit("io_rchar");
+  out.emit(s);
+  out.emit("io_wchar");
+  out.emit(s);
+  out.emit("io_syscr");
+  out.emit(s);
+  out.emit("io_syscw");
+  out.emit(s);
+  out.emit("io_read_bytes");
+  out.emit(s);
+  out.emit("io_write_bytes");
+  out.emit(s);
+  out.emit("eff_ghz");
+  out.emit(s);
+  out.emit("norm_time_us");
   out.newline();
 }
 
+// every column of emit_csv_one after the name
 inline void
-emit_csv_one(const sink &out, const benchmark_t &b, u32 detail, char sep)
+__emit_csv_values(const sink &out, const benchmark_t &b, u32 detail, const char *s)
 {
-  const char s[2] = { sep, '\0' };
-  out.emit(b.name.c_str());
-  out.emit(s);
   out.emit_double(b.time);
   out.emit(s);
   out.emit_int(b.cycles);
@@ -315,63 +540,454 @@ emit_csv_one(const sink &out, const benchmark_t &b, u32 detail, char sep)
     out.emit(s);
     out.emit_int(b.emulation_faults);
   }
+  out.emit(s);
+  out.emit_int(b.max_rss_kb);
+  out.emit(s);
+  out.emit_int(b.user_time_us);
+  out.emit(s);
+  out.emit_int(b.sys_time_us);
+  out.emit(s);
+  out.emit_int(b.vol_ctx_switches);
+  out.emit(s);
+  out.emit_int(b.invol_ctx_switches);
+  out.emit(s);
+  out.emit_int(b.ru_minor_faults);
+  out.emit(s);
+  out.emit_int(b.ru_major_faults);
+  out.emit(s);
+  out.emit_double(b.launch_us);
+  out.emit(s);
+  out.emit_int(b.cg_usage_us);
+  out.emit(s);
+  out.emit_int(b.cg_user_us);
+  out.emit(s);
+  out.emit_int(b.cg_system_us);
+  out.emit(s);
+  out.emit_int(b.cg_memory_peak);
+  out.emit(s);
+  out.emit_int(b.cg_memory_anon);
+  out.emit(s);
+  out.emit_int(b.cg_memory_file);
+  out.emit(s);
+  out.emit_int(b.cg_io_rbytes);
+  out.emit(s);
+  out.emit_int(b.cg_io_wbytes);
+  out.emit(s);
+  out.emit_int(b.mem_peak_rss_kb);
+  out.emit(s);
+  out.emit_int(b.mem_avg_rss_kb);
+  out.emit(s);
+  out.emit_int(b.mem_peak_anon_kb);
+  out.emit(s);
+  out.emit_int(b.mem_peak_file_kb);
+  out.emit(s);
+  out.emit_int(b.mem_pss_kb);
+  out.emit(s);
+  out.emit_int(b.mem_swap_kb);
+  out.emit(s);
+  out.emit_double(b.mem_fault_rate);
+  out.emit(s);
+  out.emit_int(b.io_rchar);
+  out.emit(s);
+  out.emit_int(b.io_wchar);
+  out.emit(s);
+  out.emit_int(b.io_syscr);
+  out.emit(s);
+  out.emit_int(b.io_syscw);
+  out.emit(s);
+  out.emit_int(b.io_read_bytes);
+  out.emit(s);
+  out.emit_int(b.io_write_bytes);
+  out.emit(s);
+  out.emit_double(b.eff_ghz);
+  out.emit(s);
+  out.emit_double(b.norm_time_us);
+}
+
+inline void
+emit_csv_one(const sink &out, const benchmark_t &b, u32 detail, char sep)
+{
+  const char s[2] = { sep, '\0' };
+  out.emit(b.name.c_str());
+  out.emit(s);
+  __emit_csv_values(out, b, detail, s);
   out.newline();
 }
 
+// one counter over the runs of a benchmark. order statistics come from selection on a copy of the
+// values (quickselect, O(n) each), quantiles interpolate between neighbours (linear, as numpy's
+// default); outliers by Tukey's fences: mild beyond 1.5 IQR of the quartiles, severe beyond 3
 struct stats_t {
   double mean, stddev, mn, mx;
+  double median;
+  double mad;     // median absolute deviation from the median, unscaled
+  double q1, q3, iqr;
+  double p5, p95, p99;
+  double trimmed_mean;     // mean of the middle 80%, 10% cut at each end
+  u32 n;
+  u32 mild_outliers;
+  u32 severe_outliers;
 };
 
+enum class outlier : u8 { none, mild, severe };
+
+namespace __impl
+{
+
+inline void
+__swap(double &a, double &b)
+{
+  double t = a;
+  a = b;
+  b = t;
+}
+
+// rearranges v[lo, hi) so v[k] is the value a sort would put there, smaller ones before it and
+// larger ones after; three-way partition, so runs of equal counts don't degrade it
+inline void
+__select(double *v, usize lo, usize hi, usize k)
+{
+  while ( hi - lo > 1 ) {
+    const double a = v[lo], b = v[lo + (hi - lo) / 2], c = v[hi - 1];
+    const double p = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+    usize lt = lo, i = lo, gt = hi;
+    while ( i < gt ) {
+      if ( v[i] < p )
+        __swap(v[lt++], v[i++]);
+      else if ( v[i] > p )
+        __swap(v[i], v[--gt]);
+      else
+        ++i;
+    }
+    if ( k < lt )
+      hi = lt;
+    else if ( k >= gt )
+      lo = gt;
+    else
+      return;
+  }
+}
+
+inline double
+__quantile(double *v, usize n, double q)
+{
+  const double h = q * static_cast<double>(n - 1);
+  const usize k = static_cast<usize>(h);
+  __select(v, 0, n, k);
+  const double x = v[k];
+  const double frac = h - static_cast<double>(k);
+  if ( frac <= 0.0 || k + 1 >= n ) return x;
+  double y = v[k + 1];     // the next order statistic: smallest of the upper part
+  for ( usize i = k + 2; i < n; ++i )
+    if ( v[i] < y ) y = v[i];
+  return x + frac * (y - x);
+}
+
+inline double
+__sqrt(double x)
+{
+  return x > 0 ? __builtin_sqrt(x) : 0;
+}
+
+};     // namespace __impl
+
+inline outlier
+classify(const stats_t &s, double v)
+{
+  if ( v < s.q1 - 3.0 * s.iqr || v > s.q3 + 3.0 * s.iqr ) return outlier::severe;
+  if ( v < s.q1 - 1.5 * s.iqr || v > s.q3 + 1.5 * s.iqr ) return outlier::mild;
+  return outlier::none;
+}
+
 template <typename V, typename F>
 inline stats_t
 compute_stats(const V &runs, F field_accessor)
 {
   stats_t s{ 0, 0, 0, 0 };
   if ( runs.size() == 0 ) return s;
+  const usize n = runs.size();
+  micron::vector<double> v;
+  v.reserve(n);
   double sum = 0.0;
-  double mn = static_cast<double>(field_accessor(runs[0]));
-  double mx = mn;
   for ( const auto &r : runs ) {
-    double v = static_cast<double>(field_accessor(r));
-    sum += v;
-    if ( v < mn ) mn = v;
-    if ( v > mx ) mx = v;
-  }
-  s.mean = sum / static_cast<double>(runs.size());
-  if ( runs.size() > 1 ) {
-    double sq = 0.0;
-    for ( const auto &r : runs ) {
-      double v = static_cast<double>(field_accessor(r));
-      double d = v - s.mean;
-      sq += d * d;
+    const double x = static_cast<double>(field_accessor(r));
+    v.push_back(x);
+    sum += x;
+  }
+  double *d = &v[0];
+  s.n = static_cast<u32>(n);
+  s.mean = sum / static_cast<double>(n);
+  s.mn = s.mx = d[0];
+  double sq = 0.0;
+  for ( usize i = 0; i < n; ++i ) {
+    if ( d[i] < s.mn ) s.mn = d[i];
+    if ( d[i] > s.mx ) s.mx = d[i];
+    sq += (d[i] - s.mean) * (d[i] - s.mean);
+  }
+  if ( n > 1 ) s.stddev = __impl::__sqrt(sq / static_cast<double>(n - 1));
+
+  s.median = __impl::__quantile(d, n, 0.5);
+  s.q1 = __impl::__quantile(d, n, 0.25);
+  s.q3 = __impl::__quantile(d, n, 0.75);
+  s.iqr = s.q3 - s.q1;
+  s.p5 = __impl::__quantile(d, n, 0.05);
+  s.p95 = __impl::__quantile(d, n, 0.95);
+  s.p99 = __impl::__quantile(d, n, 0.99);
+
+  const usize cut = n / 10;
+  if ( cut == 0 ) {
+    s.trimmed_mean = s.mean;
+  } else {
+    __impl::__select(d, 0, n, cut);
+    __impl::__select(d, cut, n, n - cut - 1);
+    double t = 0.0;
+    for ( usize i = cut; i < n - cut; ++i ) t += d[i];
+    s.trimmed_mean = t / static_cast<double>(n - 2 * cut);
+  }
+
+  for ( usize i = 0; i < n; ++i ) {
+    const outlier o = classify(s, d[i]);
+    if ( o == outlier::severe )
+      ++s.severe_outliers;
+    else if ( o == outlier::mild )
+      ++s.mild_outliers;
+    d[i] = d[i] < s.median ? s.median - d[i] : d[i] - s.median;
+  }
+  s.mad = __impl::__quantile(d, n, 0.5);
+  return s;
+}
+
+// every numeric field of benchmark_t by its CSV column name, for statistics over all of them;
+// detail: the -d level whose CSV carries the column
+struct field_def {
+  const char *name;
+  u32 detail;
+  double (*get)(const benchmark_t &);
+  void (*set)(benchmark_t &, double);
+};
+
+#define __BBENCH_FIELD(col, member, lvl)                                                                                \
+  { col, lvl, [](const benchmark_t &b) { return static_cast<double>(b.member); },                                   \
+    [](benchmark_t &b, double v) { b.member = static_cast<decltype(b.member)>(v); } }
+inline constexpr field_def fields[] = {
+  __BBENCH_FIELD("time_us", time, 1),
+  __BBENCH_FIELD("cycles", cycles, 1),
+  __BBENCH_FIELD("instructions", instructions, 1),
+  __BBENCH_FIELD("branches", total_branches, 1),
+  __BBENCH_FIELD("branch_misses", branch_misses, 1),
+  __BBENCH_FIELD("total_cycles", total_cycles, 1),
+  __BBENCH_FIELD("cpu_time", cpu_time, 1),
+  __BBENCH_FIELD("context_switches", context_switches, 1),
+  __BBENCH_FIELD("migrations", migrations, 1),
+  __BBENCH_FIELD("cache_misses", cache_misses, 1),
+  __BBENCH_FIELD("l1_cache", l1_cache, 1),
+  __BBENCH_FIELD("l1t_cache", l1t_cache, 1),
+  __BBENCH_FIELD("ll_cache", ll_cache, 1),
+  __BBENCH_FIELD("cache_node", access, 1),
+  __BBENCH_FIELD("bpu", bpu, 1),
+  __BBENCH_FIELD("page_faults", page_faults, 2),
+  __BBENCH_FIELD("bus_cycles", bus_cycles, 2),
+  __BBENCH_FIELD("stalled_front", stalled_front, 2),
+  __BBENCH_FIELD("stalled_back", stalled_back, 2),
+  __BBENCH_FIELD("dtlb_access", dtlb_access, 2),
+  __BBENCH_FIELD("dtlb_miss", dtlb_miss, 2),
+  __BBENCH_FIELD("itlb_access", itlb_access, 2),
+  __BBENCH_FIELD("itlb_miss", itlb_miss, 2),
+  __BBENCH_FIELD("l1d_miss", l1d_miss, 2),
+  __BBENCH_FIELD("llcache_miss", llcache_miss, 2),
+  __BBENCH_FIELD("l1t_miss", l1t_miss, 3),
+  __BBENCH_FIELD("l1d_prefetch", l1d_prefetch, 3),
+  __BBENCH_FIELD("l1d_prefetch_miss", l1d_prefetch_miss, 3),
+  __BBENCH_FIELD("minor_faults", minor_faults, 3),
+  __BBENCH_FIELD("major_faults", major_faults, 3),
+  __BBENCH_FIELD("alignment_faults", alignment_faults, 3),
+  __BBENCH_FIELD("emulation_faults", emulation_faults, 3),
+  __BBENCH_FIELD("max_rss_kb", max_rss_kb, 1),
+  __BBENCH_FIELD("user_time_us", user_time_us, 1),
+  __BBENCH_FIELD("sys_time_us", sys_time_us, 1),
+  __BBENCH_FIELD("vol_ctx_switches", vol_ctx_switches, 1),
+  __BBENCH_FIELD("invol_ctx_switches", invol_ctx_switches, 1),
+  __BBENCH_FIELD("ru_minor_faults", ru_minor_faults, 1),
+  __BBENCH_FIELD("ru_major_faults", ru_major_faults, 1),
+  __BBENCH_FIELD("launch_us", launch_us, 1),
+  __BBENCH_FIELD("cg_usage_us", cg_usage_us, 1),
+  __BBENCH_FIELD("cg_user_us", cg_user_us, 1),
+  __BBENCH_FIELD("cg_system_us", cg_system_us, 1),
+  __BBENCH_FIELD("cg_memory_peak", cg_memory_peak, 1),
+  __BBENCH_FIELD("cg_memory_anon", cg_memory_anon, 1),
+  __BBENCH_FIELD("cg_memory_file", cg_memory_file, 1),
+  __BBENCH_FIELD("cg_io_rbytes", cg_io_rbytes, 1),
+  __BBENCH_FIELD("cg_io_wbytes", cg_io_wbytes, 1),
+  __BBENCH_FIELD("mem_peak_rss_kb", mem_peak_rss_kb, 1),
+  __BBENCH_FIELD("mem_avg_rss_kb", mem_avg_rss_kb, 1),
+  __BBENCH_FIELD("mem_peak_anon_kb", mem_peak_anon_kb, 1),
+  __BBENCH_FIELD("mem_peak_file_kb", mem_peak_file_kb, 1),
+  __BBENCH_FIELD("mem_pss_kb", mem_pss_kb, 1),
+  __BBENCH_FIELD("mem_swap_kb", mem_swap_kb, 1),
+  __BBENCH_FIELD("mem_fault_rate", mem_fault_rate, 1),
+  __BBENCH_FIELD("io_rchar", io_rchar, 1),
+  __BBENCH_FIELD("io_wchar", io_wchar, 1),
+  __BBENCH_FIELD("io_syscr", io_syscr, 1),
+  __BBENCH_FIELD("io_syscw", io_syscw, 1),
+  __BBENCH_FIELD("io_read_bytes", io_read_bytes, 1),
+  __BBENCH_FIELD("io_write_bytes", io_write_bytes, 1),
+  __BBENCH_FIELD("eff_ghz", eff_ghz, 1),
+  __BBENCH_FIELD("norm_time_us", norm_time_us, 1),
+};
+#undef __BBENCH_FIELD
+inline constexpr usize n_fields = sizeof(fields) / sizeof(fields[0]);
+
+inline void
+__emit_outliers(const sink &out, const stats_t &s)
+{
+  out.emit_int(s.mild_outliers);
+  out.emit("/");
+  out.emit_int(s.severe_outliers);
+}
+
+// one line per counter that was measured (not zero in every run) at this detail level
+inline void
+emit_counter_stats(const sink &out, const micron::vector<benchmark_t> &runs, u32 detail, bool color)
+{
+  for ( const field_def &f : fields ) {
+    if ( f.detail > detail ) continue;
+    const stats_t st = compute_stats(runs, f.get);
+    if ( st.mn == 0.0 && st.mx == 0.0 ) continue;
+    if ( color ) out.emit("\033[34m", 5);
+    out.emit("  ");
+    out.emit(f.name);
+    out.emit(":");
+    if ( color ) out.emit("\033[0m", 4);
+    out.emit(" median=");
+    out.emit_double(st.median);
+    out.emit(" mad=");
+    out.emit_double(st.mad);
+    out.emit(" mean=");
+    out.emit_double(st.mean);
+    out.emit(" stddev=");
+    out.emit_double(st.stddev);
+    out.emit(" p5=");
+    out.emit_double(st.p5);
+    out.emit(" p95=");
+    out.emit_double(st.p95);
+    out.emit(" p99=");
+    out.emit_double(st.p99);
+    out.emit(" outliers(mild/severe)=");
+    __emit_outliers(out, st);
+    out.newline();
+  }
+}
+
+// one value per format::fields column of the detail level, which is the emit_csv_header order;
+// doubles throughout, a median or a mean of integer counters keeps its fraction
+inline void
+__emit_csv_doubles(const sink &out, const double *v, u32 detail, const char *s)
+{
+  bool first = true;
+  for ( usize f = 0; f < n_fields; ++f ) {
+    if ( fields[f].detail > detail ) continue;
+    if ( !first ) out.emit(s);
+    out.emit_double(v[f]);
+    first = false;
+  }
+}
+
+// CSV rows "NAME:median", "NAME:mad", ... under the emit_csv_header columns, one per statistic
+inline void
+emit_csv_stats(const sink &out, const micron::vector<benchmark_t> &runs, u32 detail, char sep)
+{
+  if ( runs.size() == 0 ) return;
+  const char *stat_names[] = { "median", "mad", "iqr", "p5", "p95", "p99", "trimmed_mean", "stddev" };
+  const usize n_stats = sizeof(stat_names) / sizeof(stat_names[0]);
+  stats_t st[n_fields];
+  for ( usize f = 0; f < n_fields; ++f ) st[f] = compute_stats(runs, fields[f].get);
+  const char s[2] = { sep, '\0' };
+  for ( usize k = 0; k < n_stats; ++k ) {
+    double row[n_fields];
+    for ( usize f = 0; f < n_fields; ++f ) {
+      const double vals[] = { st[f].median, st[f].mad, st[f].iqr, st[f].p5, st[f].p95, st[f].p99, st[f].trimmed_mean, st[f].stddev };
+      row[f] = vals[k];
     }
-    s.stddev = sq / static_cast<double>(runs.size() - 1);
-    double x = s.stddev > 0 ? s.stddev : 0;
-    if ( x > 0 ) {
-      double r = x;
-      for ( int i = 0; i < 12; ++i ) r = 0.5 * (r + x / r);
-      s.stddev = r;
+    out.emit(runs[0].name.c_str());
+    out.emit(":");
+    out.emit(stat_names[k]);
+    out.emit(s);
+    __emit_csv_doubles(out, row, detail, s);
+    out.newline();
+  }
+  // after a level shift, one "NAME:segment:FIRST-LAST" row of means per stretch between
+  // changepoints, "NAME:stable:FIRST-LAST" for the stable one
+  const changepoint::analysis cp = changepoint::analyze(runs);
+  if ( !cp.shifted() ) return;
+  usize from = 0;
+  for ( usize i = 0; i <= cp.cuts.size(); ++i ) {
+    const usize to = i < cp.cuts.size() ? cp.cuts[i] : runs.size();
+    double row[n_fields];
+    for ( usize f = 0; f < n_fields; ++f ) {
+      double sum = 0.0;
+      for ( usize r = from; r < to; ++r ) sum += fields[f].get(runs[r]);
+      row[f] = sum / static_cast<double>(to - from);
     }
+    out.emit(runs[0].name.c_str());
+    out.emit(from == cp.stable_begin ? ":stable:" : ":segment:");
+    out.emit_int(static_cast<long long>(from));
+    out.emit("-");
+    out.emit_int(static_cast<long long>(to - 1));
+    out.emit(s);
+    __emit_csv_doubles(out, row, detail, s);
+    out.newline();
+    from = to;
   }
-  s.mn = mn;
-  s.mx = mx;
-  return s;
 }
 
+inline void
+__emit_segments(const sink &out, const char *what, const micron::vector<changepoint::segment> &segs)
+{
+  out.emit(what);
+  for ( usize i = 0; i < segs.size(); ++i ) {
+    out.emit(i ? " | " : " ");
+    out.emit_int(static_cast<long long>(segs[i].begin));
+    out.emit("-");
+    out.emit_int(static_cast<long long>(segs[i].end - 1));
+    out.emit("=");
+    out.emit_double(segs[i].level);
+  }
+  out.newline();
+}
+
+// every run's time, deviation from the mean, Tukey flag (* mild, ** severe outlier) and
+// changepoint marks: a rule at each level shift, [time] / [freq] for runs off the stable
+// segment's level, [migrated]
 inline void
 emit_table(const sink &out, const micron::vector<benchmark_t> &runs)
 {
   if ( runs.size() == 0 ) return;
   auto s = compute_stats(runs, [](const benchmark_t &b) { return b.time; });
+  const changepoint::analysis cp = changepoint::analyze(runs);
   out.emit("# Table of individual time measurements (us):\n");
-  for ( const auto &r : runs ) {
+  usize next_cut = 0;
+  for ( usize i = 0; i < runs.size(); ++i ) {
+    const benchmark_t &r = runs[i];
+    if ( next_cut < cp.cuts.size() && cp.cuts[next_cut] == i ) {
+      out.emit("  -- level shift --\n");
+      ++next_cut;
+    }
     out.emit("  ");
     out.emit_double(r.time);
     out.emit("  (");
     double dev = r.time - s.mean;
     if ( dev >= 0 ) out.emit("+");
     out.emit_double(dev);
-    out.emit(")\n");
+    out.emit(")");
+    const outlier o = classify(s, r.time);
+    if ( o == outlier::severe )
+      out.emit(" **");
+    else if ( o == outlier::mild )
+      out.emit(" *");
+    if ( cp.flags[i] & changepoint::time_shift ) out.emit(" [time]");
+    if ( cp.flags[i] & changepoint::freq_shift ) out.emit(" [freq]");
+    if ( cp.flags[i] & changepoint::migrated ) out.emit(" [migrated]");
+    out.newline();
   }
   out.emit("# Final: mean=");
   out.emit_double(s.mean);
@@ -382,6 +998,33 @@ emit_table(const sink &out, const micron::vector<benchmark_t> &runs)
   out.emit(" max=");
   out.emit_double(s.mx);
   out.newline();
+  out.emit("# Robust: median=");
+  out.emit_double(s.median);
+  out.emit(" mad=");
+  out.emit_double(s.mad);
+  out.emit(" iqr=");
+  out.emit_double(s.iqr);
+  out.emit(" p5=");
+  out.emit_double(s.p5);
+  out.emit(" p95=");
+  out.emit_double(s.p95);
+  out.emit(" p99=");
+  out.emit_double(s.p99);
+  out.emit(" trimmed-mean=");
+  out.emit_double(s.trimmed_mean);
+  out.emit(" outliers(mild/severe)=");
+  __emit_outliers(out, s);
+  out.newline();
+  if ( !cp.shifted() ) return;
+  __emit_segments(out, "# Segments (time us):", cp.time);
+  if ( cp.freq.size() > 1 ) __emit_segments(out, "# Segments (cycles/ref-cycles):", cp.freq);
+  out.emit("# Stable: runs ");
+  out.emit_int(static_cast<long long>(cp.stable_begin));
+  out.emit("-");
+  out.emit_int(static_cast<long long>(cp.stable_end - 1));
+  out.emit(", ");
+  out.emit_int(static_cast<long long>(cp.flagged));
+  out.emit(" runs flagged\n");
 }
 
 };     // namespace bbench::format
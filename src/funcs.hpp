@@ -53,11 +53,93 @@ struct benchmark_t {
   long long l1d_prefetch;
   long long l1d_prefetch_miss;
 
+  // child rusage from wait4 (binary runs only)
+  long long max_rss_kb;
+  long long user_time_us;
+  long long sys_time_us;
+  long long vol_ctx_switches;
+  long long invol_ctx_switches;
+  long long ru_minor_faults;
+  long long ru_major_faults;
+
+  // request -> child parked before exec, counter setup excluded (binary runs only)
+  double launch_us;
+
+  // --cgroup: cpu.stat, memory.peak / memory.stat (bytes), io.stat summed over devices
+  long long cg_usage_us;
+  long long cg_user_us;
+  long long cg_system_us;
+  long long cg_memory_peak;
+  long long cg_memory_anon;
+  long long cg_memory_file;
+  long long cg_io_rbytes;
+  long long cg_io_wbytes;
+
+  // --mem-sample: /proc/PID/statm timeline of the root process (KiB); pss/swap from smaps_rollup at the peak
+  long long mem_peak_rss_kb;
+  long long mem_avg_rss_kb;
+  long long mem_peak_anon_kb;
+  long long mem_peak_file_kb;
+  long long mem_pss_kb;
+  long long mem_swap_kb;
+  long long mem_samples;
+  double mem_fault_rate;     // minor + major faults per second over the sampled span
+
+  // --io: /proc/PID/io of the child (bytes / calls), read after exit and before reaping
+  long long io_rchar;
+  long long io_wchar;
+  long long io_syscr;
+  long long io_syscw;
+  long long io_read_bytes;
+  long long io_write_bytes;
+
+  // clock normalisation from cycles / ref-cycles (0 when ref-cycles didn't count): the effective
+  // clock (ratio x nominal) and the time the run would have taken at the reference clock (nominal,
+  // or --ref-ghz), in time's unit; turbo / throttling between runs and clock differences between
+  // hosts drop out
+  double eff_ghz;
+  double norm_time_us;
+
   // multiplex bookkeeping (per-event time_enabled / time_running)
   unsigned long long time_enabled_ns;
   unsigned long long time_running_ns;
 };
 
+// every perf counter field of benchmark_t (rusage excluded), for passes that treat them alike
+inline constexpr long long benchmark_t::*counter_fields[] = {
+  &benchmark_t::cycles,
+  &benchmark_t::instructions,
+  &benchmark_t::cache_misses,
+  &benchmark_t::total_branches,
+  &benchmark_t::branch_misses,
+  &benchmark_t::total_cycles,
+  &benchmark_t::cpu_time,
+  &benchmark_t::context_switches,
+  &benchmark_t::migrations,
+  &benchmark_t::l1_cache,
+  &benchmark_t::l1t_cache,
+  &benchmark_t::ll_cache,
+  &benchmark_t::access,
+  &benchmark_t::bpu,
+  &benchmark_t::page_faults,
+  &benchmark_t::minor_faults,
+  &benchmark_t::major_faults,
+  &benchmark_t::bus_cycles,
+  &benchmark_t::stalled_front,
+  &benchmark_t::stalled_back,
+  &benchmark_t::alignment_faults,
+  &benchmark_t::emulation_faults,
+  &benchmark_t::dtlb_access,
+  &benchmark_t::dtlb_miss,
+  &benchmark_t::itlb_access,
+  &benchmark_t::itlb_miss,
+  &benchmark_t::l1d_miss,
+  &benchmark_t::l1t_miss,
+  &benchmark_t::llcache_miss,
+  &benchmark_t::l1d_prefetch,
+  &benchmark_t::l1d_prefetch_miss,
+};
+
 auto
 per_op(double x, long long a)
 {
@@ -0,0 +1,488 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/memory/cmemory.hpp>
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+#include "baseline.hpp"
+#include "bench.hpp"
+#include "changepoint.hpp"
+#include "format.hpp"
+#include "funcs.hpp"
+#include "options.hpp"
+#include "stopping.hpp"
+#include "sysfs.hpp"
+#include "systrace.hpp"
+#include "topdown.hpp"
+
+// JSON output (bbench --json / --jsonl). a writer keeps the commas and nesting straight over a
+// format::sink, so a record is streamed out as it is built, never held whole; the functions below
+// write the members of each result type into the object the caller has open, so --jsonl can put
+// "type" / "index" next to them on one line. numbers the format can't hold (nan, inf) are null,
+// bytes of a string that aren't UTF-8 (a binary path, a latin-1 hostname) become U+FFFD
+namespace bbench::json
+{
+
+namespace __impl
+{
+
+// length of the well-formed UTF-8 sequence at p (lead byte >= 0x80), 0 if it isn't one: no
+// overlong forms, no surrogates, nothing past U+10FFFF
+inline usize
+__utf8_len(const unsigned char *p)
+{
+  const unsigned char c = p[0];
+  usize n = 0;
+  unsigned char lo = 0x80, hi = 0xbf;     // allowed range of the second byte
+  if ( c >= 0xc2 && c <= 0xdf )
+    n = 2;
+  else if ( c >= 0xe0 && c <= 0xef ) {
+    n = 3;
+    if ( c == 0xe0 ) lo = 0xa0;
+    if ( c == 0xed ) hi = 0x9f;
+  } else if ( c >= 0xf0 && c <= 0xf4 ) {
+    n = 4;
+    if ( c == 0xf0 ) lo = 0x90;
+    if ( c == 0xf4 ) hi = 0x8f;
+  } else
+    return 0;
+  if ( p[1] < lo || p[1] > hi ) return 0;
+  for ( usize i = 2; i < n; ++i )
+    if ( (p[i] & 0xc0) != 0x80 ) return 0;
+  return n;
+}
+
+};     // namespace __impl
+
+class writer
+{
+  const format::sink &out;
+  u64 empty = 1;     // bit d: nothing written yet at depth d
+  u32 depth = 0;
+  bool after_key = false;
+
+  void
+  __sep(void)
+  {
+    if ( after_key ) {
+      after_key = false;
+      return;
+    }
+    if ( !((empty >> depth) & 1) ) out.emit(",", 1);
+    empty &= ~(1ull << depth);
+  }
+
+  void
+  __open(const char *c)
+  {
+    __sep();
+    out.emit(c, 1);
+    ++depth;
+    empty |= 1ull << depth;
+  }
+
+  void
+  __close(const char *c)
+  {
+    --depth;
+    out.emit(c, 1);
+  }
+
+  void
+  __quoted(const char *s)
+  {
+    out.emit("\"", 1);
+    const char *run = s;
+    for ( ; *s; ++s ) {
+      const unsigned char c = static_cast<unsigned char>(*s);
+      if ( c >= 0x20 && c < 0x80 && c != '"' && c != '\\' ) continue;
+      usize n = 0;
+      if ( c >= 0x80 && (n = __impl::__utf8_len(reinterpret_cast<const unsigned char *>(s))) > 0 ) {
+        s += n - 1;
+        continue;
+      }
+      out.emit(run, static_cast<usize>(s - run));
+      run = s + 1;
+      if ( c >= 0x80 )
+        out.emit("\\ufffd", 6);
+      else if ( c == '"' )
+        out.emit("\\\"", 2);
+      else if ( c == '\\' )
+        out.emit("\\\\", 2);
+      else if ( c == '\n' )
+        out.emit("\\n", 2);
+      else if ( c == '\t' )
+        out.emit("\\t", 2);
+      else {
+        const char hex[] = "0123456789abcdef";
+        const char u[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+        out.emit(u, 6);
+      }
+    }
+    out.emit(run, static_cast<usize>(s - run));
+    out.emit("\"", 1);
+  }
+
+public:
+  explicit writer(const format::sink &o) : out(o) {}
+
+  writer &
+  begin_object(void)
+  {
+    __open("{");
+    return *this;
+  }
+
+  writer &
+  end_object(void)
+  {
+    __close("}");
+    return *this;
+  }
+
+  writer &
+  begin_array(void)
+  {
+    __open("[");
+    return *this;
+  }
+
+  writer &
+  end_array(void)
+  {
+    __close("]");
+    return *this;
+  }
+
+  writer &
+  key(const char *k)
+  {
+    __sep();
+    __quoted(k);
+    out.emit(":", 1);
+    after_key = true;
+    return *this;
+  }
+
+  // nullptr is null
+  writer &
+  string(const char *s)
+  {
+    if ( !s ) return null();
+    __sep();
+    __quoted(s);
+    return *this;
+  }
+
+  // by the exponent bits: -ffast-math folds v != v away
+  writer &
+  number(double v)
+  {
+    u64 bits;
+    micron::memcpy(&bits, &v, sizeof(bits));
+    if ( ((bits >> 52) & 0x7ff) == 0x7ff ) return null();
+    __sep();
+    out.emit_double(v);
+    return *this;
+  }
+
+  writer &
+  integer(long long v)
+  {
+    __sep();
+    out.emit_int(v);
+    return *this;
+  }
+
+  writer &
+  boolean(bool v)
+  {
+    __sep();
+    out.emit(v ? "true" : "false");
+    return *this;
+  }
+
+  writer &
+  null(void)
+  {
+    __sep();
+    out.emit("null", 4);
+    return *this;
+  }
+
+  // end of a --jsonl record, flushed so a reader tailing the file sees it whole and at once; the
+  // next one starts at the top level again
+  void
+  line(void)
+  {
+    out.newline();
+    out.flush();
+    empty = 1;
+    depth = 0;
+    after_key = false;
+  }
+};
+
+// every format::fields column of the detail level, by CSV name, plus name
+inline void
+run_members(writer &w, const benchmark_t &b, u32 detail)
+{
+  w.key("name").string(b.name.c_str());
+  for ( const format::field_def &f : format::fields )
+    if ( f.detail <= detail ) w.key(f.name).number(f.get(b));
+  if ( b.mem_samples > 0 ) w.key("mem_samples").integer(b.mem_samples);
+}
+
+inline void
+usage_members(writer &w, const child_usage &u)
+{
+  w.key("max_rss_kb").integer(u.max_rss_kb);
+  w.key("user_time_us").integer(u.user_time_us);
+  w.key("sys_time_us").integer(u.sys_time_us);
+  w.key("vol_ctx_switches").integer(u.vol_ctx_switches);
+  w.key("invol_ctx_switches").integer(u.invol_ctx_switches);
+  w.key("ru_minor_faults").integer(u.minor_faults);
+  w.key("ru_major_faults").integer(u.major_faults);
+  w.key("status").integer(u.status);
+  w.key("timed_out").boolean(u.timed_out);
+}
+
+// -e: every event with its value and the errno its open failed with (0 when it counted)
+inline void
+dynamic_members(writer &w, const dynamic_result_t &r)
+{
+  w.key("name").string(r.name.c_str());
+  w.key("time_us").number(r.time);
+  w.key("launch_us").number(r.launch_us);
+  w.key("events").begin_array();
+  for ( const dynamic_result_t::entry &e : r.rows ) {
+    w.begin_object();
+    w.key("name").string(e.name);
+    w.key("value").integer(e.value);
+    w.key("errno").integer(e.err);
+    w.end_object();
+  }
+  w.end_array();
+  w.key("usage").begin_object();
+  usage_members(w, r.usage);
+  w.end_object();
+}
+
+inline void
+stats_members(writer &w, const format::stats_t &s)
+{
+  w.key("n").integer(s.n);
+  w.key("mean").number(s.mean);
+  w.key("stddev").number(s.stddev);
+  w.key("min").number(s.mn);
+  w.key("max").number(s.mx);
+  w.key("median").number(s.median);
+  w.key("mad").number(s.mad);
+  w.key("q1").number(s.q1);
+  w.key("q3").number(s.q3);
+  w.key("iqr").number(s.iqr);
+  w.key("p5").number(s.p5);
+  w.key("p95").number(s.p95);
+  w.key("p99").number(s.p99);
+  w.key("trimmed_mean").number(s.trimmed_mean);
+  w.key("mild_outliers").integer(s.mild_outliers);
+  w.key("severe_outliers").integer(s.severe_outliers);
+}
+
+// one object per column of the detail level that was measured (not zero in every run)
+inline void
+stats(writer &w, const micron::vector<benchmark_t> &runs, u32 detail)
+{
+  w.begin_object();
+  for ( const format::field_def &f : format::fields ) {
+    if ( f.detail > detail ) continue;
+    const format::stats_t s = format::compute_stats(runs, f.get);
+    if ( s.mn == 0.0 && s.mx == 0.0 ) continue;
+    w.key(f.name).begin_object();
+    stats_members(w, s);
+    w.end_object();
+  }
+  w.end_object();
+}
+
+inline void
+__segments(writer &w, const micron::vector<changepoint::segment> &segs)
+{
+  w.begin_array();
+  for ( const changepoint::segment &g : segs ) {
+    w.begin_object();
+    w.key("begin").integer(static_cast<long long>(g.begin));
+    w.key("end").integer(static_cast<long long>(g.end));
+    w.key("level").number(g.level);
+    w.end_object();
+  }
+  w.end_array();
+}
+
+// segments as [begin, end) run ranges; flags per run as the changepoint bits
+inline void
+changepoints(writer &w, const changepoint::analysis &a)
+{
+  w.begin_object();
+  w.key("shifted").boolean(a.shifted());
+  w.key("time");
+  __segments(w, a.time);
+  w.key("freq");
+  __segments(w, a.freq);
+  w.key("cuts").begin_array();
+  for ( usize c : a.cuts ) w.integer(static_cast<long long>(c));
+  w.end_array();
+  w.key("stable_begin").integer(static_cast<long long>(a.stable_begin));
+  w.key("stable_end").integer(static_cast<long long>(a.stable_end));
+  w.key("flagged").integer(static_cast<long long>(a.flagged));
+  w.key("flags").begin_array();
+  for ( u8 f : a.flags ) w.integer(f);
+  w.end_array();
+  w.end_object();
+}
+
+inline void
+stop(writer &w, const stopping::report &r, bool median)
+{
+  w.begin_object();
+  w.key("runs").integer(static_cast<long long>(r.runs));
+  w.key("reason").string(stopping::reason_name(r.why));
+  w.key("estimator").string(median ? "median" : "mean");
+  w.key("estimate").number(r.estimate);
+  w.key("half_width").number(r.half_width);
+  w.key("relative").number(r.relative);
+  w.end_object();
+}
+
+inline void
+topdown(writer &w, const topdown::topdown_t &td)
+{
+  w.begin_object();
+  w.key("supported").boolean(td.supported);
+  if ( td.supported ) {
+    w.key("retiring").number(td.retiring);
+    w.key("bad_spec").number(td.bad_spec);
+    w.key("frontend").number(td.frontend);
+    w.key("backend").number(td.backend);
+  }
+  w.end_object();
+}
+
+// per-run means, as emit_regions prints them
+inline void
+regions(writer &w, const micron::vector<roi_region> &rs, usize n_runs)
+{
+  const double n = static_cast<double>(n_runs ? n_runs : 1);
+  w.begin_array();
+  for ( const roi_region &r : rs ) {
+    w.begin_object();
+    w.key("name").string(r.name.c_str());
+    w.key("time_us").number(r.b.time / n);
+    w.key("cycles").number(static_cast<double>(r.b.cycles) / n);
+    w.key("instructions").number(static_cast<double>(r.b.instructions) / n);
+    w.key("entered").number(static_cast<double>(r.count) / n);
+    w.end_object();
+  }
+  w.end_array();
+}
+
+// totals over n_runs runs, every call
+inline void
+syscalls(writer &w, const systrace::table &t, usize n_runs)
+{
+  w.begin_object();
+  w.key("ok").boolean(t.ok);
+  w.key("runs").integer(static_cast<long long>(n_runs));
+  w.key("lost").integer(static_cast<long long>(t.lost));
+  w.key("calls").begin_array();
+  for ( const systrace::syscall_stat &c : t.calls ) {
+    w.begin_object();
+    w.key("nr").integer(c.nr);
+    w.key("name").string(systrace::name(c.nr));
+    w.key("count").integer(static_cast<long long>(c.count));
+    w.key("errors").integer(static_cast<long long>(c.errors));
+    w.key("total_ns").integer(static_cast<long long>(c.total_ns));
+    w.key("max_ns").integer(static_cast<long long>(c.max_ns));
+    w.end_object();
+  }
+  w.end_array();
+  w.end_object();
+}
+
+inline void
+comparison(writer &w, const baseline::comparison &c)
+{
+  w.begin_object();
+  w.key("metric").string(c.metric);
+  w.key("baseline_mean").number(c.base->mean);
+  w.key("baseline_n").integer(c.base->n);
+  w.key("mean").number(c.cur.mean);
+  w.key("n").integer(c.cur.n);
+  w.key("change").number(c.change);
+  w.key("threshold").number(c.threshold);
+  w.key("tested").boolean(c.tested);
+  w.key("significant").boolean(c.significant);
+  w.key("gated").boolean(c.gated);
+  w.key("verdict").string(c.v == baseline::verdict::regression ? "regression"
+                          : c.v == baseline::verdict::improvement ? "improvement"
+                                                                  : "unchanged");
+  w.end_object();
+}
+
+inline void
+host(writer &w, const sys::host_info &h)
+{
+  w.begin_object();
+  w.key("hostname").string(h.hostname);
+  w.key("cpu_model").string(h.cpu_model);
+  w.key("kernel").string(h.kernel);
+  w.key("governor").string(h.governor);
+  w.key("cpus").integer(h.cpus);
+  w.key("nominal_khz").integer(static_cast<long long>(h.nominal_khz));
+  w.key("fingerprint").integer(static_cast<long long>(sys::host_fingerprint(h) & 0x7fffffffffffffffull));
+  w.end_object();
+}
+
+// the measurement settings; the environment stays out (--env values may be secrets), only
+// whether it was replaced
+inline void
+opts(writer &w, const benchmark_opts &o)
+{
+  w.begin_object();
+  w.key("detail").integer(o.detail);
+  w.key("delay_ms").integer(o.delay_ms);
+  w.key("timeout_ms").integer(o.timeout_ms);
+  w.key("inherit").boolean(o.inherit);
+  w.key("scale").boolean(o.scale);
+  w.key("pinned").boolean(o.pinned);
+  w.key("exclude_kernel").boolean(o.excl_kernel);
+  w.key("exclude_user").boolean(o.excl_user);
+  w.key("events").string(o.event_csv);
+  w.key("pre").string(o.pre);
+  w.key("post").string(o.post);
+  w.key("argv");
+  if ( o.argv ) {
+    w.begin_array();
+    for ( const char *const *a = o.argv; *a; ++a ) w.string(*a);
+    w.end_array();
+  } else {
+    w.null();
+  }
+  w.key("env_override").boolean(o.envp != nullptr);
+  w.key("stdin").boolean(o.stdin_fd >= 0);
+  w.key("stdout").string(o.stdout_path);
+  w.key("stderr").string(o.stderr_path);
+  w.key("fork_server").boolean(o.fork_server);
+  w.key("cgroup").boolean(o.cgroup);
+  w.key("mem_interval_us").integer(o.mem_interval_us);
+  w.key("io").boolean(o.io);
+  w.key("ref_khz").integer(static_cast<long long>(o.ref_khz));
+  w.end_object();
+}
+
+};     // namespace bbench::json
@@ -0,0 +1,298 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/linux/io.hpp>
+#include <micron/linux/sys/fcntl.hpp>
+#include <micron/memory/cmemory.hpp>
+#include <micron/syscall.hpp>
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+#include "funcs.hpp"
+
+// memory timeline of a running child (bbench --mem-sample)
+//
+// /proc/PID/statm and /proc/PID/stat are opened once and pread from the wait loop on every tick:
+// resident / file-backed pages and the fault counters, no allocation, no open per tick.
+// smaps_rollup walks every vma and pins the mm it was opened on (so it can't be opened before
+// exec), it is only read when the RSS reaches a new peak, at most every rollup_every ticks.
+// samples go to a fixed buffer; when it's full every other sample is dropped and the period
+// doubles, so a long run keeps an evenly spaced, bounded timeline. only the root process is sampled
+namespace bbench::memsample
+{
+
+struct sample {
+  u64 t_us;     // since the start of the measurement
+  u64 rss_kb;
+  u64 anon_kb;
+  u64 file_kb;     // file-backed + shmem
+  u64 minflt;
+  u64 majflt;
+};
+
+struct timeline {
+  micron::vector<sample> samples;
+  u64 interval_us;     // effective spacing after decimation
+};
+
+namespace __impl
+{
+
+inline const char *
+__skip_ws(const char *p, const char *end)
+{
+  while ( p < end && (*p == ' ' || *p == '\t') ) ++p;
+  return p;
+}
+
+inline const char *
+__parse_u64(const char *p, const char *end, u64 &v)
+{
+  v = 0;
+  p = __skip_ws(p, end);
+  while ( p < end && *p >= '0' && *p <= '9' ) v = v * 10 + static_cast<u64>(*p++ - '0');
+  return p;
+}
+
+// "Key:   123 kB" line in smaps_rollup; 0 when missing
+inline u64
+__kb_of(const char *buf, usize len, const char *key)
+{
+  const usize kl = micron::strlen(key);
+  const char *end = buf + len;
+  for ( const char *p = buf; p + kl < end; ) {
+    if ( micron::strncmp(p, key, kl) == 0 && p[kl] == ':' ) {
+      u64 v = 0;
+      __parse_u64(p + kl + 1, end, v);
+      return v;
+    }
+    while ( p < end && *p != '\n' ) ++p;
+    ++p;
+  }
+  return 0;
+}
+
+inline long
+__pread(int fd, char *buf, usize cap)
+{
+  long r = micron::syscall(SYS_pread64, fd, buf, cap - 1, 0);
+  if ( r > 0 ) buf[r] = '\0';
+  return r;
+}
+
+inline int
+__open_proc(int pid, const char *leaf)
+{
+  char path[64] = "/proc/";
+  usize n = 6;
+  char digits[12];
+  int k = 0;
+  for ( int v = pid; k == 0 || v > 0; v /= 10 ) digits[k++] = static_cast<char>('0' + v % 10);
+  while ( k > 0 ) path[n++] = digits[--k];
+  path[n++] = '/';
+  while ( *leaf ) path[n++] = *leaf++;
+  path[n] = '\0';
+  return micron::open(path, micron::posix::o_rdonly | micron::posix::o_cloexec);
+}
+
+// AT_PAGESZ from our own auxv, the child has the same page size
+inline u64
+__page_kb(void)
+{
+  int fd = micron::open("/proc/self/auxv", micron::posix::o_rdonly | micron::posix::o_cloexec);
+  u64 aux[2 * 64];
+  u64 page = 4096;
+  if ( fd >= 0 ) {
+    const long r = micron::posix::read(fd, aux, sizeof(aux));
+    for ( long i = 0; i + 1 < r / 8; i += 2 )
+      if ( aux[i] == 6 /* AT_PAGESZ */ ) page = aux[i + 1];
+    micron::close(fd);
+  }
+  return page / 1024;
+}
+
+};     // namespace __impl
+
+class sampler
+{
+  int pid = -1;
+  int statm_fd = -1;
+  int stat_fd = -1;
+  u64 page_kb = 4;
+  u64 t0_ns = 0;
+  u64 interval_ns = 0;
+  sample *buf = nullptr;
+  usize cap = 0;
+  usize n = 0;
+  u32 stride = 1;     // keep one tick out of stride
+  u32 tick_no = 0;
+  u32 since_rollup = 0;
+  char text[1024];     // smaps_rollup is ~ 800 bytes; statm and stat fit easily
+  // summary
+  u64 peak_rss = 0;
+  u64 peak_anon = 0;
+  u64 peak_file = 0;
+  u64 rollup_rss = 0;
+  u64 pss = 0;
+  u64 swap = 0;
+  double rss_sum = 0.0;
+  u64 rss_n = 0;
+  u64 flt0 = 0;
+  u64 flt_last = 0;
+  u64 t_last_ns = 0;
+  bool any = false;
+
+  static constexpr u32 rollup_every = 16;
+
+  void
+  __close(int &fd)
+  {
+    if ( fd >= 0 ) micron::close(fd);
+    fd = -1;
+  }
+
+  void
+  __rollup(void)
+  {
+    // pins the mm at open: opened here, after exec, every time
+    int fd = __impl::__open_proc(pid, "smaps_rollup");
+    if ( fd < 0 ) return;
+    const long r = __impl::__pread(fd, text, sizeof(text));
+    micron::close(fd);
+    if ( r <= 0 ) return;
+    pss = __impl::__kb_of(text, static_cast<usize>(r), "Pss");
+    swap = __impl::__kb_of(text, static_cast<usize>(r), "Swap");
+  }
+
+  void
+  __push(const sample &s)
+  {
+    if ( n == cap ) {
+      for ( usize i = 0; i < n / 2; ++i ) buf[i] = buf[2 * i];
+      n /= 2;
+      stride *= 2;
+    }
+    buf[n++] = s;
+  }
+
+public:
+  sampler(void) = default;
+  sampler(const sampler &) = delete;
+  sampler &operator=(const sampler &) = delete;
+
+  ~sampler()
+  {
+    __close(statm_fd);
+    __close(stat_fd);
+    delete[] buf;
+  }
+
+  // capacity: timeline length kept (0 = summary only); the buffer is allocated here, not per tick
+  bool
+  open(int child_pid, u32 interval_us, usize capacity)
+  {
+    pid = child_pid;
+    interval_ns = static_cast<u64>(interval_us) * 1000ull;
+    statm_fd = __impl::__open_proc(pid, "statm");
+    stat_fd = __impl::__open_proc(pid, "stat");
+    page_kb = __impl::__page_kb();
+    if ( capacity ) {
+      buf = new sample[capacity];
+      cap = capacity;
+    }
+    return statm_fd >= 0;
+  }
+
+  u64
+  period_ns(void) const
+  {
+    return interval_ns;
+  }
+
+  void
+  start(u64 now_ns)
+  {
+    t0_ns = now_ns;
+  }
+
+  void
+  tick(u64 now_ns)
+  {
+    if ( statm_fd < 0 ) return;
+    long r = __impl::__pread(statm_fd, text, sizeof(text));
+    if ( r <= 0 ) return;
+    const char *end = text + r;
+    u64 size = 0, resident = 0, shared = 0;
+    const char *p = __impl::__parse_u64(text, end, size);
+    p = __impl::__parse_u64(p, end, resident);
+    __impl::__parse_u64(p, end, shared);
+    if ( resident == 0 ) return;     // exited, the zombie has no mm left
+
+    sample s{};
+    s.t_us = (now_ns - t0_ns) / 1000ull;
+    s.rss_kb = resident * page_kb;
+    s.file_kb = shared * page_kb;
+    s.anon_kb = s.rss_kb > s.file_kb ? s.rss_kb - s.file_kb : 0;
+    if ( stat_fd >= 0 && (r = __impl::__pread(stat_fd, text, sizeof(text))) > 0 ) {
+      // fields after "(comm)": state ppid pgrp session tty tpgid flags minflt cminflt majflt
+      end = text + r;
+      p = end;
+      while ( p > text && *(p - 1) != ')' ) --p;
+      for ( int f = 0; f < 10 && p < end; ++f ) {
+        u64 v = 0;
+        p = __impl::__parse_u64(p, end, v);     // state isn't numeric: v = 0, skipped below
+        if ( f == 7 ) s.minflt = v;
+        if ( f == 9 ) s.majflt = v;
+        while ( p < end && *p != ' ' ) ++p;
+      }
+    }
+
+    if ( !any ) flt0 = s.minflt + s.majflt;
+    any = true;
+    flt_last = s.minflt + s.majflt;
+    t_last_ns = now_ns;
+    rss_sum += static_cast<double>(s.rss_kb);
+    ++rss_n;
+    ++since_rollup;
+    if ( s.rss_kb > peak_rss ) {
+      peak_rss = s.rss_kb;
+      peak_anon = s.anon_kb;
+      peak_file = s.file_kb;
+      if ( since_rollup >= rollup_every || rollup_rss == 0 ) {
+        __rollup();
+        rollup_rss = s.rss_kb;
+        since_rollup = 0;
+      }
+    }
+    if ( cap && tick_no++ % stride == 0 ) __push(s);
+  }
+
+  void
+  collect(benchmark_t &b) const
+  {
+    b.mem_samples = static_cast<long long>(rss_n);
+    if ( !any ) return;
+    b.mem_peak_rss_kb = static_cast<long long>(peak_rss);
+    b.mem_peak_anon_kb = static_cast<long long>(peak_anon);
+    b.mem_peak_file_kb = static_cast<long long>(peak_file);
+    b.mem_avg_rss_kb = static_cast<long long>(rss_sum / static_cast<double>(rss_n));
+    b.mem_pss_kb = static_cast<long long>(pss);
+    b.mem_swap_kb = static_cast<long long>(swap);
+    const double secs = static_cast<double>(t_last_ns - t0_ns) / 1e9;
+    b.mem_fault_rate = secs > 0.0 ? static_cast<double>(flt_last - flt0) / secs : 0.0;
+  }
+
+  void
+  collect(timeline &tl) const
+  {
+    tl.interval_us = interval_ns / 1000ull * stride;
+    tl.samples.reserve(n);
+    for ( usize i = 0; i < n; ++i ) tl.samples.push_back(buf[i]);
+  }
+};
+
+};     // namespace bbench::memsample
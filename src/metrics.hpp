@@ -8,8 +8,12 @@
 
 #include <micron/memory/cmemory.hpp>
 #include <micron/types.hpp>
+#include <micron/vector.hpp>
 
+#include "events.hpp"
+#include "format.hpp"
 #include "funcs.hpp"
+#include "sysfs.hpp"
 
 // pseudo perf stat -M metrics for benchmark_t
 // -> ipc
@@ -17,9 +21,10 @@
 // -> cache_miss_rate
 // -> frontend_stall_rate
 // -> backend_stall_rate
-// -> ghz
+// -> ghz (cycles over wall time), clock_ratio (cycles / ref-cycles), eff_ghz (ratio x nominal)
 // -> inst_per_ns
 // -> dtlb_miss_rate, itlb_miss_rate, l1d_miss_rate, llc_miss_rate
+// and user expressions (-M 'l3_mpki=LLC-load-misses/instructions*1000'), see expr below
 
 namespace bbench::metric
 {
@@ -104,24 +109,40 @@ ghz(const benchmark_t &b)
   return __safe_div(b.cycles, static_cast<long long>(b.time * 1000.0));
 }
 
+// expr is the same metric in -M expression form, over perf event names so it also works with -e
+inline double
+clock_ratio(const benchmark_t &b)
+{
+  return __safe_div(b.cycles, b.total_cycles);
+}
+
+inline double
+eff_ghz(const benchmark_t &b)
+{
+  return b.eff_ghz;
+}
+
 struct named_metric {
   const char *name;
   double (*fn)(const benchmark_t &);
+  const char *expr;
 };
 
 inline constexpr named_metric known_metrics[] = {
-  { "ipc", &ipc },
-  { "cpi", &cpi },
-  { "branch-miss-rate", &branch_miss_rate },
-  { "cache-miss-rate", &cache_miss_rate },
-  { "frontend-stall-rate", &frontend_stall_rate },
-  { "backend-stall-rate", &backend_stall_rate },
-  { "l1d-miss-rate", &l1d_miss_rate },
-  { "l1i-miss-rate", &l1i_miss_rate },
-  { "llc-miss-rate", &llc_miss_rate },
-  { "dtlb-miss-rate", &dtlb_miss_rate },
-  { "itlb-miss-rate", &itlb_miss_rate },
-  { "ghz", &ghz },
+  { "ipc", &ipc, "instructions / cycles" },
+  { "cpi", &cpi, "cycles / instructions" },
+  { "branch-miss-rate", &branch_miss_rate, "branch-misses / branches" },
+  { "cache-miss-rate", &cache_miss_rate, "cache-misses / L1-dcache-loads" },
+  { "frontend-stall-rate", &frontend_stall_rate, "stalled-cycles-frontend / cycles" },
+  { "backend-stall-rate", &backend_stall_rate, "stalled-cycles-backend / cycles" },
+  { "l1d-miss-rate", &l1d_miss_rate, "L1-dcache-load-misses / L1-dcache-loads" },
+  { "l1i-miss-rate", &l1i_miss_rate, "L1-icache-load-misses / L1-icache-loads" },
+  { "llc-miss-rate", &llc_miss_rate, "LLC-load-misses / LLC-loads" },
+  { "dtlb-miss-rate", &dtlb_miss_rate, "dTLB-load-misses / dTLB-loads" },
+  { "itlb-miss-rate", &itlb_miss_rate, "iTLB-load-misses / iTLB-loads" },
+  { "ghz", &ghz, "cycles / (time_us * 1000)" },
+  { "clock-ratio", &clock_ratio, "cycles / ref-cycles" },
+  { "eff-ghz", &eff_ghz, "eff_ghz" },
 };
 
 inline const named_metric *
@@ -134,4 +155,407 @@ lookup_metric(const char *name)
   return nullptr;
 }
 
+// perf event names (as -e takes them) of the counters benchmark_t has a column for
+struct event_field {
+  const char *event;
+  const char *column;     // format::fields name
+};
+
+inline constexpr event_field event_fields[] = {
+  { "cycles", "cycles" },
+  { "cpu-cycles", "cycles" },
+  { "instructions", "instructions" },
+  { "branches", "branches" },
+  { "branch-instructions", "branches" },
+  { "branch-misses", "branch_misses" },
+  { "cache-misses", "cache_misses" },
+  { "bus-cycles", "bus_cycles" },
+  { "stalled-cycles-frontend", "stalled_front" },
+  { "stalled-cycles-backend", "stalled_back" },
+  { "ref-cycles", "total_cycles" },
+  { "cpu-clock", "cpu_time" },
+  { "page-faults", "page_faults" },
+  { "faults", "page_faults" },
+  { "context-switches", "context_switches" },
+  { "cs", "context_switches" },
+  { "cpu-migrations", "migrations" },
+  { "migrations", "migrations" },
+  { "minor-faults", "minor_faults" },
+  { "major-faults", "major_faults" },
+  { "alignment-faults", "alignment_faults" },
+  { "emulation-faults", "emulation_faults" },
+  { "L1-dcache-loads", "l1_cache" },
+  { "L1-dcache-load-misses", "l1d_miss" },
+  { "L1-dcache-prefetches", "l1d_prefetch" },
+  { "L1-dcache-prefetch-misses", "l1d_prefetch_miss" },
+  { "L1-icache-loads", "l1t_cache" },
+  { "L1-icache-load-misses", "l1t_miss" },
+  { "LLC-loads", "ll_cache" },
+  { "LLC-load-misses", "llcache_miss" },
+  { "dTLB-loads", "dtlb_access" },
+  { "dTLB-load-misses", "dtlb_miss" },
+  { "iTLB-loads", "itlb_access" },
+  { "iTLB-load-misses", "itlb_miss" },
+  { "branch-loads", "bpu" },
+  { "node-loads", "cache_node" },
+};
+
+// one operand of an expression: a benchmark_t column, a perf event, or both when the event has a
+// column. field is what a static run reads, event what -e has to open
+struct ref {
+  const format::field_def *field;
+  const event_def *event;
+};
+
+// value with its standard deviation, for expressions over many runs
+struct uval {
+  double v;
+  double sd;
+};
+
+namespace __impl
+{
+
+inline const format::field_def *
+__field(const char *column)
+{
+  for ( const format::field_def &f : format::fields )
+    if ( micron::strcmp(f.name, column) == 0 ) return &f;
+  return nullptr;
+}
+
+// name is either a column or an event; fills in the other side where there is one
+inline bool
+__resolve(const char *name, ref &r)
+{
+  r.field = __field(name);
+  r.event = lookup_event(name);
+  for ( const event_field &m : event_fields ) {
+    if ( r.field && !r.event && micron::strcmp(m.column, name) == 0 ) r.event = lookup_event(m.event);
+    if ( r.event && !r.field && micron::strcmp(m.event, name) == 0 ) r.field = __field(m.column);
+  }
+  return r.field || r.event;
+}
+
+inline bool
+__ident_start(char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+inline bool
+__ident_char(char c)
+{
+  return __ident_start(c) || (c >= '0' && c <= '9') || c == '-' || c == '.';
+}
+
+inline double
+__abs(double x)
+{
+  return x < 0 ? -x : x;
+}
+
+};     // namespace __impl
+
+// a -M expression, compiled once to a small stack program:
+//   metric   = [name '='] expr            (no name: the expression text is the name)
+//   expr     = term (('+' | '-') term)*
+//   term     = unary (('*' | '/') unary)*
+//   unary    = '-' unary | number | name | '(' expr ')'
+// a name is a format::fields column (time_us, llcache_miss, ...), a perf event name
+// (LLC-load-misses, ref-cycles, ...) or a known metric, which expands in place. names may contain
+// '-': the longest known name wins, so "cycles-instructions" is a subtraction but
+// "L1-dcache-loads" one operand; put spaces around a minus to be sure. x / 0 is 0
+class expr
+{
+  enum class opc : u8 { constant, load, neg, add, sub, mul, div };
+
+  struct op {
+    opc code;
+    u32 arg;     // load: refs index
+    double k;    // constant
+  };
+
+  micron::vector<op> prog;
+  micron::vector<ref> refs;
+  char label[64] = {};
+  const char *p = nullptr;
+  const char *err = nullptr;
+  u32 depth = 0;
+
+  void
+  __emit(opc c, u32 arg = 0, double k = 0.0)
+  {
+    prog.push_back(op{ c, arg, k });
+  }
+
+  void
+  __skip(void)
+  {
+    while ( *p == ' ' || *p == '\t' ) ++p;
+  }
+
+  bool
+  __fail(const char *why)
+  {
+    if ( !err ) err = why;
+    return false;
+  }
+
+  bool
+  __compile(const char *text)
+  {
+    const char *saved = p;
+    p = text;
+    const bool ok = __expr();
+    __skip();
+    p = saved;
+    return ok;
+  }
+
+  bool
+  __name(void)
+  {
+    // the longest prefix of the identifier run that names something; shorter ones end before a '-'
+    const char *end = p;
+    while ( __impl::__ident_char(*end) ) ++end;
+    char buf[64];
+    for ( const char *e = end; e > p; --e ) {
+      if ( e != end && *e != '-' ) continue;
+      const usize n = static_cast<usize>(e - p);
+      if ( n >= sizeof(buf) ) continue;
+      micron::memcpy(buf, p, n);
+      buf[n] = '\0';
+      ref r{};
+      if ( __impl::__resolve(buf, r) ) {
+        p = e;
+        u32 idx = static_cast<u32>(refs.size());
+        for ( u32 i = 0; i < refs.size(); ++i )
+          if ( refs[i].field == r.field && refs[i].event == r.event ) idx = i;
+        if ( idx == refs.size() ) refs.push_back(r);
+        __emit(opc::load, idx);
+        return true;
+      }
+      const named_metric *m = lookup_metric(buf);
+      if ( m ) {
+        if ( ++depth > 8 ) return __fail("metrics nest too deep");
+        p = e;
+        const bool ok = __compile(m->expr);
+        --depth;
+        return ok;
+      }
+    }
+    return __fail("unknown counter or metric name");
+  }
+
+  bool
+  __unary(void)
+  {
+    __skip();
+    if ( *p == '-' ) {
+      ++p;
+      if ( !__unary() ) return false;
+      __emit(opc::neg);
+      return true;
+    }
+    if ( *p == '(' ) {
+      ++p;
+      if ( !__expr() ) return false;
+      __skip();
+      if ( *p != ')' ) return __fail("missing ')'");
+      ++p;
+      return true;
+    }
+    if ( *p >= '0' && *p <= '9' ) {
+      double v = 0.0;
+      if ( !sys::parse_double(p, v) ) return __fail("bad number");
+      __emit(opc::constant, 0, v);
+      return true;
+    }
+    if ( __impl::__ident_start(*p) ) return __name();
+    return __fail("expected a number, a name or '('");
+  }
+
+  bool
+  __term(void)
+  {
+    if ( !__unary() ) return false;
+    for ( ;; ) {
+      __skip();
+      const char c = *p;
+      if ( c != '*' && c != '/' ) return true;
+      ++p;
+      if ( !__unary() ) return false;
+      __emit(c == '*' ? opc::mul : opc::div);
+    }
+  }
+
+  bool
+  __expr(void)
+  {
+    if ( !__term() ) return false;
+    for ( ;; ) {
+      __skip();
+      const char c = *p;
+      if ( c != '+' && c != '-' ) return true;
+      ++p;
+      if ( !__term() ) return false;
+      __emit(c == '+' ? opc::add : opc::sub);
+    }
+  }
+
+public:
+  // "name=expr" or "expr"; false with error() set when it doesn't parse or names something unknown
+  bool
+  compile(const char *spec)
+  {
+    const char *eq = spec;
+    while ( *eq && *eq != '=' ) ++eq;
+    const char *body = *eq == '=' ? eq + 1 : spec;
+    const usize n = static_cast<usize>(eq - spec);
+    sys::copy_line(label, n + 1 < sizeof(label) ? n + 1 : sizeof(label), spec);
+    p = body;
+    const bool ok = __expr();
+    __skip();
+    if ( ok && *p ) return __fail("unexpected text after the expression");
+    return ok && !err;
+  }
+
+  const char *
+  error(void) const
+  {
+    return err;
+  }
+
+  // how far into the spec the parser got, for pointing at the error
+  const char *
+  where(void) const
+  {
+    return p;
+  }
+
+  const char *
+  name(void) const
+  {
+    return label;
+  }
+
+  const micron::vector<ref> &
+  operands(void) const
+  {
+    return refs;
+  }
+
+  // the -d level that measures every column it reads
+  u32
+  detail(void) const
+  {
+    u32 d = 1;
+    for ( const ref &r : refs )
+      if ( r.field && r.field->detail > d ) d = r.field->detail;
+    return d;
+  }
+
+  // true when some operand is an event benchmark_t has no column for (only -e can count it)
+  bool
+  needs_dynamic(void) const
+  {
+    for ( const ref &r : refs )
+      if ( !r.field ) return true;
+    return false;
+  }
+
+  // appends the events it reads that aren't in events yet (same type and config)
+  void
+  add_events(micron::vector<event_def> &events) const
+  {
+    for ( const ref &r : refs ) {
+      if ( !r.event ) continue;
+      bool have = false;
+      for ( const event_def &e : events )
+        if ( e.type == r.event->type && e.config == r.event->config ) have = true;
+      if ( !have ) events.push_back(*r.event);
+    }
+  }
+
+  // value(const ref &) -> double for each operand
+  template <typename F>
+  double
+  eval(F &&value) const
+  {
+    double st[64];
+    usize sp = 0;
+    for ( const op &o : prog ) {
+      switch ( o.code ) {
+      case opc::constant :
+        st[sp++] = o.k;
+        break;
+      case opc::load :
+        st[sp++] = value(refs[o.arg]);
+        break;
+      case opc::neg :
+        st[sp - 1] = -st[sp - 1];
+        break;
+      default : {
+        const double b = st[--sp], a = st[sp - 1];
+        st[sp - 1] = o.code == opc::add ? a + b : o.code == opc::sub ? a - b : o.code == opc::mul ? a * b : (b != 0.0 ? a / b : 0.0);
+      }
+      }
+      if ( sp >= 64 ) return 0.0;
+    }
+    return sp ? st[sp - 1] : 0.0;
+  }
+
+  // on one static run
+  double
+  on(const benchmark_t &b) const
+  {
+    return eval([&](const ref &r) { return r.field ? r.field->get(b) : 0.0; });
+  }
+
+  // over many static runs: the expression of the column means, sd that of the per-run values. the
+  // operands of a ratio like ipc move together from run to run, so their spreads can't be
+  // propagated as if independent
+  uval
+  over(const micron::vector<benchmark_t> &runs) const
+  {
+    const double v = eval([&](const ref &r) { return r.field ? format::compute_stats(runs, r.field->get).mean : 0.0; });
+    return uval{ v, format::compute_stats(runs, [&](const benchmark_t &b) { return on(b); }).stddev };
+  }
+};
+
+// a -M list: comma-separated known metric names and name=expr definitions
+inline bool
+compile_list(const char *csv, micron::vector<expr> &out, const format::sink &err)
+{
+  char buf[256];
+  usize bi = 0;
+  bool ok = true;
+  for ( const char *q = csv;; ++q ) {
+    if ( *q == ',' || *q == '\0' ) {
+      if ( bi > 0 ) {
+        buf[bi] = '\0';
+        expr e;
+        if ( e.compile(buf) ) {
+          out.push_back(micron::move(e));
+        } else {
+          err.emit("bbench: -M '");
+          err.emit(buf);
+          err.emit("': ");
+          err.emit(e.error());
+          err.emit(" at '");
+          err.emit(e.where());
+          err.emit("'\n");
+          ok = false;
+        }
+        bi = 0;
+      }
+      if ( *q == '\0' ) break;
+    } else if ( bi < sizeof(buf) - 1 ) {
+      buf[bi++] = *q;
+    }
+  }
+  return ok;
+}
+
 };     // namespace bbench::metric
@@ -0,0 +1,549 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <linux/perf_event.h>
+
+#include <micron/linux/io.hpp>
+#include <micron/linux/sys/ioctl.hpp>
+#include <micron/linux/sys/fcntl.hpp>
+#include <micron/memory/cmemory.hpp>
+#include <micron/string/string.hpp>
+#include <micron/syscall.hpp>
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+#include "process.hpp"
+#include "ring.hpp"
+#include "sysfs.hpp"
+
+// off-CPU time of a binary run or an in-process payload (bbench --off-cpu)
+//
+// a dummy event with context_switch = 1 gives a PERF_RECORD_SWITCH for every switch in / out of
+// the traced tasks; the out record says whether the task was preempted (still runnable) or went
+// to sleep. sched:sched_switch samples with callchains land in the same ring and name the stack
+// each task left the cpu from. both are inherited, so one ring per cpu as in proctree.
+// a voluntary interval is split at its sched_wakeup: out -> wakeup is blocked, wakeup -> in is
+// waiting for a cpu. sched_wakeup fires in the waker's context, so it can only be seen cpu-wide
+// with the raw payload (perf_event_paranoid <= -1 or CAP_PERFMON); without it voluntary intervals
+// count as blocked whole. callchains need perf_event_paranoid <= 1
+namespace bbench::offcpu
+{
+
+inline constexpr u32 max_depth = 32;
+
+// one distinct switch-out callchain and the off-CPU time that followed it
+struct stack {
+  u64 ips[max_depth];     // innermost first, PERF_CONTEXT_* markers included
+  u32 depth;
+  u64 count;
+  u64 total_ns;
+};
+
+struct result {
+  micron::string name;
+  double time;
+  child_usage usage;     // binaries only
+  u64 offcpu_ns;
+  u64 runnable_ns;     // preempted, or woken and waiting for a cpu
+  u64 blocked_ns;      // asleep until the wakeup
+  u64 switches;
+  u64 preemptions;
+  micron::vector<stack> stacks;     // by total_ns
+  u64 lost;                         // records the kernel dropped (ring too small)
+  bool wakeups;                     // false: no sched_wakeup, voluntary intervals count as blocked
+  bool callchains;                  // false: sched_switch couldn't be sampled, no stacks
+  bool ok;                          // false: switch records couldn't be opened
+};
+
+namespace __impl
+{
+
+enum __kind : u32 { __ev_stack = 0, __ev_out = 1, __ev_wake = 2, __ev_in = 3 };
+
+struct __event {
+  u64 t;
+  i32 tid;
+  u32 kind;
+  u32 stack;
+  bool preempt;
+};
+
+// per tid, while walking the events in time order
+struct __thread {
+  i32 tid;
+  u64 out_t;     // 0 = on cpu
+  u64 wake_t;
+  u32 stack;     // ~0u = none seen
+  bool preempt;
+};
+
+inline constexpr u32 __no_stack = ~0u;
+
+template <typename T, typename L>
+inline void
+__sift(T *v, usize i, usize n, L &less)
+{
+  for ( ;; ) {
+    usize c = 2 * i + 1;
+    if ( c >= n ) return;
+    if ( c + 1 < n && less(v[c], v[c + 1]) ) ++c;
+    if ( !less(v[i], v[c]) ) return;
+    T t = v[i];
+    v[i] = v[c];
+    v[c] = t;
+    i = c;
+  }
+}
+
+// in place, no allocation: event lists get long
+template <typename T, typename L>
+inline void
+__heap_sort(T *v, usize n, L &&less)
+{
+  if ( n < 2 ) return;
+  for ( usize i = n / 2; i-- > 0; ) __sift(v, i, n, less);
+  for ( usize e = n - 1; e > 0; --e ) {
+    T t = v[0];
+    v[0] = v[e];
+    v[e] = t;
+    __sift(v, 0, e, less);
+  }
+}
+
+inline u64
+__hash_ips(const u64 *ips, u32 depth)
+{
+  u64 h = 0xcbf29ce484222325ull;
+  for ( u32 i = 0; i < depth; ++i ) h = (h ^ ips[i]) * 0x100000001b3ull;
+  return h ^ depth;
+}
+
+// open addressing key -> index, -1 = empty; the owner keeps the keys
+class __index
+{
+  i32 *slots = nullptr;
+  usize len = 0;
+
+public:
+  __index(void) = default;
+  __index(const __index &) = delete;
+  __index &operator=(const __index &) = delete;
+
+  ~__index() { delete[] slots; }
+
+  // the slot of key; eq(i) compares entry i against key. *slot == -1: not present
+  template <typename E>
+  i32 *
+  find(u64 hash, usize count, E &&eq, u64 (*hash_of)(usize, const void *), const void *owner)
+  {
+    if ( count * 2 >= len ) {
+      delete[] slots;
+      len = len ? len * 2 : 256;
+      slots = new i32[len];
+      for ( usize i = 0; i < len; ++i ) slots[i] = -1;
+      for ( usize i = 0; i < count; ++i ) {
+        usize b = hash_of(i, owner) & (len - 1);
+        while ( slots[b] != -1 ) b = (b + 1) & (len - 1);
+        slots[b] = static_cast<i32>(i);
+      }
+    }
+    usize b = hash & (len - 1);
+    while ( slots[b] != -1 && !eq(static_cast<usize>(slots[b])) ) b = (b + 1) & (len - 1);
+    return &slots[b];
+  }
+};
+
+inline u64
+__hash_tid(i32 tid)
+{
+  return static_cast<u64>(static_cast<u32>(tid)) * 0x9e3779b1u;
+}
+
+};     // namespace __impl
+
+// /proc/kallsyms text symbols, for the kernel half of the stacks; empty when kptr_restrict hides
+// the addresses
+class ksyms
+{
+  struct sym {
+    u64 addr;
+    u32 name;     // offset into names
+  };
+
+  char *names = nullptr;
+  micron::vector<sym> syms;
+
+public:
+  ksyms(void) = default;
+  ksyms(const ksyms &) = delete;
+  ksyms &operator=(const ksyms &) = delete;
+
+  ~ksyms() { delete[] names; }
+
+  bool
+  load(void)
+  {
+    int fd = micron::open("/proc/kallsyms", micron::posix::o_rdonly | micron::posix::o_cloexec);
+    if ( fd < 0 ) return false;
+    // "ffffffff81000000 T _stext\n"; procfs reports no size, read until eof
+    usize cap = 4u << 20, len = 0;
+    names = new char[cap];
+    for ( ;; ) {
+      if ( len + 65536 > cap ) {
+        char *g = new char[cap * 2];
+        micron::memcpy(g, names, len);
+        delete[] names;
+        names = g;
+        cap *= 2;
+      }
+      const long r = micron::posix::read(fd, names + len, 65536);
+      if ( r <= 0 ) break;
+      len += static_cast<usize>(r);
+    }
+    micron::close(fd);
+    names[len] = '\0';
+    for ( usize i = 0; i < len; ) {
+      u64 addr = 0;
+      for ( ; i < len && names[i] != ' '; ++i ) {
+        const char c = names[i];
+        addr = addr * 16 + static_cast<u64>(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+      }
+      const char type = i + 1 < len ? names[i + 1] : '\0';
+      i += 3;
+      const usize name = i;
+      while ( i < len && names[i] != '\n' && names[i] != '\t' && names[i] != ' ' ) ++i;
+      const usize name_end = i;
+      while ( i < len && names[i] != '\n' ) ++i;
+      const bool text = type == 't' || type == 'T' || type == 'w' || type == 'W';
+      if ( text && addr && name_end < len ) {
+        names[name_end] = '\0';     // the module suffix ("\t[ext4]") goes with the terminator
+        syms.push_back({ addr, static_cast<u32>(name) });
+      }
+      ++i;
+    }
+    if ( syms.size() == 0 ) return false;
+    __impl::__heap_sort(&syms[0], syms.size(), [](const sym &a, const sym &b) { return a.addr < b.addr; });
+    return true;
+  }
+
+  // the symbol ip falls in and its offset; nullptr when below the first one or not loaded
+  const char *
+  find(u64 ip, u64 &off) const
+  {
+    if ( syms.size() == 0 || ip < syms[0].addr ) return nullptr;
+    usize lo = 0, hi = syms.size();
+    while ( hi - lo > 1 ) {
+      const usize mid = (lo + hi) / 2;
+      if ( syms[mid].addr <= ip )
+        lo = mid;
+      else
+        hi = mid;
+    }
+    off = ip - syms[lo].addr;
+    return names + syms[lo].name;
+  }
+};
+
+// PERF_CONTEXT_KERNEL / USER / ...: markers in a callchain, not addresses
+inline bool
+is_context(u64 ip)
+{
+  return ip >= static_cast<u64>(-4095);
+}
+
+inline constexpr u64 context_kernel = static_cast<u64>(-128);     // PERF_CONTEXT_KERNEL
+
+// index of the first kernel frame in s (after PERF_CONTEXT_KERNEL); s.depth when there is none
+inline u32
+kernel_begin(const stack &s)
+{
+  for ( u32 k = 0; k < s.depth; ++k )
+    if ( s.ips[k] == context_kernel ) return k + 1;
+  return s.depth;
+}
+
+class tracer
+{
+  ring_set task_rings;     // SWITCH records + sched_switch callchains of the traced tasks
+  ring_set wake_rings;     // cpu-wide sched_wakeup
+  micron::vector<int> task_fds;     // ring and redirected, for enable / disable
+  micron::vector<int> wake_fds;
+  micron::vector<int> owned;     // the redirected ones, closed here
+  long wake_pid = -1;            // offset of the woken pid in the sched_wakeup payload
+  bool self = false;
+  bool have_switch = false;
+  bool have_stacks = false;
+
+  micron::vector<__impl::__event> events;
+  micron::vector<stack> stacks;
+  micron::vector<i32> tids;     // every tid that switched, to filter the system-wide wakeups
+  __impl::__index stack_index;
+  __impl::__index tid_index;
+
+  static u64
+  __stack_hash(usize i, const void *owner)
+  {
+    const stack &s = static_cast<const tracer *>(owner)->stacks[i];
+    return __impl::__hash_ips(s.ips, s.depth);
+  }
+
+  static u64
+  __tid_hash(usize i, const void *owner)
+  {
+    return __impl::__hash_tid(static_cast<const tracer *>(owner)->tids[i]);
+  }
+
+  u32
+  __intern(const u64 *ips, u32 depth)
+  {
+    i32 *slot = stack_index.find(
+        __impl::__hash_ips(ips, depth), stacks.size(),
+        [&](usize i) {
+          if ( stacks[i].depth != depth ) return false;
+          for ( u32 k = 0; k < depth; ++k )
+            if ( stacks[i].ips[k] != ips[k] ) return false;
+          return true;
+        },
+        &__stack_hash, this);
+    if ( *slot == -1 ) {
+      stack s{};
+      micron::memcpy(s.ips, ips, depth * sizeof(u64));
+      s.depth = depth;
+      stacks.push_back(s);
+      *slot = static_cast<i32>(stacks.size() - 1);
+    }
+    return static_cast<u32>(*slot);
+  }
+
+  i32 *
+  __tid_slot(i32 tid)
+  {
+    return tid_index.find(__impl::__hash_tid(tid), tids.size(), [&](usize i) { return tids[i] == tid; }, &__tid_hash, this);
+  }
+
+  void
+  __task_record(const perf_event_header &h, const char *body, usize len)
+  {
+    if ( h.type == PERF_RECORD_SWITCH && len >= 16 ) {
+      // sample_id_all with TID | TIME: { pid, tid, time }
+      const i32 tid = *reinterpret_cast<const i32 *>(body + 4);
+      const u64 t = *reinterpret_cast<const u64 *>(body + 8);
+      const bool out = h.misc & PERF_RECORD_MISC_SWITCH_OUT;
+      const bool preempt = h.misc & PERF_RECORD_MISC_SWITCH_OUT_PREEMPT;
+      events.push_back({ t, tid, out ? __impl::__ev_out : __impl::__ev_in, __impl::__no_stack, preempt });
+      i32 *slot = __tid_slot(tid);
+      if ( *slot == -1 ) {
+        tids.push_back(tid);
+        *slot = static_cast<i32>(tids.size() - 1);
+      }
+    } else if ( h.type == PERF_RECORD_SAMPLE && len >= 24 ) {
+      // TID | TIME | CALLCHAIN: { pid, tid, time, nr, ips[nr] }
+      const i32 tid = *reinterpret_cast<const i32 *>(body + 4);
+      const u64 t = *reinterpret_cast<const u64 *>(body + 8);
+      u64 nr = *reinterpret_cast<const u64 *>(body + 16);
+      if ( 24 + nr * 8 > len ) return;
+      if ( nr > max_depth ) nr = max_depth;
+      const u32 s = __intern(reinterpret_cast<const u64 *>(body + 24), static_cast<u32>(nr));
+      events.push_back({ t, tid, __impl::__ev_stack, s, false });
+    }
+  }
+
+  void
+  __wake_record(const perf_event_header &h, const char *body, usize len)
+  {
+    // TID | TIME | RAW: { pid, tid, time, raw_size, raw[] }
+    if ( h.type != PERF_RECORD_SAMPLE || len < 20 + static_cast<usize>(wake_pid) + 4 ) return;
+    const u64 t = *reinterpret_cast<const u64 *>(body + 8);
+    const i32 woken = *reinterpret_cast<const i32 *>(body + 20 + wake_pid);
+    if ( *__tid_slot(woken) == -1 ) return;     // not ours (or woken before its first switch, harmless)
+    events.push_back({ t, woken, __impl::__ev_wake, __impl::__no_stack, false });
+  }
+
+  void
+  __open_wakeups(void)
+  {
+    const long long id = sys::tracepoint_id("sched/sched_wakeup");
+    wake_pid = sys::tracepoint_field("sched/sched_wakeup", "pid");
+    if ( id < 0 || wake_pid < 0 ) return;
+    perf_event_attr a{};
+    a.size = sizeof(a);
+    a.type = PERF_TYPE_TRACEPOINT;
+    a.config = static_cast<u64>(id);
+    a.sample_period = 1;
+    a.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+    a.disabled = 1;
+    // every wakeup on the machine comes through here; 256 KiB per cpu
+    wake_rings.open(a, -1, [&](int, perf_ring &ring) { wake_fds.push_back(ring.fd()); }, 6);
+  }
+
+public:
+  tracer(void) = default;
+  tracer(const tracer &) = delete;
+  tracer &operator=(const tracer &) = delete;
+
+  ~tracer()
+  {
+    for ( int fd : owned ) micron::close(fd);
+  }
+
+  // pid = a parked child (enabled on exec) or 0 for the calling thread and the threads it starts
+  // (enabled by enable()). false: context switch records couldn't be opened on any cpu
+  bool
+  attach(int pid)
+  {
+    self = pid == 0;
+    const bool on_exec = !self;
+    perf_event_attr a{};
+    a.size = sizeof(a);
+    a.type = PERF_TYPE_SOFTWARE;
+    a.config = PERF_COUNT_SW_DUMMY;
+    a.context_switch = 1;
+    a.sample_id_all = 1;
+    a.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME;
+    a.exclude_kernel = 1;     // switch records don't care, it keeps paranoid 2 working
+    a.exclude_hv = 1;
+    a.inherit = 1;
+    a.disabled = 1;
+    a.enable_on_exec = on_exec;
+
+    const long long switch_id = sys::tracepoint_id("sched/sched_switch");
+    perf_event_attr s{};
+    s.size = sizeof(s);
+    s.type = PERF_TYPE_TRACEPOINT;
+    s.config = static_cast<u64>(switch_id);
+    s.sample_period = 1;
+    s.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN;
+    s.sample_max_stack = max_depth;
+    s.inherit = 1;
+    s.disabled = 1;
+    s.enable_on_exec = on_exec;
+
+    have_switch = task_rings.open(
+                      a, pid,
+                      [&](int cpu, perf_ring &ring) {
+                        task_fds.push_back(ring.fd());
+                        if ( switch_id < 0 ) return;
+                        // the tracepoint fires in kernel mode: exclude_kernel would filter every hit
+                        perf_event_attr x = s;
+                        long fd = micron::syscall(SYS_perf_event_open, &x, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+                        if ( fd < 0 ) return;
+                        owned.push_back(static_cast<int>(fd));
+                        task_fds.push_back(static_cast<int>(fd));
+                        if ( ring.redirect(static_cast<int>(fd)) ) have_stacks = true;
+                      },
+                      6)
+                  > 0;
+    if ( have_switch ) __open_wakeups();
+    return have_switch;
+  }
+
+  // starts the cpu-wide wakeups, and the task events when attached to pid 0 (a child's start on exec)
+  void
+  enable(void)
+  {
+    for ( int fd : wake_fds ) micron::posix::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    if ( self )
+      for ( int fd : task_fds ) micron::posix::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  void
+  disable(void)
+  {
+    for ( int fd : task_fds ) micron::posix::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    for ( int fd : wake_fds ) micron::posix::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+
+  // for the wait loop
+  int
+  watch_fd(void) const
+  {
+    return task_rings.watch_fd();
+  }
+
+  int
+  wake_watch_fd(void) const
+  {
+    return wake_rings.watch_fd();
+  }
+
+  // the task rings first: a wakeup is only kept for a tid already seen switching
+  void
+  drain(void)
+  {
+    task_rings.drain([&](const perf_event_header &h, const char *body, usize len) { __task_record(h, body, len); });
+    wake_rings.drain([&](const perf_event_header &h, const char *body, usize len) { __wake_record(h, body, len); });
+  }
+
+  void
+  finish(result &r)
+  {
+    drain();
+    r.ok = have_switch;
+    r.callchains = have_stacks;
+    r.wakeups = wake_rings.size() > 0;
+    r.lost = task_rings.lost_records() + wake_rings.lost_records();
+    r.offcpu_ns = r.runnable_ns = r.blocked_ns = r.switches = r.preemptions = 0;
+    if ( events.size() == 0 ) return;
+
+    // rings are per cpu: merge by time. on a tie the stack sample goes before the out it belongs
+    // to and the wakeup before the switch in
+    __impl::__heap_sort(&events[0], events.size(), [](const __impl::__event &x, const __impl::__event &y) {
+      return x.t < y.t || (x.t == y.t && x.kind < y.kind);
+    });
+
+    micron::vector<__impl::__thread> th;
+    th.reserve(tids.size());
+    for ( usize i = 0; i < tids.size(); ++i ) th.push_back({ tids[i], 0, 0, __impl::__no_stack, false });
+    for ( const __impl::__event &e : events ) {
+      const i32 *slot = __tid_slot(e.tid);
+      if ( *slot == -1 ) continue;
+      __impl::__thread &t = th[static_cast<usize>(*slot)];
+      switch ( e.kind ) {
+      case __impl::__ev_stack :
+        t.stack = e.stack;
+        break;
+      case __impl::__ev_out :
+        t.out_t = e.t;
+        t.wake_t = 0;
+        t.preempt = e.preempt;
+        ++r.switches;
+        if ( e.preempt ) ++r.preemptions;
+        break;
+      case __impl::__ev_wake :
+        if ( t.out_t && !t.preempt && !t.wake_t ) t.wake_t = e.t;
+        break;
+      case __impl::__ev_in : {
+        if ( !t.out_t ) break;     // the first switch in after exec / enable
+        const u64 d = e.t - t.out_t;
+        r.offcpu_ns += d;
+        if ( t.preempt ) {
+          r.runnable_ns += d;
+        } else if ( t.wake_t ) {
+          r.blocked_ns += t.wake_t - t.out_t;
+          r.runnable_ns += e.t - t.wake_t;
+        } else {
+          r.blocked_ns += d;
+        }
+        if ( t.stack != __impl::__no_stack ) {
+          stacks[t.stack].total_ns += d;
+          ++stacks[t.stack].count;
+        }
+        t.out_t = 0;
+        t.stack = __impl::__no_stack;
+        break;
+      }
+      }
+    }
+
+    for ( const stack &s : stacks )
+      if ( s.count ) r.stacks.push_back(s);
+    if ( r.stacks.size() > 1 )
+      __impl::__heap_sort(&r.stacks[0], r.stacks.size(), [](const stack &x, const stack &y) { return x.total_ns > y.total_ns; });
+  }
+};
+
+};     // namespace bbench::offcpu
@@ -23,6 +23,18 @@ struct benchmark_opts {
   const char *event_csv = nullptr;     // -e cycles,instructions,…
   const char *pre = nullptr;           // --pre CMD
   const char *post = nullptr;          // --post CMD
+  const char *const *argv = nullptr;   // -- BIN ARGS...: full argv, argv[0] = path; nullptr = { path }
+  const char *const *envp = nullptr;   // --env K=V: environment override; nullptr = inherit
+  int stdin_fd = -1;                   // --stdin FILE: memfd from map_input()
+  const char *stdout_path = nullptr;   // --stdout FILE (/dev/null to discard)
+  const char *stderr_path = nullptr;   // --stderr FILE
+  int cpu = -1;                        // pin the child to this cpu (-j scheduler); -1 = unpinned
+  bool fork_server = false;            // --fork-server: launch through forkserver::instance() when running
+  bool cgroup = false;                 // --cgroup: run in a transient cgroup v2, count the whole cgroup
+  u32 mem_interval_us = 0;             // --mem-sample US: sample /proc/PID/statm every US; 0 = off
+  u32 mem_capacity = 4096;             // timeline samples kept per run before decimating
+  bool io = false;                     // --io: /proc/PID/io totals of the child
+  u64 ref_khz = 0;                     // --ref-ghz: clock norm_time_us is scaled to; 0 = this host's nominal
 };
 
 };     // namespace bbench
@@ -50,10 +50,18 @@ perf_event_attach(int fd, struct perf_event_attr &event)
   return __pe_call(micron::syscall(SYS_perf_event_open, &event, 0, -1, fd, 0));
 };
 
+// close-on-exec so counters opened for one child don't leak into children forked concurrently (-j)
 static long
 perf_event_pid(struct perf_event_attr &event, pid_t pid)
 {
-  return __pe_call(micron::syscall(SYS_perf_event_open, &event, pid, -1, -1, 0));
+  return __pe_call(micron::syscall(SYS_perf_event_open, &event, pid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+};
+
+// everything running in the cgroup (dir fd) on one cpu
+static long
+perf_event_cgroup(struct perf_event_attr &event, int cgroup_fd, int cpu)
+{
+  return __pe_call(micron::syscall(SYS_perf_event_open, &event, cgroup_fd, cpu, -1, PERF_FLAG_PID_CGROUP | PERF_FLAG_FD_CLOEXEC));
 };
 
 namespace bbench
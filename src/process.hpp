@@ -7,16 +7,26 @@
 #pragma once
 
 #include <micron/bits/__exceptions.hpp>
+#include <micron/chrono.hpp>
 #include <micron/concepts.hpp>
+#include <micron/errno.hpp>
 #include <micron/except.hpp>
 #include <micron/linux/io.hpp>
 #include <micron/linux/sys/exec.hpp>
 #include <micron/linux/sys/fcntl.hpp>
 #include <micron/memory/actions.hpp>
+#include <micron/memory/cmemory.hpp>
 #include <micron/proc.hpp>
+#include <micron/syscall.hpp>
 #include <micron/types.hpp>
 #include <micron/vector.hpp>
 
+#include "options.hpp"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
 namespace bbench
 {
 
@@ -62,9 +72,63 @@ process(const char *t, const R *...args)
   return pid;
 }
 
+// everything process_attach needs to start a binary; unset fields inherit from bbench
+struct launch_spec {
+  const char *path = nullptr;
+  const char *const *argv = nullptr;     // NULL-terminated, argv[0] included; nullptr = { path }
+  const char *const *envp = nullptr;     // NULL-terminated; nullptr = environ
+  int stdin_fd = -1;                     // memfd from map_input(); reopened in the child for a private offset
+  int stdout_fd = -1;                    // dup'd onto 1 / 2 in the child; -1 = inherit our terminal
+  int stderr_fd = -1;
+  int cpu = -1;                          // pin the child to this cpu before exec; -1 = no affinity
+};
+
+namespace __impl
+{
+
+inline int
+__dup_onto(int fd, int target)
+{
+  if ( fd == target ) return target;
+  return static_cast<int>(micron::syscall(SYS_dup3, fd, target, 0));
+}
+
+// runs in the forked child between the sync read and execve; must not allocate
+inline void
+__child_stdio(const launch_spec &ls)
+{
+  if ( ls.stdin_fd >= 0 ) {
+    char p[32] = "/proc/self/fd/";
+    char digits[12];
+    int n = 0;
+    for ( int v = ls.stdin_fd; n == 0 || v > 0; v /= 10 ) digits[n++] = static_cast<char>('0' + v % 10);
+    usize at = 14;
+    while ( n > 0 ) p[at++] = digits[--n];
+    p[at] = '\0';
+    int f = micron::open(p, micron::posix::o_rdonly, 0);
+    if ( f >= 0 ) {
+      __dup_onto(f, 0);
+      if ( f != 0 ) micron::close(f);
+    }
+  }
+  if ( ls.stdout_fd >= 0 ) __dup_onto(ls.stdout_fd, 1);
+  if ( ls.stderr_fd >= 0 ) __dup_onto(ls.stderr_fd, 2);
+}
+
+inline void
+__child_affinity(int cpu)
+{
+  if ( cpu < 0 || cpu >= 1024 ) return;
+  u64 mask[16] = {};
+  mask[cpu / 64] = 1ull << (cpu % 64);
+  micron::syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask);
+}
+
+};     // namespace __impl
+
 template <typename F>
 inline int
-process_attach(const char *path, F &&attach_fn)
+process_attach(const launch_spec &ls, F &&attach_fn)
 {
   int sync_pipe[2];
   if ( micron::pipe2(sync_pipe, micron::posix::o_cloexec) < 0 )
@@ -83,8 +147,12 @@ process_attach(const char *path, F &&attach_fn)
     micron::posix::read(sync_pipe[0], &c, 1);
     micron::close(sync_pipe[0]);
 
-    char *argv[2] = { const_cast<char *>(path), nullptr };
-    micron::posix::execve(path, argv, environ);
+    __impl::__child_stdio(ls);
+    __impl::__child_affinity(ls.cpu);
+    char *def_argv[2] = { const_cast<char *>(ls.path), nullptr };
+    char **argv = ls.argv ? const_cast<char **>(ls.argv) : def_argv;
+    char **envp = ls.envp ? const_cast<char **>(ls.envp) : environ;
+    micron::posix::execve(ls.path, argv, envp);
     micron::posix::exit(127);
   }
 
@@ -96,4 +164,385 @@ process_attach(const char *path, F &&attach_fn)
   return static_cast<int>(pid);
 }
 
+template <typename F>
+inline int
+process_attach(const char *path, F &&attach_fn)
+{
+  launch_spec ls{};
+  ls.path = path;
+  return process_attach(ls, micron::forward<F>(attach_fn));
+}
+
+// loads a file once into a pre-faulted memfd so a benchmarked binary reads its stdin from memory
+// returns the memfd (close-on-exec) or -1
+inline int
+map_input(const char *path)
+{
+  int f = micron::open(path, micron::posix::o_rdonly, 0);
+  if ( f < 0 ) return -1;
+  int m = static_cast<int>(micron::syscall(SYS_memfd_create, "bbench-stdin", 1 /* MFD_CLOEXEC */));
+  if ( m < 0 ) {
+    micron::close(f);
+    return -1;
+  }
+  const long size = micron::syscall(SYS_lseek, f, 0, 2 /* SEEK_END */);
+  if ( size > 0 ) {
+    // PROT_READ, MAP_PRIVATE | MAP_POPULATE
+    long addr = micron::syscall(SYS_mmap, nullptr, size, 0x1, 0x02 | 0x8000, f, 0);
+    if ( addr < 0 && addr > -4096 ) {
+      micron::close(m);
+      micron::close(f);
+      return -1;
+    }
+    const char *src = reinterpret_cast<const char *>(addr);
+    long done = 0;
+    while ( done < size ) {
+      long w = micron::posix::write(m, src + done, static_cast<usize>(size - done));
+      if ( w <= 0 ) break;
+      done += w;
+    }
+    micron::syscall(SYS_munmap, addr, size);
+  }
+  micron::close(f);
+  return m;
+}
+
+// per-run stdout / stderr files for launch_spec, closed when the run is done. a file that can't be
+// opened fails the launch (stderr says which and the errno) rather than letting the child's output
+// land on our terminal
+struct stdio_redirect {
+  int out = -1;
+  int err = -1;
+
+  stdio_redirect(const char *out_path, const char *err_path)
+  {
+    if ( out_path ) out = __open("stdout", out_path);
+    if ( err_path ) err = (out_path && micron::strcmp(out_path, err_path) == 0) ? out : __open("stderr", err_path);
+  }
+
+  stdio_redirect(const stdio_redirect &) = delete;
+
+  ~stdio_redirect()
+  {
+    if ( err != -1 && err != out ) micron::close(err);
+    if ( out != -1 ) micron::close(out);
+  }
+
+private:
+  int
+  __open(const char *which, const char *path)
+  {
+    const int fl = micron::posix::o_wronly | micron::posix::o_create | micron::posix::o_trunc | micron::posix::o_cloexec;
+    const long fd = micron::syscall(SYS_openat, -100 /* AT_FDCWD */, path, fl, 0644);
+    if ( fd >= 0 ) return static_cast<int>(fd);
+    // "bbench: cannot open stdout file PATH (errno N)"
+    char digits[12];
+    int n = 0;
+    for ( long v = -fd; n == 0 || v > 0; v /= 10 ) digits[n++] = static_cast<char>('0' + v % 10);
+    char tail[24] = " (errno ";
+    usize at = 8;
+    while ( n > 0 ) tail[at++] = digits[--n];
+    tail[at++] = ')';
+    tail[at++] = '\n';
+    micron::posix::write(2, "bbench: cannot open ", 20);
+    micron::posix::write(2, which, micron::strlen(which));
+    micron::posix::write(2, " file ", 6);
+    micron::posix::write(2, path, micron::strlen(path));
+    micron::posix::write(2, tail, at);
+    if ( out != -1 ) micron::close(out);     // the destructor won't run
+    micron::exc<micron::except::runtime_error>("bbench stdio_redirect: cannot open the output file");
+    return -1;
+  }
+};
+
+// kernel struct rusage layout (wait4), kept local so libc's sys/resource.h isn't pulled in
+struct rusage_t {
+  struct {
+    long tv_sec;
+    long tv_usec;
+  } ru_utime, ru_stime;
+
+  long ru_maxrss;
+  long ru_ixrss;
+  long ru_idrss;
+  long ru_isrss;
+  long ru_minflt;
+  long ru_majflt;
+  long ru_nswap;
+  long ru_inblock;
+  long ru_oublock;
+  long ru_msgsnd;
+  long ru_msgrcv;
+  long ru_nsignals;
+  long ru_nvcsw;
+  long ru_nivcsw;
+};
+
+// what the reaped child cost, as reported by the kernel
+struct child_usage {
+  long long max_rss_kb = 0;
+  long long user_time_us = 0;
+  long long sys_time_us = 0;
+  long long vol_ctx_switches = 0;
+  long long invol_ctx_switches = 0;
+  long long minor_faults = 0;
+  long long major_faults = 0;
+  int status = 0;
+  bool timed_out = false;
+};
+
+namespace __impl
+{
+
+inline void
+__sleep_ms(u32 ms)
+{
+  if ( ms == 0 ) return;
+  micron::timespec_t req{};
+  req.tv_sec = ms / 1000;
+  req.tv_nsec = static_cast<long>((ms % 1000) * 1'000'000);
+  micron::nanosleep(req);
+}
+
+inline u64
+__now_ns(void)
+{
+  micron::timespec_t t{};
+  micron::clock_gettime(micron::clock_monotonic, t);
+  return static_cast<u64>(t.tv_sec) * 1'000'000'000ull + static_cast<u64>(t.tv_nsec);
+}
+
+inline u64
+__now_ms(void)
+{
+  return __now_ns() / 1'000'000ull;
+}
+
+inline constexpr short __pollin = 0x0001;
+inline constexpr short __pollhup = 0x0010;
+
+struct __pollfd_t {
+  int fd;
+  short events;
+  short revents;
+};
+
+inline int
+__pidfd_open(int pid)
+{
+  long r = micron::syscall(SYS_pidfd_open, pid, 0);
+  return r < 0 ? -1 : static_cast<int>(r);
+}
+
+// a blocking wait interrupted by a signal the embedding program handles is retried, or the child
+// would stay unreaped and its status and usage read as zero
+inline int
+__wait4(int pid, int *status, int options, rusage_t *ru)
+{
+  for ( ;; ) {
+    const long r = micron::syscall(SYS_wait4, pid, status, options, ru);
+    if ( r != -4 /* EINTR */ ) return static_cast<int>(r);
+  }
+}
+
+// ppoll on fd until readable or until the absolute monotonic deadline (0 = none)
+// 1 = readable, 0 = deadline passed, -1 = error
+inline int
+__poll_until(int fd, u64 deadline_ns)
+{
+  __pollfd_t p{ fd, __pollin, 0 };
+  for ( ;; ) {
+    micron::timespec_t ts{};
+    micron::timespec_t *tp = nullptr;
+    if ( deadline_ns ) {
+      const u64 now = __now_ns();
+      if ( now >= deadline_ns ) return 0;
+      const u64 rem = deadline_ns - now;
+      ts.tv_sec = static_cast<long>(rem / 1'000'000'000ull);
+      ts.tv_nsec = static_cast<long>(rem % 1'000'000'000ull);
+      tp = &ts;
+    }
+    long r = micron::syscall(SYS_ppoll, &p, 1, tp, nullptr, 0);
+    if ( r > 0 ) return 1;
+    if ( r == 0 ) return 0;
+    if ( r != -EINTR ) return -1;
+  }
+}
+
+inline void
+__fill_usage(child_usage &cu, const rusage_t &ru, int status)
+{
+  cu.max_rss_kb = ru.ru_maxrss;
+  cu.user_time_us = static_cast<long long>(ru.ru_utime.tv_sec) * 1'000'000ll + ru.ru_utime.tv_usec;
+  cu.sys_time_us = static_cast<long long>(ru.ru_stime.tv_sec) * 1'000'000ll + ru.ru_stime.tv_usec;
+  cu.vol_ctx_switches = ru.ru_nvcsw;
+  cu.invol_ctx_switches = ru.ru_nivcsw;
+  cu.minor_faults = ru.ru_minflt;
+  cu.major_faults = ru.ru_majflt;
+  cu.status = status;
+}
+
+// SIGTERM, 50 ms grace, then SIGKILL; the child is left for the caller to reap
+inline void
+__terminate(int pid, int pidfd)
+{
+  micron::posix::kill(pid, static_cast<int>(micron::signal::terminate));
+  if ( __poll_until(pidfd, __now_ns() + 50'000'000ull) == 1 ) return;
+  micron::posix::kill(pid, static_cast<int>(micron::signal::kill9));
+}
+
+// blocks until the child exits (or timeout_ms passes and it's killed), then reaps it with wait4
+// pidfd + ppoll gives an exact wakeup; kernels without pidfd_open (< 5.3) fall back to 1 ms polling
+inline void
+__wait_child(int pid, u32 timeout_ms, child_usage &cu)
+{
+  rusage_t ru{};
+  int status = 0;
+  if ( timeout_ms == 0 ) {
+    __wait4(pid, &status, 0, &ru);
+    __fill_usage(cu, ru, status);
+    return;
+  }
+
+  const u64 deadline = __now_ns() + static_cast<u64>(timeout_ms) * 1'000'000ull;
+  int pfd = __pidfd_open(pid);
+  if ( pfd >= 0 ) {
+    if ( __poll_until(pfd, deadline) == 0 ) {
+      cu.timed_out = true;
+      __terminate(pid, pfd);
+    }
+    micron::close(pfd);
+    __wait4(pid, &status, 0, &ru);
+    __fill_usage(cu, ru, status);
+    return;
+  }
+
+  for ( ;; ) {
+    if ( __wait4(pid, &status, micron::wnohang, &ru) == pid ) break;
+    if ( __now_ns() >= deadline ) {
+      cu.timed_out = true;
+      micron::posix::kill(pid, static_cast<int>(micron::signal::terminate));
+      u64 hard = __now_ms() + 50;
+      bool reaped = false;
+      while ( !reaped && __now_ms() < hard ) {
+        reaped = __wait4(pid, &status, micron::wnohang, &ru) == pid;
+        if ( !reaped ) __sleep_ms(2);
+      }
+      if ( !reaped ) {
+        micron::posix::kill(pid, static_cast<int>(micron::signal::kill9));
+        __wait4(pid, &status, 0, &ru);
+      }
+      break;
+    }
+    __sleep_ms(1);
+  }
+  __fill_usage(cu, ru, status);
+}
+
+// exited but not reaped yet: waitid with WNOWAIT leaves the zombie (and its /proc/PID) in place
+inline bool
+__exited(int pid)
+{
+  i32 si[32] = {};     // siginfo_t; si_signo stays 0 while the child runs, SIGCHLD once it exited
+  micron::syscall(SYS_waitid, 1 /* P_PID */, pid, si, 4 /* WEXITED */ | 1 /* WNOHANG */ | 0x01000000 /* WNOWAIT */, nullptr);
+  return si[0] != 0;
+}
+
+inline constexpr usize __max_watch = 4;
+
+// __wait_child that also
+//  - calls on_ready(i) whenever watch[i] turns readable (the --roi control pipe, perf ring epoll
+//    fds); -1 entries are skipped and a watch fd is dropped once it hangs up
+//  - calls on_tick(now_ns, false) every tick_ns (0 = never; the --mem-sample sampler) and
+//    on_tick(now_ns, true) once the child exited but before it is reaped, while /proc/PID still
+//    holds its totals (--io)
+template <typename F, typename T>
+inline void
+__wait_child_ticked(int pid, u32 timeout_ms, child_usage &cu, const int *watch, usize n_watch, F &&on_ready, u64 tick_ns,
+                    T &&on_tick)
+{
+  rusage_t ru{};
+  int status = 0;
+  const u64 deadline = timeout_ms ? __now_ns() + static_cast<u64>(timeout_ms) * 1'000'000ull : 0;
+  u64 next_tick = tick_ns ? __now_ns() + tick_ns : 0;
+  const int pfd = __pidfd_open(pid);
+  if ( n_watch > __max_watch ) n_watch = __max_watch;
+  __pollfd_t p[__max_watch + 1];
+  for ( usize i = 0; i < n_watch; ++i ) p[i] = { watch[i], __pollin, 0 };
+  p[n_watch] = { pfd, __pollin, 0 };
+  const unsigned long n = n_watch + (pfd >= 0 ? 1 : 0);
+  for ( ;; ) {
+    micron::timespec_t ts{};
+    micron::timespec_t *tp = nullptr;
+    u64 wait_ns = pfd >= 0 ? 0 : 1'000'000ull;     // no pidfd: check for exit every 1 ms
+    const u64 now = __now_ns();
+    if ( next_tick ) {
+      const u64 rem = now < next_tick ? next_tick - now : 0;
+      if ( wait_ns == 0 || rem < wait_ns ) wait_ns = rem;
+    }
+    if ( deadline ) {
+      const u64 rem = now < deadline ? deadline - now : 0;
+      if ( wait_ns == 0 || rem < wait_ns ) wait_ns = rem;
+    }
+    if ( deadline || next_tick || pfd < 0 ) {
+      ts.tv_sec = static_cast<long>(wait_ns / 1'000'000'000ull);
+      ts.tv_nsec = static_cast<long>(wait_ns % 1'000'000'000ull);
+      tp = &ts;
+    }
+    for ( usize i = 0; i <= n_watch; ++i ) p[i].revents = 0;
+    long r = micron::syscall(SYS_ppoll, p, n, tp, nullptr, 0);
+    if ( r < 0 && r != -EINTR ) break;
+    for ( usize i = 0; i < n_watch; ++i ) {
+      if ( p[i].revents & __pollin )
+        on_ready(i);
+      else if ( p[i].revents & __pollhup )
+        p[i].fd = -1;
+    }
+    if ( next_tick ) {
+      const u64 t = __now_ns();
+      if ( t >= next_tick ) {
+        on_tick(t, false);
+        next_tick += tick_ns;
+        if ( next_tick <= t ) next_tick = t + tick_ns;     // fell behind: skip, don't burst
+      }
+    }
+    if ( pfd >= 0 ? (p[n_watch].revents & __pollin) != 0 : __exited(pid) ) break;
+    if ( deadline && __now_ns() >= deadline ) {
+      cu.timed_out = true;
+      if ( pfd >= 0 )
+        __terminate(pid, pfd);
+      else
+        micron::posix::kill(pid, static_cast<int>(micron::signal::kill9));
+      break;
+    }
+  }
+  if ( pfd >= 0 ) micron::close(pfd);
+  on_tick(__now_ns(), true);
+  __wait4(pid, &status, 0, &ru);
+  __fill_usage(cu, ru, status);
+}
+
+template <typename F>
+inline void
+__wait_child_watch(int pid, u32 timeout_ms, child_usage &cu, int watch_fd, F &&on_ready)
+{
+  __wait_child_ticked(pid, timeout_ms, cu, &watch_fd, 1, [&](usize) { on_ready(); }, 0, [](u64, bool) {});
+}
+
+inline launch_spec
+__launch_from(const char *path, const benchmark_opts &opts, const stdio_redirect &io)
+{
+  launch_spec ls{};
+  ls.path = path;
+  ls.argv = opts.argv;
+  ls.envp = opts.envp;
+  ls.stdin_fd = opts.stdin_fd;
+  ls.stdout_fd = io.out;
+  ls.stderr_fd = io.err;
+  ls.cpu = opts.cpu;
+  return ls;
+}
+
+};     // namespace __impl
+
 };     // namespace bbench
@@ -0,0 +1,114 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/linux/io.hpp>
+#include <micron/linux/sys/fcntl.hpp>
+#include <micron/memory/cmemory.hpp>
+#include <micron/syscall.hpp>
+#include <micron/types.hpp>
+
+#include "funcs.hpp"
+
+// /proc/PID/io of a binary run (bbench --io)
+//
+// opened while the child is parked and read once after it exited, before it is reaped: the zombie
+// still reports its totals, including the I/O of every child it reaped itself
+namespace bbench::procio
+{
+
+struct io_t {
+  long long rchar;
+  long long wchar;
+  long long syscr;
+  long long syscw;
+  long long read_bytes;
+  long long write_bytes;
+};
+
+namespace __impl
+{
+
+inline long long
+__field(const char *buf, const char *key)
+{
+  const usize kl = micron::strlen(key);
+  for ( const char *p = buf; *p; ) {
+    if ( micron::strncmp(p, key, kl) == 0 && p[kl] == ':' ) {
+      p += kl + 1;
+      while ( *p == ' ' ) ++p;
+      long long v = 0;
+      while ( *p >= '0' && *p <= '9' ) v = v * 10 + (*p++ - '0');
+      return v;
+    }
+    while ( *p && *p != '\n' ) ++p;
+    if ( *p ) ++p;
+  }
+  return 0;
+}
+
+};     // namespace __impl
+
+class reader
+{
+  int fd = -1;
+  char text[512];
+
+public:
+  reader(void) = default;
+  reader(const reader &) = delete;
+  reader &operator=(const reader &) = delete;
+
+  ~reader()
+  {
+    if ( fd >= 0 ) micron::close(fd);
+  }
+
+  bool
+  open(int pid)
+  {
+    char path[40] = "/proc/";
+    usize n = 6;
+    char digits[12];
+    int k = 0;
+    for ( int v = pid; k == 0 || v > 0; v /= 10 ) digits[k++] = static_cast<char>('0' + v % 10);
+    while ( k > 0 ) path[n++] = digits[--k];
+    for ( const char *l = "/io"; *l; ) path[n++] = *l++;
+    path[n] = '\0';
+    fd = micron::open(path, micron::posix::o_rdonly | micron::posix::o_cloexec);
+    return fd >= 0;
+  }
+
+  // false when the file is gone or not ours to read (a setuid exec drops the access)
+  bool
+  read(io_t &out)
+  {
+    if ( fd < 0 ) return false;
+    const long r = micron::syscall(SYS_pread64, fd, text, sizeof(text) - 1, 0);
+    if ( r <= 0 ) return false;
+    text[r] = '\0';
+    out.rchar = __impl::__field(text, "rchar");
+    out.wchar = __impl::__field(text, "wchar");
+    out.syscr = __impl::__field(text, "syscr");
+    out.syscw = __impl::__field(text, "syscw");
+    out.read_bytes = __impl::__field(text, "read_bytes");
+    out.write_bytes = __impl::__field(text, "write_bytes");
+    return true;
+  }
+};
+
+inline void
+apply(benchmark_t &b, const io_t &io)
+{
+  b.io_rchar = io.rchar;
+  b.io_wchar = io.wchar;
+  b.io_syscr = io.syscr;
+  b.io_syscw = io.syscw;
+  b.io_read_bytes = io.read_bytes;
+  b.io_write_bytes = io.write_bytes;
+}
+
+};     // namespace bbench::procio
@@ -0,0 +1,359 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <linux/perf_event.h>
+
+#include <micron/linux/io.hpp>
+#include <micron/memory/cmemory.hpp>
+#include <micron/string/string.hpp>
+#include <micron/syscall.hpp>
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+#include "events.hpp"
+#include "process.hpp"
+#include "ring.hpp"
+
+// per-process counters for a whole process tree (make -j, pipelines, shell scripts)
+//
+// counters are opened with inherit + inherit_stat, so every descendant task that exits emits a
+// PERF_RECORD_READ with its own counts. a dummy event adds FORK/COMM/EXIT records to know who is
+// who; all of them go to one ring per cpu (inherited per-task events can't be mmap'd, so
+// everything is opened per cpu and the counters SET_OUTPUT into that cpu's dummy ring).
+// the root's own share is the total minus everything its descendants reported
+namespace bbench::proctree
+{
+
+inline constexpr const char *counter_names[] = { "task-clock", "cycles", "instructions", "cache-misses", "branch-misses" };
+inline constexpr usize n_counters = sizeof(counter_names) / sizeof(counter_names[0]);
+inline constexpr usize task_clock = 0;
+inline constexpr usize cycles = 1;
+inline constexpr usize instructions = 2;
+
+struct process {
+  int pid;
+  int ppid;
+  char comm[16];
+  u64 comm_time;     // perf clock of the COMM record the name came from; the newest exec wins
+  u32 tasks;         // exited tasks (threads) that reported counts, each counted once
+  long long values[n_counters];
+};
+
+// processes rolled up by their final comm, e.g. every cc1plus of a build
+struct executable {
+  char comm[16];
+  u32 processes;
+  long long values[n_counters];
+};
+
+struct result {
+  micron::string name;
+  double time;
+  child_usage usage;
+  long long total[n_counters];
+  micron::vector<process> processes;        // root first, the rest by cycles
+  micron::vector<executable> executables;   // by cycles
+  u64 lost;                                 // records the kernel dropped (ring too small)
+  bool ok;                                  // false: counters/rings couldn't be opened, totals only
+};
+
+namespace __impl
+{
+
+struct __read_value {
+  u64 value;
+  u64 enabled;
+  u64 running;
+  u64 id;
+};
+
+inline long long
+__scaled(const __read_value &v)
+{
+  if ( v.running == 0 ) return 0;
+  if ( v.running == v.enabled ) return static_cast<long long>(v.value);
+  return static_cast<long long>(static_cast<double>(v.value) * static_cast<double>(v.enabled) / static_cast<double>(v.running));
+}
+
+inline void
+__copy_comm(char *dst, const char *src, usize max)
+{
+  usize i = 0;
+  for ( ; i < 15 && i < max && src[i]; ++i ) dst[i] = src[i];
+  dst[i] = '\0';
+}
+
+};     // namespace __impl
+
+class tracker
+{
+  struct cpu_counters {
+    int fds[n_counters];
+    u64 ids[n_counters];
+  };
+
+  ring_set rings;
+  micron::vector<cpu_counters> ctrs;     // one per ring
+  u64 task_id = ~0ull;     // one cpu's task-clock: every exiting task sends a READ per cpu, tasks counts this one
+  int root = -1;
+  micron::vector<process> procs;
+  i32 *table = nullptr;     // pid -> index into procs, open addressing, -1 = empty
+  usize table_len = 0;
+
+  usize
+  __bucket(int pid) const
+  {
+    return (static_cast<usize>(pid) * 0x9e3779b1u) & (table_len - 1);
+  }
+
+  void
+  __rehash(void)
+  {
+    delete[] table;
+    table_len = table_len ? table_len * 2 : 256;
+    table = new i32[table_len];
+    for ( usize i = 0; i < table_len; ++i ) table[i] = -1;
+    for ( usize i = 0; i < procs.size(); ++i ) {
+      usize b = __bucket(procs[i].pid);
+      while ( table[b] != -1 && procs[static_cast<usize>(table[b])].pid != procs[i].pid ) b = (b + 1) & (table_len - 1);
+      table[b] = static_cast<i32>(i);     // a reused pid maps to its newest process
+    }
+  }
+
+  // fresh = a FORK says this pid is a new process; rings are drained cpu by cpu, so its COMM/READ
+  // may already have created the entry. only one that saw a FORK before means the pid was reused
+  process &
+  __proc(int pid, bool fresh = false)
+  {
+    if ( procs.size() * 2 >= table_len ) __rehash();
+    usize b = __bucket(pid);
+    while ( table[b] != -1 ) {
+      process &p = procs[static_cast<usize>(table[b])];
+      if ( p.pid == pid ) {
+        if ( !fresh || p.ppid == -1 ) return p;
+        break;
+      }
+      b = (b + 1) & (table_len - 1);
+    }
+    process np{};
+    np.pid = pid;
+    np.ppid = -1;
+    procs.push_back(np);
+    table[b] = static_cast<i32>(procs.size() - 1);
+    return procs[procs.size() - 1];
+  }
+
+  int
+  __counter_of(u64 id) const
+  {
+    for ( const cpu_counters &c : ctrs )
+      for ( usize k = 0; k < n_counters; ++k )
+        if ( c.ids[k] == id ) return static_cast<int>(k);
+    return -1;
+  }
+
+  // sample_id_all with PERF_SAMPLE_TIME: every record ends in its u64 timestamp
+  static u64
+  __time(const char *body, usize len)
+  {
+    return len >= 8 ? *reinterpret_cast<const u64 *>(body + len - 8) : 0;
+  }
+
+  void
+  __record(const perf_event_header &h, const char *body, usize len)
+  {
+    const u32 *w = reinterpret_cast<const u32 *>(body);
+    switch ( h.type ) {
+    case PERF_RECORD_FORK : {
+      // { pid, ppid, tid, ptid, time }: only new processes, not threads
+      if ( w[0] != w[2] || w[0] == w[1] ) break;
+      const int ppid = static_cast<int>(w[1]);
+      process &p = __proc(static_cast<int>(w[0]), true);
+      p.ppid = ppid;
+      if ( p.comm[0] != '\0' ) break;     // its COMM was drained first, from another cpu's ring
+      for ( usize b = __bucket(ppid); table[b] != -1; b = (b + 1) & (table_len - 1) ) {
+        const process &parent = procs[static_cast<usize>(table[b])];
+        if ( parent.pid == ppid ) {
+          __impl::__copy_comm(p.comm, parent.comm, 16);
+          break;
+        }
+      }
+      break;
+    }
+    case PERF_RECORD_COMM : {
+      // { pid, tid, comm[], sample_id }
+      if ( w[0] != w[1] ) break;
+      const u64 t = __time(body, len);
+      process &p = __proc(static_cast<int>(w[0]));
+      if ( t >= p.comm_time ) {
+        __impl::__copy_comm(p.comm, body + 8, len - 16);
+        p.comm_time = t;
+      }
+      break;
+    }
+    case PERF_RECORD_READ : {
+      // { pid, tid, read_format values, sample_id }
+      if ( len < 8 + sizeof(__impl::__read_value) ) break;
+      __impl::__read_value v;
+      micron::memcpy(&v, body + 8, sizeof(v));
+      const int k = __counter_of(v.id);
+      if ( k < 0 ) break;
+      process &p = __proc(static_cast<int>(w[0]));
+      p.values[k] += __impl::__scaled(v);
+      if ( v.id == task_id ) ++p.tasks;
+      break;
+    }
+    default :
+      break;
+    }
+  }
+
+public:
+  tracker(void) = default;
+  tracker(const tracker &) = delete;
+  tracker &operator=(const tracker &) = delete;
+
+  ~tracker()
+  {
+    for ( const cpu_counters &c : ctrs )
+      for ( usize k = 0; k < n_counters; ++k )
+        if ( c.fds[k] >= 0 ) micron::close(c.fds[k]);
+    delete[] table;
+  }
+
+  // opens the dummy ring + counters for pid on every online cpu; call while the child is parked
+  // path names the root until its exec COMM record says otherwise
+  bool
+  attach(int pid, const char *path, bool excl_kernel)
+  {
+    root = pid;
+    perf_event_attr d{};
+    d.size = sizeof(d);
+    d.type = PERF_TYPE_SOFTWARE;
+    d.config = PERF_COUNT_SW_DUMMY;
+    d.disabled = 1;
+    d.enable_on_exec = 1;
+    d.inherit = 1;
+    d.task = 1;
+    d.comm = 1;
+    d.comm_exec = 1;
+    d.sample_type = PERF_SAMPLE_TIME;
+    d.sample_id_all = 1;
+    rings.open(d, pid, [&](int cpu, perf_ring &ring) {
+      cpu_counters c;
+      for ( usize k = 0; k < n_counters; ++k ) {
+        c.fds[k] = -1;
+        c.ids[k] = ~0ull;
+        const event_def *def = lookup_event(counter_names[k]);
+        perf_event_attr a{};
+        a.size = sizeof(a);
+        a.type = def->type;
+        a.config = def->config;
+        a.disabled = 1;
+        a.enable_on_exec = 1;
+        a.inherit = 1;
+        a.inherit_stat = 1;
+        a.exclude_kernel = excl_kernel ? 1 : 0;
+        a.exclude_hv = 1;
+        a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING | PERF_FORMAT_ID;
+        a.sample_type = PERF_SAMPLE_TIME;
+        a.sample_id_all = 1;
+        long fd = micron::syscall(SYS_perf_event_open, &a, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+        if ( fd < 0 ) continue;
+        c.fds[k] = static_cast<int>(fd);
+        micron::posix::ioctl(c.fds[k], PERF_EVENT_IOC_ID, &c.ids[k]);
+        ring.redirect(c.fds[k]);
+      }
+      ctrs.push_back(c);
+    });
+    for ( const cpu_counters &c : ctrs )
+      if ( c.fds[task_clock] >= 0 ) {
+        task_id = c.ids[task_clock];
+        break;
+      }
+    process &rp = __proc(pid);
+    rp.ppid = static_cast<int>(micron::syscall(SYS_getpid));
+    const char *base = path;
+    for ( const char *c = path; c && *c; ++c )
+      if ( *c == '/' ) base = c + 1;
+    if ( base ) __impl::__copy_comm(rp.comm, base, 15);
+    return rings.size() > 0;
+  }
+
+  // readable whenever any ring passes its watermark; hand to __wait_child_watch
+  int
+  watch_fd(void) const
+  {
+    return rings.watch_fd();
+  }
+
+  void
+  drain(void)
+  {
+    rings.drain([&](const perf_event_header &h, const char *body, usize len) { __record(h, body, len); });
+  }
+
+  void
+  finish(result &r)
+  {
+    drain();
+    r.ok = rings.size() > 0;
+    r.lost = rings.lost_records();
+    long long reported[n_counters] = {};
+    for ( usize k = 0; k < n_counters; ++k ) r.total[k] = 0;
+    for ( const cpu_counters &c : ctrs )
+      for ( usize k = 0; k < n_counters; ++k ) {
+        if ( c.fds[k] < 0 ) continue;
+        __impl::__read_value v{};
+        if ( micron::posix::read(c.fds[k], &v, sizeof(v)) == static_cast<long>(sizeof(v)) ) r.total[k] += __impl::__scaled(v);
+      }
+    for ( const process &p : procs )
+      for ( usize k = 0; k < n_counters; ++k ) reported[k] += p.values[k];
+    process &rp = __proc(root);
+    for ( usize k = 0; k < n_counters; ++k ) rp.values[k] += r.total[k] - reported[k];
+
+    // root first, then by cycles
+    for ( const process &p : procs )
+      if ( p.pid == root ) r.processes.push_back(p);
+    for ( const process &p : procs )
+      if ( p.pid != root ) r.processes.push_back(p);
+    for ( usize i = 1; i + 1 < r.processes.size(); ++i ) {
+      usize mx = i;
+      for ( usize j = i + 1; j < r.processes.size(); ++j )
+        if ( r.processes[j].values[cycles] > r.processes[mx].values[cycles] ) mx = j;
+      if ( mx != i ) {
+        process t = r.processes[i];
+        r.processes[i] = r.processes[mx];
+        r.processes[mx] = t;
+      }
+    }
+
+    for ( const process &p : r.processes ) {
+      usize e = 0;
+      while ( e < r.executables.size() && micron::strcmp(r.executables[e].comm, p.comm) != 0 ) ++e;
+      if ( e == r.executables.size() ) {
+        executable ne{};
+        __impl::__copy_comm(ne.comm, p.comm, 16);
+        r.executables.push_back(ne);
+      }
+      ++r.executables[e].processes;
+      for ( usize k = 0; k < n_counters; ++k ) r.executables[e].values[k] += p.values[k];
+    }
+    for ( usize i = 0; i + 1 < r.executables.size(); ++i ) {
+      usize mx = i;
+      for ( usize j = i + 1; j < r.executables.size(); ++j )
+        if ( r.executables[j].values[cycles] > r.executables[mx].values[cycles] ) mx = j;
+      if ( mx != i ) {
+        executable t = r.executables[i];
+        r.executables[i] = r.executables[mx];
+        r.executables[mx] = t;
+      }
+    }
+  }
+};
+
+};     // namespace bbench::proctree
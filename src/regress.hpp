@@ -0,0 +1,198 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/memory/cmemory.hpp>
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+#include "format.hpp"
+#include "funcs.hpp"
+#include "stopping.hpp"
+
+// per-iteration cost as a regression slope (bench_linear): batches of step, 2 step, ... k step
+// iterations, each timed and counted as a whole; the fixed per-batch overhead (clock reads, counter
+// enable / disable, the loop) lands in the intercept instead of biasing the per-iteration number.
+// OLS with a t interval on the slope, and Theil-Sen (median of pairwise slopes, Sen's interval)
+// for when a few batches got interrupted
+namespace bbench::regress
+{
+
+struct fit {
+  double slope;          // per iteration
+  double intercept;      // per batch
+  double r2;
+  double slope_lo, slope_hi;     // 95% interval
+  usize n;
+};
+
+struct estimate {
+  micron::vector<double> iters;          // x: iterations per batch
+  micron::vector<benchmark_t> batches;   // y: one measurement per batch
+  const char *time_unit = "us";          // of the batches' time: bench_linear's R, not always the column's us
+  fit ols[format::n_fields];             // by format::fields index
+  fit theil_sen[format::n_fields];
+
+  // format::fields column by name, nullptr if unknown
+  const fit *
+  of(const char *column, bool robust = false) const
+  {
+    for ( usize i = 0; i < format::n_fields; ++i )
+      if ( micron::strcmp(format::fields[i].name, column) == 0 ) return robust ? &theil_sen[i] : &ols[i];
+    return nullptr;
+  }
+};
+
+namespace __impl
+{
+
+inline double
+__r2(const double *x, const double *y, usize n, double slope, double intercept)
+{
+  double my = 0.0;
+  for ( usize i = 0; i < n; ++i ) my += y[i];
+  my /= static_cast<double>(n);
+  double ss_res = 0.0, ss_tot = 0.0;
+  for ( usize i = 0; i < n; ++i ) {
+    const double e = y[i] - (intercept + slope * x[i]);
+    ss_res += e * e;
+    ss_tot += (y[i] - my) * (y[i] - my);
+  }
+  return ss_tot > 0.0 ? 1.0 - ss_res / ss_tot : (ss_res == 0.0 ? 1.0 : 0.0);
+}
+
+// the k-th smallest of v[0, n), 0-based; reorders v
+inline double
+__order(double *v, usize n, usize k)
+{
+  if ( k >= n ) k = n - 1;
+  format::__impl::__select(v, 0, n, k);
+  return v[k];
+}
+
+};     // namespace __impl
+
+inline fit
+ols(const double *x, const double *y, usize n)
+{
+  fit f{ 0.0, 0.0, 0.0, 0.0, 0.0, n };
+  if ( n < 2 ) return f;
+  double mx = 0.0, my = 0.0;
+  for ( usize i = 0; i < n; ++i ) {
+    mx += x[i];
+    my += y[i];
+  }
+  mx /= static_cast<double>(n);
+  my /= static_cast<double>(n);
+  double sxx = 0.0, sxy = 0.0;
+  for ( usize i = 0; i < n; ++i ) {
+    sxx += (x[i] - mx) * (x[i] - mx);
+    sxy += (x[i] - mx) * (y[i] - my);
+  }
+  if ( sxx <= 0.0 ) return f;
+  f.slope = sxy / sxx;
+  f.intercept = my - f.slope * mx;
+  f.r2 = __impl::__r2(x, y, n, f.slope, f.intercept);
+  if ( n > 2 ) {
+    double ss_res = 0.0;
+    for ( usize i = 0; i < n; ++i ) {
+      const double e = y[i] - (f.intercept + f.slope * x[i]);
+      ss_res += e * e;
+    }
+    const double se = format::__impl::__sqrt(ss_res / static_cast<double>(n - 2) / sxx);
+    const double h = stopping::__impl::__t975(n - 2) * se;
+    f.slope_lo = f.slope - h;
+    f.slope_hi = f.slope + h;
+  } else {
+    f.slope_lo = f.slope_hi = f.slope;
+  }
+  return f;
+}
+
+// O(n^2) pairwise slopes; bench_linear's batch counts are small
+inline fit
+theil_sen(const double *x, const double *y, usize n)
+{
+  fit f{ 0.0, 0.0, 0.0, 0.0, 0.0, n };
+  if ( n < 2 ) return f;
+  micron::vector<double> s;
+  s.reserve(n * (n - 1) / 2);
+  for ( usize i = 0; i < n; ++i )
+    for ( usize j = i + 1; j < n; ++j )
+      if ( x[j] != x[i] ) s.push_back((y[j] - y[i]) / (x[j] - x[i]));
+  const usize m = s.size();
+  if ( m == 0 ) return f;
+  f.slope = format::__impl::__quantile(&s[0], m, 0.5);
+  // Sen's interval: order statistics (m -+ C) / 2 of the slopes, C = z sqrt(n (n-1) (2n+5) / 18)
+  const double nd = static_cast<double>(n);
+  const double c = 1.959964 * format::__impl::__sqrt(nd * (nd - 1.0) * (2.0 * nd + 5.0) / 18.0);
+  const double lo = (static_cast<double>(m) - c) / 2.0;
+  const double hi = (static_cast<double>(m) + c) / 2.0;
+  f.slope_lo = __impl::__order(&s[0], m, lo > 1.0 ? static_cast<usize>(lo) - 1 : 0);
+  f.slope_hi = __impl::__order(&s[0], m, static_cast<usize>(hi));
+  micron::vector<double> r;
+  r.reserve(n);
+  for ( usize i = 0; i < n; ++i ) r.push_back(y[i] - f.slope * x[i]);
+  f.intercept = format::__impl::__quantile(&r[0], n, 0.5);
+  f.r2 = __impl::__r2(x, y, n, f.slope, f.intercept);
+  return f;
+}
+
+// both fits for time and every format::fields column of e.batches against e.iters
+inline void
+solve(estimate &e)
+{
+  const usize n = e.batches.size();
+  if ( n == 0 ) return;
+  micron::vector<double> y;
+  y.reserve(n);
+  for ( usize i = 0; i < n; ++i ) y.push_back(0.0);
+  for ( usize f = 0; f < format::n_fields; ++f ) {
+    for ( usize i = 0; i < n; ++i ) y[i] = format::fields[f].get(e.batches[i]);
+    e.ols[f] = ols(&e.iters[0], &y[0], n);
+    e.theil_sen[f] = theil_sen(&e.iters[0], &y[0], n);
+  }
+}
+
+inline void
+__emit_fit(const format::sink &out, const char *label, const fit &f)
+{
+  out.emit(label);
+  out.emit_double(f.slope);
+  out.emit(" [");
+  out.emit_double(f.slope_lo);
+  out.emit(", ");
+  out.emit_double(f.slope_hi);
+  out.emit("] intercept=");
+  out.emit_double(f.intercept);
+  out.emit(" r2=");
+  out.emit_double(f.r2);
+}
+
+// per-iteration slope of every counter that moved, OLS then Theil-Sen
+inline void
+emit(const format::sink &out, const estimate &e, u32 detail)
+{
+  out.emit("# per iteration (slope [95%], per-batch intercept, r2), ");
+  out.emit_int(static_cast<long long>(e.batches.size()));
+  out.emit(" batches\n");
+  for ( usize f = 0; f < format::n_fields; ++f ) {
+    if ( format::fields[f].detail > detail ) continue;
+    if ( e.ols[f].slope == 0.0 && e.ols[f].intercept == 0.0 ) continue;
+    out.emit("  ");
+    if ( f == 0 ) {     // time_us holds whatever unit the batches were timed in
+      out.emit("time_");
+      out.emit(e.time_unit);
+    } else {
+      out.emit(format::fields[f].name);
+    }
+    __emit_fit(out, ": ols=", e.ols[f]);
+    __emit_fit(out, "  theil-sen=", e.theil_sen[f]);
+    out.newline();
+  }
+}
+
+};     // namespace bbench::regress
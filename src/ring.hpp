@@ -0,0 +1,224 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <linux/perf_event.h>
+
+#include <micron/linux/io.hpp>
+#include <micron/linux/sys/ioctl.hpp>
+#include <micron/memory/cmemory.hpp>
+#include <micron/syscall.hpp>
+#include <micron/types.hpp>
+
+#include "perf.hpp"
+#include "sysfs.hpp"
+
+// mmap'd perf ring buffer, for events that record instead of count (task/comm/read/switch records)
+namespace bbench
+{
+
+class perf_ring
+{
+  int e_fd = -1;
+  perf_event_mmap_page *meta = nullptr;
+  char *data = nullptr;
+  u64 size = 0;     // data area, power of two
+  usize map_len = 0;
+  char *scratch = nullptr;     // records that wrap around the end get copied here
+  u64 lost = 0;
+
+public:
+  static constexpr usize page = 4096;
+
+  perf_ring(void) = default;
+  perf_ring(const perf_ring &) = delete;
+  perf_ring &operator=(const perf_ring &) = delete;
+  perf_ring(perf_ring &&o) noexcept
+      : e_fd(o.e_fd), meta(o.meta), data(o.data), size(o.size), map_len(o.map_len), scratch(o.scratch), lost(o.lost)
+  {
+    o.e_fd = -1;
+    o.meta = nullptr;
+    o.scratch = nullptr;
+  }
+
+  ~perf_ring() { close(); }
+
+  // opens attr on (pid, cpu) and maps 2^pages_log2 data pages; wakes readers at half full
+  bool
+  open(perf_event_attr &attr, int pid, int cpu, u32 pages_log2 = 4)
+  {
+    size = static_cast<u64>(page) << pages_log2;
+    attr.watermark = 1;
+    attr.wakeup_watermark = static_cast<u32>(size / 2);
+    long fd = micron::syscall(SYS_perf_event_open, &attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+    if ( fd < 0 ) return false;
+    e_fd = static_cast<int>(fd);
+    map_len = page + static_cast<usize>(size);
+    long addr = micron::syscall(SYS_mmap, nullptr, map_len, 0x1 | 0x2 /* PROT_READ|WRITE */, 0x01 /* MAP_SHARED */, e_fd, 0);
+    if ( addr < 0 && addr > -4096 ) {
+      close();
+      return false;
+    }
+    meta = reinterpret_cast<perf_event_mmap_page *>(addr);
+    data = reinterpret_cast<char *>(addr) + page;
+    scratch = new char[65536];
+    return true;
+  }
+
+  void
+  close(void)
+  {
+    if ( meta ) micron::syscall(SYS_munmap, meta, map_len);
+    meta = nullptr;
+    data = nullptr;
+    if ( e_fd != -1 ) micron::close(e_fd);
+    e_fd = -1;
+    delete[] scratch;
+    scratch = nullptr;
+  }
+
+  int
+  fd(void) const
+  {
+    return e_fd;
+  }
+
+  // records dropped by the kernel because we didn't drain fast enough
+  u64
+  lost_records(void) const
+  {
+    return lost;
+  }
+
+  // sends another (counting) event's records here; it must be on the same cpu / task
+  bool
+  redirect(int other_fd) const
+  {
+    return micron::posix::ioctl(other_fd, PERF_EVENT_IOC_SET_OUTPUT, e_fd) == 0;
+  }
+
+  // fn(const perf_event_header &, const char *body, usize body_len) for every pending record
+  template <typename F>
+  usize
+  drain(F &&fn)
+  {
+    if ( !meta ) return 0;
+    const u64 head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+    u64 tail = meta->data_tail;
+    usize n = 0;
+    while ( tail < head ) {
+      const u64 off = tail & (size - 1);
+      // records are 8-byte aligned, so the header itself never wraps
+      const perf_event_header *h = reinterpret_cast<const perf_event_header *>(data + off);
+      if ( h->size < sizeof(*h) ) break;
+      const char *rec = data + off;
+      if ( off + h->size > size ) {
+        const usize first = static_cast<usize>(size - off);
+        micron::memcpy(scratch, data + off, first);
+        micron::memcpy(scratch + first, data, h->size - first);
+        rec = scratch;
+      }
+      const perf_event_header &hdr = *reinterpret_cast<const perf_event_header *>(rec);
+      if ( hdr.type == PERF_RECORD_LOST ) lost += *reinterpret_cast<const u64 *>(rec + sizeof(hdr) + 8);
+      fn(hdr, rec + sizeof(hdr), hdr.size - sizeof(hdr));
+      tail += hdr.size;
+      ++n;
+    }
+    __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+    return n;
+  }
+};
+
+namespace __impl
+{
+
+struct __epoll_event {
+  u32 events;
+  u64 data;
+}
+#if defined(__x86_64__)
+__attribute__((packed))
+#endif
+;
+
+};     // namespace __impl
+
+// one perf_ring per online cpu for an inherited task event (those can't be mmap'd per task, the
+// kernel wants cpu != -1), plus an epoll fd over all of them for the wait loop
+class ring_set
+{
+  perf_ring *rings = nullptr;
+  usize n = 0;
+  int epfd = -1;
+
+public:
+  ring_set(void) = default;
+  ring_set(const ring_set &) = delete;
+  ring_set &operator=(const ring_set &) = delete;
+
+  ~ring_set()
+  {
+    delete[] rings;
+    if ( epfd >= 0 ) micron::close(epfd);
+  }
+
+  // opens attr for pid on every online cpu; on_open(cpu, perf_ring &) runs for each ring that
+  // opened, in cpu order, to redirect more events into it. returns the number of rings
+  template <typename F>
+  usize
+  open(perf_event_attr &attr, int pid, F &&on_open, u32 pages_log2 = 4)
+  {
+    char buf[512];
+    if ( sys::read_file("/sys/devices/system/cpu/online", buf, sizeof(buf)) <= 0 ) return 0;
+    rings = new perf_ring[sys::count_cpulist(buf)];
+    epfd = static_cast<int>(micron::syscall(SYS_epoll_create1, 02000000 /* EPOLL_CLOEXEC */));
+    sys::for_each_cpu(buf, [&](int cpu) {
+      perf_event_attr a = attr;
+      if ( !rings[n].open(a, pid, cpu, pages_log2) ) return;
+      __impl::__epoll_event ev{ 0x001 /* EPOLLIN */, static_cast<u64>(cpu) };
+      if ( epfd >= 0 ) micron::syscall(SYS_epoll_ctl, epfd, 1 /* EPOLL_CTL_ADD */, rings[n].fd(), &ev);
+      on_open(cpu, rings[n]);
+      ++n;
+    });
+    return n;
+  }
+
+  usize
+  size(void) const
+  {
+    return n;
+  }
+
+  // readable whenever any ring passes its watermark; hand to the wait loop
+  int
+  watch_fd(void) const
+  {
+    return epfd;
+  }
+
+  u64
+  lost_records(void) const
+  {
+    u64 l = 0;
+    for ( usize i = 0; i < n; ++i ) l += rings[i].lost_records();
+    return l;
+  }
+
+  // every pending record of every ring, ring by ring: records of one task that migrated can
+  // arrive out of order, consumers have to cope
+  template <typename F>
+  void
+  drain(F &&fn)
+  {
+    if ( epfd >= 0 ) {
+      __impl::__epoll_event evs[64];     // only to rearm the wakeups; every ring is read below
+      micron::syscall(SYS_epoll_wait, epfd, evs, 64, 0);
+    }
+    for ( usize i = 0; i < n; ++i ) rings[i].drain(fn);
+  }
+};
+
+};     // namespace bbench
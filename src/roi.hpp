@@ -0,0 +1,164 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/linux/io.hpp>
+#include <micron/linux/sys/fcntl.hpp>
+#include <micron/memory/cmemory.hpp>
+#include <micron/proc.hpp>
+#include <micron/syscall.hpp>
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+// bbench side of bbench_roi.h
+//
+// two pipes per run: ctl (child writes "b<name>\n" / "e\n") and ack (we write one byte per message)
+// the child's ends survive exec; ours stay O_CLOEXEC. the fd numbers reach the child through
+// BBENCH_CTL_FD / BBENCH_ACK_FD appended to its environment
+namespace bbench::roi
+{
+
+inline constexpr usize name_max = 63;
+
+namespace __impl
+{
+
+inline void
+__fmt_env(char *dst, const char *key, int fd)
+{
+  usize n = 0;
+  while ( *key ) dst[n++] = *key++;
+  dst[n++] = '=';
+  char digits[12];
+  int k = 0;
+  for ( int v = fd; k == 0 || v > 0; v /= 10 ) digits[k++] = static_cast<char>('0' + v % 10);
+  while ( k > 0 ) dst[n++] = digits[--k];
+  dst[n] = '\0';
+}
+
+inline bool
+__is_ours(const char *e)
+{
+  return micron::strncmp(e, "BBENCH_CTL_FD=", 14) == 0 || micron::strncmp(e, "BBENCH_ACK_FD=", 14) == 0;
+}
+
+inline void
+__keep_on_exec(int fd)
+{
+  micron::syscall(SYS_fcntl, fd, 2 /* F_SETFD */, 0);
+}
+
+};     // namespace __impl
+
+class session
+{
+  int child_ctl = -1;
+  int child_ack = -1;
+  char ctl_env[32];
+  char ack_env[32];
+  micron::vector<const char *> env;
+  char pending[2 * (name_max + 3)];
+  usize plen = 0;
+
+  static void
+  __close(int &fd)
+  {
+    if ( fd >= 0 ) micron::close(fd);
+    fd = -1;
+  }
+
+public:
+  int ctl = -1;     // our read end, watched in the wait loop
+  int ack = -1;
+
+  session(void) = default;
+  session(const session &) = delete;
+  session &operator=(const session &) = delete;
+
+  ~session()
+  {
+    __close(ctl);
+    __close(ack);
+    __close(child_ctl);
+    __close(child_ack);
+  }
+
+  // base_env: the environment the child would otherwise get (nullptr = environ)
+  bool
+  open(const char *const *base_env)
+  {
+    int c[2], a[2];
+    if ( micron::pipe2(c, micron::posix::o_cloexec) < 0 ) return false;
+    if ( micron::pipe2(a, micron::posix::o_cloexec) < 0 ) {
+      micron::close(c[0]);
+      micron::close(c[1]);
+      return false;
+    }
+    ctl = c[0];
+    child_ctl = c[1];
+    child_ack = a[0];
+    ack = a[1];
+    __impl::__keep_on_exec(child_ctl);
+    __impl::__keep_on_exec(child_ack);
+
+    __impl::__fmt_env(ctl_env, "BBENCH_CTL_FD", child_ctl);
+    __impl::__fmt_env(ack_env, "BBENCH_ACK_FD", child_ack);
+    const char *const *base = base_env ? base_env : const_cast<const char *const *>(environ);
+    for ( const char *const *e = base; e && *e; ++e )
+      if ( !__impl::__is_ours(*e) ) env.push_back(*e);
+    env.push_back(ctl_env);
+    env.push_back(ack_env);
+    env.push_back(nullptr);
+    return true;
+  }
+
+  const char *const *
+  envp(void) const
+  {
+    return &env[0];
+  }
+
+  // the child has its copies now; dropping ours makes ctl hang up once the child exits
+  void
+  launched(void)
+  {
+    __close(child_ctl);
+    __close(child_ack);
+  }
+
+  // reads what's available; fn(kind, name) per complete message ('b' with a name, 'e' with ""),
+  // each acked only after fn returns so the child resumes after the snapshot
+  template <typename F>
+  void
+  drain(F &&fn)
+  {
+    long r = micron::posix::read(ctl, pending + plen, sizeof(pending) - 1 - plen);
+    if ( r <= 0 ) return;
+    plen += static_cast<usize>(r);
+    usize start = 0;
+    for ( usize i = 0; i < plen; ++i ) {
+      if ( pending[i] != '\n' ) continue;
+      pending[i] = '\0';
+      const char kind = pending[start];
+      fn(kind, kind == 'b' ? pending + start + 1 : "");
+      char go = 'a';
+      micron::posix::write(ack, &go, 1);
+      start = i + 1;
+    }
+    // a line longer than the buffer didn't come from bbench_roi.h; drop it, but ack so the writer doesn't stall
+    if ( start == 0 && plen == sizeof(pending) - 1 ) {
+      char go = 'a';
+      micron::posix::write(ack, &go, 1);
+      plen = 0;
+    }
+    if ( start > 0 ) {
+      for ( usize i = start; i < plen; ++i ) pending[i - start] = pending[i];
+      plen -= start;
+    }
+  }
+};
+
+};     // namespace bbench::roi
@@ -0,0 +1,161 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+#include "format.hpp"
+
+// sequential stopping (bbench --target-ci): keep running until the 95% confidence interval of the
+// mean (t-based) or of the median (percentile bootstrap) is narrower than a target fraction of the
+// estimate, within a run / wall-clock budget. the interval is only rechecked every ~10% of new
+// runs, so the bootstrap stays cheap for long sequences
+namespace bbench::stopping
+{
+
+struct rule {
+  double target = 0.0;     // half-width / estimate, 0.01 = +-1%; 0 = off
+  u32 min_runs = 5;
+  u32 max_runs = 1000;
+  u32 max_time_ms = 0;     // wall-clock budget per benchmark; 0 = none
+  bool median = false;     // bootstrap the median instead of the mean
+};
+
+enum class reason : u8 { running, converged, max_runs, max_time };
+
+struct report {
+  usize runs;
+  double estimate;       // mean or median time
+  double half_width;     // of the 95% interval, same unit
+  double relative;       // half_width / estimate
+  reason why;
+};
+
+inline const char *
+reason_name(reason r)
+{
+  switch ( r ) {
+  case reason::converged :
+    return "converged";
+  case reason::max_runs :
+    return "max-runs";
+  case reason::max_time :
+    return "max-time";
+  default :
+    return "running";
+  }
+}
+
+namespace __impl
+{
+
+// two-sided 95% Student t quantile; exact table up to 30 degrees of freedom, then Cornish-Fisher
+inline double
+__t975(usize df)
+{
+  constexpr double table[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                               2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                               2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+  if ( df == 0 ) return 0.0;
+  if ( df <= 30 ) return table[df - 1];
+  const double z = 1.959964;
+  const double d = static_cast<double>(df);
+  return z + (z * z * z + z) / (4.0 * d) + (5.0 * z * z * z * z * z + 16.0 * z * z * z + 3.0 * z) / (96.0 * d * d);
+}
+
+inline u64
+__xorshift(u64 &s)
+{
+  s ^= s >> 12;
+  s ^= s << 25;
+  s ^= s >> 27;
+  return s * 0x2545f4914f6cdd1dull;
+}
+
+};     // namespace __impl
+
+class monitor
+{
+  rule r;
+  micron::vector<double> v;
+  micron::vector<double> scratch;
+  u64 t0_ns = 0;
+  usize next_check = 0;
+  u64 seed = 0x9e3779b97f4a7c15ull;
+  report rep{ 0, 0.0, 0.0, 0.0, reason::running };
+
+  static constexpr usize resamples = 200;
+
+  void
+  __interval(void)
+  {
+    const usize n = v.size();
+    if ( !r.median ) {
+      const format::stats_t s = format::compute_stats(v, [](double x) { return x; });
+      rep.estimate = s.mean;
+      rep.half_width = __impl::__t975(n - 1) * s.stddev / format::__impl::__sqrt(static_cast<double>(n));
+    } else {
+      micron::vector<double> meds;
+      meds.reserve(resamples);
+      for ( usize b = 0; b < resamples; ++b ) {
+        for ( usize i = 0; i < n; ++i ) scratch[i] = v[static_cast<usize>(__impl::__xorshift(seed) % n)];
+        meds.push_back(format::__impl::__quantile(&scratch[0], n, 0.5));
+      }
+      for ( usize i = 0; i < n; ++i ) scratch[i] = v[i];
+      rep.estimate = format::__impl::__quantile(&scratch[0], n, 0.5);
+      const double lo = format::__impl::__quantile(&meds[0], resamples, 0.025);
+      const double hi = format::__impl::__quantile(&meds[0], resamples, 0.975);
+      rep.half_width = (hi - lo) / 2.0;
+    }
+    rep.relative = rep.estimate != 0.0 ? rep.half_width / (rep.estimate < 0 ? -rep.estimate : rep.estimate) : 0.0;
+  }
+
+public:
+  explicit monitor(const rule &rl) : r(rl)
+  {
+    if ( r.min_runs < 2 ) r.min_runs = 2;
+    if ( r.max_runs < r.min_runs ) r.max_runs = r.min_runs;
+    v.reserve(r.min_runs);
+  }
+
+  void
+  start(u64 now_ns)
+  {
+    t0_ns = now_ns;
+  }
+
+  // one more run's time; true once the sequence should stop
+  bool
+  add(double x, u64 now_ns)
+  {
+    v.push_back(x);
+    scratch.push_back(x);
+    const usize n = v.size();
+    rep.runs = n;
+    if ( n < r.min_runs ) return false;
+    const bool out_of_runs = n >= r.max_runs;
+    const bool out_of_time = r.max_time_ms && now_ns - t0_ns >= static_cast<u64>(r.max_time_ms) * 1'000'000ull;
+    if ( n < next_check && !out_of_runs && !out_of_time ) return false;
+    next_check = n + (n / 10 > 0 ? n / 10 : 1);
+    __interval();
+    if ( rep.relative <= r.target )
+      rep.why = reason::converged;
+    else if ( out_of_runs )
+      rep.why = reason::max_runs;
+    else if ( out_of_time )
+      rep.why = reason::max_time;
+    return rep.why != reason::running;
+  }
+
+  const report &
+  result(void) const
+  {
+    return rep;
+  }
+};
+
+};     // namespace bbench::stopping
@@ -0,0 +1,287 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/linux/io.hpp>
+#include <micron/linux/sys/fcntl.hpp>
+#include <micron/memory/cmemory.hpp>
+#include <micron/types.hpp>
+
+// small, allocation-free readers for /proc and /sys pseudo-files
+namespace bbench::sys
+{
+
+// reads at most cap - 1 bytes and NUL-terminates; returns bytes read, -1 if the file can't be opened
+inline long
+read_file(const char *path, char *buf, usize cap)
+{
+  if ( cap == 0 ) return -1;
+  buf[0] = '\0';
+  int fd = micron::open(path, micron::posix::o_rdonly, 0);
+  if ( fd < 0 ) return -1;
+  usize n = 0;
+  while ( n < cap - 1 ) {
+    long r = micron::posix::read(fd, buf + n, cap - 1 - n);
+    if ( r <= 0 ) break;
+    n += static_cast<usize>(r);
+  }
+  micron::close(fd);
+  buf[n] = '\0';
+  return static_cast<long>(n);
+}
+
+// strips trailing whitespace in place (sysfs values end in '\n')
+inline void
+rstrip(char *s)
+{
+  usize n = micron::strlen(s);
+  while ( n > 0 && (s[n - 1] == '\n' || s[n - 1] == ' ' || s[n - 1] == '\t') ) s[--n] = '\0';
+}
+
+// parses an unsigned decimal, skipping leading blanks; advances p past the digits
+inline bool
+parse_u64(const char *&p, u64 &out)
+{
+  while ( *p == ' ' || *p == '\t' ) ++p;
+  if ( !(*p >= '0' && *p <= '9') ) return false;
+  u64 v = 0;
+  while ( *p >= '0' && *p <= '9' ) v = v * 10 + static_cast<u64>(*p++ - '0');
+  out = v;
+  return true;
+}
+
+// parses [-]digits[.digits][e[-]digits], the shape emit_double() produces; advances p
+inline bool
+parse_double(const char *&p, double &out)
+{
+  while ( *p == ' ' || *p == '\t' ) ++p;
+  bool neg = false;
+  if ( *p == '-' ) {
+    neg = true;
+    ++p;
+  }
+  if ( !(*p >= '0' && *p <= '9') ) return false;
+  double v = 0.0, scale = 1.0;
+  while ( *p >= '0' && *p <= '9' ) v = v * 10.0 + (*p++ - '0');
+  if ( *p == '.' ) {
+    ++p;
+    while ( *p >= '0' && *p <= '9' ) {
+      scale /= 10.0;
+      v += (*p++ - '0') * scale;
+    }
+  }
+  if ( *p == 'E' || *p == 'e' ) {
+    ++p;
+    bool eneg = false;
+    if ( *p == '-' ) {
+      eneg = true;
+      ++p;
+    } else if ( *p == '+' )
+      ++p;
+    int e = 0;
+    while ( *p >= '0' && *p <= '9' ) e = e * 10 + (*p++ - '0');
+    for ( int i = 0; i < e; ++i ) v = eneg ? v / 10.0 : v * 10.0;
+  }
+  out = neg ? -v : v;
+  return true;
+}
+
+inline bool
+read_u64(const char *path, u64 &out)
+{
+  char buf[64];
+  if ( read_file(path, buf, sizeof(buf)) <= 0 ) return false;
+  const char *p = buf;
+  return parse_u64(p, out);
+}
+
+// finds "key" at the start of a line; returns a pointer just past it, or nullptr
+inline const char *
+find_key(const char *buf, const char *key)
+{
+  const usize kn = micron::strlen(key);
+  const char *line = buf;
+  while ( *line ) {
+    if ( micron::strncmp(line, key, kn) == 0 ) return line + kn;
+    while ( *line && *line != '\n' ) ++line;
+    if ( *line == '\n' ) ++line;
+  }
+  return nullptr;
+}
+
+// copies the rest of the line at p into dst (NUL-terminated, truncated to cap)
+inline void
+copy_line(char *dst, usize cap, const char *p)
+{
+  usize n = 0;
+  if ( p )
+    while ( p[n] && p[n] != '\n' && n < cap - 1 ) {
+      dst[n] = p[n];
+      ++n;
+    }
+  dst[n] = '\0';
+}
+
+// tracefs path of a tracepoint file ("sched/sched_switch", "id"), under whichever mount exists
+inline bool
+tracepoint_file(const char *event, const char *leaf, char *buf, usize cap)
+{
+  const char *roots[] = { "/sys/kernel/tracing/events/", "/sys/kernel/debug/tracing/events/" };
+  for ( const char *root : roots ) {
+    char path[160];
+    usize n = 0;
+    for ( const char *c = root; *c && n < sizeof(path) - 1; ) path[n++] = *c++;
+    for ( const char *c = event; *c && n < sizeof(path) - 1; ) path[n++] = *c++;
+    if ( n < sizeof(path) - 1 ) path[n++] = '/';
+    for ( const char *c = leaf; *c && n < sizeof(path) - 1; ) path[n++] = *c++;
+    path[n] = '\0';
+    if ( read_file(path, buf, cap) > 0 ) return true;
+  }
+  return false;
+}
+
+// perf_event_attr.config of a tracepoint; -1 when tracefs isn't mounted or readable
+inline long long
+tracepoint_id(const char *event)
+{
+  char buf[32];
+  u64 v = 0;
+  const char *p = buf;
+  if ( !tracepoint_file(event, "id", buf, sizeof(buf)) || !parse_u64(p, v) ) return -1;
+  return static_cast<long long>(v);
+}
+
+// byte offset of a field in the tracepoint's raw record ("\tfield:pid_t pid;\toffset:24;..."); -1 if absent
+inline long
+tracepoint_field(const char *event, const char *field)
+{
+  char buf[4096];
+  if ( !tracepoint_file(event, "format", buf, sizeof(buf)) ) return -1;
+  const usize fn = micron::strlen(field);
+  for ( const char *p = buf; *p; ++p ) {
+    // the name is the last word before ';' (arrays end in "]", not a match)
+    if ( *p != ' ' || micron::strncmp(p + 1, field, fn) != 0 || p[1 + fn] != ';' ) continue;
+    const char *o = nullptr;
+    for ( const char *q = p; *q && *q != '\n'; ++q )
+      if ( micron::strncmp(q, "offset:", 7) == 0 ) {
+        o = q + 7;
+        break;
+      }
+    u64 v = 0;
+    if ( o && parse_u64(o, v) ) return static_cast<long>(v);
+    return -1;
+  }
+  return -1;
+}
+
+// calls fn(cpu) for every cpu in a kernel cpulist ("0-3,8-11")
+template <typename F>
+inline void
+for_each_cpu(const char *p, F &&fn)
+{
+  while ( *p ) {
+    u64 a = 0, b = 0;
+    if ( !parse_u64(p, a) ) break;
+    b = a;
+    if ( *p == '-' ) {
+      ++p;
+      if ( !parse_u64(p, b) ) break;
+    }
+    for ( u64 c = a; c <= b; ++c ) fn(static_cast<int>(c));
+    if ( *p != ',' ) break;
+    ++p;
+  }
+}
+
+inline u32
+count_cpulist(const char *p)
+{
+  u32 n = 0;
+  for_each_cpu(p, [&](int) { ++n; });
+  return n;
+}
+
+inline u32
+online_cpus(void)
+{
+  char buf[256];
+  if ( read_file("/sys/devices/system/cpu/online", buf, sizeof(buf)) <= 0 ) return 1;
+  u32 n = count_cpulist(buf);
+  return n ? n : 1;
+}
+
+// the clock ref-cycles tick at, in kHz; 0 when nothing says. cpufreq's base_frequency
+// (intel_pstate) or amd_pstate_nominal_freq, else the "@ 3.60GHz" of the model name
+inline u64
+nominal_khz(void)
+{
+  char buf[4096];
+  const char *files[] = { "/sys/devices/system/cpu/cpu0/cpufreq/base_frequency",
+                          "/sys/devices/system/cpu/cpu0/cpufreq/amd_pstate_nominal_freq" };
+  for ( const char *f : files ) {
+    u64 v = 0;
+    const char *p = buf;
+    if ( read_file(f, buf, sizeof(buf)) > 0 && parse_u64(p, v) && v > 0 ) return v;
+  }
+  if ( read_file("/proc/cpuinfo", buf, sizeof(buf)) <= 0 ) return 0;
+  const char *p = find_key(buf, "model name");
+  if ( !p ) return 0;
+  for ( ; *p && *p != '\n'; ++p ) {
+    if ( *p != '@' ) continue;
+    const char *q = p + 1;
+    double ghz = 0.0;
+    if ( parse_double(q, ghz) && (*q == 'G' || (*q == ' ' && q[1] == 'G')) ) return static_cast<u64>(ghz * 1e6);
+  }
+  return 0;
+}
+
+struct host_info {
+  char hostname[64];
+  char cpu_model[128];
+  char kernel[64];
+  char governor[32];
+  u32 cpus;
+  u64 nominal_khz;
+};
+
+inline host_info
+query_host(void)
+{
+  host_info h{};
+  char buf[4096];
+  if ( read_file("/proc/sys/kernel/hostname", h.hostname, sizeof(h.hostname)) > 0 ) rstrip(h.hostname);
+  if ( read_file("/proc/sys/kernel/osrelease", h.kernel, sizeof(h.kernel)) > 0 ) rstrip(h.kernel);
+  if ( read_file("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor", h.governor, sizeof(h.governor)) > 0 ) rstrip(h.governor);
+  if ( read_file("/proc/cpuinfo", buf, sizeof(buf)) > 0 ) {
+    const char *p = find_key(buf, "model name");
+    if ( p ) {
+      while ( *p == ' ' || *p == '\t' || *p == ':' ) ++p;
+      copy_line(h.cpu_model, sizeof(h.cpu_model), p);
+    }
+  }
+  h.cpus = online_cpus();
+  h.nominal_khz = nominal_khz();
+  return h;
+}
+
+// FNV-1a; cheap stable id for host metadata strings
+inline u64
+fnv1a(const char *s, u64 h = 0xcbf29ce484222325ull)
+{
+  while ( *s ) {
+    h ^= static_cast<u8>(*s++);
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+inline u64
+host_fingerprint(const host_info &h)
+{
+  return fnv1a(h.governor, fnv1a(h.kernel, fnv1a(h.cpu_model)));
+}
+
+};     // namespace bbench::sys
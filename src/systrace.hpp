@@ -0,0 +1,290 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <linux/perf_event.h>
+
+#include <micron/linux/io.hpp>
+#include <micron/memory/cmemory.hpp>
+#include <micron/syscall.hpp>
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+#include "ring.hpp"
+#include "sysfs.hpp"
+
+// per-syscall counts and time of a binary run (bbench --syscalls)
+//
+// raw_syscalls:sys_enter / sys_exit tracepoints, sampled on every hit with the raw payload,
+// opened on the child with inherit so its whole tree is seen. like proctree, inherited events
+// go to one ring per cpu, sys_exit SET_OUTPUT into the sys_enter ring of the same cpu. enter and
+// exit are paired per tid; a task that migrated inside a blocking syscall has its halves in two
+// rings, so either half may arrive first. PERF_SAMPLE_RAW on tracepoints needs
+// perf_event_paranoid <= -1 or CAP_PERFMON
+namespace bbench::systrace
+{
+
+inline constexpr usize max_nr = 1024;
+
+struct syscall_stat {
+  i32 nr;
+  u64 count;
+  u64 errors;       // returned -4095..-1
+  u64 total_ns;     // enter to exit, only calls whose both halves were seen
+  u64 max_ns;
+};
+
+// one run's table
+struct table {
+  micron::vector<syscall_stat> calls;     // most total time first
+  u64 lost;                               // records dropped by the kernel; counts are low by that much
+  bool ok;                                // false: tracepoints couldn't be opened, calls is empty
+};
+
+namespace __impl
+{
+
+struct __name {
+  long nr;
+  const char *name;
+};
+
+#define __BBENCH_SC(x) { SYS_##x, #x }
+inline constexpr __name __names[] = {
+  __BBENCH_SC(read), __BBENCH_SC(write), __BBENCH_SC(close), __BBENCH_SC(fstat), __BBENCH_SC(lseek), __BBENCH_SC(mmap),
+  __BBENCH_SC(mprotect), __BBENCH_SC(munmap), __BBENCH_SC(brk), __BBENCH_SC(rt_sigaction), __BBENCH_SC(rt_sigprocmask),
+  __BBENCH_SC(rt_sigreturn), __BBENCH_SC(ioctl), __BBENCH_SC(pread64), __BBENCH_SC(pwrite64), __BBENCH_SC(readv),
+  __BBENCH_SC(writev), __BBENCH_SC(sched_yield), __BBENCH_SC(mremap), __BBENCH_SC(msync), __BBENCH_SC(mincore),
+  __BBENCH_SC(madvise), __BBENCH_SC(dup), __BBENCH_SC(nanosleep), __BBENCH_SC(getpid), __BBENCH_SC(sendfile),
+  __BBENCH_SC(socket), __BBENCH_SC(connect), __BBENCH_SC(accept), __BBENCH_SC(sendto), __BBENCH_SC(recvfrom),
+  __BBENCH_SC(sendmsg), __BBENCH_SC(recvmsg), __BBENCH_SC(shutdown), __BBENCH_SC(bind), __BBENCH_SC(listen),
+  __BBENCH_SC(getsockname), __BBENCH_SC(getpeername), __BBENCH_SC(socketpair), __BBENCH_SC(setsockopt),
+  __BBENCH_SC(getsockopt), __BBENCH_SC(clone), __BBENCH_SC(execve), __BBENCH_SC(exit), __BBENCH_SC(wait4),
+  __BBENCH_SC(kill), __BBENCH_SC(uname), __BBENCH_SC(fcntl), __BBENCH_SC(flock), __BBENCH_SC(fsync),
+  __BBENCH_SC(fdatasync), __BBENCH_SC(truncate), __BBENCH_SC(ftruncate), __BBENCH_SC(getcwd), __BBENCH_SC(chdir),
+  __BBENCH_SC(fchdir), __BBENCH_SC(fchmod), __BBENCH_SC(fchown), __BBENCH_SC(umask), __BBENCH_SC(gettimeofday),
+  __BBENCH_SC(getrlimit), __BBENCH_SC(getrusage), __BBENCH_SC(sysinfo), __BBENCH_SC(times), __BBENCH_SC(getuid),
+  __BBENCH_SC(getgid), __BBENCH_SC(setuid), __BBENCH_SC(setgid), __BBENCH_SC(geteuid), __BBENCH_SC(getegid),
+  __BBENCH_SC(setpgid), __BBENCH_SC(getppid), __BBENCH_SC(setsid), __BBENCH_SC(sigaltstack), __BBENCH_SC(statfs),
+  __BBENCH_SC(fstatfs), __BBENCH_SC(prctl), __BBENCH_SC(setrlimit), __BBENCH_SC(sync), __BBENCH_SC(gettid),
+  __BBENCH_SC(readahead), __BBENCH_SC(getxattr), __BBENCH_SC(lgetxattr), __BBENCH_SC(tkill), __BBENCH_SC(futex),
+  __BBENCH_SC(sched_setaffinity), __BBENCH_SC(sched_getaffinity), __BBENCH_SC(io_setup), __BBENCH_SC(io_submit),
+  __BBENCH_SC(io_getevents), __BBENCH_SC(getdents64), __BBENCH_SC(set_tid_address), __BBENCH_SC(fadvise64),
+  __BBENCH_SC(clock_gettime), __BBENCH_SC(clock_nanosleep), __BBENCH_SC(exit_group), __BBENCH_SC(epoll_ctl),
+  __BBENCH_SC(tgkill), __BBENCH_SC(waitid), __BBENCH_SC(openat), __BBENCH_SC(mkdirat), __BBENCH_SC(fchownat),
+  __BBENCH_SC(newfstatat), __BBENCH_SC(unlinkat), __BBENCH_SC(renameat), __BBENCH_SC(linkat), __BBENCH_SC(symlinkat),
+  __BBENCH_SC(readlinkat), __BBENCH_SC(fchmodat), __BBENCH_SC(faccessat), __BBENCH_SC(pselect6), __BBENCH_SC(ppoll),
+  __BBENCH_SC(splice), __BBENCH_SC(tee), __BBENCH_SC(utimensat), __BBENCH_SC(epoll_pwait), __BBENCH_SC(timerfd_create),
+  __BBENCH_SC(fallocate), __BBENCH_SC(timerfd_settime), __BBENCH_SC(accept4), __BBENCH_SC(eventfd2),
+  __BBENCH_SC(epoll_create1), __BBENCH_SC(dup3), __BBENCH_SC(pipe2), __BBENCH_SC(inotify_init1), __BBENCH_SC(preadv),
+  __BBENCH_SC(pwritev), __BBENCH_SC(perf_event_open), __BBENCH_SC(recvmmsg), __BBENCH_SC(prlimit64),
+  __BBENCH_SC(sendmmsg), __BBENCH_SC(getcpu), __BBENCH_SC(renameat2), __BBENCH_SC(getrandom), __BBENCH_SC(memfd_create),
+  __BBENCH_SC(execveat), __BBENCH_SC(membarrier), __BBENCH_SC(copy_file_range), __BBENCH_SC(preadv2),
+  __BBENCH_SC(pwritev2), __BBENCH_SC(statx), __BBENCH_SC(io_uring_setup), __BBENCH_SC(io_uring_enter),
+  __BBENCH_SC(clone3), __BBENCH_SC(close_range), __BBENCH_SC(openat2), __BBENCH_SC(pidfd_open), __BBENCH_SC(faccessat2),
+  __BBENCH_SC(rseq),
+#ifdef SYS_open
+  // legacy calls only the older ABIs (x86-64) still have
+  __BBENCH_SC(open), __BBENCH_SC(stat), __BBENCH_SC(lstat), __BBENCH_SC(poll), __BBENCH_SC(access), __BBENCH_SC(pipe),
+  __BBENCH_SC(select), __BBENCH_SC(dup2), __BBENCH_SC(pause), __BBENCH_SC(alarm), __BBENCH_SC(fork), __BBENCH_SC(vfork),
+  __BBENCH_SC(getdents), __BBENCH_SC(rename), __BBENCH_SC(mkdir), __BBENCH_SC(rmdir), __BBENCH_SC(creat),
+  __BBENCH_SC(link), __BBENCH_SC(unlink), __BBENCH_SC(symlink), __BBENCH_SC(readlink), __BBENCH_SC(chmod),
+  __BBENCH_SC(chown), __BBENCH_SC(lchown), __BBENCH_SC(arch_prctl), __BBENCH_SC(epoll_wait), __BBENCH_SC(epoll_create),
+  __BBENCH_SC(time), __BBENCH_SC(getpgrp), __BBENCH_SC(inotify_init), __BBENCH_SC(eventfd), __BBENCH_SC(signalfd),
+#endif
+};
+#undef __BBENCH_SC
+
+// a task currently inside a syscall, or the half of a pair that arrived first
+struct __pending {
+  i32 tid;
+  i32 nr;
+  u64 t;
+  i64 ret;
+  bool is_exit;
+};
+
+};     // namespace __impl
+
+// "read", "openat", ...; nullptr for numbers not in the table
+inline const char *
+name(i32 nr)
+{
+  for ( const auto &n : __impl::__names )
+    if ( n.nr == nr ) return n.name;
+  return nullptr;
+}
+
+class tracer
+{
+  ring_set rings;
+  micron::vector<int> exit_fds;
+  long long enter_id = -1;
+  long long exit_id = -1;
+  syscall_stat *stats = nullptr;     // indexed by nr
+  micron::vector<__impl::__pending> pending;
+
+  void
+  __pair(i32 nr, u64 dur, i64 ret)
+  {
+    syscall_stat &s = stats[nr];
+    s.total_ns += dur;
+    if ( dur > s.max_ns ) s.max_ns = dur;
+    if ( ret < 0 && ret > -4096 ) ++s.errors;
+  }
+
+  usize
+  __find(i32 tid) const
+  {
+    for ( usize i = 0; i < pending.size(); ++i )
+      if ( pending[i].tid == tid ) return i;
+    return pending.size();
+  }
+
+  // slots are recycled rather than erased; tid -1 = free
+  void
+  __drop(usize i)
+  {
+    pending[i].tid = -1;
+  }
+
+  void
+  __put(const __impl::__pending &p, usize i)
+  {
+    if ( i == pending.size() ) i = __find(-1);
+    if ( i < pending.size() )
+      pending[i] = p;
+    else
+      pending.push_back(p);
+  }
+
+  void
+  __record(const perf_event_header &h, const char *body, usize len)
+  {
+    // PERF_SAMPLE_TID | TIME | RAW: { pid, tid, time, raw_size, raw[] }
+    // raw: { u16 common_type, u8, u8, i32 common_pid, long id, ... } then args[6] (enter) or ret (exit)
+    if ( h.type != PERF_RECORD_SAMPLE || len < 20 + 24 ) return;
+    const i32 tid = *reinterpret_cast<const i32 *>(body + 4);
+    const u64 t = *reinterpret_cast<const u64 *>(body + 8);
+    const char *raw = body + 20;
+    const u16 type = *reinterpret_cast<const u16 *>(raw);
+    const i64 id = *reinterpret_cast<const i64 *>(raw + 8);
+    if ( id < 0 || id >= static_cast<i64>(max_nr) ) return;
+    const i32 nr = static_cast<i32>(id);
+    const usize i = __find(tid);
+    if ( type == enter_id ) {
+      stats[nr].nr = nr;
+      ++stats[nr].count;
+      if ( i < pending.size() && pending[i].is_exit && pending[i].nr == nr && pending[i].t >= t ) {
+        __pair(nr, pending[i].t - t, pending[i].ret);
+        __drop(i);
+        return;
+      }
+      // exit / exit_group never return
+      if ( nr == SYS_exit || nr == SYS_exit_group ) {
+        if ( i < pending.size() ) __drop(i);
+        return;
+      }
+      __put({ tid, nr, t, 0, false }, i);     // replaces an unmatched earlier half: its partner was lost
+    } else if ( type == exit_id ) {
+      const i64 ret = *reinterpret_cast<const i64 *>(raw + 16);
+      if ( i < pending.size() && !pending[i].is_exit && pending[i].nr == nr && pending[i].t <= t ) {
+        __pair(nr, t - pending[i].t, ret);
+        __drop(i);
+        return;
+      }
+      __put({ tid, nr, t, ret, true }, i);
+    }
+  }
+
+public:
+  tracer(void) = default;
+  tracer(const tracer &) = delete;
+  tracer &operator=(const tracer &) = delete;
+
+  ~tracer()
+  {
+    for ( int fd : exit_fds ) micron::close(fd);
+    delete[] stats;
+  }
+
+  // opens both tracepoints on pid, every online cpu; call while the child is parked
+  // false: no tracefs, not permitted, or no cpu could be opened
+  bool
+  attach(int pid)
+  {
+    enter_id = sys::tracepoint_id("raw_syscalls/sys_enter");
+    exit_id = sys::tracepoint_id("raw_syscalls/sys_exit");
+    if ( enter_id < 0 || exit_id < 0 ) return false;
+    stats = new syscall_stat[max_nr];
+    micron::memset(stats, 0, sizeof(syscall_stat) * max_nr);
+    perf_event_attr a{};
+    a.size = sizeof(a);
+    a.type = PERF_TYPE_TRACEPOINT;
+    a.config = static_cast<u64>(enter_id);
+    a.sample_period = 1;
+    a.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+    a.disabled = 1;
+    a.enable_on_exec = 1;
+    a.inherit = 1;
+    // 256 KiB per cpu: one record per syscall half adds up quickly
+    return rings.open(
+               a, pid,
+               [&](int cpu, perf_ring &ring) {
+                 perf_event_attr x = a;
+                 x.config = static_cast<u64>(exit_id);
+                 long fd = micron::syscall(SYS_perf_event_open, &x, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+                 if ( fd < 0 ) return;
+                 exit_fds.push_back(static_cast<int>(fd));
+                 ring.redirect(static_cast<int>(fd));
+               },
+               6)
+           > 0;
+  }
+
+  int
+  watch_fd(void) const
+  {
+    return rings.watch_fd();
+  }
+
+  u64
+  lost_records(void) const
+  {
+    return rings.lost_records();
+  }
+
+  void
+  drain(void)
+  {
+    if ( !stats ) return;
+    rings.drain([&](const perf_event_header &h, const char *body, usize len) { __record(h, body, len); });
+  }
+
+  void
+  finish(table &t)
+  {
+    drain();
+    t.ok = stats != nullptr && rings.size() > 0;
+    t.lost = rings.lost_records();
+    if ( !stats ) return;
+    micron::vector<syscall_stat> &out = t.calls;
+    for ( usize nr = 0; nr < max_nr; ++nr )
+      if ( stats[nr].count ) out.push_back(stats[nr]);
+    for ( usize i = 0; i + 1 < out.size(); ++i ) {
+      usize mx = i;
+      for ( usize j = i + 1; j < out.size(); ++j )
+        if ( out[j].total_ns > out[mx].total_ns || (out[j].total_ns == out[mx].total_ns && out[j].count > out[mx].count) ) mx = j;
+      if ( mx != i ) {
+        syscall_stat t = out[i];
+        out[i] = out[mx];
+        out[mx] = t;
+      }
+    }
+  }
+};
+
+};     // namespace bbench::systrace
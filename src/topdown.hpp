@@ -147,7 +147,8 @@ measure_bin(const char *path, const benchmark_opts &opts)
   be_bound.attr.enable_on_exec = 1;
 
   if ( opts.pre ) process<true>(opts.pre);
-  int pid = process_attach(path, [&](int child_pid) {
+  stdio_redirect io(opts.stdout_path, opts.stderr_path);
+  int pid = process_attach(__impl::__launch_from(path, opts, io), [&](int child_pid) {
     slots.open_pid(child_pid);
     retiring.open_pid(child_pid);
     bad_spec.open_pid(child_pid);
@@ -155,14 +156,14 @@ measure_bin(const char *path, const benchmark_opts &opts)
     be_bound.open_pid(child_pid);
   });
 
-  micron::waitpid(pid, nullptr, 0);
+  child_usage cu;
+  __impl::__wait_child(pid, opts.timeout_ms, cu);
 
   slots.end();
   retiring.end();
   bad_spec.end();
   fe_bound.end();
   be_bound.end();
-  (void)opts;
 
   if ( opts.post ) process<true>(opts.post);
 
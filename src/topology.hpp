@@ -0,0 +1,111 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <micron/types.hpp>
+#include <micron/vector.hpp>
+
+#include "sysfs.hpp"
+
+// cpu topology from /sys/devices/system/cpu, used to place concurrent runs
+//
+//  -> one logical cpu per physical core (no shared SMT siblings)
+//  -> optionally one per last-level cache
+namespace bbench::topology
+{
+
+struct cpu_info {
+  int cpu;
+  int core_leader;     // lowest cpu among the SMT siblings
+  int llc_leader;      // lowest cpu sharing the last-level cache, -1 if unknown
+  int package;
+};
+
+namespace __impl
+{
+
+inline void
+__path(char *dst, usize cap, int cpu, const char *leaf)
+{
+  const char *pre = "/sys/devices/system/cpu/cpu";
+  usize n = 0;
+  while ( *pre && n < cap - 1 ) dst[n++] = *pre++;
+  char digits[12];
+  int k = 0;
+  for ( int v = cpu; k == 0 || v > 0; v /= 10 ) digits[k++] = static_cast<char>('0' + v % 10);
+  while ( k > 0 && n < cap - 1 ) dst[n++] = digits[--k];
+  while ( *leaf && n < cap - 1 ) dst[n++] = *leaf++;
+  dst[n] = '\0';
+}
+
+// first cpu of a cpulist, -1 if empty
+inline int
+__first_cpu(const char *list)
+{
+  const char *p = list;
+  u64 v = 0;
+  return sys::parse_u64(p, v) ? static_cast<int>(v) : -1;
+}
+
+inline int
+__read_leader(int cpu, const char *leaf)
+{
+  char path[128];
+  char buf[256];
+  __path(path, sizeof(path), cpu, leaf);
+  if ( sys::read_file(path, buf, sizeof(buf)) <= 0 ) return -1;
+  return __first_cpu(buf);
+}
+
+};     // namespace __impl
+
+inline micron::vector<cpu_info>
+query(void)
+{
+  micron::vector<cpu_info> out;
+  char buf[512];
+  if ( sys::read_file("/sys/devices/system/cpu/online", buf, sizeof(buf)) <= 0 ) return out;
+  sys::for_each_cpu(buf, [&](int cpu) {
+    cpu_info ci{ cpu, cpu, -1, 0 };
+    int lead = __impl::__read_leader(cpu, "/topology/thread_siblings_list");
+    if ( lead >= 0 ) ci.core_leader = lead;
+    ci.llc_leader = __impl::__read_leader(cpu, "/cache/index3/shared_cpu_list");
+    char path[128];
+    __impl::__path(path, sizeof(path), cpu, "/topology/physical_package_id");
+    u64 pkg = 0;
+    if ( sys::read_u64(path, pkg) ) ci.package = static_cast<int>(pkg);
+    out.push_back(ci);
+  });
+  return out;
+}
+
+// up to n cpus, each on its own physical core; with distinct_llc also each on its own LLC
+// cpu 0 is handed out last since that's where most interrupt and housekeeping work lands
+inline micron::vector<int>
+pick_cpus(u32 n, bool distinct_llc)
+{
+  micron::vector<int> picked;
+  micron::vector<int> llcs;
+  micron::vector<cpu_info> cpus = query();
+  for ( int pass = 0; pass < 2 && picked.size() < n; ++pass ) {
+    for ( const auto &c : cpus ) {
+      if ( picked.size() >= n ) break;
+      if ( c.cpu != c.core_leader ) continue;
+      if ( (pass == 0) == (c.cpu == 0) ) continue;
+      if ( distinct_llc && c.llc_leader >= 0 ) {
+        bool seen = false;
+        for ( int l : llcs )
+          if ( l == c.llc_leader ) seen = true;
+        if ( seen ) continue;
+        llcs.push_back(c.llc_leader);
+      }
+      picked.push_back(c.cpu);
+    }
+  }
+  return picked;
+}
+
+};     // namespace bbench::topology
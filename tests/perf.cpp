@@ -0,0 +1,219 @@
+
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+// harness self-benchmark: what every bbench primitive costs, so its own regressions show up
+// usage: perf_test [N] [BINARY]   (N samples per primitive, BINARY for spawn latency, default /bin/true)
+
+#include "../src/bench.hpp"
+#include "../src/format.hpp"
+
+#include <micron/io/stdout.hpp>
+#include <micron/vector.hpp>
+#include <micron/memory/cmemory.hpp>
+
+namespace {
+
+inline u64
+now_ns(void) {
+  micron::timespec_t t{};
+  micron::clock_gettime(micron::clock_monotonic, t);
+  return static_cast<u64>(t.tv_sec) * 1'000'000'000ull + static_cast<u64>(t.tv_nsec);
+}
+
+inline u64
+now_tsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return 0;
+#endif
+}
+
+struct samples {
+  micron::vector<u64> ns;
+  micron::vector<u64> tsc;
+};
+
+// Hoare quickselect; leaves v[k] as the k-th smallest
+u64
+select_kth(micron::vector<u64> &v, usize k) {
+  usize lo = 0, hi = v.size() - 1;
+  while (lo < hi) {
+    const u64 pivot = v[lo + (hi - lo) / 2];
+    usize i = lo, j = hi;
+    while (i <= j) {
+      while (v[i] < pivot) ++i;
+      while (v[j] > pivot) --j;
+      if (i <= j) {
+        u64 t = v[i]; v[i] = v[j]; v[j] = t;
+        ++i;
+        if (j == 0) break;
+        --j;
+      }
+    }
+    if (k <= j) hi = j;
+    else if (k >= i) lo = i;
+    else break;
+  }
+  return v[k];
+}
+
+void
+report(const bbench::format::sink &out, const char *name, samples &s) {
+  if (s.ns.size() == 0) return;
+  const usize n = s.ns.size();
+  const usize p50 = n / 2;
+  const usize p99 = (n * 99) / 100 < n ? (n * 99) / 100 : n - 1;
+  const u64 ns50 = select_kth(s.ns, p50);
+  const u64 ns99 = select_kth(s.ns, p99);
+  const u64 tsc50 = select_kth(s.tsc, p50);
+  const u64 tsc99 = select_kth(s.tsc, p99);
+  out.emit(name);
+  for (usize k = micron::strlen(name); k < 40; ++k) out.emit(" ");
+  out.emit_int(static_cast<long long>(ns50)); out.emit("\t");
+  out.emit_int(static_cast<long long>(ns99)); out.emit("\t");
+  out.emit_int(static_cast<long long>(tsc50)); out.emit("\t");
+  out.emit_int(static_cast<long long>(tsc99));
+  out.newline();
+}
+
+// times only fn; setup/teardown run outside the timed window
+template <typename S, typename F, typename T>
+void
+measure(const bbench::format::sink &out, const char *name, usize n, S &&setup, F &&fn, T &&teardown) {
+  samples s;
+  s.ns.reserve(n);
+  s.tsc.reserve(n);
+  for (usize i = 0; i < n; ++i) {
+    setup();
+    const u64 t0 = now_ns();
+    const u64 c0 = now_tsc();
+    fn();
+    const u64 c1 = now_tsc();
+    const u64 t1 = now_ns();
+    teardown();
+    s.ns.push_back(t1 - t0);
+    s.tsc.push_back(c1 - c0);
+  }
+  report(out, name, s);
+}
+
+template <typename F>
+void
+measure(const bbench::format::sink &out, const char *name, usize n, F &&fn) {
+  measure(out, name, n, [] {}, micron::forward<F>(fn), [] {});
+}
+
+void
+kernel_clock_costs(const bbench::format::sink &out, usize n) {
+  {
+    bbench::hardware_cycles *c = nullptr;
+    measure(out, "kernel_clock::open", n,
+            [&] { c = new bbench::hardware_cycles(bbench::quiet{}); },
+            [&] { c->open(); },
+            [&] { delete c; });
+  }
+  bbench::hardware_cycles c{ bbench::quiet{} };
+  c.open();
+  measure(out, "kernel_clock::start", n, [&] { c.start(); });
+  measure(out, "kernel_clock::stop", n, [&] { c.stop(); });
+  volatile long long sink_v = 0;
+  measure(out, "kernel_clock::read", n, [&] { sink_v = c.read(); });
+  (void)sink_v;
+}
+
+template <class G>
+void
+group_costs(const bbench::format::sink &out, const char *begin_name, const char *end_name, const char *collect_name, usize n) {
+  G gr{ bbench::quiet{} };
+  gr.open();
+  bbench::time_clock cl;
+  cl.begin();
+  cl.end();
+  measure(out, begin_name, n, [&] { gr.begin(); });
+  measure(out, end_name, n, [&] { gr.end(); });
+  measure(out, collect_name, n, [&] {
+    bbench::benchmark_t b = bbench::__impl::collect<bbench::time_resolution::us>(micron::string{}, cl, gr);
+    (void)b;
+  });
+}
+
+template <bbench::system_clocks C>
+void
+system_clock_costs(const bbench::format::sink &out, const char *start_name, const char *stop_name, usize n) {
+  bbench::system_clock<C> c;
+  measure(out, start_name, n, [&] { c.start(); });
+  measure(out, stop_name, n, [&] { c.stop(); });
+}
+
+void
+stopwatch_costs(const bbench::format::sink &out, usize n) {
+  bbench::stopwatch<> sw;
+  sw.begin();
+  measure(out, "stopwatch::lap", n, [&] { sw.lap(); });
+}
+
+void
+spawn_costs(const bbench::format::sink &out, const char *path, usize n) {
+  int pid = -1;
+  measure(out, "process_attach (spawn)", n,
+          [] {},
+          [&] { pid = bbench::process_attach(path, [](int) {}); },
+          [&] { micron::waitpid(pid, nullptr, 0); });
+  if (!bbench::forkserver::start()) return;
+  bbench::launch_spec ls{};
+  ls.path = path;
+  bbench::child_usage cu;
+  measure(out, "forkserver::launch (spawn)", n,
+          [] {},
+          [&] { pid = bbench::forkserver::instance().launch(ls, [](int) {}); },
+          [&] {
+            bbench::forkserver::instance().wait_exit(pid, 0, cu);
+            bbench::forkserver::instance().collect(cu);
+          });
+}
+
+};
+
+int
+main(int argc, char **argv) {
+  long long n_arg = 10000;
+  if (argc > 1) {
+    long long v = 0;
+    for (const char *p = argv[1]; *p >= '0' && *p <= '9'; ++p) v = v * 10 + (*p - '0');
+    if (v > 0) n_arg = v;
+  }
+  const usize n = static_cast<usize>(n_arg);
+  const usize n_spawn = n / 50 ? n / 50 : 1;
+  const char *spawn_path = argc > 2 ? argv[2] : "/bin/true";
+
+  bbench::format::sink out = bbench::format::sink::stdout_sink();
+  out.emit("# primitive                             p50_ns\tp99_ns\tp50_tsc\tp99_tsc\n");
+
+  measure(out, "(empty: timer overhead)", n, [] {});
+
+  kernel_clock_costs(out, n);
+
+  group_costs<bbench::event_group_d1>(out, "event_group_d1::begin", "event_group_d1::end", "event_group_d1::collect", n);
+  group_costs<bbench::event_group_d2>(out, "event_group_d2::begin", "event_group_d2::end", "event_group_d2::collect", n);
+  group_costs<bbench::event_group_d3>(out, "event_group_d3::begin", "event_group_d3::end", "event_group_d3::collect", n);
+
+  using bbench::system_clocks;
+  system_clock_costs<system_clocks::realtime_set>(out, "system_clock<realtime_set>::start", "system_clock<realtime_set>::stop", n);
+  system_clock_costs<system_clocks::realtime>(out, "system_clock<realtime>::start", "system_clock<realtime>::stop", n);
+  system_clock_costs<system_clocks::realtime_coarse>(out, "system_clock<realtime_coarse>::start", "system_clock<realtime_coarse>::stop", n);
+  system_clock_costs<system_clocks::taitime>(out, "system_clock<taitime>::start", "system_clock<taitime>::stop", n);
+  system_clock_costs<system_clocks::monotonic>(out, "system_clock<monotonic>::start", "system_clock<monotonic>::stop", n);
+  system_clock_costs<system_clocks::monotonic_coarse>(out, "system_clock<monotonic_coarse>::start", "system_clock<monotonic_coarse>::stop", n);
+  system_clock_costs<system_clocks::monotonic_raw>(out, "system_clock<monotonic_raw>::start", "system_clock<monotonic_raw>::stop", n);
+  system_clock_costs<system_clocks::since_boot>(out, "system_clock<since_boot>::start", "system_clock<since_boot>::stop", n);
+  system_clock_costs<system_clocks::cputime>(out, "system_clock<cputime>::start", "system_clock<cputime>::stop", n);
+  system_clock_costs<system_clocks::cputime_this>(out, "system_clock<cputime_this>::start", "system_clock<cputime_this>::stop", n);
+
+  stopwatch_costs(out, n);
+  spawn_costs(out, spawn_path, n_spawn);
+  return 0;
+}
@@ -0,0 +1,267 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+// statistics self-check: known samples through the estimators bbench reports, at counter
+// magnitudes (cycles, instructions) as well as small ones, and runs through the archive and back.
+// prints one line per check, exits 1 on any mismatch
+// usage: stats_test
+
+#include "../src/aggregate.hpp"
+#include "../src/archive.hpp"
+#include "../src/baseline.hpp"
+#include "../src/format.hpp"
+#include "../src/metrics.hpp"
+#include "../src/regress.hpp"
+#include "../src/stopping.hpp"
+
+#include <micron/vector.hpp>
+
+namespace {
+
+usize failures = 0;
+
+void
+check(const bbench::format::sink &out, const char *name, double got, double want, double rel = 1e-9) {
+  const double err = got > want ? got - want : want - got;
+  const double mag = want < 0 ? -want : want;
+  const bool ok = err <= rel * (mag > 0.0 ? mag : 1.0);
+  out.emit(ok ? "ok    " : "FAIL  ");
+  out.emit(name);
+  out.emit(": got ");
+  out.emit_double(got);
+  out.emit(", want ");
+  out.emit_double(want);
+  out.newline();
+  if (!ok) ++failures;
+}
+
+void
+expect(const bbench::format::sink &out, const char *name, bool ok) {
+  out.emit(ok ? "ok    " : "FAIL  ");
+  out.emit(name);
+  out.newline();
+  if (!ok) ++failures;
+}
+
+// x_i = base + scale * i, i in [0, n): mean base + scale (n-1)/2, sample stddev scale sqrt(n (n+1) / 12)
+micron::vector<double>
+ramp(double base, double scale, usize n) {
+  micron::vector<double> v;
+  v.reserve(n);
+  for (usize i = 0; i < n; ++i) v.push_back(base + scale * static_cast<double>(i));
+  return v;
+}
+
+void
+stddev_checks(const bbench::format::sink &out) {
+  const auto id = [](double x) { return x; };
+  // sqrt(10 * 11 / 12) = 3.0276503540974917
+  check(out, "stddev, ramp of 10, scale 1", bbench::format::compute_stats(ramp(0.0, 1.0, 10), id).stddev, 3.0276503540974917);
+  check(out, "stddev, ramp of 10, scale 1e4", bbench::format::compute_stats(ramp(1e9, 1e4, 10), id).stddev, 3.0276503540974917e4);
+  check(out, "stddev, ramp of 10, scale 1e9", bbench::format::compute_stats(ramp(4e9, 1e9, 10), id).stddev, 3.0276503540974917e9);
+  check(out, "stddev, ramp of 10, scale 1e12", bbench::format::compute_stats(ramp(0.0, 1e12, 10), id).stddev, 3.0276503540974917e12);
+  // through a counter column, as emit_counter_stats / -x --table see it
+  micron::vector<bbench::benchmark_t> runs;
+  for (usize i = 0; i < 10; ++i) {
+    bbench::benchmark_t b{};
+    b.cycles = 3'000'000'000ll + 250'000'000ll * static_cast<long long>(i);
+    runs.push_back(b);
+  }
+  check(out, "stddev, cycles column", bbench::format::compute_stats(runs, [](const bbench::benchmark_t &b) { return static_cast<double>(b.cycles); }).stddev,
+        2.5e8 * 3.0276503540974917);
+}
+
+// --target-ci's mean interval: t(n-1) s / sqrt(n), checked once the whole sample is in
+double
+half_width(const micron::vector<double> &v) {
+  bbench::stopping::rule r;
+  r.target = 1e-12;
+  r.min_runs = static_cast<u32>(v.size());
+  r.max_runs = static_cast<u32>(v.size());
+  bbench::stopping::monitor m(r);
+  m.start(0);
+  for (double x : v) m.add(x, 0);
+  return m.result().half_width;
+}
+
+void
+interval_checks(const bbench::format::sink &out) {
+  // 2.262 * 3.0276503540974917e9 / sqrt(10)
+  check(out, "ci half-width, ramp of 10, scale 1e9", half_width(ramp(4e9, 1e9, 10)), 2165700117.744837);
+  // t(19999) = 1.9600826 (Cornish-Fisher), s = sqrt(20000 * 20001 / 12)
+  check(out, "ci half-width, ramp of 20000", half_width(ramp(0.0, 1.0, 20000)), 80.02203862171964);
+}
+
+// --check's Welch test at cycle-count spreads: means 1e9 and 1.02e9, stddev 1e7, 10 runs each
+void
+welch_checks(const bbench::format::sink &out) {
+  double t = 0.0, df = 0.0;
+  bbench::baseline::__impl::__welch(1e9, 1e7, 10, 1.02e9, 1e7, 10, t, df);
+  check(out, "welch t, cycles", t, 4.47213595499958);     // 2e7 / sqrt(2e13)
+  check(out, "welch df, cycles", df, 18.0);
+}
+
+// streamed aggregates: Welford over the whole ramp, and Chan's merge of two halves
+void
+aggregate_checks(const bbench::format::sink &out) {
+  const micron::vector<double> v = ramp(4e9, 1e9, 10);
+  bbench::aggregate::moments all, lo, hi;
+  for (usize i = 0; i < v.size(); ++i) {
+    all.add(v[i]);
+    (i < 4 ? lo : hi).add(v[i]);
+  }
+  lo.merge(hi);
+  check(out, "aggregate stddev, scale 1e9", all.stddev(), 3.0276503540974917e9);
+  check(out, "aggregate stddev, merged halves", lo.stddev(), 3.0276503540974917e9);
+}
+
+// bench_linear's OLS interval at cycle scale: y = 1e9 x plus residuals of 2e7 - 3e7 over 5 batches
+void
+regression_checks(const bbench::format::sink &out) {
+  const double x[] = { 1.0, 2.0, 3.0, 4.0, 5.0 };
+  const double y[] = { 1.03e9, 1.98e9, 2.98e9, 4.03e9, 4.98e9 };
+  const bbench::regress::fit f = bbench::regress::ols(x, y, 5);
+  check(out, "ols slope", f.slope, 995000000.0);
+  check(out, "ols intercept", f.intercept, 15000000.0);
+  // slope -+ t(3) sqrt(ss_res / 3 / sxx), ss_res 2.75e15, sxx 10
+  check(out, "ols slope 95% low", f.slope_lo, 964534669.4311934);
+  check(out, "ols slope 95% high", f.slope_hi, 1025465330.5688066);
+}
+
+// -M spreads with correlated operands: instructions = 2 cycles in every run, cycles a ramp at 1e9
+// scale. ipc doesn't move at all; cycles - instructions moves exactly as much as cycles
+void
+metric_checks(const bbench::format::sink &out) {
+  micron::vector<bbench::benchmark_t> runs;
+  for (usize i = 0; i < 10; ++i) {
+    bbench::benchmark_t b{};
+    b.cycles = 4'000'000'000ll + 1'000'000'000ll * static_cast<long long>(i);
+    b.instructions = 2 * b.cycles;
+    runs.push_back(b);
+  }
+  bbench::metric::expr diff, ipc;
+  if (!diff.compile("cycles - instructions") || !ipc.compile("ipc")) {
+    out.emit("FAIL  metric expressions don't compile\n");
+    ++failures;
+    return;
+  }
+  check(out, "metric value, ipc", ipc.over(runs).v, 2.0);
+  check(out, "metric sd, ipc", ipc.over(runs).sd, 0.0);
+  check(out, "metric sd, difference", diff.over(runs).sd, 3.0276503540974917e9);
+}
+
+// 5 runs of name: a fractional time (double column), cycles at 1e12 that step back once (integer
+// column with a negative delta), every other column 0 (constant)
+micron::vector<bbench::benchmark_t>
+archive_runs(const char *name, long long base) {
+  micron::vector<bbench::benchmark_t> v;
+  for (usize i = 0; i < 5; ++i) {
+    bbench::benchmark_t b{};
+    b.name = micron::string{ name };
+    b.time = 1000.25 + 0.5 * static_cast<double>(i);
+    b.cycles = base + 7 * static_cast<long long>(i) - (i == 3 ? 100 : 0);
+    v.push_back(b);
+  }
+  return v;
+}
+
+// the first n bytes of b as the whole of path
+bool
+write_file(const char *path, const micron::vector<u8> &b, usize n) {
+  const int fd = micron::open(path, micron::posix::o_wronly | micron::posix::o_create | micron::posix::o_trunc, 0644);
+  if (fd < 0) return false;
+  const bool ok = bbench::archive::__impl::__write_all(fd, &b[0], n);
+  micron::close(fd);
+  return ok;
+}
+
+bool
+has_tag(const bbench::archive::block &b, const char *tag) {
+  return bbench::archive::__impl::__eq(b.tag, tag);
+}
+
+// every row of block k as for_each hands it out, against the runs it was encoded from
+bool
+rows_match(const bbench::archive::reader &r, usize k, const micron::vector<bbench::benchmark_t> &want) {
+  usize i = 0, same = 0;
+  r.for_each(r[k], [&](const bbench::benchmark_t &b) {
+    if (i < want.size() && b.time == want[i].time && b.cycles == want[i].cycles && b.instructions == 0
+        && micron::strcmp(b.name.c_str(), want[i].name.c_str()) == 0)
+      ++same;
+    ++i;
+  });
+  return i == want.size() && same == want.size();
+}
+
+// one column of block k through a cursor
+bool
+column_matches(const bbench::archive::reader &r, usize k, const micron::vector<bbench::benchmark_t> &want) {
+  const bbench::archive::column *c = bbench::archive::find(r[k], "cycles");
+  if (!c || c->kind != bbench::archive::col_integer) return false;
+  bbench::archive::cursor cur(*c);
+  for (const auto &b : want)
+    if (cur.next() != static_cast<double>(b.cycles)) return false;
+  return true;
+}
+
+// blocks a, b, c encoded, written whole, with c torn in half, and with b's length overwritten; the
+// reader keeps every block that parses, and append cuts the torn tail off before it writes
+void
+archive_checks(const bbench::format::sink &out) {
+  const char *path = "/tmp/bbench_stats_test.bba";
+  const auto a = archive_runs("a", 1'000'000'000'000ll);
+  const auto b = archive_runs("b", 2'000'000'000'000ll);
+  const auto c = archive_runs("c", 3'000'000'000'000ll);
+  micron::vector<u8> file;
+  bbench::archive::__impl::__header(file);
+  bbench::archive::encode(a, 1, "r1", file);
+  const usize b_at = file.size();
+  bbench::archive::encode(b, 1, "r2", file);
+  const usize c_at = file.size();
+  bbench::archive::encode(c, 1, "r3", file);
+  {
+    bbench::archive::reader r;
+    const bool ok = write_file(path, file, file.size()) && r.open(path) && r.size() == 3;
+    expect(out, "archive round trip, 3 blocks", ok);
+    if (ok) {
+      expect(out, "archive round trip, rows", r.rows() == 15 && rows_match(r, 0, a) && rows_match(r, 2, c));
+      expect(out, "archive round trip, cycles cursor", column_matches(r, 1, b));
+    }
+  }
+  {
+    bbench::archive::reader r;
+    const bool ok = write_file(path, file, c_at + (file.size() - c_at) / 2) && r.open(path);
+    expect(out, "archive torn tail, blocks before it", ok && r.size() == 2 && has_tag(r[1], "r2") && rows_match(r, 1, b));
+  }
+  {
+    const bool appended = bbench::archive::append(path, c, 1, "r4");
+    bbench::archive::reader r;
+    const bool ok = appended && r.open(path) && r.size() == 3;
+    expect(out, "archive append over a torn tail", ok && has_tag(r[2], "r4") && rows_match(r, 2, c));
+  }
+  {
+    for (usize i = 4; i < 12; ++i) file[b_at + i] = 0xff;     // block bytes
+    bbench::archive::reader r;
+    const bool ok = write_file(path, file, file.size()) && r.open(path);
+    expect(out, "archive corrupted block, resync past it",
+           ok && r.size() == 2 && has_tag(r[0], "r1") && has_tag(r[1], "r3") && rows_match(r, 1, c) && column_matches(r, 1, c));
+  }
+  micron::syscall(SYS_unlink, path);
+}
+
+};
+
+int
+main(void) {
+  bbench::format::sink out = bbench::format::sink::stdout_sink();
+  stddev_checks(out);
+  interval_checks(out);
+  welch_checks(out);
+  aggregate_checks(out);
+  regression_checks(out);
+  metric_checks(out);
+  archive_checks(out);
+  return failures ? 1 : 0;
+}
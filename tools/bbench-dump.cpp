@@ -0,0 +1,227 @@
+//          Copyright David Lucius Severus 2024-.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include "../src/archive.hpp"
+#include "../src/format.hpp"
+#include "../src/json.hpp"
+
+#include <micron/io/stdout.hpp>
+#include <micron/vector.hpp>
+#include <micron/memory/cmemory.hpp>
+
+namespace {
+
+enum class mode : u8 { info, csv, json, jsonl, column };
+
+struct cli_opts {
+  mode m = mode::info;
+  char csv_sep = ',';
+  const char *column = nullptr;     // -c NAME
+  const char *output_file = nullptr;
+  const char *path = nullptr;
+};
+
+inline bool
+arg_eq(const char *a, const char *b) {
+  return micron::strcmp(a, b) == 0;
+}
+
+void usage(void) {
+  micron::io::println("bbench-dump [--info | -x SEP | --json | --jsonl | -c COLUMN] [-o FILE] ARCHIVE");
+  micron::io::println("  --info          one line per block: when, host, tag, rows, size (default)");
+  micron::io::println("  -x SEP          every run as CSV with field separator SEP (bbench -x columns)");
+  micron::io::println("  --json          one JSON document, blocks with their host and runs");
+  micron::io::println("  --jsonl         JSON Lines: a \"block\" record, then its \"run\" records");
+  micron::io::println("  -c COLUMN       one column's values (time_us, cycles, ...), one per line; decodes only it");
+  micron::io::println("  -o FILE         output to FILE");
+}
+
+bool parse_argv(int argc, char **argv, cli_opts &out) {
+  for (int i = 1; i < argc; ++i) {
+    const char *a = argv[i];
+    auto need_value = [&](const char *&dst) -> bool {
+      if (i + 1 >= argc) {
+        bbench::format::sink err = bbench::format::sink::stderr_sink();
+        err.emit("bbench-dump: "); err.emit(a); err.emit(" requires a value\n");
+        return false;
+      }
+      dst = argv[++i];
+      return true;
+    };
+    if (arg_eq(a, "--info")) {
+      out.m = mode::info;
+    } else if (arg_eq(a, "-x")) {
+      const char *v = nullptr;
+      if (!need_value(v)) return false;
+      out.m = mode::csv;
+      out.csv_sep = v[0] ? v[0] : ',';
+    } else if (arg_eq(a, "--json")) {
+      out.m = mode::json;
+    } else if (arg_eq(a, "--jsonl")) {
+      out.m = mode::jsonl;
+    } else if (arg_eq(a, "-c")) {
+      if (!need_value(out.column)) return false;
+      out.m = mode::column;
+    } else if (arg_eq(a, "-o")) {
+      if (!need_value(out.output_file)) return false;
+    } else if (arg_eq(a, "-h") || arg_eq(a, "--help")) {
+      usage();
+      return false;
+    } else if (a[0] == '-' && a[1] != '\0') {
+      bbench::format::sink err = bbench::format::sink::stderr_sink();
+      err.emit("bbench-dump: unknown flag: "); err.emit(a); err.newline();
+      return false;
+    } else {
+      out.path = a;
+    }
+  }
+  if (!out.path) {
+    usage();
+    return false;
+  }
+  return true;
+}
+
+inline void
+emit_str(const bbench::format::sink &out, const bbench::archive::str &s) {
+  out.emit(s.p, s.n);
+}
+
+void
+emit_info(const bbench::format::sink &out, const bbench::archive::reader &rd) {
+  out.emit("# block offset bytes written rows detail host tag\n");
+  for (usize i = 0; i < rd.size(); ++i) {
+    const auto &b = rd[i];
+    out.emit_int(static_cast<long long>(i));                out.emit(" ");
+    out.emit_int(static_cast<long long>(b.offset));         out.emit(" ");
+    out.emit_int(static_cast<long long>(b.bytes));          out.emit(" ");
+    out.emit_int(static_cast<long long>(b.written));        out.emit(" ");
+    out.emit_int(static_cast<long long>(b.rows));           out.emit(" ");
+    out.emit_int(b.detail);                                 out.emit(" ");
+    emit_str(out, b.hostname); out.emit("/"); emit_str(out, b.cpu_model); out.emit(" ");
+    if (b.tag.n) emit_str(out, b.tag);
+    else out.emit("-");
+    out.newline();
+  }
+  out.emit("# ");
+  out.emit_int(static_cast<long long>(rd.size()));  out.emit(" blocks, ");
+  out.emit_int(static_cast<long long>(rd.rows()));  out.emit(" runs\n");
+}
+
+// the bbench -x layout at the highest detail level any block was written with; columns a block
+// lacks come out 0
+void
+emit_csv(const bbench::format::sink &out, const bbench::archive::reader &rd, char sep) {
+  u32 detail = 1;
+  for (usize i = 0; i < rd.size(); ++i)
+    if (rd[i].detail > detail) detail = rd[i].detail;
+  bbench::format::emit_csv_header(out, detail, sep);
+  for (usize i = 0; i < rd.size(); ++i)
+    rd.for_each(rd[i], [&](const bbench::benchmark_t &b) { bbench::format::emit_csv_one(out, b, detail, sep); });
+}
+
+void
+json_block(bbench::json::writer &w, const bbench::archive::block &b, usize i) {
+  char buf[256];
+  w.key("block").integer(static_cast<long long>(i));
+  w.key("written").integer(static_cast<long long>(b.written));
+  w.key("rows").integer(static_cast<long long>(b.rows));
+  w.key("detail").integer(b.detail);
+  bbench::archive::copy(b.tag, buf, sizeof(buf));
+  w.key("tag").string(buf);
+  w.key("host").begin_object();
+  bbench::archive::copy(b.hostname, buf, sizeof(buf));
+  w.key("hostname").string(buf);
+  bbench::archive::copy(b.cpu_model, buf, sizeof(buf));
+  w.key("cpu_model").string(buf);
+  bbench::archive::copy(b.kernel, buf, sizeof(buf));
+  w.key("kernel").string(buf);
+  bbench::archive::copy(b.governor, buf, sizeof(buf));
+  w.key("governor").string(buf);
+  w.key("cpus").integer(b.cpus);
+  w.key("nominal_khz").integer(static_cast<long long>(b.nominal_khz));
+  w.key("fingerprint").integer(static_cast<long long>(b.host));
+  w.end_object();
+}
+
+void
+emit_json(const bbench::format::sink &out, const bbench::archive::reader &rd, bool lines) {
+  bbench::json::writer w(out);
+  if (!lines) w.begin_object().key("format").integer(1).key("blocks").begin_array();
+  for (usize i = 0; i < rd.size(); ++i) {
+    const auto &b = rd[i];
+    w.begin_object();
+    if (lines) w.key("type").string("block");
+    json_block(w, b, i);
+    if (lines) {
+      w.end_object();
+      w.line();
+    } else {
+      w.key("runs").begin_array();
+    }
+    usize r = 0;
+    rd.for_each(b, [&](const bbench::benchmark_t &run) {
+      w.begin_object();
+      if (lines) w.key("type").string("run").key("block").integer(static_cast<long long>(i)).key("index").integer(static_cast<long long>(r));
+      bbench::json::run_members(w, run, b.detail);
+      w.end_object();
+      if (lines) w.line();
+      ++r;
+    });
+    if (!lines) w.end_array().end_object();
+  }
+  if (!lines) {
+    w.end_array().end_object();
+    w.line();
+  }
+}
+
+// the fast path: one column straight off the mapping, nothing else decoded
+bool
+emit_column(const bbench::format::sink &out, const bbench::archive::reader &rd, const char *name) {
+  bool found = false;
+  for (usize i = 0; i < rd.size(); ++i) {
+    const bbench::archive::column *c = bbench::archive::find(rd[i], name);
+    if (!c) continue;
+    found = true;
+    bbench::archive::cursor cur(*c);
+    for (u64 r = 0; r < rd[i].rows; ++r) {
+      out.emit_double(cur.next());
+      out.newline();
+    }
+  }
+  return found;
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char **argv) {
+  cli_opts cli;
+  if (!parse_argv(argc, argv, cli)) return -1;
+  bbench::archive::reader rd;
+  if (!rd.open(cli.path)) {
+    bbench::format::sink err = bbench::format::sink::stderr_sink();
+    err.emit("bbench-dump: not a bbench archive: "); err.emit(cli.path); err.newline();
+    return -1;
+  }
+  bbench::format::sink out = cli.output_file
+      ? bbench::format::sink::file_sink(cli.output_file)
+      : bbench::format::sink::stdout_sink();
+  switch (cli.m) {
+  case mode::info:  emit_info(out, rd); break;
+  case mode::csv:   emit_csv(out, rd, cli.csv_sep); break;
+  case mode::json:  emit_json(out, rd, false); break;
+  case mode::jsonl: emit_json(out, rd, true); break;
+  case mode::column:
+    if (!emit_column(out, rd, cli.column)) {
+      bbench::format::sink err = bbench::format::sink::stderr_sink();
+      err.emit("bbench-dump: no block has a column "); err.emit(cli.column); err.newline();
+      return -1;
+    }
+    break;
+  }
+  return 0;
+}
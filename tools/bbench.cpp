@@ -4,12 +4,22 @@
 //    (See accompanying file LICENSE.txt or copy at
 //          https://www.boost.org/LICENSE_1_0.txt)
 
+#include "../src/aggregate.hpp"
+#include "../src/archive.hpp"
+#include "../src/baseline.hpp"
 #include "../src/bench.hpp"
+#include "../src/changepoint.hpp"
+#include "../src/characterize.hpp"
 #include "../src/events.hpp"
 #include "../src/format.hpp"
+#include "../src/json.hpp"
 #include "../src/metrics.hpp"
 #include "../src/options.hpp"
+#include "../src/stopping.hpp"
 #include "../src/topdown.hpp"
+#include "../src/topology.hpp"
+
+#include <omp.h>
 
 #include <micron/io/stdout.hpp>
 #include <micron/vector.hpp>
@@ -23,10 +33,38 @@ struct cli_opts {
   bool verbose = false;
   bool table = false;
   bool topdown_only = false;
+  bool interleave = false;     // round-robin over paths instead of path-by-path
+  bool shuffle = false;        // shuffle path order every round (--seed)
+  u64 seed = 0;
+  u32 jobs = 1;                // -j N concurrent runs, one physical core each
+  bool distinct_llc = false;   // --no-shared-llc
   char csv_sep = '\0';     // '\0' means: use human format
+  bool json = false;       // --json / --jsonl instead of human or CSV
+  bool jsonl = false;      // --jsonl: one record per line, each run as it finishes
   const char *output_file = nullptr;
+  bool unbuffered = false;     // --unbuffered: a write per fragment, for watching output live
   const char *metrics_csv = nullptr;
+  micron::vector<bbench::metric::expr> metrics;     // -M, compiled once
+  const char *characterize_out = nullptr;     // --characterize FILE
+  const char *machine_profile = nullptr;      // --machine-profile FILE
   micron::vector<const char *> paths;
+  micron::vector<const char *> env_overrides;     // --env K=V
+  micron::vector<const char *> env_storage;       // merged envp handed to the child
+  bool env_clear = false;
+  const char *stdin_file = nullptr;
+  bool roi = false;            // --roi: counters from bbench_roi.h regions only
+  bool per_process = false;    // --per-process: split counters over the spawned process tree
+  bool off_cpu = false;        // --off-cpu: runnable / blocked time and switch-out stacks
+  const char *mem_timeline = nullptr;     // --mem-timeline FILE: --mem-sample samples as CSV
+  bool syscalls = false;       // --syscalls: per-syscall counts and time via raw_syscalls tracepoints
+  bbench::stopping::rule stop;     // --target-ci: run until the time CI is tight, instead of -n
+  const char *save_baseline = nullptr;     // --save-baseline FILE
+  const char *archive = nullptr;           // --archive FILE: append every run, tagged --rev
+  const char *check_baseline = nullptr;    // --check FILE
+  const char *rev = "-";                   // --rev R: revision the saved baseline is filed under
+  const char *against_rev = nullptr;       // --baseline-rev R: compare against R, not the newest
+  bbench::baseline::thresholds limits;     // --threshold 5% / time_us=2%,cycles=1%
+  bool stable_only = false;    // --stable: summarise only the runs of the stable segment
 };
 
 inline bool
@@ -41,6 +79,22 @@ parse_int(const char *s, long long &out) {
   return true;
 }
 
+// "1%" -> 0.01, "0.01" -> 0.01
+inline bool
+parse_fraction(const char *s, double &out) {
+  if (!s || !(*s >= '0' && *s <= '9') && *s != '.') return false;
+  double v = 0.0, scale = 1.0;
+  bool dot = false;
+  for (; (*s >= '0' && *s <= '9') || (*s == '.' && !dot); ++s) {
+    if (*s == '.') { dot = true; continue; }
+    if (dot) { scale /= 10.0; v += (*s - '0') * scale; }
+    else v = v * 10 + (*s - '0');
+  }
+  if (*s == '%') { v /= 100.0; ++s; }
+  out = v;
+  return *s == '\0' && v > 0.0;
+}
+
 inline bool
 arg_eq(const char *a, const char *b) {
   return micron::strcmp(a, b) == 0;
@@ -48,18 +102,60 @@ arg_eq(const char *a, const char *b) {
 
 void print_usage(void) {
   micron::io::println("bbench [options] BINARY [BINARY...]");
+  micron::io::println("bbench [options] -- BINARY [ARGS...]");
   micron::io::println("  -n / -r N         repeat N times; print mean +- stddev (min/max)");
+  micron::io::println("  --target-ci P     instead of -n: run until the 95% CI of the mean time is within P (1% or 0.01)");
+  micron::io::println("  --ci-median       with --target-ci, bootstrap the CI of the median instead");
+  micron::io::println("  --min-runs N      with --target-ci, never stop before N runs (default 5)");
+  micron::io::println("  --max-runs N      with --target-ci, give up after N runs (default 1000)");
+  micron::io::println("  --max-time MS     with --target-ci, give up after MS ms per binary");
+  micron::io::println("  --interleave      run one round over all binaries per repetition (drift-resistant)");
+  micron::io::println("  --seed N          shuffle binary order every round with seed N (implies --interleave)");
+  micron::io::println("  -j N              run N binaries concurrently, each pinned to its own physical core");
+  micron::io::println("  --no-shared-llc   with -j, also keep concurrent runs on separate last-level caches");
+  micron::io::println("  --fork-server     launch binaries from a small pre-forked helper (constant fork cost)");
+  micron::io::println("  --roi             count only regions marked with bbench_roi.h (roi_begin/roi_end)");
+  micron::io::println("  --cgroup          run each binary in a transient cgroup v2; count everything it spawns");
+  micron::io::println("  --mem-sample US   sample the child's RSS / anon / file pages / faults every US microseconds");
+  micron::io::println("  --mem-timeline F  write every --mem-sample sample to F as CSV (default interval 1000 us)");
+  micron::io::println("  --io              report the child's /proc/PID/io (bytes and read/write calls)");
+  micron::io::println("  --syscalls        ranked per-syscall table (raw_syscalls tracepoints; perf_event_paranoid -1)");
+  micron::io::println("  --per-process     split counters over every process the binary spawns (rolled up per executable)");
+  micron::io::println("  --off-cpu         time spent off the cpu: runnable vs blocked, and the stacks it switched out from");
   micron::io::println("  -d / -dd / -ddd   detail level (default 1; 2 adds TLB+misses; 3 adds prefetch+faults)");
   micron::io::println("  -e EVENT...       custom event set by symbolic name");
   micron::io::println("  -D MS             delay measurement start by MS ms");
   micron::io::println("  --timeout MS      kill child after MS ms");
   micron::io::println("  --pre  CMD        run CMD before each measurement");
   micron::io::println("  --post CMD        run CMD after each measurement");
-  micron::io::println("  --table           per-run table");
+  micron::io::println("  --env K=V         set K=V in the child's environment (repeatable)");
+  micron::io::println("  --env-clear       start the child with an empty environment (plus --env)");
+  micron::io::println("  --stdin FILE      feed FILE to the child's stdin from memory");
+  micron::io::println("  --stdout FILE     redirect the child's stdout (/dev/null to discard)");
+  micron::io::println("  --stderr FILE     redirect the child's stderr");
+  micron::io::println("  --table           per-run table, outliers and level shifts marked; with -x adds NAME:median / mad /");
+  micron::io::println("                    p95 / ... rows and NAME:segment:A-B rows after a level shift");
+  micron::io::println("  --stable          report only the longest run stretch without a level shift in time or clock");
+  micron::io::println("  --ref-ghz F       scale norm_time_us (time at a fixed clock, from cycles/ref-cycles) to F GHz");
+  micron::io::println("                    instead of this host's nominal clock, to compare hosts");
   micron::io::println("  -x SEP            CSV output with field separator SEP");
+  micron::io::println("  --json            one JSON document: host, options, every run, stats, changepoints, metrics");
+  micron::io::println("  --jsonl           JSON Lines: a meta record, one record per run as it finishes, then summaries");
+  micron::io::println("  --save-baseline F file every metric's mean/stddev/median under this host, detail level and --rev");
+  micron::io::println("  --check F         compare against the baseline in F; exit 1 on a regression, 2 if none is stored");
+  micron::io::println("  --archive F       append every run to the columnar archive F, tagged --rev (read with bbench-dump)");
+  micron::io::println("  --rev R           revision to save the baseline / archive block under (default -)");
+  micron::io::println("  --baseline-rev R  with --check, compare against revision R instead of the newest");
+  micron::io::println("  --threshold SPEC  with --check, relative change that counts: 5% (default) or time_us=2%,cycles=1%;");
+  micron::io::println("                    time_us, cycles, instructions and metrics named here gate, the rest only report");
   micron::io::println("  -o FILE           output to FILE");
+  micron::io::println("  --unbuffered      write every output fragment at once (default: per line to a terminal, buffered to a file)");
   micron::io::println("  -v / --verbose    show counter open errors");
-  micron::io::println("  -M METRIC...      derived metrics (ipc, branch-miss-rate, cache-miss-rate, …)");
+  micron::io::println("  -M METRIC...      derived metrics (ipc, branch-miss-rate, cache-miss-rate, …) or NAME=EXPR over");
+  micron::io::println("                    counters and events, e.g. 'l3_mpki=LLC-load-misses/instructions*1000';");
+  micron::io::println("                    raises -d or adds -e events as the expressions need");
+  micron::io::println("  --characterize F  measure memory latency/bandwidth + throughput, save machine profile to F");
+  micron::io::println("  --machine-profile F  tag results with the machine profile saved in F");
   micron::io::println("  --topdown         emit Intel Icelake+ top-down quadrant breakdown");
   micron::io::println("  --no-inherit      don't inherit counters to child threads");
   micron::io::println("  --no-scale        print raw counts, skip multiplex scaling");
@@ -94,6 +190,74 @@ bool parse_argv(int argc, char **argv, cli_opts &out) {
     if (arg_eq(a, "-n") || arg_eq(a, "-r")) {
       long long v; if (!need_int(a, v) || v < 1) return false;
       out.n_runs = static_cast<usize>(v);
+    } else if (arg_eq(a, "--target-ci")) {
+      const char *v = nullptr;
+      if (!need_value(a, v)) return false;
+      if (!parse_fraction(v, out.stop.target)) {
+        bbench::format::sink err = bbench::format::sink::stderr_sink();
+        err.emit("bbench: --target-ci expects a fraction or a percentage (0.01, 1%)\n");
+        return false;
+      }
+    } else if (arg_eq(a, "--ci-median")) {
+      out.stop.median = true;
+    } else if (arg_eq(a, "--min-runs")) {
+      long long v; if (!need_int(a, v) || v < 2) return false;
+      out.stop.min_runs = static_cast<u32>(v);
+    } else if (arg_eq(a, "--max-runs")) {
+      long long v; if (!need_int(a, v) || v < 2) return false;
+      out.stop.max_runs = static_cast<u32>(v);
+    } else if (arg_eq(a, "--max-time")) {
+      long long v; if (!need_int(a, v) || v < 1) return false;
+      out.stop.max_time_ms = static_cast<u32>(v);
+    } else if (arg_eq(a, "--save-baseline")) {
+      if (!need_value(a, out.save_baseline)) return false;
+    } else if (arg_eq(a, "--archive")) {
+      if (!need_value(a, out.archive)) return false;
+    } else if (arg_eq(a, "--check")) {
+      if (!need_value(a, out.check_baseline)) return false;
+    } else if (arg_eq(a, "--rev")) {
+      if (!need_value(a, out.rev)) return false;
+    } else if (arg_eq(a, "--baseline-rev")) {
+      if (!need_value(a, out.against_rev)) return false;
+    } else if (arg_eq(a, "--threshold")) {
+      const char *v = nullptr;
+      if (!need_value(a, v)) return false;
+      if (!out.limits.parse(v)) {
+        bbench::format::sink err = bbench::format::sink::stderr_sink();
+        err.emit("bbench: --threshold expects 5% or metric=2%,metric=0.01\n");
+        return false;
+      }
+    } else if (arg_eq(a, "--interleave")) {
+      out.interleave = true;
+    } else if (arg_eq(a, "--seed")) {
+      long long v; if (!need_int(a, v) || v < 0) return false;
+      out.seed = static_cast<u64>(v);
+      out.shuffle = true;
+      out.interleave = true;
+    } else if (arg_eq(a, "-j")) {
+      long long v; if (!need_int(a, v) || v < 1) return false;
+      out.jobs = static_cast<u32>(v);
+    } else if (arg_eq(a, "--no-shared-llc")) {
+      out.distinct_llc = true;
+    } else if (arg_eq(a, "--fork-server")) {
+      out.bench_opts.fork_server = true;
+    } else if (arg_eq(a, "--roi")) {
+      out.roi = true;
+    } else if (arg_eq(a, "--cgroup")) {
+      out.bench_opts.cgroup = true;
+    } else if (arg_eq(a, "--mem-sample")) {
+      long long v; if (!need_int(a, v) || v < 1) return false;
+      out.bench_opts.mem_interval_us = static_cast<u32>(v);
+    } else if (arg_eq(a, "--mem-timeline")) {
+      if (!need_value(a, out.mem_timeline)) return false;
+    } else if (arg_eq(a, "--io")) {
+      out.bench_opts.io = true;
+    } else if (arg_eq(a, "--syscalls")) {
+      out.syscalls = true;
+    } else if (arg_eq(a, "--per-process")) {
+      out.per_process = true;
+    } else if (arg_eq(a, "--off-cpu")) {
+      out.off_cpu = true;
     } else if (arg_eq(a, "-d")) {
       out.bench_opts.detail = 1;
     } else if (arg_eq(a, "-dd")) {
@@ -114,18 +278,71 @@ bool parse_argv(int argc, char **argv, cli_opts &out) {
       if (!need_value(a, out.bench_opts.pre)) return false;
     } else if (arg_eq(a, "--post")) {
       if (!need_value(a, out.bench_opts.post)) return false;
+    } else if (arg_eq(a, "--env")) {
+      const char *v = nullptr;
+      if (!need_value(a, v)) return false;
+      out.env_overrides.push_back(v);
+    } else if (arg_eq(a, "--env-clear")) {
+      out.env_clear = true;
+    } else if (arg_eq(a, "--stdin")) {
+      if (!need_value(a, out.stdin_file)) return false;
+    } else if (arg_eq(a, "--stdout")) {
+      if (!need_value(a, out.bench_opts.stdout_path)) return false;
+    } else if (arg_eq(a, "--stderr")) {
+      if (!need_value(a, out.bench_opts.stderr_path)) return false;
+    } else if (arg_eq(a, "--")) {
+      if (i + 1 >= argc) {
+        print_usage();
+        return false;
+      }
+      if (out.paths.size() != 0) {
+        bbench::format::sink err = bbench::format::sink::stderr_sink();
+        err.emit("bbench: -- BINARY ARGS... can't be combined with other binaries\n");
+        return false;
+      }
+      // main's argv is NULL-terminated, so the tail can be handed to execve as is
+      out.paths.push_back(argv[i + 1]);
+      out.bench_opts.argv = argv + i + 1;
+      break;
     } else if (arg_eq(a, "--table")) {
       out.table = true;
+    } else if (arg_eq(a, "--stable")) {
+      out.stable_only = true;
+    } else if (arg_eq(a, "--ref-ghz")) {
+      const char *v = nullptr;
+      double ghz = 0.0;
+      if (!need_value(a, v)) return false;
+      if (!bbench::sys::parse_double(v, ghz) || ghz <= 0.0) {
+        bbench::format::sink err = bbench::format::sink::stderr_sink();
+        err.emit("bbench: --ref-ghz expects a clock in GHz (3.0)\n");
+        return false;
+      }
+      out.bench_opts.ref_khz = static_cast<u64>(ghz * 1e6);
+      if (!bbench::set_ref_ghz(ghz)) {
+        bbench::format::sink err = bbench::format::sink::stderr_sink();
+        err.emit("bbench: --ref-ghz: this host's nominal clock is unknown, norm_time_us stays 0\n");
+      }
     } else if (arg_eq(a, "-x")) {
       const char *v = nullptr;
       if (!need_value(a, v)) return false;
       out.csv_sep = v[0] ? v[0] : ',';
+    } else if (arg_eq(a, "--json")) {
+      out.json = true;
+    } else if (arg_eq(a, "--jsonl")) {
+      out.json = true;
+      out.jsonl = true;
     } else if (arg_eq(a, "-o")) {
       if (!need_value(a, out.output_file)) return false;
+    } else if (arg_eq(a, "--unbuffered")) {
+      out.unbuffered = true;
     } else if (arg_eq(a, "-v") || arg_eq(a, "--verbose")) {
       out.verbose = true;
     } else if (arg_eq(a, "-M")) {
       if (!need_value(a, out.metrics_csv)) return false;
+    } else if (arg_eq(a, "--characterize")) {
+      if (!need_value(a, out.characterize_out)) return false;
+    } else if (arg_eq(a, "--machine-profile")) {
+      if (!need_value(a, out.machine_profile)) return false;
     } else if (arg_eq(a, "--topdown")) {
       out.topdown_only = true;
     } else if (arg_eq(a, "--no-inherit")) {
@@ -151,88 +368,828 @@ bool parse_argv(int argc, char **argv, cli_opts &out) {
       out.paths.push_back(a);
     }
   }
-  if (out.paths.size() == 0) {
+  if (out.mem_timeline && out.bench_opts.mem_interval_us == 0) out.bench_opts.mem_interval_us = 1000;
+  if (out.json && out.csv_sep != '\0') {
+    bbench::format::sink err = bbench::format::sink::stderr_sink();
+    err.emit("bbench: -x and --json / --jsonl are exclusive\n");
+    return false;
+  }
+  if (out.paths.size() == 0 && !out.characterize_out) {
     print_usage();
     return false;
   }
   return true;
 }
 
-inline long long
-avg_int(const micron::vector<bbench::benchmark_t> &v, long long bbench::benchmark_t::*f) {
-  long long sum = 0;
-  for (const auto &b : v) sum += b.*f;
-  return sum / static_cast<long long>(v.size());
+inline bool
+env_key_eq(const char *a, const char *b) {
+  while (*a && *a != '=' && *a == *b) { ++a; ++b; }
+  return (*a == '=' || *a == '\0') && (*b == '=' || *b == '\0');
 }
 
-inline double
-avg_double(const micron::vector<bbench::benchmark_t> &v, double bbench::benchmark_t::*f) {
-  double sum = 0.0;
-  for (const auto &b : v) sum += b.*f;
-  return sum / static_cast<double>(v.size());
+// environ minus overridden keys, then the --env entries, NULL-terminated
+void
+build_env(cli_opts &cli) {
+  if (cli.env_overrides.size() == 0 && !cli.env_clear) return;
+  if (!cli.env_clear) {
+    for (char **e = environ; *e; ++e) {
+      bool overridden = false;
+      for (const char *o : cli.env_overrides)
+        if (env_key_eq(*e, o)) { overridden = true; break; }
+      if (!overridden) cli.env_storage.push_back(*e);
+    }
+  }
+  for (const char *o : cli.env_overrides) cli.env_storage.push_back(o);
+  cli.env_storage.push_back(nullptr);
+  cli.bench_opts.envp = &cli.env_storage[0];
 }
 
+// one streaming pass: Welford means in double, so long counters can't overflow a running sum
 bbench::benchmark_t
 collapse_runs(const micron::vector<bbench::benchmark_t> &runs) {
-  bbench::benchmark_t out{};
-  if (runs.size() == 0) return out;
-  out.name = runs.front().name;
-  out.time             = avg_double(runs, &bbench::benchmark_t::time);
-  out.cycles           = avg_int   (runs, &bbench::benchmark_t::cycles);
-  out.instructions     = avg_int   (runs, &bbench::benchmark_t::instructions);
-  out.cache_misses     = avg_int   (runs, &bbench::benchmark_t::cache_misses);
-  out.total_branches   = avg_int   (runs, &bbench::benchmark_t::total_branches);
-  out.branch_misses    = avg_int   (runs, &bbench::benchmark_t::branch_misses);
-  out.total_cycles     = avg_int   (runs, &bbench::benchmark_t::total_cycles);
-  out.cpu_time         = avg_int   (runs, &bbench::benchmark_t::cpu_time);
-  out.context_switches = avg_int   (runs, &bbench::benchmark_t::context_switches);
-  out.migrations       = avg_int   (runs, &bbench::benchmark_t::migrations);
-  out.l1_cache         = avg_int   (runs, &bbench::benchmark_t::l1_cache);
-  out.l1t_cache        = avg_int   (runs, &bbench::benchmark_t::l1t_cache);
-  out.ll_cache         = avg_int   (runs, &bbench::benchmark_t::ll_cache);
-  out.access           = avg_int   (runs, &bbench::benchmark_t::access);
-  out.bpu              = avg_int   (runs, &bbench::benchmark_t::bpu);
-  out.page_faults      = avg_int   (runs, &bbench::benchmark_t::page_faults);
-  out.bus_cycles       = avg_int   (runs, &bbench::benchmark_t::bus_cycles);
-  out.stalled_front    = avg_int   (runs, &bbench::benchmark_t::stalled_front);
-  out.stalled_back     = avg_int   (runs, &bbench::benchmark_t::stalled_back);
-  out.dtlb_access      = avg_int   (runs, &bbench::benchmark_t::dtlb_access);
-  out.dtlb_miss        = avg_int   (runs, &bbench::benchmark_t::dtlb_miss);
-  out.itlb_access      = avg_int   (runs, &bbench::benchmark_t::itlb_access);
-  out.itlb_miss        = avg_int   (runs, &bbench::benchmark_t::itlb_miss);
-  out.l1d_miss         = avg_int   (runs, &bbench::benchmark_t::l1d_miss);
-  out.l1t_miss         = avg_int   (runs, &bbench::benchmark_t::l1t_miss);
-  out.llcache_miss     = avg_int   (runs, &bbench::benchmark_t::llcache_miss);
-  out.l1d_prefetch     = avg_int   (runs, &bbench::benchmark_t::l1d_prefetch);
-  out.l1d_prefetch_miss = avg_int  (runs, &bbench::benchmark_t::l1d_prefetch_miss);
-  out.minor_faults     = avg_int   (runs, &bbench::benchmark_t::minor_faults);
-  out.major_faults     = avg_int   (runs, &bbench::benchmark_t::major_faults);
-  out.alignment_faults = avg_int   (runs, &bbench::benchmark_t::alignment_faults);
-  out.emulation_faults = avg_int   (runs, &bbench::benchmark_t::emulation_faults);
-  return out;
+  bbench::aggregate::aggregator agg;
+  for (const auto &b : runs) agg.add(b);
+  return agg.mean();
+}
+
+// mean time of one path, without building the whole collapsed record
+double
+mean_time(const micron::vector<bbench::benchmark_t> &runs) {
+  bbench::aggregate::moments m;
+  for (const auto &b : runs) m.add(b.time);
+  return m.mean;
+}
+
+template <typename T>
+inline void
+swap_at(micron::vector<T> &v, usize a, usize b) {
+  auto tmp = micron::move(v[a]);
+  v[a] = micron::move(v[b]);
+  v[b] = micron::move(tmp);
 }
 
+// regions, sys and stop (per path, may be empty) are kept in step with v
 void
-sort_results(micron::vector<micron::vector<bbench::benchmark_t>> &v) {
+sort_results(micron::vector<micron::vector<bbench::benchmark_t>> &v,
+             micron::vector<micron::vector<bbench::roi_region>> &regions,
+             micron::vector<micron::vector<bbench::systrace::table>> &sys,
+             micron::vector<bbench::stopping::report> &stop) {
+  micron::vector<double> key;
+  key.reserve(v.size());
+  for (usize i = 0; i < v.size(); ++i) key.push_back(mean_time(v[i]));
   for (usize i = 0; i + 1 < v.size(); ++i) {
     usize mn = i;
     for (usize j = i + 1; j < v.size(); ++j)
-      if (collapse_runs(v[j]).time < collapse_runs(v[mn]).time) mn = j;
+      if (key[j] < key[mn]) mn = j;
     if (mn != i) {
-      auto tmp = micron::move(v[i]);
-      v[i] = micron::move(v[mn]);
-      v[mn] = micron::move(tmp);
+      swap_at(v, i, mn);
+      swap_at(key, i, mn);
+      if (regions.size() == v.size()) swap_at(regions, i, mn);
+      if (sys.size() == v.size()) swap_at(sys, i, mn);
+      if (stop.size() == v.size()) {
+        bbench::stopping::report t = stop[i];
+        stop[i] = stop[mn];
+        stop[mn] = t;
+      }
     }
   }
 }
 
+// xorshift64*; deterministic for a given --seed so a shuffled schedule can be replayed
+inline u64
+next_rand(u64 &state) {
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 0x2545f4914f6cdd1dull;
+}
+
+void
+shuffle_order(micron::vector<usize> &order, u64 &state) {
+  for (usize i = order.size(); i > 1; --i) {
+    usize j = static_cast<usize>(next_rand(state) % i);
+    usize tmp = order[i - 1];
+    order[i - 1] = order[j];
+    order[j] = tmp;
+  }
+}
+
+struct slot {
+  usize path;
+  usize run;
+  bool round_start;
+};
+
+// path-major by default; with --interleave one round = one run of every path, optionally shuffled
+micron::vector<slot>
+make_schedule(const cli_opts &cli) {
+  micron::vector<slot> sched;
+  if (!cli.interleave) {
+    for (usize p = 0; p < cli.paths.size(); ++p)
+      for (usize r = 0; r < cli.n_runs; ++r) sched.push_back({ p, r, false });
+    return sched;
+  }
+  micron::vector<usize> order;
+  for (usize p = 0; p < cli.paths.size(); ++p) order.push_back(p);
+  u64 state = cli.seed ? cli.seed : 0x9e3779b97f4a7c15ull;
+  for (usize r = 0; r < cli.n_runs; ++r) {
+    if (cli.shuffle) shuffle_order(order, state);
+    for (usize k = 0; k < order.size(); ++k) sched.push_back({ order[k], r, k == 0 });
+  }
+  return sched;
+}
+
+// per-run results; roi[path][run] is only filled with --roi, mem with --mem-timeline, sys with --syscalls,
+// stop[path] with --target-ci; live is the --jsonl sink every run is written to as it lands
+struct results {
+  micron::vector<micron::vector<bbench::benchmark_t>> runs;
+  micron::vector<micron::vector<micron::vector<bbench::roi_region>>> roi;
+  micron::vector<micron::vector<bbench::memsample::timeline>> mem;
+  micron::vector<micron::vector<bbench::systrace::table>> sys;
+  micron::vector<bbench::stopping::report> stop;
+  const bbench::format::sink *live = nullptr;
+  bool pinned = false;     // -j workers had a core each
+};
+
+// {"type":"run","index":R,...}; whole records only, -j workers take turns
+inline void
+stream_run(const bbench::format::sink &out, const bbench::benchmark_t &b, usize run, u32 detail) {
+#pragma omp critical(bbench_jsonl)
+  {
+    bbench::json::writer w(out);
+    w.begin_object();
+    w.key("type").string("run");
+    w.key("index").integer(static_cast<long long>(run));
+    bbench::json::run_members(w, b, detail);
+    w.end_object();
+    w.line();
+  }
+}
+
+inline void
+run_slot(const cli_opts &cli, const bbench::benchmark_opts &opts, const slot &s, results &res) {
+  bbench::run_outputs o;
+  if (cli.roi) o.regions = &res.roi[s.path][s.run];
+  if (cli.mem_timeline) o.mem = &res.mem[s.path][s.run];
+  if (cli.syscalls) o.syscalls = &res.sys[s.path][s.run];
+  res.runs[s.path][s.run] = bbench::benchmark_bin(cli.paths[s.path], opts, o);
+  if (res.live) stream_run(*res.live, res.runs[s.path][s.run], s.run, opts.detail);
+}
+
+// path,run,t_us,rss_kb,anon_kb,file_kb,minflt,majflt; one line per sample
+bool
+write_timelines(const cli_opts &cli, const results &res) {
+  bbench::format::sink f = bbench::format::sink::file_sink(cli.mem_timeline);
+  if (f.fd < 0) return false;
+  f.emit("path,run,t_us,rss_kb,anon_kb,file_kb,minflt,majflt\n");
+  for (usize p = 0; p < res.mem.size(); ++p)
+    for (usize r = 0; r < res.mem[p].size(); ++r)
+      for (const auto &m : res.mem[p][r].samples) {
+        f.emit(cli.paths[p]);                         f.emit(",");
+        f.emit_int(static_cast<long long>(r));        f.emit(",");
+        f.emit_int(static_cast<long long>(m.t_us));   f.emit(",");
+        f.emit_int(static_cast<long long>(m.rss_kb)); f.emit(",");
+        f.emit_int(static_cast<long long>(m.anon_kb)); f.emit(",");
+        f.emit_int(static_cast<long long>(m.file_kb)); f.emit(",");
+        f.emit_int(static_cast<long long>(m.minflt)); f.emit(",");
+        f.emit_int(static_cast<long long>(m.majflt));
+        f.newline();
+      }
+  return true;
+}
+
+// round_ts[r] is the start of round r in ms since the first round (serial interleaved runs only)
+void
+run_serial(const cli_opts &cli, const micron::vector<slot> &sched, results &res, micron::vector<double> &round_ts) {
+  using mono = bbench::system_clock<bbench::system_clocks::monotonic>;
+  const double t0 = mono::now();
+  for (const slot &s : sched) {
+    if (s.round_start) round_ts.push_back((mono::now() - t0) * 1e3);
+    run_slot(cli, cli.bench_opts, s, res);
+  }
+}
+
+// --target-ci: every path gets runs appended until its monitor says stop. path by path, or with
+// --interleave in rounds over the paths that are still going
+void
+run_sequential(const cli_opts &cli, results &res, micron::vector<double> &round_ts) {
+  using mono = bbench::system_clock<bbench::system_clocks::monotonic>;
+  const double t0 = mono::now();
+  const usize np = cli.paths.size();
+  micron::vector<bbench::stopping::monitor> mons;
+  micron::vector<u8> done;
+  for (usize p = 0; p < np; ++p) {
+    mons.push_back(bbench::stopping::monitor(cli.stop));
+    done.push_back(0);
+  }
+  // one more run of p into freshly appended slots; true when p is finished
+  auto one = [&](usize p) -> bool {
+    const usize r = res.runs[p].size();
+    if (r == 0) mons[p].start(bbench::__impl::__now_ns());
+    res.runs[p].push_back(bbench::benchmark_t{});
+    if (cli.mem_timeline) res.mem[p].push_back(bbench::memsample::timeline{});
+    if (cli.syscalls) res.sys[p].push_back(bbench::systrace::table{});
+    if (cli.roi) res.roi[p].push_back(micron::vector<bbench::roi_region>{});
+    run_slot(cli, cli.bench_opts, slot{ p, r, false }, res);
+    return mons[p].add(res.runs[p][r].time, bbench::__impl::__now_ns());
+  };
+  if (!cli.interleave) {
+    for (usize p = 0; p < np; ++p)
+      while (!one(p)) {}
+  } else {
+    micron::vector<usize> order;
+    for (usize p = 0; p < np; ++p) order.push_back(p);
+    u64 state = cli.seed ? cli.seed : 0x9e3779b97f4a7c15ull;
+    for (usize left = np; left > 0;) {
+      if (cli.shuffle) shuffle_order(order, state);
+      round_ts.push_back((mono::now() - t0) * 1e3);
+      for (usize k = 0; k < np; ++k) {
+        const usize p = order[k];
+        if (done[p]) continue;
+        if (one(p)) { done[p] = 1; --left; }
+      }
+    }
+  }
+  for (usize p = 0; p < np; ++p) res.stop.push_back(mons[p].result());
+}
+
+void
+emit_stop(const bbench::format::sink &out, const bbench::stopping::report &r, bool median, bool color) {
+  if (color) out.emit("\033[34m", 5);
+  out.emit("runs needed:   ");
+  if (color) out.emit("\033[0m", 4);
+  out.emit_int(static_cast<long long>(r.runs));
+  out.emit(" ("); out.emit(bbench::stopping::reason_name(r.why));
+  out.emit(", 95% CI of the "); out.emit(median ? "median" : "mean");
+  out.emit(" +-"); out.emit_double(r.half_width);
+  out.emit(" us = "); out.emit_double(r.relative * 100.0);
+  out.emit("%)\n");
+}
+
+// every worker owns one picked cpu for its lifetime; each result lands in its preallocated slot
+void
+run_parallel(const cli_opts &cli, const micron::vector<slot> &sched, results &res) {
+  micron::vector<int> cpus = bbench::topology::pick_cpus(cli.jobs, cli.distinct_llc);
+  int workers = static_cast<int>(cpus.size());
+  if (workers < static_cast<int>(cli.jobs)) {
+    bbench::format::sink err = bbench::format::sink::stderr_sink();
+    err.emit("bbench: -j ");
+    err.emit_int(static_cast<long long>(cli.jobs));
+    err.emit(": only ");
+    err.emit_int(static_cast<long long>(workers));
+    err.emit(" isolated cores available\n");
+  }
+  if (workers == 0) workers = 1;
+  res.pinned = !cpus.empty();
+  const long n = static_cast<long>(sched.size());
+
+#pragma omp parallel for num_threads(workers) schedule(dynamic, 1)
+  for (long i = 0; i < n; ++i) {
+    bbench::benchmark_opts opts = cli.bench_opts;
+    const int t = omp_get_thread_num();
+    opts.cpu = t < static_cast<int>(cpus.size()) ? cpus[t] : -1;
+    run_slot(cli, opts, sched[i], res);
+  }
+}
+
+// sums every run's regions by name; count stays the total number of entries
+micron::vector<bbench::roi_region>
+merge_regions(const micron::vector<micron::vector<bbench::roi_region>> &per_run) {
+  micron::vector<bbench::roi_region> out;
+  for (const auto &run : per_run)
+    for (const auto &r : run) {
+      usize k = 0;
+      while (k < out.size() && micron::strcmp(out[k].name.c_str(), r.name.c_str()) != 0) ++k;
+      if (k == out.size()) { out.push_back(bbench::roi_region{ r.name, bbench::benchmark_t{}, 0 }); }
+      out[k].b.time += r.b.time;
+      for (auto f : bbench::counter_fields) out[k].b.*f += r.b.*f;
+      out[k].count += r.count;
+    }
+  return out;
+}
+
+// per-region means over the runs
+void
+emit_regions(const bbench::format::sink &out, const micron::vector<bbench::roi_region> &regions, usize n_runs, bool color) {
+  if (color) out.emit("\033[34m", 5);
+  out.emit("regions:       ");
+  if (color) out.emit("\033[0m", 4);
+  if (regions.size() == 0) {
+    out.emit("none marked (whole-process counters shown)\n");
+    return;
+  }
+  out.newline();
+  const double n = static_cast<double>(n_runs ? n_runs : 1);
+  for (const auto &r : regions) {
+    out.emit("  ");
+    out.emit(r.name.size() ? r.name.c_str() : "(unnamed)");
+    out.emit(": ");
+    out.emit_double(r.b.time / n);
+    out.emit(" us, cycles=");
+    out.emit_int(static_cast<long long>(static_cast<double>(r.b.cycles) / n));
+    out.emit(", instructions=");
+    out.emit_int(static_cast<long long>(static_cast<double>(r.b.instructions) / n));
+    out.emit(", entered ");
+    out.emit_double(static_cast<double>(r.count) / n);
+    out.emit("x per run\n");
+  }
+}
+
+inline void
+emit_tree_values(const bbench::format::sink &out, const long long *sum, usize n_runs) {
+  long long v[bbench::proctree::n_counters];
+  for (usize k = 0; k < bbench::proctree::n_counters; ++k) v[k] = sum[k] / static_cast<long long>(n_runs);
+  out.emit(" task-clock(ms)="); out.emit_double(static_cast<double>(v[bbench::proctree::task_clock]) / 1e6);
+  out.emit(" cycles=");         out.emit_int(v[bbench::proctree::cycles]);
+  out.emit(" instructions=");   out.emit_int(v[bbench::proctree::instructions]);
+  out.emit(" ipc=");
+  out.emit_double(v[bbench::proctree::cycles] ? static_cast<double>(v[bbench::proctree::instructions]) / static_cast<double>(v[bbench::proctree::cycles]) : 0.0);
+  for (usize k = bbench::proctree::instructions + 1; k < bbench::proctree::n_counters; ++k) {
+    out.emit(" "); out.emit(bbench::proctree::counter_names[k]); out.emit("="); out.emit_int(v[k]);
+  }
+}
+
+// folds run r into acc: totals and per-executable counters summed, every run's processes kept
+void
+merge_tree(bbench::proctree::result &acc, bbench::proctree::result &&r, usize run) {
+  if (run == 0) {
+    acc = micron::move(r);
+    return;
+  }
+  acc.time += r.time;
+  acc.usage.timed_out = acc.usage.timed_out || r.usage.timed_out;
+  acc.ok = acc.ok && r.ok;
+  acc.lost += r.lost;
+  for (usize k = 0; k < bbench::proctree::n_counters; ++k) acc.total[k] += r.total[k];
+  for (const auto &p : r.processes) acc.processes.push_back(p);
+  for (const auto &e : r.executables) {
+    usize k = 0;
+    while (k < acc.executables.size() && micron::strcmp(acc.executables[k].comm, e.comm) != 0) ++k;
+    if (k == acc.executables.size()) {
+      acc.executables.push_back(e);
+      continue;
+    }
+    acc.executables[k].processes += e.processes;
+    for (usize c = 0; c < bbench::proctree::n_counters; ++c) acc.executables[k].values[c] += e.values[c];
+  }
+  for (usize i = 0; i + 1 < acc.executables.size(); ++i) {
+    usize mx = i;
+    for (usize j = i + 1; j < acc.executables.size(); ++j)
+      if (acc.executables[j].values[bbench::proctree::cycles] > acc.executables[mx].values[bbench::proctree::cycles]) mx = j;
+    if (mx != i) swap_at(acc.executables, i, mx);
+  }
+}
+
+// rollup per executable; every process (root first) with --table / -v. res holds n_runs runs
+// (merge_tree): time, counters and process counts are per-run means, the process list every run's
+void
+emit_tree(const bbench::format::sink &out, const bbench::proctree::result &res, usize n_runs, bool per_pid, bool color) {
+  const long long n = static_cast<long long>(n_runs);
+  out.emit(res.name.c_str()); out.emit(": time(us)="); out.emit_double(res.time / static_cast<double>(n_runs));
+  out.emit(" processes="); out.emit_int((static_cast<long long>(res.processes.size()) + n / 2) / n);
+  if (n_runs > 1) { out.emit(" runs="); out.emit_int(n); }
+  out.newline();
+  if (!res.ok) {
+    out.emit("  [per-process counters unavailable; check perf_event_paranoid]\n");
+    return;
+  }
+  out.emit("  total:");
+  emit_tree_values(out, res.total, n_runs);
+  out.newline();
+  for (const auto &e : res.executables) {
+    out.emit("  ");
+    if (color) out.emit("\033[34m", 5);
+    out.emit(e.comm[0] ? e.comm : "(unknown)");
+    if (color) out.emit("\033[0m", 4);
+    out.emit(" x"); out.emit_int((static_cast<long long>(e.processes) + n / 2) / n);
+    out.emit(":");
+    emit_tree_values(out, e.values, n_runs);
+    out.newline();
+  }
+  if (per_pid) {
+    out.emit(n_runs > 1 ? "  processes (every run):\n" : "  processes:\n");
+    for (const auto &p : res.processes) {
+      out.emit("    "); out.emit_int(p.pid);
+      out.emit(" ppid="); out.emit_int(p.ppid);
+      out.emit(" "); out.emit(p.comm[0] ? p.comm : "(unknown)");
+      out.emit(":");
+      emit_tree_values(out, p.values, 1);
+      out.newline();
+    }
+  }
+  if (res.lost) {
+    if (color) out.emit("\033[31m", 5);
+    out.emit("  [lost "); out.emit_int(static_cast<long long>(res.lost));
+    out.emit(" records, the per-process split is incomplete; their counts sit with the root]\n");
+    if (color) out.emit("\033[0m", 4);
+  }
+  if (res.usage.timed_out) out.emit("  [timed out]\n");
+}
+
+// sums the per-run tables; counts stay totals, emit_syscalls divides by the run count
+bbench::systrace::table
+merge_syscalls(const micron::vector<bbench::systrace::table> &per_run) {
+  bbench::systrace::table out{};
+  for (const auto &t : per_run) {
+    out.ok = out.ok || t.ok;
+    out.lost += t.lost;
+    for (const auto &c : t.calls) {
+      usize k = 0;
+      while (k < out.calls.size() && out.calls[k].nr != c.nr) ++k;
+      if (k == out.calls.size()) { out.calls.push_back(bbench::systrace::syscall_stat{ c.nr, 0, 0, 0, 0 }); }
+      out.calls[k].count += c.count;
+      out.calls[k].errors += c.errors;
+      out.calls[k].total_ns += c.total_ns;
+      if (c.max_ns > out.calls[k].max_ns) out.calls[k].max_ns = c.max_ns;
+    }
+  }
+  for (usize i = 0; i + 1 < out.calls.size(); ++i) {
+    usize mx = i;
+    for (usize j = i + 1; j < out.calls.size(); ++j)
+      if (out.calls[j].total_ns > out.calls[mx].total_ns) mx = j;
+    if (mx != i) swap_at(out.calls, i, mx);
+  }
+  return out;
+}
+
+// ranked by time in the call; the top 20 unless verbose. values are per-run means
+void
+emit_syscalls(const bbench::format::sink &out, const bbench::systrace::table &t, usize n_runs, const char *label,
+              bool verbose, bool color) {
+  if (color) out.emit("\033[34m", 5);
+  out.emit(label);
+  if (color) out.emit("\033[0m", 4);
+  if (!t.ok) {
+    out.emit("unavailable (needs tracefs and perf_event_paranoid -1 or CAP_PERFMON)\n");
+    return;
+  }
+  out.newline();
+  const double n = static_cast<double>(n_runs ? n_runs : 1);
+  for (usize i = 0; i < t.calls.size() && (verbose || i < 20); ++i) {
+    const auto &c = t.calls[i];
+    const char *name = bbench::systrace::name(c.nr);
+    out.emit("  ");
+    if (name) out.emit(name);
+    else { out.emit("sys_"); out.emit_int(c.nr); }
+    out.emit(": calls=");      out.emit_double(static_cast<double>(c.count) / n);
+    out.emit(" errors=");      out.emit_double(static_cast<double>(c.errors) / n);
+    out.emit(" total(us)=");   out.emit_double(static_cast<double>(c.total_ns) / n / 1e3);
+    out.emit(" avg(ns)=");     out.emit_double(c.count ? static_cast<double>(c.total_ns) / static_cast<double>(c.count) : 0.0);
+    out.emit(" max(us)=");     out.emit_double(static_cast<double>(c.max_ns) / 1e3);
+    out.newline();
+  }
+  if (!verbose && t.calls.size() > 20) {
+    out.emit("  ... "); out.emit_int(static_cast<long long>(t.calls.size() - 20)); out.emit(" more (-v)\n");
+  }
+  if (t.lost) {
+    out.emit("  [lost "); out.emit_int(static_cast<long long>(t.lost)); out.emit(" records, counts are low]\n");
+  }
+}
+
+inline void
+emit_hex(const bbench::format::sink &out, u64 v) {
+  char buf[19] = "0x";
+  usize n = 2;
+  for (int sh = 60; sh >= 0; sh -= 4) {
+    const u32 d = static_cast<u32>((v >> sh) & 0xf);
+    if (n == 2 && d == 0 && sh) continue;
+    buf[n++] = static_cast<char>(d < 10 ? '0' + d : 'a' + d - 10);
+  }
+  out.emit(buf, n);
+}
+
+// stacks of different runs match on their kernel frames: user addresses move with ASLR from one
+// run to the next, kernel text stays put for the whole boot
+inline bool
+same_stack(const bbench::offcpu::stack &a, const bbench::offcpu::stack &b) {
+  u32 i = bbench::offcpu::kernel_begin(a), j = bbench::offcpu::kernel_begin(b);
+  for (;; ++i, ++j) {
+    const bool end_a = i == a.depth || bbench::offcpu::is_context(a.ips[i]);
+    const bool end_b = j == b.depth || bbench::offcpu::is_context(b.ips[j]);
+    if (end_a || end_b) return end_a && end_b;
+    if (a.ips[i] != b.ips[j]) return false;
+  }
+}
+
+// folds run r into acc: times and counts summed, stacks with the same kernel frames merged (the
+// user frames shown are those of the first run that had it), re-ranked by time
+void
+merge_offcpu(bbench::offcpu::result &acc, bbench::offcpu::result &&r, usize run) {
+  if (run == 0) {
+    acc = micron::move(r);
+    return;
+  }
+  acc.time += r.time;
+  acc.usage.user_time_us += r.usage.user_time_us;
+  acc.usage.sys_time_us += r.usage.sys_time_us;
+  acc.usage.timed_out = acc.usage.timed_out || r.usage.timed_out;
+  acc.offcpu_ns += r.offcpu_ns;
+  acc.runnable_ns += r.runnable_ns;
+  acc.blocked_ns += r.blocked_ns;
+  acc.switches += r.switches;
+  acc.preemptions += r.preemptions;
+  acc.lost += r.lost;
+  acc.wakeups = acc.wakeups && r.wakeups;
+  acc.callchains = acc.callchains && r.callchains;
+  acc.ok = acc.ok && r.ok;
+  for (const auto &st : r.stacks) {
+    usize k = 0;
+    while (k < acc.stacks.size() && !same_stack(acc.stacks[k], st)) ++k;
+    if (k == acc.stacks.size()) {
+      acc.stacks.push_back(st);
+      continue;
+    }
+    acc.stacks[k].count += st.count;
+    acc.stacks[k].total_ns += st.total_ns;
+  }
+  for (usize i = 0; i + 1 < acc.stacks.size(); ++i) {
+    usize mx = i;
+    for (usize j = i + 1; j < acc.stacks.size(); ++j)
+      if (acc.stacks[j].total_ns > acc.stacks[mx].total_ns) mx = j;
+    if (mx != i) swap_at(acc.stacks, i, mx);
+  }
+}
+
+// totals, then the stacks by off-CPU time: the top 10 and 8 frames each unless verbose.
+// kernel frames by name when /proc/kallsyms is readable, user frames as addresses. res holds
+// n_runs runs (merge_offcpu); every time and count is a per-run mean
+void
+emit_offcpu(const bbench::format::sink &out, const bbench::offcpu::result &res, usize n_runs,
+            const bbench::offcpu::ksyms &ks, bool verbose, bool color) {
+  const double n = static_cast<double>(n_runs);
+  const u64 nu = static_cast<u64>(n_runs);
+  out.emit(res.name.c_str()); out.emit(": time(us)="); out.emit_double(res.time / n);
+  out.emit(" cpu(us)="); out.emit_int((res.usage.user_time_us + res.usage.sys_time_us) / static_cast<long long>(n_runs));
+  if (n_runs > 1) { out.emit(" runs="); out.emit_int(static_cast<long long>(n_runs)); }
+  out.newline();
+  if (!res.ok) {
+    out.emit("  [off-cpu analysis unavailable; check perf_event_paranoid]\n");
+    return;
+  }
+  out.emit("  off-cpu(us)=");   out.emit_double(static_cast<double>(res.offcpu_ns) / 1e3 / n);
+  out.emit(" runnable(us)=");   out.emit_double(static_cast<double>(res.runnable_ns) / 1e3 / n);
+  out.emit(" blocked(us)=");    out.emit_double(static_cast<double>(res.blocked_ns) / 1e3 / n);
+  out.emit(" switches=");       out.emit_int(static_cast<long long>(res.switches / nu));
+  out.emit(" preempted=");      out.emit_int(static_cast<long long>(res.preemptions / nu));
+  out.newline();
+  if (!res.wakeups)
+    out.emit("  [no sched_wakeup (needs perf_event_paranoid -1 or CAP_PERFMON): voluntary waits count as blocked]\n");
+  if (!res.callchains) out.emit("  [no switch-out stacks (needs perf_event_paranoid 1)]\n");
+  for (usize i = 0; i < res.stacks.size() && (verbose || i < 10); ++i) {
+    const auto &st = res.stacks[i];
+    if (color) out.emit("\033[34m", 5);
+    out.emit("  "); out.emit_double(static_cast<double>(st.total_ns) / 1e3 / n);
+    out.emit(" us in "); out.emit_int(static_cast<long long>((st.count + nu / 2) / nu)); out.emit(" switches");
+    if (color) out.emit("\033[0m", 4);
+    out.newline();
+    u32 shown = 0;
+    for (u32 k = 0; k < st.depth && (verbose || shown < 8); ++k) {
+      if (bbench::offcpu::is_context(st.ips[k])) continue;
+      u64 off = 0;
+      const char *sym = ks.find(st.ips[k], off);
+      out.emit("      ");
+      if (sym) { out.emit(sym); out.emit("+"); emit_hex(out, off); }
+      else emit_hex(out, st.ips[k]);
+      out.newline();
+      ++shown;
+    }
+  }
+  if (!verbose && res.stacks.size() > 10) {
+    out.emit("  ... "); out.emit_int(static_cast<long long>(res.stacks.size() - 10)); out.emit(" more stacks (-v)\n");
+  }
+  if (res.lost) {
+    if (color) out.emit("\033[31m", 5);
+    out.emit("  [lost "); out.emit_int(static_cast<long long>(res.lost)); out.emit(" records, off-cpu time is low]\n");
+    if (color) out.emit("\033[0m", 4);
+  }
+  if (res.usage.timed_out) out.emit("  [timed out]\n");
+}
+
+// the moved metrics of every path (all of them with -v), then a summary line; with jw every
+// comparison as one JSON object instead. returns the exit code: 1 with any regression in a gated
+// metric, 2 when a path has no baseline for this host / detail level
+int
+check_baseline(const bbench::format::sink &out, const cli_opts &cli,
+               const micron::vector<micron::vector<bbench::benchmark_t>> &all, bbench::json::writer *jw, bool color) {
+  bbench::baseline::store st;
+  if (!st.load(cli.check_baseline)) {
+    bbench::format::sink err = bbench::format::sink::stderr_sink();
+    err.emit("bbench: malformed lines in baseline "); err.emit(cli.check_baseline); err.newline();
+  }
+  usize regressions = 0, improvements = 0, reported = 0, missing = 0;
+  if (jw) {
+    jw->begin_object();
+    if (cli.jsonl) jw->key("type").string("baseline");
+    jw->key("file").string(cli.check_baseline);
+    jw->key("paths").begin_array();
+  } else {
+    out.newline();
+    if (color) out.emit("\033[34m", 5);
+    out.emit("baseline check: ");
+    if (color) out.emit("\033[0m", 4);
+    out.emit(cli.check_baseline); out.newline();
+  }
+  for (const auto &runs : all) {
+    if (runs.size() == 0) continue;
+    const char *name = runs[0].name.c_str();
+    const char *rev = st.pick_rev(name, cli.bench_opts.detail, cli.against_rev);
+    if (!rev) ++missing;
+    micron::vector<bbench::baseline::comparison> cmp;
+    if (rev) st.compare(runs, cli.bench_opts.detail, rev, cli.limits, cmp);
+    for (const auto &c : cmp) {
+      if (c.v == bbench::baseline::verdict::regression) ++(c.gated ? regressions : reported);
+      if (c.v == bbench::baseline::verdict::improvement) ++improvements;
+    }
+    if (jw) {
+      jw->begin_object();
+      jw->key("name").string(name);
+      jw->key("rev").string(rev);
+      jw->key("comparisons").begin_array();
+      for (const auto &c : cmp) bbench::json::comparison(*jw, c);
+      jw->end_array();
+      jw->end_object();
+      continue;
+    }
+    out.emit("  "); out.emit(name);
+    if (!rev) {
+      out.emit(": no baseline for this host and detail level\n");
+      continue;
+    }
+    out.emit(" vs rev "); out.emit(rev); out.newline();
+    for (const auto &c : cmp) {
+      if (c.v == bbench::baseline::verdict::unchanged && !cli.verbose) continue;
+      out.emit("    "); out.emit(c.metric); out.emit(": ");
+      out.emit_double(c.base->mean); out.emit(" -> "); out.emit_double(c.cur.mean);
+      out.emit(" ("); if (c.change >= 0) out.emit("+");
+      out.emit_double(c.change * 100.0); out.emit("%, limit ");
+      out.emit_double(c.threshold * 100.0); out.emit("%, ");
+      out.emit(!c.tested ? "untested" : c.significant ? "p<0.05" : "not significant");
+      out.emit(") ");
+      if (c.v == bbench::baseline::verdict::regression && !c.gated) {
+        if (color) out.emit("\033[33m", 5);
+        out.emit("regression (not gated)");
+      } else if (c.v == bbench::baseline::verdict::regression) {
+        if (color) out.emit("\033[31m", 5);
+        out.emit("REGRESSION");
+      } else if (c.v == bbench::baseline::verdict::improvement) {
+        if (color) out.emit("\033[32m", 5);
+        out.emit("improvement");
+      } else {
+        out.emit("ok");
+      }
+      if (color && c.v != bbench::baseline::verdict::unchanged) out.emit("\033[0m", 4);
+      out.newline();
+    }
+  }
+  if (jw) {
+    jw->end_array();
+    jw->key("regressions").integer(static_cast<long long>(regressions));
+    jw->key("improvements").integer(static_cast<long long>(improvements));
+    jw->key("ungated_regressions").integer(static_cast<long long>(reported));
+    jw->key("missing").integer(static_cast<long long>(missing));
+    jw->end_object();
+    if (cli.jsonl) jw->line();
+  } else {
+    out.emit("  "); out.emit_int(static_cast<long long>(regressions)); out.emit(" regressions, ");
+    out.emit_int(static_cast<long long>(improvements)); out.emit(" improvements");
+    if (reported) { out.emit(", "); out.emit_int(static_cast<long long>(reported)); out.emit(" ungated regressions"); }
+    if (missing) { out.emit(", "); out.emit_int(static_cast<long long>(missing)); out.emit(" without baseline"); }
+    out.newline();
+  }
+  if (regressions) return 1;
+  return missing ? 2 : 0;
+}
+
+// a pinned run saw interference if it migrated, or was preempted more often than a quiet core
+// allows: once per 10 ms of run time, plus one for the exit. an unpinned run gets moved and
+// preempted as a matter of course, so only -j runs are judged
+inline bool
+interfered(const bbench::benchmark_t &b) {
+  const double allowed = 1.0 + b.time / 10000.0;
+  return b.migrations > 0 || static_cast<double>(b.invol_ctx_switches) > allowed;
+}
+
+void
+emit_interference(const bbench::format::sink &out, const micron::vector<bbench::benchmark_t> &runs, bool color) {
+  usize hit = 0;
+  for (const auto &r : runs) if (interfered(r)) ++hit;
+  if (hit == 0) return;
+  if (color) out.emit("\033[31m", 5);
+  out.emit("interference:  ");
+  if (color) out.emit("\033[0m", 4);
+  out.emit_int(static_cast<long long>(hit));
+  out.emit("/");
+  out.emit_int(static_cast<long long>(runs.size()));
+  out.emit(" runs migrated or were preempted (runs:");
+  for (usize i = 0; i < runs.size(); ++i) {
+    if (!interfered(runs[i])) continue;
+    out.emit(" ");
+    out.emit_int(static_cast<long long>(i));
+  }
+  out.emit(")\n");
+}
+
+void
+emit_shift(const bbench::format::sink &out, const char *what, const micron::vector<bbench::changepoint::segment> &segs,
+           const char *unit) {
+  for (usize i = 1; i < segs.size(); ++i) {
+    out.emit(what);
+    out.emit(" at run ");
+    out.emit_int(static_cast<long long>(segs[i].begin));
+    out.emit(" (");
+    out.emit_double(segs[i - 1].level);
+    out.emit(" -> ");
+    out.emit_double(segs[i].level);
+    out.emit(unit);
+    out.emit("); ");
+  }
+}
+
+// level shifts found in the run order; with --stable the runs outside the stable segment are
+// already gone from everything else printed
+void
+emit_changepoints(const bbench::format::sink &out, const bbench::changepoint::analysis &cp, usize n_runs,
+                  bool stable_only, bool color) {
+  if (!cp.shifted()) return;
+  if (color) out.emit("\033[31m", 5);
+  out.emit("changepoints:  ");
+  if (color) out.emit("\033[0m", 4);
+  emit_shift(out, "time", cp.time, " us");
+  emit_shift(out, "clock", cp.freq, " cycles/ref");
+  out.emit("stable runs ");
+  out.emit_int(static_cast<long long>(cp.stable_begin));
+  out.emit("-");
+  out.emit_int(static_cast<long long>(cp.stable_end - 1));
+  if (stable_only) {
+    out.emit(" kept, ");
+    out.emit_int(static_cast<long long>(n_runs - (cp.stable_end - cp.stable_begin)));
+    out.emit(" dropped\n");
+  } else {
+    out.emit(", ");
+    out.emit_int(static_cast<long long>(cp.flagged));
+    out.emit(" flagged (--table marks them, --stable keeps only the stable runs)\n");
+  }
+}
+
+template <typename T>
+void
+keep_range(micron::vector<T> &v, usize from, usize to) {
+  micron::vector<T> kept;
+  for (usize i = from; i < to && i < v.size(); ++i) kept.push_back(micron::move(v[i]));
+  v = micron::move(kept);
+}
+
+// least-squares slope of run time against round start time, in us per second of wall clock
+void
+emit_drift(const bbench::format::sink &out, const micron::vector<bbench::benchmark_t> &runs,
+           const micron::vector<double> &all_ts, usize first, bool table, bool color) {
+  // runs[i] started in round first + i (first > 0 once --stable dropped a prefix)
+  micron::vector<double> round_ts;
+  for (usize i = first; i < all_ts.size(); ++i) round_ts.push_back(all_ts[i]);
+  const usize n = runs.size() < round_ts.size() ? runs.size() : round_ts.size();
+  if (n < 2) return;
+  double mx = 0.0, my = 0.0;
+  for (usize i = 0; i < n; ++i) { mx += round_ts[i] / 1e3; my += runs[i].time; }
+  mx /= static_cast<double>(n);
+  my /= static_cast<double>(n);
+  double sxy = 0.0, sxx = 0.0;
+  for (usize i = 0; i < n; ++i) {
+    const double dx = round_ts[i] / 1e3 - mx;
+    sxy += dx * (runs[i].time - my);
+    sxx += dx * dx;
+  }
+  const double slope = sxx > 0.0 ? sxy / sxx : 0.0;
+
+  if (color) out.emit("\033[34m", 5);
+  out.emit("drift:         slope=");
+  if (color) out.emit("\033[0m", 4);
+  if (slope >= 0) out.emit("+");
+  out.emit_double(slope);
+  out.emit(" us/s  first=");  out.emit_double(runs[0].time);
+  out.emit("  last=");        out.emit_double(runs[n - 1].time);
+  out.emit("  span(ms)=");    out.emit_double(round_ts[n - 1]);
+  out.newline();
+
+  if (!table) return;
+  out.emit("# Rounds (start ms, time us):\n");
+  for (usize i = 0; i < n; ++i) {
+    out.emit("  round ");
+    out.emit_int(static_cast<long long>(first + i));
+    out.emit("  +");
+    out.emit_double(round_ts[i]);
+    out.emit("  ");
+    out.emit_double(runs[i].time);
+    out.newline();
+  }
+}
+
+// time in full (mean / spread, then the robust view: one slow run moves the mean, not the median),
+// then every other measured counter of the detail level
 void
 emit_stats(const bbench::format::sink &out,
-           const micron::vector<bbench::benchmark_t> &runs, bool color) {
+           const micron::vector<bbench::benchmark_t> &runs, u32 detail, bool color) {
   using bbench::format::compute_stats;
   auto s_time = compute_stats(runs, [](const bbench::benchmark_t &b) { return b.time; });
-  auto s_cyc  = compute_stats(runs, [](const bbench::benchmark_t &b) { return static_cast<double>(b.cycles); });
-  auto s_ins  = compute_stats(runs, [](const bbench::benchmark_t &b) { return static_cast<double>(b.instructions); });
 
   if (color) out.emit("\033[34m", 5);
   out.emit("time (us):     mean=");
@@ -244,49 +1201,133 @@ emit_stats(const bbench::format::sink &out,
   out.newline();
 
   if (color) out.emit("\033[34m", 5);
-  out.emit("cycles:        mean=");
+  out.emit("               median=");
   if (color) out.emit("\033[0m", 4);
-  out.emit_double(s_cyc.mean);
-  out.emit("  stddev=");  out.emit_double(s_cyc.stddev);
+  out.emit_double(s_time.median);
+  out.emit("  mad=");     out.emit_double(s_time.mad);
+  out.emit("  iqr=");     out.emit_double(s_time.iqr);
+  out.emit("  p5=");      out.emit_double(s_time.p5);
+  out.emit("  p95=");     out.emit_double(s_time.p95);
+  out.emit("  p99=");     out.emit_double(s_time.p99);
+  out.emit("  trimmed=");  out.emit_double(s_time.trimmed_mean);
   out.newline();
+  if (s_time.mild_outliers || s_time.severe_outliers) {
+    if (color) out.emit("\033[31m", 5);
+    out.emit("outliers:      ");
+    if (color) out.emit("\033[0m", 4);
+    out.emit_int(s_time.mild_outliers); out.emit(" mild, ");
+    out.emit_int(s_time.severe_outliers); out.emit(" severe (Tukey fences on time; --table marks the runs)\n");
+  }
 
   if (color) out.emit("\033[34m", 5);
-  out.emit("instructions:  mean=");
+  out.emit("counters:");
   if (color) out.emit("\033[0m", 4);
-  out.emit_double(s_ins.mean);
-  out.emit("  stddev=");  out.emit_double(s_ins.stddev);
   out.newline();
+  bbench::format::emit_counter_stats(out, runs, detail, color);
 }
 
-void
-emit_metrics(const bbench::format::sink &out, const bbench::benchmark_t &b,
-             const char *csv, bool color) {
-  if (!csv) return;
-  char buf[64]; usize bi = 0;
-  for (const char *p = csv;; ++p) {
-    if (*p == ',' || *p == '\0') {
-      if (bi > 0) {
-        buf[bi] = '\0';
-        const auto *m = bbench::metric::lookup_metric(buf);
-        if (m) {
-          if (color) out.emit("\033[34m", 5);
-          out.emit(m->name);
-          out.emit(": ");
-          if (color) out.emit("\033[0m", 4);
-          out.emit_double(m->fn(b));
-          out.newline();
-        } else {
-          out.emit("metric '");
-          out.emit(buf);
-          out.emit("' not known\n");
-        }
-        bi = 0;
+// one -M metric: evaluated on the operand means, and on every run for the stddev and the per-run
+// median / min / max
+struct metric_summary {
+  double v, sd;
+  double median, mn, mx;
+  usize n;
+};
+
+// value(run, ref) reads one operand of one run
+template <typename F>
+metric_summary
+summarize_metric(const bbench::metric::expr &m, usize n, F &&value) {
+  using bbench::metric::ref;
+  metric_summary out{ 0.0, 0.0, 0.0, 0.0, 0.0, n };
+  if (n == 0) return out;
+  micron::vector<double> per_run;
+  for (usize i = 0; i < n; ++i) per_run.push_back(m.eval([&](const ref &r) { return value(i, r); }));
+  out.v = m.eval([&](const ref &r) {
+    double sum = 0.0;
+    for (usize i = 0; i < n; ++i) sum += value(i, r);
+    return sum / static_cast<double>(n);
+  });
+  const auto s = bbench::format::compute_stats(per_run, [](double x) { return x; });
+  out.sd = s.stddev;
+  out.median = s.median;
+  out.mn = s.mn;
+  out.mx = s.mx;
+  return out;
+}
+
+micron::vector<metric_summary>
+summarize_metrics(const micron::vector<bbench::metric::expr> &metrics,
+                  const micron::vector<bbench::benchmark_t> &runs) {
+  micron::vector<metric_summary> out;
+  for (const auto &m : metrics)
+    out.push_back(summarize_metric(m, runs.size(), [&](usize i, const bbench::metric::ref &r) {
+      return r.field ? r.field->get(runs[i]) : 0.0;
+    }));
+  return out;
+}
+
+// the same over -e runs: time_us, launch_us and the rusage columns from the run itself
+// (bbench::dynamic_column), every other operand from the rows by event
+micron::vector<metric_summary>
+summarize_metrics(const micron::vector<bbench::metric::expr> &metrics,
+                  const micron::vector<bbench::dynamic_result_t> &runs) {
+  micron::vector<bbench::benchmark_t> cols;
+  cols.reserve(runs.size());
+  for (const auto &r : runs) cols.push_back(bbench::dynamic_columns(r));
+  micron::vector<metric_summary> out;
+  for (const auto &m : metrics)
+    out.push_back(summarize_metric(m, runs.size(), [&](usize i, const bbench::metric::ref &r) -> double {
+      if (r.field && bbench::dynamic_column(r.field->name)) return r.field->get(cols[i]);
+      if (!r.event) return 0.0;
+      for (const auto &row : runs[i].rows) {
+        const bbench::event_def *e = bbench::lookup_event(row.name);
+        if (e && e->type == r.event->type && e->config == r.event->config) return static_cast<double>(row.value);
       }
-      if (*p == '\0') break;
-    } else if (bi < sizeof(buf) - 1) {
-      buf[bi++] = *p;
+      return 0.0;
+    }));
+  return out;
+}
+
+void
+emit_metrics(const bbench::format::sink &out, const micron::vector<bbench::metric::expr> &metrics,
+             const micron::vector<metric_summary> &sums, bool color) {
+  for (usize k = 0; k < metrics.size(); ++k) {
+    const metric_summary &s = sums[k];
+    if (s.n == 0) continue;
+    if (color) out.emit("\033[34m", 5);
+    out.emit(metrics[k].name());
+    out.emit(": ");
+    if (color) out.emit("\033[0m", 4);
+    out.emit_double(s.v);
+    if (s.n > 1) {
+      out.emit(" +-");      out.emit_double(s.sd);
+      out.emit("  (per run: median=");  out.emit_double(s.median);
+      out.emit(" min=");    out.emit_double(s.mn);
+      out.emit(" max=");    out.emit_double(s.mx);
+      out.emit(")");
     }
+    out.newline();
+  }
+}
+
+void
+json_metrics(bbench::json::writer &w, const micron::vector<bbench::metric::expr> &metrics,
+             const micron::vector<metric_summary> &sums) {
+  w.begin_array();
+  for (usize k = 0; k < metrics.size(); ++k) {
+    const metric_summary &s = sums[k];
+    w.begin_object();
+    w.key("name").string(metrics[k].name());
+    w.key("value").number(s.v);
+    w.key("stddev").number(s.sd);
+    w.key("median").number(s.median);
+    w.key("min").number(s.mn);
+    w.key("max").number(s.mx);
+    w.key("runs").integer(static_cast<long long>(s.n));
+    w.end_object();
   }
+  w.end_array();
 }
 
 void
@@ -303,6 +1344,121 @@ emit_topdown(const bbench::format::sink &out, const bbench::topdown::topdown_t &
   out.emit("  be-bound:    "); out.emit_double(td.backend);  out.newline();
 }
 
+void
+emit_characterization(const bbench::format::sink &out, const bbench::characterize::machine_profile &mp, bool color) {
+  if (color) out.emit("\033[34m", 5);
+  out.emit("Machine profile: ");
+  if (color) out.emit("\033[0m", 4);
+  out.emit(mp.host.hostname); out.emit(" / "); out.emit(mp.host.cpu_model);
+  out.emit("  id="); out.emit_int(static_cast<long long>(mp.id));
+  out.newline();
+  out.emit("# load latency (bytes, ns, cycles):\n");
+  for (const auto &pt : mp.latency) {
+    out.emit("  "); out.emit_int(static_cast<long long>(pt.bytes));
+    out.emit("  "); out.emit_double(pt.ns_per_load);
+    out.emit("  "); out.emit_double(pt.cycles_per_load);
+    out.newline();
+  }
+  const char *levels[3] = { "L1:   ", "L2:   ", "LLC:  " };
+  for (usize k = 0; k < 3; ++k) {
+    if (mp.cache_bytes[k] == 0) continue;
+    out.emit(levels[k]); out.emit_int(static_cast<long long>(mp.cache_bytes[k]));
+    out.emit(" bytes  "); out.emit_double(mp.cache_ns[k]); out.emit(" ns\n");
+  }
+  out.emit("DRAM: "); out.emit_double(mp.dram_ns); out.emit(" ns\n");
+  out.emit("# stream GB/s (threads, copy, scale, add, triad):\n");
+  for (const auto &bp : mp.bandwidth) {
+    out.emit("  "); out.emit_int(static_cast<long long>(bp.threads));
+    out.emit("  "); out.emit_double(bp.copy_gbs);
+    out.emit("  "); out.emit_double(bp.scale_gbs);
+    out.emit("  "); out.emit_double(bp.add_gbs);
+    out.emit("  "); out.emit_double(bp.triad_gbs);
+    out.newline();
+  }
+  out.emit("int ops/cycle: "); out.emit_double(mp.int_ops_per_cycle); out.newline();
+  out.emit("fp ops/cycle:  "); out.emit_double(mp.fp_ops_per_cycle); out.newline();
+}
+
+// host, options, the run schedule and the machine profile: --json's top-level members, or the
+// --jsonl meta record's
+void
+json_meta(bbench::json::writer &w, const cli_opts &cli, const bbench::characterize::profile_ref &machine) {
+  w.key("format").integer(1);
+  w.key("host");
+  bbench::json::host(w, bbench::sys::query_host());
+  w.key("opts");
+  bbench::json::opts(w, cli.bench_opts);
+  w.key("schedule").begin_object();
+  w.key("runs").integer(static_cast<long long>(cli.n_runs));
+  w.key("target_ci").number(cli.stop.target);
+  w.key("interleave").boolean(cli.interleave);
+  w.key("seed").integer(static_cast<long long>(cli.seed));
+  w.key("jobs").integer(cli.jobs);
+  w.key("stable_only").boolean(cli.stable_only);
+  w.end_object();
+  w.key("paths").begin_array();
+  for (const char *path : cli.paths) w.string(path);
+  w.end_array();
+  if (machine.valid) {
+    w.key("machine").begin_object();
+    w.key("id").integer(static_cast<long long>(machine.id));
+    w.key("hostname").string(machine.hostname);
+    w.key("dram_ns").number(machine.dram_ns);
+    w.key("triad_gbs_1t").number(machine.triad_gbs_1t);
+    w.end_object();
+  }
+}
+
+// one path: every run (--json only; --jsonl streamed them already), the mean, stats of every
+// measured column, level shifts, and whatever else was asked for
+void
+json_result(bbench::json::writer &w, const cli_opts &cli, const micron::vector<bbench::benchmark_t> &runs,
+            const bbench::changepoint::analysis &cp, usize n_measured, const bbench::stopping::report *stop,
+            const micron::vector<bbench::roi_region> *regions, const micron::vector<bbench::systrace::table> *sys) {
+  const u32 detail = cli.bench_opts.detail;
+  w.begin_object();
+  if (cli.jsonl) w.key("type").string("summary");
+  w.key("name").string(runs.front().name.c_str());
+  w.key("measured").integer(static_cast<long long>(n_measured));
+  w.key("kept").integer(static_cast<long long>(runs.size()));
+  if (!cli.jsonl) {
+    w.key("runs").begin_array();
+    for (const auto &b : runs) {
+      w.begin_object();
+      bbench::json::run_members(w, b, detail);
+      w.end_object();
+    }
+    w.end_array();
+  }
+  w.key("mean").begin_object();
+  bbench::json::run_members(w, collapse_runs(runs), detail);
+  w.end_object();
+  w.key("stats");
+  bbench::json::stats(w, runs, detail);
+  w.key("changepoints");
+  bbench::json::changepoints(w, cp);
+  if (stop) {
+    w.key("stop");
+    bbench::json::stop(w, *stop, cli.stop.median);
+  }
+  if (regions) {
+    w.key("regions");
+    bbench::json::regions(w, *regions, runs.size());
+  }
+  if (sys) {
+    w.key("syscalls");
+    bbench::json::syscalls(w, merge_syscalls(*sys), sys->size());
+  }
+  w.key("metrics");
+  json_metrics(w, cli.metrics, summarize_metrics(cli.metrics, runs));
+  if (cli.topdown_only) {
+    w.key("topdown");
+    bbench::json::topdown(w, bbench::topdown::measure_bin(runs.front().name.c_str(), cli.bench_opts));
+  }
+  w.end_object();
+  if (cli.jsonl) w.line();
+}
+
 } // anonymous namespace
 
 int
@@ -313,23 +1469,144 @@ main(int argc, char **argv) {
   }
   cli_opts cli;
   if (!parse_argv(argc, argv, cli)) return -1;
+  // fork the helper before anything else grows our address space; -j workers launch directly
+  if (cli.bench_opts.fork_server && cli.jobs == 1 && !bbench::forkserver::start()) {
+    bbench::format::sink err = bbench::format::sink::stderr_sink();
+    err.emit("bbench: fork server unavailable, launching directly\n");
+  }
+  build_env(cli);
+  // -M pulls in what it reads: a higher -d for columns past the current level, -e for events
+  // benchmark_t has no column for
+  bool metrics_dynamic = false;
+  if (cli.metrics_csv) {
+    bbench::format::sink err = bbench::format::sink::stderr_sink();
+    if (!bbench::metric::compile_list(cli.metrics_csv, cli.metrics, err)) return -1;
+    for (const auto &m : cli.metrics) {
+      if (m.detail() > cli.bench_opts.detail) cli.bench_opts.detail = m.detail();
+      if (m.needs_dynamic()) metrics_dynamic = true;
+    }
+    if (metrics_dynamic && !cli.bench_opts.event_csv)
+      err.emit("bbench: -M reads events without a fixed column, counting them as with -e\n");
+    // a dynamic run only has the events it counts plus bbench::dynamic_column
+    bool ok = true;
+    if (metrics_dynamic || cli.bench_opts.event_csv)
+      for (const auto &m : cli.metrics)
+        for (const auto &r : m.operands()) {
+          if (r.event || bbench::dynamic_column(r.field->name)) continue;
+          err.emit("bbench: -M '"); err.emit(m.name()); err.emit("': "); err.emit(r.field->name);
+          err.emit(" has no perf event to count in an -e run\n");
+          ok = false;
+        }
+    if (!ok) return -1;
+  }
+  if (cli.bench_opts.cgroup) {
+    char why[256], limits[256];
+    bbench::format::sink err = bbench::format::sink::stderr_sink();
+    if (!bbench::cgroup::probe(why, sizeof(why), limits, sizeof(limits))) {
+      err.emit("bbench: --cgroup disabled: "); err.emit(why); err.newline();
+      cli.bench_opts.cgroup = false;
+    } else if (limits[0]) {
+      err.emit("bbench: --cgroup: "); err.emit(limits); err.newline();
+    }
+  }
+  if (cli.stdin_file) {
+    cli.bench_opts.stdin_fd = bbench::map_input(cli.stdin_file);
+    if (cli.bench_opts.stdin_fd < 0) {
+      bbench::format::sink err = bbench::format::sink::stderr_sink();
+      err.emit("bbench: cannot load --stdin "); err.emit(cli.stdin_file); err.newline();
+      return -1;
+    }
+  }
 
   // open output sink (stdout or file)
   bbench::format::sink out = cli.output_file
       ? bbench::format::sink::file_sink(cli.output_file)
       : bbench::format::sink::stdout_sink();
-  const bool color = cli.output_file == nullptr && cli.csv_sep == '\0';
+  if (cli.unbuffered) out.set_buffering(bbench::format::buffering::none);
+  const bool color = cli.output_file == nullptr && cli.csv_sep == '\0' && !cli.json;
+
+  if (cli.characterize_out) {
+    bbench::characterize::machine_profile mp = bbench::characterize::run();
+    if (!cli.json) emit_characterization(out, mp, color);
+    bbench::format::sink prof = bbench::format::sink::file_sink(cli.characterize_out);
+    if (prof.fd < 0) {
+      bbench::format::sink err = bbench::format::sink::stderr_sink();
+      err.emit("bbench: cannot write machine profile to "); err.emit(cli.characterize_out); err.newline();
+      return -1;
+    }
+    bbench::characterize::save_profile(prof, mp);
+    if (cli.paths.size() == 0) return 0;
+  }
+
+  bbench::characterize::profile_ref machine{};
+  if (cli.machine_profile) {
+    machine = bbench::characterize::load_profile(cli.machine_profile);
+    if (!machine.valid) {
+      bbench::format::sink err = bbench::format::sink::stderr_sink();
+      err.emit("bbench: not a machine profile: "); err.emit(cli.machine_profile); err.newline();
+    } else if (cli.csv_sep == '\0' && !cli.json) {
+      out.emit("# machine: "); out.emit(machine.hostname);
+      out.emit(" id="); out.emit_int(static_cast<long long>(machine.id));
+      out.emit(" dram_ns="); out.emit_double(machine.dram_ns);
+      out.emit(" triad_gbs_1t="); out.emit_double(machine.triad_gbs_1t);
+      out.newline();
+    }
+  }
+
+  if (cli.json && (cli.per_process || cli.off_cpu)) {
+    bbench::format::sink err = bbench::format::sink::stderr_sink();
+    err.emit("bbench: --per-process / --off-cpu have no JSON form, ignoring --json\n");
+    cli.json = cli.jsonl = false;
+  }
+  // --json: one object, closed at the very end; --jsonl: a meta record first, the rest as it comes
+  bbench::json::writer jw(out);
+  if (cli.json) {
+    jw.begin_object();
+    if (cli.jsonl) jw.key("type").string("meta");
+    json_meta(jw, cli, machine);
+    if (cli.jsonl) {
+      jw.end_object();
+      jw.line();
+    } else {
+      jw.key("results").begin_array();
+    }
+  }
+  auto close_json = [&] {
+    if (!cli.json || cli.jsonl) return;
+    jw.end_object();
+    jw.line();
+  };
 
-  if (cli.bench_opts.event_csv) {
+  if (cli.bench_opts.event_csv || metrics_dynamic) {
     micron::vector<bbench::event_def> events;
     if (!bbench::parse_event_list(cli.bench_opts.event_csv, events)) {
       bbench::format::sink err = bbench::format::sink::stderr_sink();
       err.emit("bbench: one or more event names in -e were not recognized\n");
     }
+    for (const auto &m : cli.metrics) m.add_events(events);
     for (const char *path : cli.paths) {
-      bbench::dynamic_result_t res{};
+      micron::vector<bbench::dynamic_result_t> all;
+      if (cli.json) {
+        if (!cli.jsonl) jw.begin_object().key("name").string(path).key("runs").begin_array();
+        for (usize r = 0; r < cli.n_runs; ++r) {
+          all.push_back(bbench::benchmark_bin_dynamic(path, events, cli.bench_opts));
+          jw.begin_object();
+          if (cli.jsonl) jw.key("type").string("run").key("index").integer(static_cast<long long>(r));
+          bbench::json::dynamic_members(jw, all[r]);
+          jw.end_object();
+          if (cli.jsonl) jw.line();
+        }
+        if (!cli.jsonl) jw.end_array();
+        else jw.begin_object().key("type").string("summary").key("name").string(path);
+        jw.key("metrics");
+        json_metrics(jw, cli.metrics, summarize_metrics(cli.metrics, all));
+        jw.end_object();
+        if (cli.jsonl) jw.line();
+        continue;
+      }
       for (usize r = 0; r < cli.n_runs; ++r)
-        res = bbench::benchmark_bin_dynamic(path, events, cli.bench_opts);
+        all.push_back(bbench::benchmark_bin_dynamic(path, events, cli.bench_opts));
+      const bbench::dynamic_result_t &res = all[all.size() - 1];
       out.emit(path); out.emit(": time(us)="); out.emit_double(res.time); out.newline();
       for (const auto &row : res.rows) {
         out.emit("  ");
@@ -343,45 +1620,180 @@ main(int argc, char **argv) {
         }
         out.newline();
       }
+      out.emit("  max-rss-kb: ");     out.emit_int(res.usage.max_rss_kb);     out.newline();
+      out.emit("  user-time-us: ");   out.emit_int(res.usage.user_time_us);   out.newline();
+      out.emit("  sys-time-us: ");    out.emit_int(res.usage.sys_time_us);    out.newline();
+      out.emit("  vol-cs: ");         out.emit_int(res.usage.vol_ctx_switches);   out.newline();
+      out.emit("  invol-cs: ");       out.emit_int(res.usage.invol_ctx_switches); out.newline();
+      out.emit("  minor-faults: ");   out.emit_int(res.usage.minor_faults);   out.newline();
+      out.emit("  major-faults: ");   out.emit_int(res.usage.major_faults);   out.newline();
+      out.emit("  launch-us: ");      out.emit_double(res.launch_us);         out.newline();
+      if (res.usage.timed_out) out.emit("  [timed out]\n");
+      emit_metrics(out, cli.metrics, summarize_metrics(cli.metrics, all), color);
+    }
+    if (cli.json && !cli.jsonl) jw.end_array();
+    close_json();
+    return 0;
+  }
+
+  if (cli.per_process) {
+    for (const char *path : cli.paths) {
+      bbench::proctree::result res{};
+      for (usize r = 0; r < cli.n_runs; ++r)
+        merge_tree(res, bbench::benchmark_bin_tree(path, cli.bench_opts), r);
+      emit_tree(out, res, cli.n_runs, cli.table || cli.verbose, color);
+    }
+    return 0;
+  }
+
+  if (cli.off_cpu) {
+    bbench::offcpu::ksyms ks;
+    ks.load();
+    for (const char *path : cli.paths) {
+      bbench::offcpu::result res{};
+      for (usize r = 0; r < cli.n_runs; ++r)
+        merge_offcpu(res, bbench::benchmark_bin_offcpu(path, cli.bench_opts), r);
+      emit_offcpu(out, res, cli.n_runs, ks, cli.verbose, color);
     }
     return 0;
   }
 
-  micron::vector<micron::vector<bbench::benchmark_t>> all_results;
-  for (const char *path : cli.paths) {
+  results res;
+  if (cli.jsonl) res.live = &out;
+  micron::vector<double> round_ts;
+  const bool sequential = cli.stop.target > 0.0;
+  // --target-ci appends runs as it goes
+  const usize n_slots = sequential ? 0 : cli.n_runs;
+  for (usize p = 0; p < cli.paths.size(); ++p) {
     micron::vector<bbench::benchmark_t> runs;
-    for (usize r = 0; r < cli.n_runs; ++r) {
-      runs.emplace_back(bbench::benchmark_bin(path, cli.bench_opts));
+    for (usize r = 0; r < n_slots; ++r) runs.push_back(bbench::benchmark_t{});
+    res.runs.push_back(micron::move(runs));
+    if (cli.mem_timeline) {
+      micron::vector<bbench::memsample::timeline> mem_runs;
+      for (usize r = 0; r < n_slots; ++r) mem_runs.push_back(bbench::memsample::timeline{});
+      res.mem.push_back(micron::move(mem_runs));
+    }
+    if (cli.syscalls) {
+      micron::vector<bbench::systrace::table> sys_runs;
+      for (usize r = 0; r < n_slots; ++r) sys_runs.push_back(bbench::systrace::table{});
+      res.sys.push_back(micron::move(sys_runs));
+    }
+    if (!cli.roi) continue;
+    micron::vector<micron::vector<bbench::roi_region>> roi_runs;
+    for (usize r = 0; r < n_slots; ++r) roi_runs.push_back(micron::vector<bbench::roi_region>{});
+    res.roi.push_back(micron::move(roi_runs));
+  }
+  if (sequential) {
+    if (cli.jobs > 1) {
+      bbench::format::sink err = bbench::format::sink::stderr_sink();
+      err.emit("bbench: --target-ci runs one binary at a time, -j ignored\n");
     }
-    all_results.push_back(micron::move(runs));
+    run_sequential(cli, res, round_ts);
+  } else {
+    micron::vector<slot> sched = make_schedule(cli);
+    if (cli.jobs > 1)
+      run_parallel(cli, sched, res);
+    else
+      run_serial(cli, sched, res, round_ts);
+  }
+  // before sort_results reorders runs, while res.mem still lines up with cli.paths
+  if (cli.mem_timeline && !write_timelines(cli, res)) {
+    bbench::format::sink err = bbench::format::sink::stderr_sink();
+    err.emit("bbench: cannot write --mem-timeline "); err.emit(cli.mem_timeline); err.newline();
   }
 
-  sort_results(all_results);
+  micron::vector<micron::vector<bbench::roi_region>> regions;
+  for (auto &per_run : res.roi) regions.push_back(merge_regions(per_run));
+  micron::vector<micron::vector<bbench::benchmark_t>> &all_results = res.runs;
+  sort_results(all_results, regions, res.sys, res.stop);
+
+  // every measured run, before --stable trims anything: the archive is the raw history. a failed
+  // append still reports, but the exit code says the history has a gap
+  bool archive_failed = false;
+  if (cli.archive)
+    for (const auto &runs : all_results)
+      if (!bbench::archive::append(cli.archive, runs, cli.bench_opts.detail, cli.rev)) {
+        bbench::format::sink err = bbench::format::sink::stderr_sink();
+        err.emit("bbench: cannot append to archive "); err.emit(cli.archive); err.newline();
+        archive_failed = true;
+        break;
+      }
+
+  // level shifts per path, on the full run order; --stable then drops everything outside the
+  // stable segment before any summary (roi regions are already merged and keep every run)
+  micron::vector<bbench::changepoint::analysis> shifts;
+  micron::vector<usize> n_measured;
+  for (usize p = 0; p < all_results.size(); ++p) {
+    shifts.push_back(bbench::changepoint::analyze(all_results[p]));
+    n_measured.push_back(all_results[p].size());
+    if (!cli.stable_only || !shifts[p].shifted()) continue;
+    keep_range(all_results[p], shifts[p].stable_begin, shifts[p].stable_end);
+    if (res.sys.size() == all_results.size()) keep_range(res.sys[p], shifts[p].stable_begin, shifts[p].stable_end);
+  }
 
   if (cli.csv_sep != '\0') bbench::format::emit_csv_header(out, cli.bench_opts.detail, cli.csv_sep);
+  if (cli.json) {
+    for (usize p = 0; p < all_results.size(); ++p)
+      json_result(jw, cli, all_results[p], shifts[p], n_measured[p], cli.stop.target > 0.0 ? &res.stop[p] : nullptr,
+                  cli.roi ? &regions[p] : nullptr, cli.syscalls ? &res.sys[p] : nullptr);
+    if (!cli.jsonl) jw.end_array();
+  }
 
   bool first = true;
-  for (auto &runs : all_results) {
+  for (usize p = 0; p < all_results.size() && !cli.json; ++p) {
+    auto &runs = all_results[p];
     bbench::benchmark_t agg = collapse_runs(runs);
     if (cli.csv_sep != '\0') {
       bbench::format::emit_csv_one(out, agg, cli.bench_opts.detail, cli.csv_sep);
+      if (cli.table && runs.size() > 1) bbench::format::emit_csv_stats(out, runs, cli.bench_opts.detail, cli.csv_sep);
     } else {
       if (!first) out.newline();
       first = false;
-      bbench::format::emit_human_one(out, agg, cli.bench_opts.detail, color, cli.n_runs);
-      if (cli.n_runs > 1)
-        emit_stats(out, runs, color);
+      bbench::format::emit_human_one(out, agg, cli.bench_opts.detail, color, static_cast<u32>(runs.size()));
+      if (sequential) emit_stop(out, res.stop[p], cli.stop.median, color);
+      if (runs.size() > 1)
+        emit_stats(out, runs, cli.bench_opts.detail, color);
+      if (cli.interleave && cli.jobs == 1)
+        emit_drift(out, runs, round_ts, cli.stable_only ? shifts[p].stable_begin : 0, cli.table, color);
+      if (res.pinned) emit_interference(out, runs, color);
+      emit_changepoints(out, shifts[p], n_measured[p], cli.stable_only, color);
+      if (cli.roi) emit_regions(out, regions[p], runs.size(), color);
+      if (cli.syscalls) {
+        emit_syscalls(out, merge_syscalls(res.sys[p]), runs.size(), "syscalls:      ", cli.verbose, color);
+        if (cli.table && runs.size() > 1)
+          for (usize r = 0; r < res.sys[p].size(); ++r) {
+            out.emit("# run "); out.emit_int(static_cast<long long>(r)); out.newline();
+            emit_syscalls(out, res.sys[p][r], 1, "syscalls:      ", cli.verbose, color);
+          }
+      }
       if (cli.table)
         bbench::format::emit_table(out, runs);
-      if (cli.metrics_csv)
-        emit_metrics(out, agg, cli.metrics_csv, color);
+      emit_metrics(out, cli.metrics, summarize_metrics(cli.metrics, runs), color);
       if (cli.topdown_only) {
         bbench::topdown::topdown_t td = bbench::topdown::measure_bin(runs.front().name.c_str(), cli.bench_opts);
         emit_topdown(out, td, color);
       }
     }
-    if (cli.verbose && cli.n_runs == 1) {
+    if (cli.verbose && runs.size() == 1) {
+    }
+  }
+
+  // check before saving, so --check F --save-baseline F compares against the previous state
+  int rc = 0;
+  if (cli.check_baseline) {
+    if (cli.json && !cli.jsonl) jw.key("baseline");
+    rc = check_baseline(out, cli, all_results, cli.json ? &jw : nullptr, color);
+  }
+  close_json();
+  if (cli.save_baseline) {
+    bbench::baseline::store st;
+    st.load(cli.save_baseline);
+    for (const auto &runs : all_results) st.put(runs, cli.bench_opts.detail, cli.rev);
+    if (!st.save(cli.save_baseline)) {
+      bbench::format::sink err = bbench::format::sink::stderr_sink();
+      err.emit("bbench: cannot write baseline "); err.emit(cli.save_baseline); err.newline();
+      return -1;
     }
   }
-  return 0;
+  return archive_failed ? -1 : rc;
 }
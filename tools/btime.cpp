@@ -26,9 +26,296 @@ parse_int(const char *s, long long &out) {
 
 void usage(void) {
   micron::io::println("btime [-r N] [-x SEP] [-q] BINARY");
-  micron::io::println("  -r N    repeat N times; print mean / stddev / min / max");
-  micron::io::println("  -x SEP  CSV output, one row per run + final summary");
-  micron::io::println("  -q      quiet — print only the number(s), no labels");
+  micron::io::println("btime [-r N] [-x SEP] [-q] [--warmup N] [--prepare CMD] [--scan P=SPEC]... -- CMD [ARGS...]");
+  micron::io::println("  -r N            repeat N times; print mean / stddev / min / max");
+  micron::io::println("  -x SEP          CSV output, one row per run + final summary (one row per point with --)");
+  micron::io::println("  -q              quiet — print only the number(s), no labels");
+  micron::io::println("  --warmup N      unmeasured runs before each point");
+  micron::io::println("  --prepare CMD   run CMD (split on spaces, no shell) before every run");
+  micron::io::println("  --scan P=SPEC   substitute {P} in CMD/ARGS/--prepare; SPEC is LO..HI, LO..HI:+STEP, LO..HI:xFACTOR or a,b,c");
+  micron::io::println("                  several --scan flags run the cartesian product");
+}
+
+inline char *
+dup_str(const char *s, usize n) {
+  char *d = new char[n + 1];
+  micron::memcpy(d, s, n);
+  d[n] = '\0';
+  return d;
+}
+
+inline char *
+int_str(long long v) {
+  char buf[24];
+  usize n = 0;
+  bool neg = v < 0;
+  unsigned long long u = neg ? static_cast<unsigned long long>(-v) : static_cast<unsigned long long>(v);
+  do { buf[n++] = static_cast<char>('0' + u % 10); u /= 10; } while (u);
+  if (neg) buf[n++] = '-';
+  char *d = new char[n + 1];
+  for (usize i = 0; i < n; ++i) d[i] = buf[n - 1 - i];
+  d[n] = '\0';
+  return d;
+}
+
+struct scan {
+  const char *name;
+  usize name_len;
+  micron::vector<const char *> values;
+};
+
+// P=LO..HI[:+STEP|:xFACTOR] or P=a,b,c
+bool
+parse_scan(const char *spec, scan &out) {
+  const char *eq = spec;
+  while (*eq && *eq != '=') ++eq;
+  if (*eq != '=' || eq == spec) return false;
+  out.name = spec;
+  out.name_len = static_cast<usize>(eq - spec);
+  const char *v = eq + 1;
+
+  const char *dots = v;
+  while (*dots && !(dots[0] == '.' && dots[1] == '.')) ++dots;
+  long long lo, hi;
+  if (*dots && parse_int(v, lo) && parse_int(dots + 2, hi)) {
+    long long step = 1;
+    bool mul = false;
+    const char *c = dots + 2;
+    while (*c && *c != ':') ++c;
+    if (*c == ':') {
+      ++c;
+      if (*c == 'x' || *c == '*') { mul = true; ++c; }
+      else if (*c == '+') ++c;
+      if (!parse_int(c, step)) return false;
+    }
+    if (lo > hi || (mul ? step < 2 || lo < 1 : step < 1)) return false;
+    // the next value is taken only when it can't pass HI, so a scan ending near LLONG_MAX stops
+    // instead of wrapping
+    for (long long x = lo;; x = mul ? x * step : x + step) {
+      out.values.push_back(int_str(x));
+      if (mul ? x > hi / step
+              : static_cast<unsigned long long>(hi) - static_cast<unsigned long long>(x) < static_cast<unsigned long long>(step))
+        break;
+    }
+    return true;
+  }
+
+  const char *start = v;
+  for (const char *p = v;; ++p) {
+    if (*p == ',' || *p == '\0') {
+      if (p > start) out.values.push_back(dup_str(start, static_cast<usize>(p - start)));
+      start = p + 1;
+      if (*p == '\0') break;
+    }
+  }
+  return out.values.size() > 0;
+}
+
+// replaces every {P} with the current value of scan P; unknown placeholders stay as they are
+char *
+expand(const char *tmpl, const micron::vector<scan> &scans, const micron::vector<usize> &at) {
+  usize len = 0;
+  for (int pass = 0; pass < 2; ++pass) {
+    char *d = pass ? new char[len + 1] : nullptr;
+    usize n = 0;
+    for (const char *p = tmpl; *p;) {
+      bool hit = false;
+      if (*p == '{') {
+        for (usize k = 0; k < scans.size() && !hit; ++k) {
+          const scan &sc = scans[k];
+          if (micron::strncmp(p + 1, sc.name, sc.name_len) == 0 && p[1 + sc.name_len] == '}') {
+            const char *val = sc.values[at[k]];
+            const usize vl = micron::strlen(val);
+            if (d) micron::memcpy(d + n, val, vl);
+            n += vl;
+            p += sc.name_len + 2;
+            hit = true;
+          }
+        }
+      }
+      if (!hit) {
+        if (d) d[n] = *p;
+        ++n;
+        ++p;
+      }
+    }
+    if (d) { d[n] = '\0'; return d; }
+    len = n;
+  }
+  return nullptr;
+}
+
+// whitespace split, no quoting: --prepare is shell-free like the command itself
+micron::vector<const char *>
+split_words(const char *cmd) {
+  micron::vector<const char *> out;
+  const char *p = cmd;
+  while (*p) {
+    while (*p == ' ' || *p == '\t') ++p;
+    const char *b = p;
+    while (*p && *p != ' ' && *p != '\t') ++p;
+    if (p > b) out.push_back(dup_str(b, static_cast<usize>(p - b)));
+  }
+  return out;
+}
+
+micron::vector<const char *>
+expand_all(const micron::vector<const char *> &tmpl, const micron::vector<scan> &scans, const micron::vector<usize> &at) {
+  micron::vector<const char *> out;
+  for (const char *t : tmpl) out.push_back(expand(t, scans, at));
+  out.push_back(nullptr);
+  return out;
+}
+
+// the strings of a split_words / expand_all / scan list (delete[] of the nullptr terminator is a no-op)
+void
+free_all(micron::vector<const char *> &v) {
+  for (usize i = 0; i < v.size(); ++i) delete[] v[i];
+}
+
+void
+run_prepare(const micron::vector<const char *> &argv) {
+  if (argv.size() < 2) return;
+  bbench::launch_spec ls{};
+  ls.path = argv[0];
+  ls.argv = &argv[0];
+  int pid = bbench::process_attach(ls, [](int) {});
+  bbench::child_usage cu;
+  bbench::__impl::__wait_child(pid, 0, cu);
+}
+
+struct command_opts {
+  usize n_runs = 1;
+  usize warmup = 0;
+  char csv_sep = '\0';
+  bool quiet = false;
+  const char *prepare = nullptr;
+  micron::vector<scan> scans;
+  micron::vector<const char *> cmd;
+};
+
+// "p=8 q=foo" for humans, bare values for CSV
+void
+emit_point_label(const bbench::format::sink &out, const command_opts &co, const micron::vector<usize> &at, const char *sep, bool named) {
+  for (usize k = 0; k < co.scans.size(); ++k) {
+    if (k) out.emit(sep);
+    if (named) { out.emit(co.scans[k].name, co.scans[k].name_len); out.emit("="); }
+    out.emit(co.scans[k].values[at[k]]);
+  }
+}
+
+void
+emit_point(const bbench::format::sink &out, const command_opts &co, const micron::vector<usize> &at,
+           const micron::vector<bbench::benchmark_t> &runs) {
+  auto t = bbench::format::compute_stats(runs, [](const bbench::benchmark_t &b) { return b.time; });
+  auto cyc = bbench::format::compute_stats(runs, [](const bbench::benchmark_t &b) { return b.cycles; });
+  auto ins = bbench::format::compute_stats(runs, [](const bbench::benchmark_t &b) { return b.instructions; });
+  auto br = bbench::format::compute_stats(runs, [](const bbench::benchmark_t &b) { return b.total_branches; });
+  auto brm = bbench::format::compute_stats(runs, [](const bbench::benchmark_t &b) { return b.branch_misses; });
+  auto cm = bbench::format::compute_stats(runs, [](const bbench::benchmark_t &b) { return b.cache_misses; });
+  const double ipc = cyc.mean > 0 ? ins.mean / cyc.mean : 0.0;
+  const double miss = br.mean > 0 ? 100.0 * brm.mean / br.mean : 0.0;
+
+  if (co.csv_sep != '\0') {
+    const char s[2] = { co.csv_sep, '\0' };
+    emit_point_label(out, co, at, s, false);
+    if (co.scans.size()) out.emit(s);
+    out.emit_int(static_cast<long long>(runs.size())); out.emit(s);
+    out.emit_double(t.mean); out.emit(s);
+    out.emit_double(t.stddev); out.emit(s);
+    out.emit_double(t.mn); out.emit(s);
+    out.emit_double(t.mx); out.emit(s);
+    out.emit_int(static_cast<long long>(cyc.mean)); out.emit(s);
+    out.emit_int(static_cast<long long>(ins.mean)); out.emit(s);
+    out.emit_double(ipc); out.emit(s);
+    out.emit_double(miss); out.emit(s);
+    out.emit_int(static_cast<long long>(cm.mean)); out.emit(s);
+    out.emit_double(t.median); out.emit(s);
+    out.emit_double(t.mad); out.emit(s);
+    out.emit_double(t.p95); out.emit(s);
+    out.emit_double(t.p99); out.emit(s);
+    out.emit_int(t.mild_outliers + t.severe_outliers);
+    out.newline();
+    return;
+  }
+  if (co.quiet) {
+    out.emit_double(t.mean); out.emit(" ");
+    out.emit_double(t.stddev); out.emit(" ");
+    out.emit_double(ipc); out.newline();
+    return;
+  }
+  if (co.scans.size()) { emit_point_label(out, co, at, " ", true); out.newline(); }
+  out.emit("  time(us): mean="); out.emit_double(t.mean);
+  out.emit("  stddev=");        out.emit_double(t.stddev);
+  out.emit("  min=");           out.emit_double(t.mn);
+  out.emit("  max=");           out.emit_double(t.mx);
+  out.newline();
+  out.emit("  median=");        out.emit_double(t.median);
+  out.emit("  mad=");           out.emit_double(t.mad);
+  out.emit("  p95=");           out.emit_double(t.p95);
+  out.emit("  p99=");           out.emit_double(t.p99);
+  out.emit("  outliers=");      out.emit_int(t.mild_outliers); out.emit("/"); out.emit_int(t.severe_outliers);
+  out.newline();
+  out.emit("  cycles=");        out.emit_int(static_cast<long long>(cyc.mean));
+  out.emit("  instructions=");  out.emit_int(static_cast<long long>(ins.mean));
+  out.emit("  ipc=");           out.emit_double(ipc);
+  out.newline();
+  out.emit("  branch-miss%=");  out.emit_double(miss);
+  out.emit("  cache-misses=");  out.emit_int(static_cast<long long>(cm.mean));
+  out.newline();
+}
+
+// one point per combination of scan values, each measured through benchmark_bin
+int
+run_command(command_opts &co) {
+  bbench::format::sink out = bbench::format::sink::stdout_sink();
+  micron::vector<const char *> prep_tmpl;
+  if (co.prepare) prep_tmpl = split_words(co.prepare);
+
+  if (co.csv_sep != '\0' && !co.quiet) {
+    const char s[2] = { co.csv_sep, '\0' };
+    for (const auto &sc : co.scans) { out.emit(sc.name, sc.name_len); out.emit(s); }
+    out.emit("runs"); out.emit(s); out.emit("time_mean_us"); out.emit(s); out.emit("time_stddev_us"); out.emit(s);
+    out.emit("time_min_us"); out.emit(s); out.emit("time_max_us"); out.emit(s); out.emit("cycles"); out.emit(s);
+    out.emit("instructions"); out.emit(s); out.emit("ipc"); out.emit(s); out.emit("branch_miss_pct"); out.emit(s);
+    out.emit("cache_misses"); out.emit(s); out.emit("time_median_us"); out.emit(s); out.emit("time_mad_us"); out.emit(s);
+    out.emit("time_p95_us"); out.emit(s); out.emit("time_p99_us"); out.emit(s); out.emit("outliers");
+    out.newline();
+  }
+
+  micron::vector<usize> at;
+  for (usize k = 0; k < co.scans.size(); ++k) at.push_back(0);
+  for (bool more = true; more;) {
+    micron::vector<const char *> argv = expand_all(co.cmd, co.scans, at);
+    micron::vector<const char *> prep;
+    if (prep_tmpl.size()) prep = expand_all(prep_tmpl, co.scans, at);
+    bbench::benchmark_opts bo;
+    bo.argv = &argv[0];
+
+    for (usize w = 0; w < co.warmup; ++w) {
+      run_prepare(prep);
+      (void)bbench::benchmark_bin(argv[0], bo);
+    }
+    micron::vector<bbench::benchmark_t> runs;
+    runs.reserve(co.n_runs);
+    for (usize r = 0; r < co.n_runs; ++r) {
+      run_prepare(prep);
+      runs.push_back(bbench::benchmark_bin(argv[0], bo));
+    }
+    emit_point(out, co, at, runs);
+    free_all(argv);
+    free_all(prep);
+
+    // odometer over the scans, last one fastest
+    more = false;
+    for (usize k = co.scans.size(); k-- > 0;) {
+      if (++at[k] < co.scans[k].values.size()) { more = true; break; }
+      at[k] = 0;
+    }
+  }
+  free_all(prep_tmpl);
+  for (auto &sc : co.scans) free_all(sc.values);
+  return 0;
 }
 
 };
@@ -44,6 +331,8 @@ main(int argc, char **argv) {
   char csv_sep = '\0';
   bool quiet = false;
   const char *path = nullptr;
+  command_opts co;
+  bool command_mode = false;
 
   for (int i = 1; i < argc; ++i) {
     const char *a = argv[i];
@@ -52,6 +341,27 @@ main(int argc, char **argv) {
       long long v;
       if (!parse_int(argv[++i], v) || v < 1) { usage(); return -1; }
       n_runs = static_cast<usize>(v);
+    } else if (micron::strcmp(a, "--warmup") == 0) {
+      if (i + 1 >= argc) { usage(); return -1; }
+      long long v;
+      if (!parse_int(argv[++i], v) || v < 0) { usage(); return -1; }
+      co.warmup = static_cast<usize>(v);
+    } else if (micron::strcmp(a, "--prepare") == 0) {
+      if (i + 1 >= argc) { usage(); return -1; }
+      co.prepare = argv[++i];
+    } else if (micron::strcmp(a, "--scan") == 0) {
+      if (i + 1 >= argc) { usage(); return -1; }
+      scan sc;
+      if (!parse_scan(argv[++i], sc)) {
+        bbench::format::sink err = bbench::format::sink::stderr_sink();
+        err.emit("btime: bad --scan "); err.emit(argv[i]); err.newline();
+        return -1;
+      }
+      co.scans.push_back(micron::move(sc));
+    } else if (micron::strcmp(a, "--") == 0) {
+      for (int k = i + 1; k < argc; ++k) co.cmd.push_back(argv[k]);
+      command_mode = true;
+      break;
     } else if (micron::strcmp(a, "-x") == 0) {
       if (i + 1 >= argc) { usage(); return -1; }
       const char *s = argv[++i];
@@ -69,6 +379,18 @@ main(int argc, char **argv) {
       break;
     }
   }
+  if (command_mode) {
+    if (co.cmd.size() == 0) { usage(); return -1; }
+    co.n_runs = n_runs;
+    co.csv_sep = csv_sep;
+    co.quiet = quiet;
+    return run_command(co);
+  }
+  if (co.scans.size() || co.prepare || co.warmup) {
+    bbench::format::sink err = bbench::format::sink::stderr_sink();
+    err.emit("btime: --scan / --prepare / --warmup need the -- CMD [ARGS...] form\n");
+    return -1;
+  }
   if (!path) { usage(); return -1; }
 
   micron::vector<double> times;
@@ -95,6 +417,12 @@ main(int argc, char **argv) {
       out.emit("stddev"); out.emit(s); out.emit_double(stats.stddev); out.newline();
       out.emit("min"); out.emit(s); out.emit_double(stats.mn); out.newline();
       out.emit("max"); out.emit(s); out.emit_double(stats.mx); out.newline();
+      out.emit("median"); out.emit(s); out.emit_double(stats.median); out.newline();
+      out.emit("mad"); out.emit(s); out.emit_double(stats.mad); out.newline();
+      out.emit("p5"); out.emit(s); out.emit_double(stats.p5); out.newline();
+      out.emit("p95"); out.emit(s); out.emit_double(stats.p95); out.newline();
+      out.emit("p99"); out.emit(s); out.emit_double(stats.p99); out.newline();
+      out.emit("trimmed_mean"); out.emit(s); out.emit_double(stats.trimmed_mean); out.newline();
     }
     return 0;
   }
@@ -124,6 +452,17 @@ main(int argc, char **argv) {
     out.emit("  min=");         out.emit_double(stats.mn);
     out.emit("  max=");         out.emit_double(stats.mx);
     out.newline();
+    out.emit("          median="); out.emit_double(stats.median);
+    out.emit("  mad=");         out.emit_double(stats.mad);
+    out.emit("  p5=");          out.emit_double(stats.p5);
+    out.emit("  p95=");         out.emit_double(stats.p95);
+    out.emit("  p99=");         out.emit_double(stats.p99);
+    out.newline();
+    if (stats.mild_outliers || stats.severe_outliers) {
+      out.emit("          outliers: "); out.emit_int(stats.mild_outliers); out.emit(" mild, ");
+      out.emit_int(stats.severe_outliers); out.emit(" severe");
+      out.newline();
+    }
   }
   return 0;
 }